@@ -5,9 +5,13 @@
 
 #include "busy.h"
 
+/* Count of entries read at once. */
+#define LS_ENTRIES 16
+
 errno_t ls_cmd(busy_ctx_t *ctx) {
 	reiser4_object_t *object;
-	entry_hint_t entry;
+	entry_hint_t *entries;
+	int32_t count, i;
 
 	aal_assert("vpf-1710", ctx != NULL);
 
@@ -30,10 +34,23 @@ errno_t ls_cmd(busy_ctx_t *ctx) {
 	}
 
 	if (reiser4_psobj(object)->p.id.group == DIR_OBJECT) {
-		while (reiser4_object_readdir(object, &entry) > 0) {
-			printf("[%s] %s\n", reiser4_print_key(&entry.object),
-			       entry.name);
+		if (!(entries = aal_calloc(LS_ENTRIES * sizeof(*entries), 0))) {
+			reiser4_object_close(object);
+			return -ENOMEM;
+		}
+		
+		while ((count = reiser4_object_readdir_batch(object, entries,
+							     LS_ENTRIES, 
+							     NULL)) > 0)
+		{
+			for (i = 0; i < count; i++) {
+				printf("[%s] %s\n", 
+				       reiser4_print_key(&entries[i].object),
+				       entries[i].name);
+			}
 		}
+
+		aal_free(entries);
 	} else {
 		printf("[%s] %s\n", 
 		       reiser4_print_key(&object->info.object), 
@@ -28,5 +28,9 @@ extern unsigned int aux_adler32(unsigned int adler,
 				char *buff, 
 				unsigned int n);
 
+extern unsigned int aux_adler32_fill(unsigned int adler,
+				     unsigned char c,
+				     unsigned int n);
+
 
 #endif
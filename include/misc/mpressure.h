@@ -9,7 +9,7 @@
 
 #include <reiser4/types.h>
 
-extern void misc_mpressure_setup(uint32_t value);
+extern errno_t misc_mpressure_setup(const char *value);
 extern int misc_mpressure_detect(reiser4_tree_t *tree);
 
 #endif
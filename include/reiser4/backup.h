@@ -25,6 +25,10 @@ extern errno_t reiser4_backup_layout(reiser4_fs_t *fs,
 				     region_func_t region_func, 
 				     void *data);
 
+extern errno_t reiser4_backup_layout_body(reiser4_alloc_t *alloc, 
+					  uint32_t blksize, uint64_t len, 
+					  region_func_t func, void *data);
+
 extern errno_t reiser4_old_backup_layout(reiser4_fs_t *fs, 
 					 region_func_t region_func,
 					 void *data);
@@ -55,6 +55,9 @@ extern uint64_t reiser4_bitmap_find_marked(reiser4_bitmap_t *bitmap,
 extern uint64_t reiser4_bitmap_find_cleared(reiser4_bitmap_t *bitmap, 
 					    uint64_t start);
 
+extern uint64_t reiser4_bitmap_calc(reiser4_bitmap_t *bitmap, uint64_t start,
+				    uint64_t count, int marked);
+
 extern uint64_t reiser4_bitmap_calc_marked(reiser4_bitmap_t *bitmap);
 extern uint64_t reiser4_bitmap_calc_cleared(reiser4_bitmap_t *bitmap);
 
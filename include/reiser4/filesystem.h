@@ -26,6 +26,8 @@ extern errno_t reiser4_fs_clobber(aal_device_t *device);
 
 extern errno_t reiser4_fs_resize(reiser4_fs_t *fs, count_t blocks);
 
+extern int64_t reiser4_fs_resize_estimate(reiser4_fs_t *fs, count_t blocks);
+
 extern errno_t reiser4_fs_copy(reiser4_fs_t *src_fs, reiser4_fs_t *dst_fs);
 
 extern errno_t reiser4_fs_layout(reiser4_fs_t *fs,
@@ -34,6 +36,13 @@ extern errno_t reiser4_fs_layout(reiser4_fs_t *fs,
 
 extern reiser4_owner_t reiser4_fs_belongs(reiser4_fs_t *fs, blk_t blk);
 
+extern reiser4_owner_map_t *reiser4_fs_owner_map(reiser4_fs_t *fs);
+
+extern void reiser4_fs_owner_reset(reiser4_fs_t *fs);
+
+extern reiser4_owner_t reiser4_owner_map_find(reiser4_owner_map_t *map,
+					      blk_t blk);
+
 extern reiser4_fs_t *reiser4_fs_create(aal_device_t *device,
 				       fs_hint_t *hint);
 
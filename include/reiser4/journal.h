@@ -18,6 +18,7 @@ extern bool_t reiser4_journal_isdirty(reiser4_journal_t *journal);
 extern errno_t reiser4_journal_mark(reiser4_journal_t *journal);
 extern errno_t reiser4_journal_sync(reiser4_journal_t *journal);
 extern errno_t reiser4_journal_replay(reiser4_journal_t *journal);
+extern bool_t reiser4_journal_pending(reiser4_journal_t *journal);
 
 extern errno_t reiser4_journal_layout(reiser4_journal_t *journal, 
 				      region_func_t region_func,
@@ -10,6 +10,7 @@
 
 #ifndef ENABLE_MINIMAL
 extern errno_t reiser4_node_sync(reiser4_node_t *node);
+extern errno_t reiser4_node_seal(reiser4_node_t *node);
 extern uint16_t reiser4_node_space(reiser4_node_t *node);
 extern uint16_t reiser4_node_overhead(reiser4_node_t *node);
 extern uint16_t reiser4_node_maxspace(reiser4_node_t *node);
@@ -69,6 +70,9 @@ extern uint8_t reiser4_node_get_level(reiser4_node_t *node);
 
 extern reiser4_node_t *reiser4_node_open(reiser4_tree_t *tree, blk_t nr);
 
+extern reiser4_node_t *reiser4_node_open_block(reiser4_tree_t *tree,
+					       aal_block_t *block);
+
 extern errno_t reiser4_node_leftmost_key(reiser4_node_t *node,
 					 reiser4_key_t *key);
 
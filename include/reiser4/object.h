@@ -95,6 +95,11 @@ extern int64_t reiser4_object_read(reiser4_object_t *object,
 extern errno_t reiser4_object_readdir(reiser4_object_t *object,
 				      entry_hint_t *entry);
 
+extern int32_t reiser4_object_readdir_batch(reiser4_object_t *object,
+					    entry_hint_t *entries,
+					    uint32_t count,
+					    stat_hint_t *stats);
+
 extern errno_t reiser4_object_entry_prep(reiser4_tree_t *tree,
 					 reiser4_object_t *parent,
 					 entry_hint_t *entry,
@@ -504,6 +504,11 @@ struct reiser4_node {
 	/* Reference to right neighbour. It is used for establishing silbing
 	   links among nodes in memory tree cache. */
 	reiser4_node_t *right;
+
+	/* Links in the tree cache LRU list. Only leaf nodes are kept there, as
+	   they are the only candidates for eviction on memory pressure. */
+	reiser4_node_t *lru_prev;
+	reiser4_node_t *lru_next;
 	
 	/* Usage counter to prevent releasing used nodes. */
 	signed int counter;
@@ -1152,6 +1157,9 @@ typedef struct reiser4_object_plug {
 	errno_t (*seekdir) (reiser4_object_t *, reiser4_key_t *);
 
 #ifndef ENABLE_MINIMAL
+	/* Reads up to passed count of entries at once. */
+	int32_t (*readdir_batch) (reiser4_object_t *, entry_hint_t *, uint32_t);
+	
 	uint64_t sdext_mandatory;
 	uint64_t sdext_unknown;
 #endif
@@ -1399,6 +1407,11 @@ struct reiser4_node_plug {
 	/* Saves node to device */
 	errno_t (*sync) (reiser4_node_t *);
 
+	/* Updates node fields depending on the whole node content in the node
+	   block, checksum for instance. Needed if the block is written not by
+	   sync method. May be not implemented. */
+	errno_t (*seal) (reiser4_node_t *);
+
 	/* Initializes node with passed block and key plugin. */
 	reiser4_node_t *(*init) (aal_block_t *, uint8_t , 
 				 reiser4_key_plug_t *);
@@ -1695,6 +1708,9 @@ struct reiser4_journal_plug {
 	/* Replays the journal */
 	errno_t (*replay) (reiser4_journal_ent_t *);
 
+	/* Checks if the journal has transactions to be replayed. */
+	bool_t (*pending) (reiser4_journal_ent_t *);
+
 	/* Prints journal content */
 	void (*print) (reiser4_journal_ent_t *, aal_stream_t *, uint16_t);
 	
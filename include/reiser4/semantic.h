@@ -18,5 +18,12 @@ extern reiser4_object_t *reiser4_semantic_try_open(reiser4_tree_t *tree,
 						   reiser4_key_t *from,
 						   bool_t follow);
 
+#ifndef ENABLE_MINIMAL
+extern void reiser4_semantic_forget(reiser4_tree_t *tree,
+				    reiser4_key_t *parent,
+				    char *name);
+
+extern void reiser4_semantic_flush(reiser4_tree_t *tree);
+#endif
 
 #endif
@@ -152,6 +152,9 @@ extern errno_t reiser4_tree_copy(reiser4_tree_t *src_tree,
 extern errno_t reiser4_tree_resize(reiser4_tree_t *tree,
 				   count_t blocks);
 
+extern int64_t reiser4_tree_resize_estimate(reiser4_tree_t *tree,
+					    count_t blocks);
+
 extern uint8_t reiser4_tree_get_height(reiser4_tree_t *tree);
 
 extern errno_t reiser4_tree_rehash_node(reiser4_tree_t *tree,
@@ -135,6 +135,26 @@ typedef enum reiser4_owner {
 	O_BACKUP   = 1 << 6,
 	O_UNKNOWN  = 1 << 7
 } reiser4_owner_t;
+
+/* Range of blocks owned by some fs component. */
+typedef struct reiser4_owner_range {
+	blk_t start;
+	blk_t end;
+
+	/* The biggest end of this and all previous ranges. */
+	blk_t reach;
+
+	/* Ranges met earlier in reiser4_fs_belongs() order win. */
+	uint32_t prio;
+	reiser4_owner_t owner;
+} reiser4_owner_range_t;
+
+/* Block ownership map. Ranges are sorted by start block. */
+typedef struct reiser4_owner_map {
+	reiser4_owner_range_t *ranges;
+	uint32_t count;
+	uint32_t size;
+} reiser4_owner_map_t;
 #endif
 
 /* Reiser4 wrappers for all filesystem objects (journal, block allocator,
@@ -195,8 +215,64 @@ typedef errno_t (*modify_func_t) (reiser4_node_t *node,
 				  pos_t *pos, trans_hint_t *hint);
 #endif
 
+/* Memory pressure detect function. It returns the mask of caches which are
+   over their limits, 0 if there is no pressure. */
 typedef int (*mpc_func_t) (reiser4_tree_t *);
 
+#ifndef ENABLE_MINIMAL
+/* Progress function of long tree operations. It gets the count of blocks
+   processed already and the total count of blocks to be processed. */
+typedef void (*progress_func_t) (reiser4_tree_t *, count_t, count_t);
+#endif
+
+enum mpressure_flags {
+	/* Formatted nodes cache is over its limit. */
+	MP_NODES                = 1 << 0,
+
+	/* Extent data blocks cache is over its limit. */
+	MP_BLOCKS               = 1 << 1
+};
+
+/* Tree cache statistics. */
+typedef struct tree_stat {
+	/* Node lookups satisfied from the cache. */
+	uint64_t hits;
+
+	/* Node lookups that required reading the node from device. */
+	uint64_t misses;
+
+	/* Leaf nodes evicted from the cache on memory pressure. */
+	uint64_t evicts;
+
+	/* Cache misses satisfied from blocks read in advance by traversal. */
+	uint64_t prefetched;
+
+	/* Path components resolved from the dentry cache. */
+	uint64_t dentry_hits;
+
+	/* Path components resolved by the directory lookup. */
+	uint64_t dentry_misses;
+} tree_stat_t;
+
+#ifndef ENABLE_MINIMAL
+typedef struct tree_prefetch tree_prefetch_t;
+
+/* Children of an internal node being traversed. They are read at once in
+   the disk order on the first cache miss among them. */
+struct tree_prefetch {
+	/* Sorted block numbers of children. */
+	blk_t *blks;
+	uint32_t count;
+
+	/* Read blocks, NULL for not read and already taken ones. */
+	aal_block_t **blocks;
+	int loaded;
+
+	/* Prefetch of the upper level node. */
+	tree_prefetch_t *prev;
+};
+#endif
+
 /* Tree structure. */
 struct reiser4_tree {
 	tree_entity_t ent;
@@ -217,12 +293,39 @@ struct reiser4_tree {
 	/* Memory pressure detect function. */
 	mpc_func_t mpc_func;
 
+#ifndef ENABLE_MINIMAL
+	/* Progress function of copying and resizing and its data. */
+	progress_func_t progress_func;
+	void *progress_data;
+#endif
+
 	/* Formatted nodes hash table. */
 	aal_hash_table_t *nodes;
 
+	/* Leaf nodes LRU list. Recently used leaves are at the head, cold ones
+	   are evicted from the tail. */
+	reiser4_node_t *lru_head;
+	reiser4_node_t *lru_tail;
+
+	/* Formatted nodes cache statistics. */
+	tree_stat_t stat;
+
 #ifndef ENABLE_MINIMAL
 	/* Extents data stored here. */
 	aal_hash_table_t *blocks;
+
+	/* Prefetches of nodes on the current traverse path, the innermost
+	   first. */
+	tree_prefetch_t *prefetch;
+
+	/* Blocks held by prefetches, they count as nodes for memory pressure
+	   detection. */
+	uint32_t pfcount;
+
+	/* Directory entries resolved by the semantic open, both found and not
+	   found ones. Created on the first use. */
+	aal_hash_table_t *dentries;
+	uint32_t dcount;
 #endif
 };
 
@@ -262,6 +365,9 @@ struct reiser4_fs {
 
 	/* Pointer to the oid allocator in use */
 	reiser4_oid_t *oid;
+
+	/* Block ownership map. Built on the first use. */
+	reiser4_owner_map_t *owners;
 #endif
 
 	/* Pointer to the storage tree wrapper object */
@@ -29,6 +29,14 @@ typedef struct repair_am {
 	
 	repair_am_stat_t stat;
 	aal_gauge_t *gauge;
+
+	/* Called every @interval seconds to save the pass state, so that an 
+	   interrupted pass could be resumed. */
+	errno_t (*checkpoint) (void *data);
+	void *data;
+
+	uint32_t interval;
+	time_t next;
 } repair_am_t;
 
 extern errno_t repair_add_missing(repair_am_t *am);
@@ -12,7 +12,7 @@
 
 /* Statistics gathered during the pass. */
 typedef struct repair_ds_stat {
-	uint64_t read_nodes;
+	uint64_t read_nodes, read_requests;
 	uint64_t good_nodes, good_leaves, good_twigs;
 	uint64_t fixed_nodes, fixed_leaves, fixed_twigs;
 
@@ -10,6 +10,25 @@
 #include <repair/repair.h>
 #include <reiser4/filesystem.h>
 
+/* The index of node and block records of the packed fs. It follows the last
+   record, so that a record of any block may be read without unpacking the
+   rest of the stream. Entries are sorted by block numbers. */
+typedef struct repair_pack_entry {
+	uint64_t blk;
+	
+	/* Offset of the record from the first record in the stream. */
+	uint64_t offset;
+} repair_pack_entry_t;
+
+/* The tail of the packed fs, it ends the stream. */
+typedef struct repair_pack_tail {
+	/* Offset of the index from the first record in the stream. */
+	uint64_t index;
+	uint64_t blocks;
+	uint32_t blksize;
+	char sign[4];
+} repair_pack_tail_t;
+
 extern errno_t repair_fs_open(repair_data_t *repair, 
 			      aal_device_t *host_device,
 			      aal_device_t *journal_device);
@@ -18,12 +37,17 @@ extern errno_t repair_fs_replay(reiser4_fs_t *fs);
 
 extern errno_t repair_fs_pack(reiser4_fs_t *fs, 
 			      reiser4_bitmap_t *bitmap, 
-			      aal_stream_t *stream);
+			      aal_stream_t *stream,
+			      bool_t index);
 
 extern reiser4_fs_t *repair_fs_unpack(aal_device_t *device, 
 				      reiser4_bitmap_t *bitmap,
 				      aal_stream_t *stream);
 
+extern reiser4_fs_t *repair_fs_unpack_meta(aal_device_t *device, 
+					   reiser4_bitmap_t *bitmap,
+					   aal_stream_t *stream);
+
 extern errno_t repair_fs_lost_key(reiser4_fs_t *fs, 
 				  reiser4_key_t *key);
 
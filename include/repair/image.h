@@ -0,0 +1,13 @@
+/* Copyright 2001-2005 by Hans Reiser, licensing governed by
+   reiser4progs/COPYING.
+   
+   repair/image.h -- device over the packed fs metadata image. */
+
+#ifndef REPAIR_IMAGE_H
+#define REPAIR_IMAGE_H
+
+#include <stdio.h>
+#include <repair/repair.h>
+
+extern aal_device_t *repair_image_open(FILE *file, char *name);
+#endif
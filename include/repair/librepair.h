@@ -27,6 +27,7 @@ extern "C" {
 #include <repair/object.h>
 #include <repair/oid.h>
 #include <repair/pset.h>
+#include <repair/image.h>
 
 /*  -------------------------------------------------
     | Common scheem for communication with users.   |
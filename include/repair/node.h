@@ -11,6 +11,36 @@
 extern reiser4_node_t *repair_node_open(reiser4_tree_t *tree,
 					blk_t blk, uint32_t mkid);
 
+extern reiser4_node_t *repair_node_open_block(reiser4_tree_t *tree,
+					      aal_block_t *block,
+					      uint32_t mkid);
+
+/* Max number of blocks read from device at once. */
+#define RA_BLOCKS	256
+
+/* Nodes readahead. */
+typedef struct repair_ra {
+	reiser4_tree_t *tree;
+	reiser4_bitmap_t *bm;		/* Blocks to be read. */
+
+	char *buff;			/* Data of blocks read ahead. */
+	uint32_t size;
+	blk_t start;			/* The region read ahead. */
+	count_t count;
+	int failed;			/* The region cannot be read at once. */
+
+	void *pipe;			/* Reading stage working in parallel. */
+	uint64_t requests;		/* Read requests issued. */
+} repair_ra_t;
+
+extern errno_t repair_ra_init(repair_ra_t *ra, reiser4_tree_t *tree,
+			      reiser4_bitmap_t *bm, uint32_t jobs);
+
+extern void repair_ra_fini(repair_ra_t *ra);
+
+extern reiser4_node_t *repair_ra_open(repair_ra_t *ra, blk_t blk, 
+				      uint32_t mkid);
+
 extern errno_t repair_node_check_level(reiser4_node_t *node,
 				       uint8_t mode);
 
@@ -47,5 +47,7 @@ typedef enum repair_mode {
 #define NODE_PACK_SIGN		"NODE"
 #define BLOCK_PACK_SIGN		"BLCK"
 #define JOURNAL_PACK_SIGN	"JRNL"
+#define INDEX_PACK_SIGN		"INDX"
+#define TAIL_PACK_SIGN		"TAIL"
 
 #endif
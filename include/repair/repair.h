@@ -15,6 +15,7 @@ enum {
 	REPAIR_WHOLE	= 0x1,
 	REPAIR_NO_MKID	= 0x2,
 	REPAIR_YES	= 0X3,
+	REPAIR_RESUME	= 0x4,
 	REPAIR_LAST
 };
 
@@ -27,8 +28,14 @@ typedef struct repair_data {
 
 	uint8_t mode;
 	char *bitmap_file;
+	char *checkpoint_file;
+
+	/* Seconds between checkpoints of the add missing pass, 0 for the
+	   default interval. */
+	uint32_t checkpoint_interval;
 	
 	uint32_t flags;
+	uint32_t jobs;
 } repair_data_t;
 
 extern errno_t repair_check(repair_data_t *repair);
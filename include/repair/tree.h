@@ -8,6 +8,12 @@
 
 #include <repair/repair.h>
 
+/* Pointer to a node to be put to the tree by repair_tree_build(). */
+typedef struct repair_ptr {
+	blk_t blk;
+	reiser4_key_t key;
+} repair_ptr_t;
+
 extern errno_t repair_tree_parent_rkey(reiser4_tree_t *tree,
 				       reiser4_node_t *node, 
 				       reiser4_key_t *rd_key);
@@ -31,6 +37,11 @@ extern errno_t repair_tree_insert(reiser4_tree_t *tree,
 extern errno_t repair_tree_attach_node(reiser4_tree_t *tree,
 				       reiser4_node_t *node);
 
+extern errno_t repair_tree_build(reiser4_tree_t *tree,
+				 repair_ptr_t *ptrs,
+				 uint64_t count,
+				 uint8_t level);
+
 extern bool_t repair_tree_data_level(uint8_t level);
 
 extern bool_t repair_tree_legal_level(reiser4_item_plug_t *plug, 
@@ -12,7 +12,7 @@
 
 /* Statistics gathered during the pass. */
 typedef struct repair_ts_stat {
-	uint64_t read_twigs, fixed_twigs;
+	uint64_t read_twigs, read_requests, fixed_twigs;
 	uint64_t bad_unfm_ptrs;
 	time_t time;
 } repair_ts_stat_t;
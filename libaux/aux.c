@@ -176,6 +176,12 @@ char *aux_unpack_string(uint64_t value,
 #define ADLER_NMAX (5552)
 #define ADLER_BASE (65521l)
 
+#define ADLER_DO1(t, i) { s1 += (t)[i]; s2 += s1; }
+#define ADLER_DO4(t, i) ADLER_DO1(t, i); ADLER_DO1(t, i + 1); \
+	ADLER_DO1(t, i + 2); ADLER_DO1(t, i + 3);
+#define ADLER_DO16(t) ADLER_DO4(t, 0); ADLER_DO4(t, 4); \
+	ADLER_DO4(t, 8); ADLER_DO4(t, 12);
+
 unsigned int aux_adler32(unsigned int adler, char *buff, unsigned int n) {
 	unsigned char *t = (unsigned char *)buff;
 	unsigned int s1 = 1, s2 = 0;
@@ -189,7 +195,13 @@ unsigned int aux_adler32(unsigned int adler, char *buff, unsigned int n) {
 	while (n > 0) {
 		k = n < ADLER_NMAX ? n : ADLER_NMAX;
 		n -= k;
-	
+
+		/* ADLER_NMAX is a multiple of 16, so only the very last chunk
+		   has the tail less than 16 bytes. */
+		for (; k >= 16; k -= 16, t += 16) {
+			ADLER_DO16(t);
+		}
+		
 		while (k--) {
 			s1 += *t++; 
 			s2 += s1;
@@ -201,3 +213,24 @@ unsigned int aux_adler32(unsigned int adler, char *buff, unsigned int n) {
 	
 	return (s2 << 16) | s1;
 }
+
+/* Updates the adler32 checksum @adler got from aux_adler32() as if @n bytes of
+   value @c were appended to the checksummed data. Computed arithmetically,
+   with no buffer: after @n bytes s1 grows by n * c and s2 grows by n * s1 plus
+   c * n * (n + 1) / 2. */
+unsigned int aux_adler32_fill(unsigned int adler, unsigned char c,
+			      unsigned int n)
+{
+	uint64_t s1, s2, m;
+
+	s1 = adler & 0xffff;
+	s2 = adler >> 16;
+	m = n % ADLER_BASE;
+	
+	s2 = (s2 + m * s1) % ADLER_BASE;
+	s2 = (s2 + (uint64_t)c * (((uint64_t)n * (n + 1) / 2) %
+				  ADLER_BASE)) % ADLER_BASE;
+	s1 = (s1 + m * c) % ADLER_BASE;
+
+	return (unsigned int)((s2 << 16) | s1);
+}
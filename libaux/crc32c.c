@@ -78,12 +78,58 @@ static const uint32_t crc32c_table[256] = {
 };
 
 /*
- * Steps through buffer one byte at at time, calculates reflected
- * crc using table.
+ * Tables for slicing-by-8: crc32c_slice[k][i] is crc of byte i followed by k
+ * zero bytes. crc32c_slice[0] is crc32c_table. Built on the first use.
+ */
+static uint32_t crc32c_slice[8][256];
+static int crc32c_slice_ready = 0;
+
+static void crc32c_init_slice(void)
+{
+	uint32_t i, k, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[i];
+		crc32c_slice[0][i] = crc;
+
+		for (k = 1; k < 8; k++) {
+			crc = crc32c_table[crc & 0xFFL] ^ (crc >> 8);
+			crc32c_slice[k][i] = crc;
+		}
+	}
+
+	crc32c_slice_ready = 1;
+}
+
+/*
+ * Steps through buffer eight bytes at a time, calculates reflected crc
+ * using slicing-by-8 tables. The tail is handled one byte at a time. Bytes
+ * are loaded one by one, so the result does not depend on alignment and
+ * byte order.
  */
 
 uint32_t crc32c_le(uint32_t crc, unsigned char const *data, uint32_t length)
 {
+	if (!crc32c_slice_ready)
+		crc32c_init_slice();
+
+	while (length >= 8) {
+		crc ^= (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+			((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+
+		crc = crc32c_slice[7][crc & 0xFF] ^
+			crc32c_slice[6][(crc >> 8) & 0xFF] ^
+			crc32c_slice[5][(crc >> 16) & 0xFF] ^
+			crc32c_slice[4][crc >> 24] ^
+			crc32c_slice[3][data[4]] ^
+			crc32c_slice[2][data[5]] ^
+			crc32c_slice[1][data[6]] ^
+			crc32c_slice[0][data[7]];
+
+		data += 8;
+		length -= 8;
+	}
+	
 	while (length--)
 		crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
 	return crc;
@@ -8,7 +8,10 @@
 #  include <config.h>
 #endif
 
+#include <stdio.h>
+#include <ctype.h>
 #include <reiser4/libreiser4.h>
+#include <misc/misc.h>
 
 /* This is somehow opaque and seem like a magic digit. But the reasons to choose
    this value are the following:
@@ -19,14 +22,160 @@
    adjusted and thigs are allocated (node pointers and extents). So, this value
    is such as able to help some hipotetical big extent to fit into device region
    between two bitmap blocks.
-*/
-static uint32_t watermark = 5120;
 
-void misc_mpressure_setup(uint32_t value) {
-	watermark = value;
+   Now it is only used as the lower bound of the cache size (5120 blocks of 4K)
+   and as the cache size if available memory cannot be determined. */
+#define MPRESSURE_MIN_CACHE	(5120 * 4096ULL)
+
+/* Percent of available memory used for the tree cache by default. */
+#define MPRESSURE_MEM_PERCENT	25
+
+/* Percent of the cache given to formatted nodes, the rest is for extent data
+   blocks. Nodes are re-read much more often than data, so they get more. */
+#define MPRESSURE_NODES_PERCENT	75
+
+/* Cache limits. A limit is either in bytes, or in blocks if it was given as
+   a plain number of nodes, as --cache used to take before sizes. */
+typedef struct mpressure_limit {
+	uint64_t value;
+	bool_t blocks;
+} mpressure_limit_t;
+
+static mpressure_limit_t nodes_limit;
+static mpressure_limit_t blocks_limit;
+
+/* Set if the limits are set up, by the user or by default. */
+static bool_t limits_set = 0;
+
+/* Splits the total cache size @total between nodes and extent data blocks. */
+static void misc_mpressure_split(uint64_t total, bool_t blocks) {
+	nodes_limit.value = total * MPRESSURE_NODES_PERCENT / 100;
+	blocks_limit.value = total - nodes_limit.value;
+	nodes_limit.blocks = blocks_limit.blocks = blocks;
+	limits_set = 1;
+}
+
+/* Returns MemAvailable from /proc/meminfo in bytes, 0 if it is unknown. */
+static uint64_t misc_mpressure_avail(void) {
+	unsigned long long value;
+	uint64_t avail = 0;
+	char line[256];
+	FILE *fp;
+
+	if (!(fp = fopen("/proc/meminfo", "r")))
+		return 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "MemAvailable: %llu kB", &value) == 1) {
+			avail = value * 1024;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return avail;
+}
+
+/* Sets up the default cache limits from the available memory. */
+static void misc_mpressure_init(void) {
+	uint64_t total;
+
+	total = misc_mpressure_avail() / 100 * MPRESSURE_MEM_PERCENT;
+
+	if (total < MPRESSURE_MIN_CACHE)
+		total = MPRESSURE_MIN_CACHE;
+
+	misc_mpressure_split(total, 0);
+}
+
+/* Parses one cache size. A plain number is a count of nodes, K, M and G 
+   suffixes give the size in kilo-, mega- and gigabytes. */
+static errno_t misc_mpressure_parse(const char *str, mpressure_limit_t *limit) {
+	long long size;
+	uint32_t len;
+
+	if (!(len = aal_strlen(str)))
+		return -EINVAL;
+
+	if ((size = misc_size2long(str)) == INVAL_DIG || size <= 0)
+		return -EINVAL;
+
+	if (isdigit(str[len - 1])) {
+		limit->value = size;
+		limit->blocks = 1;
+	} else {
+		limit->value = (uint64_t)size * 1024;
+		limit->blocks = 0;
+	}
+	
+	return 0;
 }
 
-/* This function detects if mempry pressure is here. */
+/* Returns @limit in bytes. */
+static uint64_t misc_mpressure_bytes(mpressure_limit_t *limit, 
+				     uint32_t blksize)
+{
+	return limit->blocks ? limit->value * blksize : limit->value;
+}
+
+/* Sets the cache limits up from the @value string. It is either the total
+   cache size "SIZE", which is split between nodes and extent data blocks, or
+   separate sizes "NODES,DATA". */
+errno_t misc_mpressure_setup(const char *value) {
+	mpressure_limit_t nodes, blocks;
+	char buff[255];
+	char *data;
+
+	aal_memset(buff, 0, sizeof(buff));
+	aal_strncpy(buff, value, sizeof(buff) - 1);
+
+	if (!(data = aal_strchr(buff, ','))) {
+		if (misc_mpressure_parse(buff, &nodes))
+			return -EINVAL;
+
+		misc_mpressure_split(nodes.value, nodes.blocks);
+		return 0;
+	}
+
+	*data++ = '\0';
+
+	/* Both parts must be given, e.g. "4M," is wrong. */
+	if (misc_mpressure_parse(buff, &nodes) ||
+	    misc_mpressure_parse(data, &blocks))
+	{
+		return -EINVAL;
+	}
+
+	nodes_limit = nodes;
+	blocks_limit = blocks;
+	limits_set = 1;
+	
+	return 0;
+}
+
+/* This function detects if memory pressure is here. Returns the mask of caches
+   which are over their limits. */
 int misc_mpressure_detect(reiser4_tree_t *tree) {
-	return tree->nodes->real + tree->blocks->real > watermark;
+	uint32_t blksize;
+	int res = 0;
+
+	if (!limits_set)
+		misc_mpressure_init();
+
+	blksize = reiser4_tree_get_blksize(tree);
+	
+	/* Blocks read in advance by traversal are nodes not cached yet. */
+	if ((uint64_t)(tree->nodes->real + tree->pfcount) * blksize > 
+	    misc_mpressure_bytes(&nodes_limit, blksize))
+	{
+		res |= MP_NODES;
+	}
+
+	if ((uint64_t)tree->blocks->real * blksize > 
+	    misc_mpressure_bytes(&blocks_limit, blksize))
+	{
+		res |= MP_BLOCKS;
+	}
+	
+	return res;
 }
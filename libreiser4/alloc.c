@@ -159,7 +159,9 @@ void reiser4_alloc_close(
 {
 	aal_assert("umka-1504", alloc != NULL);
 
-	alloc->fs->alloc = NULL;
+	/* The allocator may be not assigned to the fs yet, or replaced. */
+	if (alloc->fs->alloc == alloc)
+		alloc->fs->alloc = NULL;
 	
 	/* Calling the plugin for close its internal instance properly */
 	reiser4call(alloc, close);
@@ -242,6 +244,28 @@ count_t reiser4_alloc_allocate(
 	return blocks;
 }
 
+/* Makes request to plugin for allocating blocks starting the search from
+   *@start. This is used for placing new blocks near some others. Falls back to
+   the search from the beginning if nothing is found after *@start. */
+count_t reiser4_alloc_allocate_near(
+	reiser4_alloc_t *alloc, /* allocator for working with */
+	blk_t *start,           /* preferred start block */
+	count_t count)          /* requested block count */
+{
+	count_t blocks;
+	
+	aal_assert("umka-3141", alloc != NULL);
+	aal_assert("umka-3142", start != NULL);
+
+	if (!(blocks = reiser4call(alloc, allocate, start, count)))
+		return reiser4_alloc_allocate(alloc, start, count);
+	
+	if (alloc->hook.alloc)
+		alloc->hook.alloc(alloc, *start, blocks, alloc->hook.data);
+		
+	return blocks;
+}
+
 errno_t reiser4_alloc_valid(
 	reiser4_alloc_t *alloc)	/* allocator to be checked */
 {
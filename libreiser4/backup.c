@@ -34,6 +34,7 @@ reiser4_backup_t *reiser4_backup_create(reiser4_fs_t *fs) {
 		goto error_free_block;
 
 	reiser4_backup_mkdirty(backup);
+	reiser4_fs_owner_reset(fs);
 	return backup;
 	
 error_free_block:
@@ -108,6 +109,7 @@ reiser4_backup_t *reiser4_backup_open(reiser4_fs_t *fs) {
 	
 	aal_block_free(backup->data);
 	backup->data = NULL;
+	reiser4_fs_owner_reset(fs);
 	return backup;
 	
  error_free_block:
@@ -154,6 +156,7 @@ errno_t reiser4_backup_valid(reiser4_backup_t *backup) {
 void reiser4_backup_close(reiser4_backup_t *backup) {
 	aal_assert("vpf-1398", backup != NULL);
 	
+	reiser4_fs_owner_reset(backup->fs);
 	aal_block_fini(&backup->hint.block);	
 	aal_free(backup);
 }
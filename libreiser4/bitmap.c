@@ -61,22 +61,55 @@ int reiser4_bitmap_test(
 	return aal_test_bit(bitmap->map, bit);
 }
 
+/* Returns the number of set bits in @word. */
+static inline uint32_t reiser4_bitmap_weight(uint64_t word) {
+	word -= (word >> 1) & 0x5555555555555555ULL;
+	word = (word & 0x3333333333333333ULL) +
+		((word >> 2) & 0x3333333333333333ULL);
+	word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	
+	return (word * 0x0101010101010101ULL) >> 56;
+}
+
 /* Makes loop through bitmap and calculates the number of marked/cleared blocks
    in it. This function is used for checking the bitmap on validness. Also it is
    used for calculating marked blocks of bitmap in reiser4_bitmap_open function. See
-   bellow for details. */
-static uint64_t reiser4_bitmap_calc(
+   bellow for details. Bits are counted by 64-bit words, only the unaligned head
+   and tail of the range are handled by bytes and bits. Bits out of the bitmap
+   are considered as cleared ones. */
+uint64_t reiser4_bitmap_calc(
 	reiser4_bitmap_t *bitmap,	   /* bitmap will be used for calculating bits */
 	uint64_t start,		   /* start bit, calculating should be performed from */
 	uint64_t count,		   /* end bit, calculating should be stoped on */
 	int marked)		   /* flag for kind of calculating (marked or cleared) */
 {
-	uint64_t i, bits = 0;
+	uint64_t i, end, bits = 0;
+	unsigned char *map;
+
+	map = (unsigned char *)bitmap->map;
 	
-	for (i = start; i < start + count; i++)
-		bits += reiser4_bitmap_test(bitmap, i) ? marked : !marked;
+	if ((end = start + count) > bitmap->total)
+		end = bitmap->total;
+
+	/* Bits up to the byte boundary. */
+	for (i = start; i < end && (i & 7); i++)
+		bits += aal_test_bit(map, i) ? 1 : 0;
+
+	/* Bytes up to the word boundary. The map is allocated by aal_calloc(),
+	   so it is aligned well enough for word access. */
+	for (; i + 8 <= end && (i & 63); i += 8)
+		bits += reiser4_bitmap_weight(map[i >> 3]);
+
+	for (; i + 64 <= end; i += 64)
+		bits += reiser4_bitmap_weight(*(uint64_t *)(map + (i >> 3)));
+
+	for (; i + 8 <= end; i += 8)
+		bits += reiser4_bitmap_weight(map[i >> 3]);
+
+	for (; i < end; i++)
+		bits += aal_test_bit(map, i) ? 1 : 0;
 
-	return bits;
+	return marked ? bits : count - bits;
 }
 
 /* Checks whether passed range of blocks is inside of bitmap and marks
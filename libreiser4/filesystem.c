@@ -159,6 +159,8 @@ void reiser4_fs_close(reiser4_fs_t *fs) {
 	if (fs->backup) {
 		reiser4_backup_close(fs->backup);
 	}
+
+	reiser4_fs_owner_reset(fs);
 #endif
 	
 	/* Freeing memory occupied by fs instance */
@@ -166,6 +168,212 @@ void reiser4_fs_close(reiser4_fs_t *fs) {
 }
 
 #ifndef ENABLE_MINIMAL
+/* Context of building block ownership map. */
+typedef struct owner_build {
+	reiser4_owner_map_t *map;
+	reiser4_owner_t owner;
+	uint32_t prio;
+} owner_build_t;
+
+/* Adds the range of blocks of the current component to the map. Adjacent
+   ranges of the same component are merged. */
+static errno_t cb_owner_range(blk_t start, count_t width, void *data) {
+	owner_build_t *build = (owner_build_t *)data;
+	reiser4_owner_map_t *map = build->map;
+	reiser4_owner_range_t *range;
+	uint32_t size;
+
+	if (!width)
+		return 0;
+	
+	if (map->count) {
+		range = &map->ranges[map->count - 1];
+
+		if (range->prio == build->prio && range->end == start) {
+			range->end += width;
+			return 0;
+		}
+	}
+
+	if (map->count == map->size) {
+		size = map->size ? map->size * 2 : 64;
+
+		if (!(range = aal_malloc(size * sizeof(*range))))
+			return -ENOMEM;
+
+		if (map->ranges) {
+			aal_memcpy(range, map->ranges,
+				   map->count * sizeof(*range));
+			aal_free(map->ranges);
+		}
+
+		map->ranges = range;
+		map->size = size;
+	}
+
+	range = &map->ranges[map->count++];
+	
+	range->start = start;
+	range->end = start + width;
+	range->prio = build->prio;
+	range->owner = build->owner;
+	
+	return 0;
+}
+
+static void reiser4_owner_map_free(reiser4_owner_map_t *map) {
+	if (map->ranges)
+		aal_free(map->ranges);
+
+	aal_free(map);
+}
+
+/* Builds block ownership map of @fs. Components are enumerated in the same
+   order reiser4_fs_belongs() used to check them, which gives priorities to
+   their ranges in the case they overlap. */
+static reiser4_owner_map_t *reiser4_owner_map_build(reiser4_fs_t *fs) {
+	reiser4_owner_range_t range;
+	reiser4_owner_map_t *map;
+	owner_build_t build;
+	uint32_t i, j;
+	errno_t res;
+	
+	if (!(map = aal_calloc(sizeof(*map), 0)))
+		return NULL;
+
+	build.map = map;
+
+	build.owner = O_MASTER;
+	build.prio = 0;
+	
+	if ((res = reiser4_master_layout(fs->master, cb_owner_range, &build)))
+		goto error_free_map;
+
+	build.owner = O_FORMAT;
+	build.prio++;
+	
+	if ((res = reiser4_format_layout(fs->format, cb_owner_range, &build)))
+		goto error_free_map;
+
+	build.owner = O_OID;
+	build.prio++;
+	
+	if ((res = reiser4_oid_layout(fs->oid, cb_owner_range, &build)))
+		goto error_free_map;
+
+	if (fs->journal) {
+		build.owner = O_JOURNAL;
+		build.prio++;
+	
+		if ((res = reiser4_journal_layout(fs->journal,
+						  cb_owner_range, &build)))
+		{
+			goto error_free_map;
+		}
+	}
+
+	build.owner = O_STATUS;
+	build.prio++;
+	
+	if ((res = reiser4_status_layout(fs->status, cb_owner_range, &build)))
+		goto error_free_map;
+
+	build.owner = O_ALLOC;
+	build.prio++;
+	
+	if ((res = reiser4_alloc_layout(fs->alloc, cb_owner_range, &build)))
+		goto error_free_map;
+
+	build.owner = O_BACKUP;
+	build.prio++;
+	
+	if ((res = reiser4_backup_layout(fs, cb_owner_range, &build)))
+		goto error_free_map;
+
+	/* Sorting ranges by start block. Ranges of each component come in
+	   ascending order, so insertion sort has not much to do here. */
+	for (i = 1; i < map->count; i++) {
+		range = map->ranges[i];
+
+		for (j = i; j > 0 && map->ranges[j - 1].start > range.start; j--)
+			map->ranges[j] = map->ranges[j - 1];
+
+		map->ranges[j] = range;
+	}
+
+	for (i = 0; i < map->count; i++) {
+		map->ranges[i].reach = map->ranges[i].end;
+		
+		if (i && map->ranges[i - 1].reach > map->ranges[i].reach)
+			map->ranges[i].reach = map->ranges[i - 1].reach;
+	}
+	
+	return map;
+
+ error_free_map:
+	reiser4_owner_map_free(map);
+	return NULL;
+}
+
+/* Returns block ownership map of @fs. It is built on the first call and kept
+   until the fs is closed or reiser4_fs_owner_reset() is called. */
+reiser4_owner_map_t *reiser4_fs_owner_map(reiser4_fs_t *fs) {
+	aal_assert("umka-3143", fs != NULL);
+
+	if (!fs->owners)
+		fs->owners = reiser4_owner_map_build(fs);
+
+	return fs->owners;
+}
+
+/* Drops block ownership map of @fs. Should be called when fs layout is
+   changed, the map is built again on the next use. */
+void reiser4_fs_owner_reset(reiser4_fs_t *fs) {
+	aal_assert("umka-3144", fs != NULL);
+
+	if (!fs->owners)
+		return;
+
+	reiser4_owner_map_free(fs->owners);
+	fs->owners = NULL;
+}
+
+/* Returns owner of @blk from @map. The last range starting not after @blk is
+   found by binary search, then ranges which may still cover @blk are looked
+   through back while their reach is after @blk. There is usually no overlaps,
+   and only one range is checked then. */
+reiser4_owner_t reiser4_owner_map_find(reiser4_owner_map_t *map, blk_t blk) {
+	reiser4_owner_range_t *range;
+	reiser4_owner_t owner;
+	uint32_t left, right;
+	uint32_t i, mid, prio;
+
+	aal_assert("umka-3145", map != NULL);
+	
+	for (left = 0, right = map->count; left < right; ) {
+		mid = (left + right) / 2;
+
+		if (map->ranges[mid].start <= blk)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+
+	owner = O_UNKNOWN;
+	prio = MAX_UINT32;
+	
+	for (i = left; i > 0 && map->ranges[i - 1].reach > blk; i--) {
+		range = &map->ranges[i - 1];
+
+		if (range->end > blk && range->prio < prio) {
+			owner = range->owner;
+			prio = range->prio;
+		}
+	}
+
+	return owner;
+}
+
 static errno_t cb_check_block(blk_t start, count_t width, void *data) {
 	blk_t blk = *(blk_t *)data;
 	return (blk >= start && blk < start + width);
@@ -173,8 +381,15 @@ static errno_t cb_check_block(blk_t start, count_t width, void *data) {
 
 /* Returns passed @blk owner */
 reiser4_owner_t reiser4_fs_belongs(reiser4_fs_t *fs, blk_t blk) {
+	reiser4_owner_map_t *map;
+	
 	aal_assert("umka-1534", fs != NULL);
 
+	if ((map = reiser4_fs_owner_map(fs)))
+		return reiser4_owner_map_find(map, blk);
+
+	/* No memory for the map, checking all the layouts then. */
+	
 	/* Checks if passed @blk is master super block */
 	if (reiser4_master_layout(fs->master, cb_check_block, &blk))
 		return O_MASTER;
@@ -371,23 +586,191 @@ errno_t reiser4_fs_backup(reiser4_fs_t *fs, backup_hint_t *hint) {
 	return reiser4_pset_backup(fs->tree, hint);
 }
 
-/* Resizes passed open @fs by passed @blocks */
+/* Opens the journal of @fs if it is not opened yet. Journal area is not a
+   part of the tree, so it should be known for block level operations. */
+static errno_t reiser4_fs_open_journal(reiser4_fs_t *fs) {
+	if (fs->journal)
+		return 0;
+	
+	if (!(fs->journal = reiser4_journal_open(fs, fs->device))) {
+		aal_error("Can't open the journal of the filesystem.");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static errno_t cb_clear_block(blk_t start, count_t width, void *data) {
+	reiser4_bitmap_t *bitmap = (reiser4_bitmap_t *)data;
+
+	/* Only backup blocks inside the fs are kept in the bitmap. */
+	if (start < bitmap->total)
+		reiser4_bitmap_clear_region(bitmap, start, width);
+	
+	return 0;
+}
+
+/* Returns the number of blocks to be moved for resizing @fs to @blocks, or
+   negative value for errors. */
+int64_t reiser4_fs_resize_estimate(
+	reiser4_fs_t *fs,               /* fs to be resized */
+	count_t blocks)                 /* new fs size */
+{
+	errno_t res;
+	
+	aal_assert("umka-3133", fs != NULL);
+
+	if ((res = reiser4_fs_open_journal(fs)))
+		return res;
+
+	return reiser4_tree_resize_estimate(fs->tree, blocks);
+}
+
+/* Resizes passed open @fs to passed @blocks. The tree is moved out of the area
+   to be cut off or out of the new backup blocks first. Then the allocator and
+   the backup are built for the new size, as backup blocks are spread over the
+   whole fs, and replace the old ones along with the format length and free
+   blocks. If something fails, the old ones are kept. */
 errno_t reiser4_fs_resize(
 	reiser4_fs_t *fs,               /* fs to be resized */
 	count_t blocks)                 /* new fs size */
 {
-	return reiser4_tree_resize(fs->tree, blocks);
+	reiser4_backup_t *backup;
+	reiser4_bitmap_t *bitmap;
+	reiser4_alloc_t *alloc;
+	reiser4_alloc_t *old;
+	count_t len, free;
+	uint32_t blksize;
+	errno_t res;
+	
+	aal_assert("umka-3134", fs != NULL);
+
+	len = reiser4_format_get_len(fs->format);
+	blksize = reiser4_master_get_blksize(fs->master);
+
+	if (blocks == len)
+		return 0;
+
+	if ((res = reiser4_format_check_len(fs->device, blksize, blocks)))
+		return res;
+
+	if ((res = reiser4_fs_open_journal(fs)))
+		return res;
+
+	if ((res = reiser4_tree_resize(fs->tree, blocks)))
+		return res;
+
+	if (!(bitmap = reiser4_bitmap_create(len)))
+		return -ENOMEM;
+
+	if ((res = reiser4_alloc_extract(fs->alloc, bitmap)))
+		goto error_free_bitmap;
+
+	/* Old backup blocks are not needed anymore. */
+	if ((res = reiser4_backup_layout(fs, cb_clear_block, bitmap)))
+		goto error_free_bitmap;
+	
+	reiser4_bitmap_resize(bitmap, blocks);
+	
+	if (!(alloc = reiser4_alloc_create(fs, blocks))) {
+		res = -EINVAL;
+		goto error_free_bitmap;
+	}
+
+	if ((res = reiser4_alloc_assign(alloc, bitmap)))
+		goto error_free_alloc;
+
+	alloc->hook = fs->alloc->hook;
+
+	/* Bitmap blocks of the new area and the new backup blocks. */
+	if ((res = reiser4_alloc_layout(alloc, cb_mark_block, alloc)))
+		goto error_free_alloc;
+
+	if ((res = reiser4_backup_layout_body(alloc, blksize, blocks,
+					      cb_mark_block, alloc)))
+	{
+		goto error_free_alloc;
+	}
+
+	/* The backup keeps the format, so it is created for the new one. */
+	old = fs->alloc;
+	free = reiser4_format_get_free(fs->format);
+	
+	fs->alloc = alloc;
+	reiser4_format_set_len(fs->format, blocks);
+	reiser4_format_set_free(fs->format, reiser4_alloc_free(alloc));
+	reiser4_fs_owner_reset(fs);
+	
+	if (!(backup = reiser4_backup_create(fs))) {
+		aal_error("Can't create the filesystem backup.");
+		
+		fs->alloc = old;
+		reiser4_format_set_len(fs->format, len);
+		reiser4_format_set_free(fs->format, free);
+		reiser4_fs_owner_reset(fs);
+		
+		res = -EINVAL;
+		goto error_free_alloc;
+	}
+
+	reiser4_alloc_close(old);
+
+	if (fs->backup)
+		reiser4_backup_close(fs->backup);
+
+	fs->backup = backup;
+	
+	reiser4_bitmap_close(bitmap);
+	return 0;
+
+ error_free_alloc:
+	reiser4_alloc_close(alloc);
+ error_free_bitmap:
+	reiser4_bitmap_close(bitmap);
+	return res;
 }
 
-/* Makes copy of @src_fs to @dst_fs */
+/* Makes copy of @src_fs to @dst_fs. The tree is copied block by block, so
+   @dst_fs should be just created one with the same geometry. The journal of
+   @src_fs should not have transactions to be replayed. */
 errno_t reiser4_fs_copy(
 	reiser4_fs_t *src_fs,           /* fs to be copied */
 	reiser4_fs_t *dst_fs)           /* destination fs */
 {
+	reiser4_format_t *format;
+	errno_t res;
+	
 	aal_assert("umka-2484", src_fs != NULL);
 	aal_assert("umka-2485", dst_fs != NULL);
+
+	if ((res = reiser4_fs_open_journal(src_fs)))
+		return res;
+
+	/* Metadata of the source fs are not consistent until its journal is
+	   replayed, and replaying it changes the source fs. */
+	if (reiser4_journal_pending(src_fs->journal)) {
+		aal_error("The journal of the filesystem on %s has "
+			  "transactions not replayed.", src_fs->device->name);
+		return -EINVAL;
+	}
 	
-	return reiser4_tree_copy(src_fs->tree, dst_fs->tree);
+	if ((res = reiser4_tree_copy(src_fs->tree, dst_fs->tree)))
+		return res;
+
+	/* Nodes keep the mkfs stamp of the source fs. */
+	format = src_fs->format;
+	reiser4_format_set_stamp(dst_fs->format, 
+				 reiser4_format_get_stamp(format));
+	reiser4_format_set_policy(dst_fs->format,
+				  reiser4_format_get_policy(format));
+
+	/* Objectids of the copied objects are in use. */
+	reiser4_oid_set_next(dst_fs->oid, reiser4_oid_next(src_fs->oid));
+	reiser4_oid_set_used(dst_fs->oid, reiser4_oid_get_used(src_fs->oid));
+	reiser4_oid_mkdirty(dst_fs->oid);
+
+	/* Getting the fs-global plugin set from the copied root dir. */
+	return reiser4_pset_tree(dst_fs->tree, 1);
 }
 
 /* Synchronizes all filesystem objects. */
@@ -87,7 +87,9 @@ reiser4_journal_t *reiser4_journal_open(
 			  plug->label, device->name);
 		goto error_free_journal;
 	}
-	
+
+	/* Journal blocks are known now. */
+	reiser4_fs_owner_reset(fs);
 	return journal;
 
  error_free_journal:
@@ -180,6 +182,7 @@ reiser4_journal_t *reiser4_journal_create(
 		goto error_free_entity;
 	}
 	
+	reiser4_fs_owner_reset(fs);
 	return journal;
 
  error_free_entity:
@@ -202,6 +205,17 @@ errno_t reiser4_journal_replay(
 	return reiser4call(journal, replay);
 }
 
+/* Returns TRUE if @journal has transactions not replayed yet, that is the
+   filesystem was not unmounted cleanly and its metadata are not consistent
+   until the journal is replayed. */
+bool_t reiser4_journal_pending(
+	reiser4_journal_t *journal)	/* journal to be checked */
+{
+	aal_assert("umka-3167", journal != NULL);
+
+	return reiser4call(journal, pending);
+}
+
 /* Saves journal structures on journal device */
 errno_t reiser4_journal_sync(
 	reiser4_journal_t *journal)	/* journal to be saved */
@@ -231,6 +245,9 @@ void reiser4_journal_close(
 	
 	reiser4_journal_sync(journal);
 	reiser4call(journal, close);
+
+	/* Journal blocks should not be owned by the journal anymore. */
+	reiser4_fs_owner_reset(journal->fs);
 	aal_free(journal);
 }
 #endif
@@ -117,30 +117,17 @@ void reiser4_node_move(reiser4_node_t *node, blk_t nr) {
 }
 #endif
 
-/* Opens node on specified @tree and block number @nr. */
-reiser4_node_t *reiser4_node_open(reiser4_tree_t *tree, blk_t nr) {
+/* Opens node on specified @tree from already read @block. The @block is owned
+   by the node on success and is released on failure. */
+reiser4_node_t *reiser4_node_open_block(reiser4_tree_t *tree,
+					aal_block_t *block)
+{
 	uint16_t pid;
-	uint32_t size;
-
-	aal_block_t *block;
-	aal_device_t *device;
 	reiser4_plug_t *plug;
         reiser4_node_t *node;
  
-        aal_assert("umka-160", tree != NULL);
-        aal_assert("vpf-1652", tree->fs != NULL);
-        aal_assert("vpf-1653", tree->fs->device != NULL);
-
-	/* Getting tree characteristics needed for open node. */
-	size = reiser4_tree_get_blksize(tree);
-	device = tree->fs->device;
-	
-	/* Load block at @nr, that node lie in. */
-	if (!(block = aal_block_load(device, size, nr))) {
-		aal_error("Can't read block %llu. %s.",
-			  (unsigned long long)nr, device->error);
-		return NULL;
-	}
+        aal_assert("vpf-1914", tree != NULL);
+        aal_assert("vpf-1915", block != NULL);
 
 	/* Getting node plugin id. */
 	pid = *((uint16_t *)block->data);
@@ -170,6 +157,30 @@ reiser4_node_t *reiser4_node_open(reiser4_tree_t *tree, blk_t nr) {
         return NULL;
 }
 
+/* Opens node on specified @tree and block number @nr. */
+reiser4_node_t *reiser4_node_open(reiser4_tree_t *tree, blk_t nr) {
+	uint32_t size;
+	aal_block_t *block;
+	aal_device_t *device;
+ 
+        aal_assert("umka-160", tree != NULL);
+        aal_assert("vpf-1652", tree->fs != NULL);
+        aal_assert("vpf-1653", tree->fs->device != NULL);
+
+	/* Getting tree characteristics needed for open node. */
+	size = reiser4_tree_get_blksize(tree);
+	device = tree->fs->device;
+	
+	/* Load block at @nr, that node lie in. */
+	if (!(block = aal_block_load(device, size, nr))) {
+		aal_error("Can't read block %llu. %s.",
+			  (unsigned long long)nr, device->error);
+		return NULL;
+	}
+
+	return reiser4_node_open_block(tree, block);
+}
+
 #ifndef ENABLE_MINIMAL
 /* Saves node to device if it is dirty and closes node */
 errno_t reiser4_node_fini(reiser4_node_t *node) {
@@ -348,6 +359,17 @@ errno_t reiser4_node_merge(reiser4_node_t *node, pos_t *pos1, pos_t *pos2) {
 	return objcall(node, merge, pos1, pos2);
 }
 
+/* Prepares @node block for being written not by reiser4_node_sync(), lets
+   node plugin to update its checksum, etc. */
+errno_t reiser4_node_seal(reiser4_node_t *node) {
+	aal_assert("umka-3172", node != NULL);
+
+	if (!node->plug->seal)
+		return 0;
+
+	return objcall(node, seal);
+}
+
 /* Saves passed @node onto device it was opened on */
 errno_t reiser4_node_sync(reiser4_node_t *node) {
 	aal_assert("umka-2253", node != NULL);
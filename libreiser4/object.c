@@ -202,6 +202,10 @@ errno_t reiser4_object_add_entry(
 
 	if (!reiser4_psobj(object)->add_entry)
 		return -EINVAL;
+
+	/* The name could be cached as not existent. */
+	reiser4_semantic_forget((reiser4_tree_t *)object->info.tree,
+				&object->info.object, entry->name);
 	
 	return plugcall(reiser4_psobj(object), add_entry, object, entry);
 }
@@ -215,6 +219,10 @@ errno_t reiser4_object_rem_entry(
     
 	if (!reiser4_psobj(object)->rem_entry)
 		return -EINVAL;
+
+	/* The entry name is not always known here, and the removed object 
+	   could be a directory with cached entries, drop them all. */
+	reiser4_semantic_flush((reiser4_tree_t *)object->info.tree);
 	
 	return plugcall(reiser4_psobj(object), rem_entry, object, entry);
 }
@@ -348,6 +356,11 @@ errno_t reiser4_object_attach(reiser4_object_t *object,
 	
 	if (!reiser4_psobj(object)->attach) 
 		return 0;
+
+	/* Directories get ".." pointing to @parent, it could be cached as not
+	   existent or pointing to the previous parent. */
+	reiser4_semantic_forget((reiser4_tree_t *)object->info.tree,
+				&object->info.object, "..");
 	
 	if ((res = plugcall(reiser4_psobj(object), attach, 
 			    object, parent ? parent : NULL)))
@@ -372,6 +385,10 @@ errno_t reiser4_object_detach(reiser4_object_t *object,
 
 	if (!reiser4_psobj(object)->detach) 
 		return 0;
+
+	/* Directories lose ".." pointing to @parent. */
+	reiser4_semantic_forget((reiser4_tree_t *)object->info.tree,
+				&object->info.object, "..");
 	
 	if ((res = plugcall(reiser4_psobj(object), detach,
 			    object, parent ? parent : NULL))) 
@@ -699,6 +716,102 @@ errno_t reiser4_object_readdir(reiser4_object_t *object,
 	return plugcall(reiser4_psobj(object), readdir, object, entry);
 }
 
+/* Loads stat data of objects pointed by @entries to @stats. Objects are opened
+   in the order of their stat data keys, so that stat data lying together are 
+   found in already loaded leaves. Extensions to be loaded are set up in @stats
+   by the caller. The extmask is left zero if the object cannot be opened. */
+static void reiser4_object_readdir_stat(reiser4_object_t *object,
+					entry_hint_t *entries,
+					uint32_t count,
+					stat_hint_t *stats)
+{
+	reiser4_object_t *child;
+	reiser4_tree_t *tree;
+	reiser4_key_t *key;
+	uint32_t *order;
+	uint32_t i, j, k;
+
+	tree = (reiser4_tree_t *)object->info.tree;
+
+	/* Going in the directory order if there is no memory for sorting. */
+	if ((order = aal_calloc(count * sizeof(*order), 0))) {
+		for (i = 0; i < count; i++) {
+			for (j = i; j > 0; j--) {
+				key = &entries[order[j - 1]].object;
+				
+				if (reiser4_key_compfull(key, 
+							 &entries[i].object) <= 0)
+				{
+					break;
+				}
+				
+				order[j] = order[j - 1];
+			}
+
+			order[j] = i;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		k = order ? order[i] : i;
+		stats[k].extmask = 0;
+
+		if (!(child = reiser4_object_obtain(tree, object,
+						    &entries[k].object)))
+		{
+			continue;
+		}
+
+		if (reiser4_object_stat(child, &stats[k]))
+			stats[k].extmask = 0;
+
+		reiser4_object_close(child);
+	}
+
+	if (order)
+		aal_free(order);
+}
+
+/* Reads up to @count entries at the current @object offset to @entries. If
+   @stats is not NULL, stat data of the read entries are loaded into it too. 
+   Returns count of read entries, zero if the directory is over. */
+int32_t reiser4_object_readdir_batch(reiser4_object_t *object,
+				     entry_hint_t *entries,
+				     uint32_t count,
+				     stat_hint_t *stats)
+{
+	int32_t read;
+	errno_t res;
+
+	aal_assert("umka-3164", object != NULL);
+	aal_assert("umka-3165", entries != NULL);
+
+	if (!reiser4_psobj(object)->readdir)
+		return -EINVAL;
+
+	if (reiser4_psobj(object)->readdir_batch) {
+		read = plugcall(reiser4_psobj(object), readdir_batch,
+				object, entries, count);
+	} else {
+		/* Falling back to reading entries one by one. */
+		for (read = 0; read < (int32_t)count; read++) {
+			res = plugcall(reiser4_psobj(object), readdir,
+				       object, &entries[read]);
+
+			if (res < 0)
+				return res;
+
+			if (res == 0)
+				break;
+		}
+	}
+
+	if (read > 0 && stats)
+		reiser4_object_readdir_stat(object, entries, read, stats);
+
+	return read;
+}
+
 /* Enumerates all enries in @object. Calls @open_func for each of them. Used in
    semanthic path in librepair. */
 errno_t reiser4_object_traverse(reiser4_object_t *object,
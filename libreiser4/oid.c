@@ -197,6 +197,13 @@ void reiser4_oid_set_used(reiser4_oid_t *oid, uint64_t used) {
 	reiser4call(oid, set_used, used);
 }
 
+/* Sets the first not used oid in passed oid allocator */
+void reiser4_oid_set_next(reiser4_oid_t *oid, uint64_t next) {
+	aal_assert("umka-3131", oid != NULL);
+    
+	reiser4call(oid, set_next, next);
+}
+
 
 /* Returns number of free oids from passed oid allocator */
 uint64_t reiser4_oid_free(reiser4_oid_t *oid) {
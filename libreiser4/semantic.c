@@ -15,6 +15,186 @@ typedef struct resolve {
 	reiser4_key_t key;
 } resolve_t;
 
+#ifndef ENABLE_MINIMAL
+#define SEMANTIC_DENTRIES_TABLE_SIZE (512)
+
+/* Maximal number of cached entries. The whole cache is dropped on overflow, 
+   it is refilled by the paths being opened at the moment. */
+#define SEMANTIC_DENTRIES_MAX (4096)
+
+/* Cached result of looking up @name in the directory @parent. */
+typedef struct dentry {
+	reiser4_key_t parent;
+	reiser4_key_t object;
+	bool_t present;
+	char *name;
+} dentry_t;
+
+/* The name is allocated together with the entry. */
+static void cb_dentries_keyrem_func(void *key) {
+	aal_free(key);
+}
+
+static uint64_t cb_dentries_hash_func(void *key) {
+	dentry_t *dentry = (dentry_t *)key;
+	uint64_t hash;
+	char *name;
+
+	hash = reiser4_key_get_objectid(&dentry->parent);
+	
+	for (name = dentry->name; *name; name++)
+		hash = hash * 31 + (unsigned char)*name;
+
+	return hash;
+}
+
+static int cb_dentries_comp_func(void *key1, void *key2, void *data) {
+	dentry_t *dentry1 = (dentry_t *)key1;
+	dentry_t *dentry2 = (dentry_t *)key2;
+	int res;
+
+	if ((res = reiser4_key_compfull(&dentry1->parent, &dentry2->parent)))
+		return res;
+
+	return aal_strcmp(dentry1->name, dentry2->name);
+}
+
+static dentry_t *reiser4_semantic_find(reiser4_tree_t *tree, 
+				       reiser4_key_t *parent, 
+				       char *name)
+{
+	dentry_t dentry;
+
+	if (!tree->dentries)
+		return NULL;
+	
+	aal_memcpy(&dentry.parent, parent, sizeof(dentry.parent));
+	dentry.name = name;
+
+	return aal_hash_table_lookup(tree->dentries, &dentry);
+}
+
+/* Caches the result of looking up @name in @parent. @object is NULL if there
+   is no such entry. Failing to cache is not an error. */
+static void reiser4_semantic_cache(reiser4_tree_t *tree, 
+				   reiser4_key_t *parent, 
+				   char *name, reiser4_key_t *object)
+{
+	dentry_t *dentry;
+	uint32_t len;
+
+	if (tree->dcount >= SEMANTIC_DENTRIES_MAX)
+		reiser4_semantic_flush(tree);
+	
+	if (!tree->dentries) {
+		if (!(tree->dentries = 
+		      aal_hash_table_create(SEMANTIC_DENTRIES_TABLE_SIZE,
+					    cb_dentries_hash_func,
+					    cb_dentries_comp_func,
+					    cb_dentries_keyrem_func,
+					    NULL)))
+		{
+			return;
+		}
+	}
+
+	len = aal_strlen(name);
+	
+	if (!(dentry = aal_calloc(sizeof(*dentry) + len + 1, 0)))
+		return;
+
+	dentry->name = (char *)(dentry + 1);
+	aal_memcpy(dentry->name, name, len);
+	aal_memcpy(&dentry->parent, parent, sizeof(dentry->parent));
+	
+	if ((dentry->present = (object != NULL)))
+		aal_memcpy(&dentry->object, object, sizeof(dentry->object));
+
+	if (aal_hash_table_insert(tree->dentries, dentry, dentry)) {
+		aal_free(dentry);
+		return;
+	}
+
+	tree->dcount++;
+}
+
+/* Drops the cached entry @name of the directory @parent. */
+void reiser4_semantic_forget(reiser4_tree_t *tree, 
+			     reiser4_key_t *parent, 
+			     char *name) 
+{
+	dentry_t dentry;
+	
+	aal_assert("umka-3158", tree != NULL);
+	aal_assert("umka-3159", parent != NULL);
+	aal_assert("umka-3160", name != NULL);
+
+	if (!reiser4_semantic_find(tree, parent, name))
+		return;
+	
+	aal_memcpy(&dentry.parent, parent, sizeof(dentry.parent));
+	dentry.name = name;
+
+	if (!aal_hash_table_remove(tree->dentries, &dentry))
+		tree->dcount--;
+}
+
+/* Drops all cached entries. */
+void reiser4_semantic_flush(reiser4_tree_t *tree) {
+	aal_assert("umka-3161", tree != NULL);
+
+	if (!tree->dentries)
+		return;
+	
+	aal_hash_table_free(tree->dentries);
+	tree->dentries = NULL;
+	tree->dcount = 0;
+}
+#endif
+
+/* Looks up @name in the current directory, saves the key of found object 
+   into @key. */
+static lookup_t reiser4_semantic_lookup(resolve_t *resol, char *name,
+					reiser4_key_t *key)
+{
+	entry_hint_t entry;
+	lookup_t res;
+#ifndef ENABLE_MINIMAL
+	dentry_t *dentry;
+
+	if ((dentry = reiser4_semantic_find(resol->tree, 
+					    &resol->object->info.object,
+					    name)))
+	{
+		resol->tree->stat.dentry_hits++;
+		
+		if (!dentry->present)
+			return ABSENT;
+
+		aal_memcpy(key, &dentry->object, sizeof(*key));
+		return PRESENT;
+	}
+	
+	resol->tree->stat.dentry_misses++;
+#endif
+	
+	if ((res = plugcall(reiser4_psobj(resol->object), lookup, 
+			    resol->object, name, &entry)) < 0)
+	{
+		return res;
+	}
+
+#ifndef ENABLE_MINIMAL
+	reiser4_semantic_cache(resol->tree, &resol->object->info.object, 
+			       name, res == PRESENT ? &entry.object : NULL);
+#endif
+
+	if (res == PRESENT)
+		aal_memcpy(key, &entry.object, sizeof(*key));
+	
+	return res;
+}
+
 /* Callback function for finding statdata of the current directory */
 static errno_t cb_find_statdata(char *path, char *entry, void *data) {
 #ifdef ENABLE_SYMLINKS
@@ -71,7 +251,7 @@ static errno_t cb_find_statdata(char *path, char *entry, void *data) {
 
 /* Callback function to find @name inside the current object. */
 static errno_t cb_find_entry(char *path, char *name, void *data) {
-	entry_hint_t entry;
+	reiser4_key_t key;
 	resolve_t *resol;
 	lookup_t res;
 
@@ -85,11 +265,8 @@ static errno_t cb_find_entry(char *path, char *name, void *data) {
 	}
 	
 	/* Looking up for @entry in current directory */
-	if ((res = plugcall(reiser4_psobj(resol->object), lookup, 
-			     resol->object, name, &entry)) < 0)
-	{
+	if ((res = reiser4_semantic_lookup(resol, name, &key)) < 0)
 		return res;
-	}
 	
 	if (res != PRESENT) {
 		if (resol->present) {
@@ -109,7 +286,7 @@ static errno_t cb_find_entry(char *path, char *name, void *data) {
 	resol->parent = resol->object;
 	
 	/* Save found key. */
-	aal_memcpy(&resol->key, &entry.object, sizeof(resol->key));
+	aal_memcpy(&resol->key, &key, sizeof(resol->key));
 	
 	return 0;
 }
@@ -95,6 +95,282 @@ uint8_t reiser4_tree_get_height(reiser4_tree_t *tree) {
 	return reiser4call(tree->fs->format, get_height);
 }
 
+/* Maximal number of nodes read in advance by one request. */
+#define TREE_PREFETCH_RUN (64)
+
+/* Collects block numbers of children of @node not loaded yet into @pf. They
+   are sorted so that reiser4_tree_prefetch_read() could merge neighbour ones
+   into one read. */
+static errno_t reiser4_tree_prefetch_init(reiser4_tree_t *tree,
+					  reiser4_node_t *node,
+					  tree_prefetch_t *pf)
+{
+	reiser4_place_t place;
+	uint32_t units, i, j;
+	count_t len;
+	blk_t blk;
+
+	aal_memset(pf, 0, sizeof(*pf));
+
+	/* Counting node pointers to allocate the array at once. */
+	for (units = 0, place.pos.item = 0;
+	     place.pos.item < reiser4_node_items(node);
+	     place.pos.item++)
+	{
+		place.pos.unit = MAX_UINT32;
+
+		if (reiser4_place_open(&place, node, &place.pos))
+			break;
+
+		if (reiser4_item_branch(place.plug))
+			units += reiser4_item_units(&place);
+	}
+
+	if (!units)
+		return 0;
+
+	if (!(pf->blks = aal_malloc(units * sizeof(blk_t))))
+		return -ENOMEM;
+
+	len = aal_device_len(tree->fs->device) /
+		(reiser4_tree_get_blksize(tree) / tree->fs->device->blksize);
+
+	for (place.pos.item = 0; place.pos.item < reiser4_node_items(node);
+	     place.pos.item++)
+	{
+		place.pos.unit = MAX_UINT32;
+
+		if (reiser4_place_open(&place, node, &place.pos))
+			break;
+
+		if (!reiser4_item_branch(place.plug))
+			continue;
+
+		for (place.pos.unit = 0;
+		     place.pos.unit < reiser4_item_units(&place) &&
+		     pf->count < units; place.pos.unit++)
+		{
+			blk = reiser4_item_down_link(&place);
+
+			/* Broken pointers are left to the traverse itself. */
+			if (blk == INVAL_BLK || blk >= len ||
+			    reiser4_fake_ack(blk))
+			{
+				continue;
+			}
+
+			if (reiser4_tree_lookup_node(tree, blk))
+				continue;
+
+			/* Insertion sort, pointers of a node are mostly
+			   ordered already. */
+			for (i = pf->count; i > 0 && pf->blks[i - 1] > blk; i--)
+				pf->blks[i] = pf->blks[i - 1];
+
+			pf->blks[i] = blk;
+			pf->count++;
+		}
+	}
+
+	/* Dropping duplicates. */
+	for (i = 0, j = 0; i < pf->count; i++) {
+		if (j && pf->blks[j - 1] == pf->blks[i])
+			continue;
+
+		pf->blks[j++] = pf->blks[i];
+	}
+
+	pf->count = j;
+	return 0;
+}
+
+/* Releases blocks not taken by the traverse and the arrays of @pf. */
+static void reiser4_tree_prefetch_fini(reiser4_tree_t *tree,
+				       tree_prefetch_t *pf)
+{
+	uint32_t i;
+
+	if (tree->prefetch == pf)
+		tree->prefetch = pf->prev;
+
+	if (pf->blocks) {
+		for (i = 0; i < pf->count; i++) {
+			if (!pf->blocks[i])
+				continue;
+			
+			aal_block_free(pf->blocks[i]);
+			tree->pfcount--;
+		}
+
+		aal_free(pf->blocks);
+	}
+
+	if (pf->blks)
+		aal_free(pf->blks);
+
+	aal_memset(pf, 0, sizeof(*pf));
+}
+
+/* Reads all blocks of @pf by runs of neighbour ones. Runs which failed to be
+   read are skipped, their nodes are read one by one later and errors are
+   reported there. */
+static void reiser4_tree_prefetch_read(reiser4_tree_t *tree,
+				       tree_prefetch_t *pf)
+{
+	uint32_t blksize, factor;
+	aal_device_t *device;
+	uint32_t i, j, k;
+	char *buff;
+
+	pf->loaded = 1;
+
+	device = tree->fs->device;
+	blksize = reiser4_tree_get_blksize(tree);
+	factor = blksize / device->blksize;
+
+	if (!(pf->blocks = aal_calloc(pf->count * sizeof(aal_block_t *), 0)))
+		return;
+
+	if (!(buff = aal_malloc(TREE_PREFETCH_RUN * blksize)))
+		return;
+
+	for (i = 0; i < pf->count; i = j) {
+		for (j = i + 1; j < pf->count && j - i < TREE_PREFETCH_RUN &&
+			     pf->blks[j] == pf->blks[j - 1] + 1; j++);
+
+		if (aal_device_read(device, buff, pf->blks[i] * factor,
+				    (j - i) * factor))
+		{
+			continue;
+		}
+
+		for (k = i; k < j; k++) {
+			if (!(pf->blocks[k] = aal_block_alloc(device, blksize,
+							      pf->blks[k])))
+			{
+				break;
+			}
+
+			aal_memcpy(pf->blocks[k]->data,
+				   buff + (k - i) * blksize, blksize);
+			tree->pfcount++;
+		}
+	}
+
+	aal_free(buff);
+}
+
+/* Takes the block @blk out of prefetches on the traverse path. Reads the
+   whole prefetch it belongs to if it is not read yet. Returns NULL if @blk is
+   not prefetched. */
+static aal_block_t *reiser4_tree_prefetch_take(reiser4_tree_t *tree,
+					       blk_t blk)
+{
+	uint32_t left, right, pos;
+	tree_prefetch_t *pf;
+	aal_block_t *block;
+
+	for (pf = tree->prefetch; pf; pf = pf->prev) {
+		for (left = 0, right = pf->count; left < right; ) {
+			pos = (left + right) / 2;
+
+			if (pf->blks[pos] < blk)
+				left = pos + 1;
+			else
+				right = pos;
+		}
+
+		if (left == pf->count || pf->blks[left] != blk)
+			continue;
+
+		if (!pf->loaded)
+			reiser4_tree_prefetch_read(tree, pf);
+
+		if (!pf->blocks)
+			return NULL;
+
+		/* Once taken the block is never given out again, the node
+		   may be changed since then. */
+		if ((block = pf->blocks[left])) {
+			pf->blocks[left] = NULL;
+			tree->pfcount--;
+		}
+
+		return block;
+	}
+
+	return NULL;
+}
+
+/* Forgets blocks from @start to @start + @count in prefetches on the traverse
+   path. Called when the blocks are written or nodes for them get to the tree
+   cache, so that a copy read in advance is never given out after the block
+   has changed. Not read prefetches forget them as well, they could be read
+   before the change gets to device otherwise. */
+static void reiser4_tree_prefetch_drop(reiser4_tree_t *tree,
+				       blk_t start, count_t count)
+{
+	uint32_t left, right, pos, end;
+	tree_prefetch_t *pf;
+
+	for (pf = tree->prefetch; pf; pf = pf->prev) {
+		for (left = 0, right = pf->count; left < right; ) {
+			pos = (left + right) / 2;
+
+			if (pf->blks[pos] < start)
+				left = pos + 1;
+			else
+				right = pos;
+		}
+
+		for (end = left; end < pf->count &&
+			     pf->blks[end] < start + count; end++)
+		{
+			if (!pf->blocks || !pf->blocks[end])
+				continue;
+
+			aal_block_free(pf->blocks[end]);
+			tree->pfcount--;
+		}
+
+		if (end == left)
+			continue;
+
+		aal_memmove(pf->blks + left, pf->blks + end,
+			    (pf->count - end) * sizeof(blk_t));
+
+		if (pf->blocks) {
+			aal_memmove(pf->blocks + left, pf->blocks + end,
+				    (pf->count - end) * sizeof(aal_block_t *));
+		}
+
+		pf->count -= end - left;
+	}
+}
+
+/* Releases all blocks read in advance on memory pressure. Prefetches are not
+   read again, their nodes are read one by one if needed. */
+static void reiser4_tree_prefetch_release(reiser4_tree_t *tree) {
+	tree_prefetch_t *pf;
+	uint32_t i;
+
+	for (pf = tree->prefetch; pf; pf = pf->prev) {
+		pf->loaded = 1;
+		
+		if (!pf->blocks)
+			continue;
+
+		for (i = 0; i < pf->count; i++) {
+			if (!pf->blocks[i])
+				continue;
+
+			aal_block_free(pf->blocks[i]);
+			pf->blocks[i] = NULL;
+			tree->pfcount--;
+		}
+	}
+}
+
 /* As @node already lies in @tree->nodes hash table and it is going to change
    its block number, we have to update its hash entry in @tree->nodes. This
    function does that job and also moves @node to @new_blk location. */
@@ -111,6 +387,7 @@ errno_t reiser4_tree_rehash_node(reiser4_tree_t *tree,
 	
 	old_blk = node->block->nr;
 	reiser4_node_move(node, new_blk);
+	reiser4_tree_prefetch_drop(tree, new_blk, 1);
 
 	/* Allocating new key and assign new block number value to it. */
 	if (!(set_blk = aal_calloc(sizeof(*set_blk), 0)))
@@ -127,11 +404,62 @@ errno_t reiser4_tree_rehash_node(reiser4_tree_t *tree,
 }
 #endif
 
+/* Puts leaf @node to the head of @tree LRU list. */
+static void reiser4_tree_lru_link(reiser4_tree_t *tree,
+				  reiser4_node_t *node)
+{
+	node->lru_prev = NULL;
+	node->lru_next = tree->lru_head;
+
+	if (tree->lru_head)
+		tree->lru_head->lru_prev = node;
+	else
+		tree->lru_tail = node;
+
+	tree->lru_head = node;
+}
+
+/* Removes @node from @tree LRU list if it is there. */
+static void reiser4_tree_lru_unlink(reiser4_tree_t *tree,
+				    reiser4_node_t *node)
+{
+	if (!node->lru_prev && tree->lru_head != node)
+		return;
+
+	if (node->lru_prev)
+		node->lru_prev->lru_next = node->lru_next;
+	else
+		tree->lru_head = node->lru_next;
+
+	if (node->lru_next)
+		node->lru_next->lru_prev = node->lru_prev;
+	else
+		tree->lru_tail = node->lru_prev;
+
+	node->lru_prev = NULL;
+	node->lru_next = NULL;
+}
+
+/* Marks @node as recently used one by moving it to the head of LRU list. */
+static void reiser4_tree_lru_touch(reiser4_tree_t *tree,
+				   reiser4_node_t *node)
+{
+	if (tree->lru_head == node)
+		return;
+
+	if (!node->lru_prev)
+		return;
+
+	reiser4_tree_lru_unlink(tree, node);
+	reiser4_tree_lru_link(tree, node);
+}
+
 /* Puts @node to @tree->nodes hash table. */
 static errno_t reiser4_tree_hash_node(reiser4_tree_t *tree,
 				      reiser4_node_t *node)
 {
 	blk_t *blk;
+	errno_t res;
 
 	aal_assert("umka-3040", tree != NULL);
 	aal_assert("umka-3041", node != NULL);
@@ -143,7 +471,20 @@ static errno_t reiser4_tree_hash_node(reiser4_tree_t *tree,
 
 	*blk = node->block->nr;
 
-	return aal_hash_table_insert(tree->nodes, blk, node);
+	if ((res = aal_hash_table_insert(tree->nodes, blk, node)))
+		return res;
+
+#ifndef ENABLE_MINIMAL
+	/* The cached node is the only valid copy of the block now. */
+	reiser4_tree_prefetch_drop(tree, node->block->nr, 1);
+#endif
+
+	/* Internal and twig nodes are not put to LRU list, so they are never
+	   evicted on memory pressure and stay in cache as long as possible. */
+	if (reiser4_node_get_level(node) == LEAF_LEVEL)
+		reiser4_tree_lru_link(tree, node);
+
+	return 0;
 }
 
 /* Removes @node from @tree->nodes hash table. Used when nodeis going to be
@@ -156,6 +497,8 @@ static errno_t reiser4_tree_unhash_node(reiser4_tree_t *tree,
 	aal_assert("umka-3046", tree != NULL);
 	aal_assert("umka-3047", node != NULL);
 
+	reiser4_tree_lru_unlink(tree, node);
+	
 	blk = node->block->nr;
 	return aal_hash_table_remove(tree->nodes, &blk);
 }
@@ -377,24 +720,6 @@ errno_t reiser4_tree_assign_root(reiser4_tree_t *tree,
 }
 #endif
 
-errno_t reiser4_tree_mpressure(reiser4_tree_t *tree) {
-	errno_t res;
-	
-	/* Check for memory pressure event. If memory pressure is uppon us, we
-	   call memory cleaning function. For now we call tree_adjust() in order
-	   to release not locked nodes. */
-	if (!tree->mpc_func || !tree->mpc_func(tree))
-		return 0;
-
-	/* Adjusting the tree as memory pressure is here. */
-	if ((res = reiser4_tree_adjust(tree))) {
-		aal_error("Can't adjust tree.");
-		return res;
-	}
-
-	return 0;
-}
-
 /* Registers passed node in tree and connects left and right neighbour
    nodes. This function does not do any tree modifications. */
 errno_t reiser4_tree_connect_node(reiser4_tree_t *tree,
@@ -554,15 +879,31 @@ reiser4_node_t *reiser4_tree_load_node(reiser4_tree_t *tree,
 				       reiser4_node_t *parent, blk_t blk)
 {
 	reiser4_node_t *node = NULL;
+#ifndef ENABLE_MINIMAL
+	aal_block_t *block;
+#endif
 
 	aal_assert("umka-1289", tree != NULL);
 
 	/* Checking if node in the local cache of @parent. */
-	if (!(node = reiser4_tree_lookup_node(tree, blk))) {
+	if ((node = reiser4_tree_lookup_node(tree, blk))) {
+		tree->stat.hits++;
+		reiser4_tree_lru_touch(tree, node);
+	} else {
 		aal_assert("umka-3004", !reiser4_fake_ack(blk));
 
+		tree->stat.misses++;
+
 		/* Node is not loaded yet. Loading it and connecting to @parent
 		   node cache. */
+#ifndef ENABLE_MINIMAL
+		if ((block = reiser4_tree_prefetch_take(tree, blk))) {
+			tree->stat.prefetched++;
+
+			if (!(node = reiser4_node_open_block(tree, block)))
+				return NULL;
+		} else
+#endif
 		if (!(node = reiser4_node_open(tree, blk)))
 			return NULL;
 
@@ -1040,6 +1381,9 @@ errno_t reiser4_tree_root_key(reiser4_tree_t *tree,
 #endif
 #define TREE_BLOCKS_TABLE_SIZE (512)
 
+/* Maximal number of extent data blocks written by one request. */
+#define TREE_FLUSH_RUN (256)
+
 /* Initializes tree instance on passed filesystem and return it to caller. Then
    it may be used for modifying tree, making lookup, etc. */
 reiser4_tree_t *reiser4_tree_init(reiser4_fs_t *fs) {
@@ -1125,9 +1469,10 @@ void reiser4_tree_close(reiser4_tree_t *tree) {
 	/* Close all remaining nodes. */
 	reiser4_tree_collapse(tree);
 
-	/* Releasing unformatted nodes hash table. */
+	/* Releasing unformatted nodes hash table and cached entries. */
 #ifndef ENABLE_MINIMAL
 	aal_hash_table_free(tree->blocks);
+	reiser4_semantic_flush(tree);
 #endif
 
 	/* Releasing fomatted nodes hash table. */
@@ -1138,27 +1483,107 @@ void reiser4_tree_close(reiser4_tree_t *tree) {
 	aal_free(tree);
 }
 #ifndef ENABLE_MINIMAL
-#if 0
 static errno_t cb_flags_dup(reiser4_place_t *place, void *data) {
 	reiser4_item_dup_flags(place, *(uint16_t *)data);
 	return 0;
 }
 
-/* Allocates extent item at passed @place. */
+/* Saves cached data blocks of extent unit part starting at @key to just
+   allocated @start. Blocks are written by runs of TREE_FLUSH_RUN blocks and
+   released from the cache. */
+static errno_t reiser4_tree_write_extent(reiser4_tree_t *tree,
+					 reiser4_key_t *key,
+					 blk_t start, count_t width)
+{
+	aal_block_t *block;
+	uint64_t offset;
+	uint32_t blksize;
+	uint32_t factor;
+	count_t done;
+	uint32_t i;
+	uint32_t run;
+	errno_t res;
+	char *buff;
+
+	blksize = reiser4_tree_get_blksize(tree);
+	factor = blksize / tree->fs->device->blksize;
+	offset = objcall(key, get_offset);
+
+	run = width < TREE_FLUSH_RUN ? width : TREE_FLUSH_RUN;
+	
+	if (!(buff = aal_malloc(run * blksize)))
+		return -ENOMEM;
+	
+	for (done = 0, res = 0; done < width; done += run) {
+		if (width - done < run)
+			run = width - done;
+
+		for (i = 0; i < run; i++) {
+			objcall(key, set_offset, offset + 
+				(done + i) * blksize);
+
+			/* Getting data block by @key */
+			if (!(block = aal_hash_table_lookup(tree->blocks, key))) {
+				aal_error("Unallocated extent unit without "
+					  "attached block detected.");
+				res = -EINVAL;
+				goto error_free_buff;
+			}
+
+			aal_memcpy(buff + i * blksize, block->data, blksize);
+		}
+
+		if ((res = aal_device_write(tree->fs->device, buff, 
+					    (start + done) * factor,
+					    run * factor)))
+		{
+			aal_error("Can't write blocks %llu-%llu.",
+				  (unsigned long long)(start + done),
+				  (unsigned long long)(start + done + 
+						       run - 1));
+			goto error_free_buff;
+		}
+
+		reiser4_tree_prefetch_drop(tree, start + done, run);
+
+		/* Releasing saved blocks from the cache. */
+		for (i = 0; i < run; i++) {
+			objcall(key, set_offset, offset + 
+				(done + i) * blksize);
+			aal_hash_table_remove(tree->blocks, key);
+		}
+	}
+
+ error_free_buff:
+	/* Leaving @key at the block next to the saved ones. */
+	objcall(key, set_offset, offset + width * blksize);
+	aal_free(buff);
+	return res;
+}
+
+/* Allocates unallocated units of extent item at passed @place and saves their
+   data blocks. Blocks are searched starting from @near, that is next to the
+   last met allocated unit, so file data goes together on device. If @split is
+   set and the whole unit cannot be allocated at once, allocated part updates
+   the unit and the rest is inserted as a new unallocated unit after it. As
+   balancing may move units to another node then, 1 is returned and the caller
+   should look the item up again. If @split is not set, the tree is not changed
+   and 1 is returned for the unit which cannot be allocated at once. */
 static errno_t reiser4_tree_alloc_extent(reiser4_tree_t *tree,
-					 reiser4_place_t *place)
+					 reiser4_place_t *place,
+					 blk_t *near, int split)
 {
 	errno_t res;
 	uint32_t units;
 	uint16_t flags;
 	ptr_hint_t ptr;
-	uint32_t blksize;
 	trans_hint_t hint;
 
 	units = reiser4_item_units(place);
-	blksize = reiser4_tree_get_blksize(tree);
 
 	/* Prepare @hint. */
+	aal_memset(&hint, 0, sizeof(hint));
+	
 	hint.count = 1;
 	hint.specific = &ptr;
 	hint.plug = place->plug;
@@ -1174,114 +1599,142 @@ static errno_t reiser4_tree_alloc_extent(reiser4_tree_t *tree,
 	for (place->pos.unit = 0; place->pos.unit < units;
 	     place->pos.unit++)
 	{
-		uint64_t width;
-		uint64_t blocks;
-		uint64_t offset;
-		
+		reiser4_place_t iplace;
 		reiser4_key_t key;
-		int first_time = 1;
-
+		count_t width;
 
 		if (objcall(place, object->fetch_units, &hint) != 1)
 			return -EIO;
 
+		if (ptr.start == EXTENT_HOLE_UNIT)
+			continue;
+		
 		/* Check if we have accessed unallocated extent. */
-		if (ptr.start != EXTENT_UNALLOC_UNIT)
+		if (ptr.start != EXTENT_UNALLOC_UNIT) {
+			*near = ptr.start + ptr.width;
 			continue;
+		}
 
-		/* Getting unit key. */
-		objcall(place, balance->fetch_key, &key);
-
-		/* Loop until all units get allocated. */
-		for (blocks = 0, width = ptr.width; width > 0; width -= ptr.width) {
-			blk_t blk;
-			uint32_t i;
-			aal_block_t *block;
-			
-			/* Trying to allocate @ptr.width blocks. */
-			if (!(ptr.width = reiser4_alloc_allocate(tree->fs->alloc,
-								 &ptr.start, width)))
-			{
-				return -ENOSPC;
-			}
-
-			if (first_time) {
-				flags = reiser4_item_get_flags(place);
-
-				/* Updating extent unit at @place->pos.unit. */
-				if (objcall(place, object->update_units, 
-					    &hint) != 1)
-				{
-					return -EIO;
-				}
-
-				first_time = 0;
-			} else {
-				errno_t res;
-				uint32_t level;
-				reiser4_place_t iplace;
-
-				iplace = *place;
-				iplace.pos.unit++;
+		width = ptr.width;
+		ptr.start = *near;
+		
+		/* Trying to allocate @width blocks. */
+		if (!(ptr.width = reiser4_alloc_allocate_near(tree->fs->alloc,
+							      &ptr.start,
+							      width)))
+		{
+			return -ENOSPC;
+		}
 
-				/* Insert new extent units. */
-				aal_memcpy(&hint.offset, &key, sizeof(key));
-				level = reiser4_node_get_level(iplace.node);
-				
-				if ((res = reiser4_tree_insert(tree, &iplace,
-							       &hint, level)) < 0)
-				{
-					return res;
-				}
+		if (ptr.width < width && !split) {
+			reiser4_alloc_release(tree->fs->alloc, ptr.start,
+					      ptr.width);
+			return 1;
+		}
 
-                                /* Updating @place by insert point, as it might
-				   be moved due to balancing. */
-				aal_memcpy(place, &iplace, sizeof(iplace));
+		/* Moving data blocks to right places, saving them and
+		   releasing from the cache. */
+		objcall(place, balance->fetch_key, &key);
 
-				/* Updating @units as it might be changed after
-				   balancing during tree_insert(). */
-				units = reiser4_item_units(place);
-			}
+		if ((res = reiser4_tree_write_extent(tree, &key, ptr.start,
+						     ptr.width)))
+		{
+			return res;
+		}
 
-			/* Moving data blocks to right places, saving them and
-			   releasing from the cache. */
-			for (blk = ptr.start, i = 0; i < ptr.width; i++, blk++) {
-				/* Getting data block by @key */
-				block = aal_hash_table_lookup(tree->blocks, &key);
-				aal_assert("umka-2469", block != NULL);
+		*near = ptr.start + ptr.width;
+		
+		/* Updating extent unit at @place->pos.unit. */
+		if (objcall(place, object->update_units, &hint) != 1)
+			return -EIO;
 
-				/* Moving block tro @blk */
-				aal_block_move(block, tree->fs->device, blk);
+		if (ptr.width == width)
+			continue;
 
-				/* Saving block to device. */
-				if ((res = aal_block_write(block))) {
-					aal_error("Can't write block "
-						  "%llu.", block->nr);
-					return res;
-				}
+		/* Inserting the rest of the unit as unallocated one. @key
+		   points to its first block already. */
+		ptr.start = EXTENT_UNALLOC_UNIT;
+		ptr.width = width - ptr.width;
 
-				/* Releasing cache entry. */
-				aal_hash_table_remove(tree->blocks, &key);
+		flags = reiser4_item_get_flags(place);
+		aal_memcpy(&hint.offset, &key, sizeof(key));
 
-				/* Updating the key to find next data block */
-				offset = objcall(&key, get_offset);
+		iplace = *place;
+		iplace.pos.unit++;
 
-				objcall(&key, set_offset, offset + blksize);
-			}
-			
-			blocks += ptr.width;
+		if ((res = reiser4_tree_insert(tree, &iplace, &hint,
+					       reiser4_node_get_level(
+						       iplace.node))) < 0)
+		{
+			return res;
 		}
+
+		return 1;
 	}
 
 	return 0;
 }
-#endif /* 0 */
 
-static errno_t cb_node_adjust(reiser4_tree_t *tree, reiser4_node_t *node) {
-	errno_t res;
+/* Allocates unallocated extent item at @place. */
+static errno_t cb_nodeptr_adjust(reiser4_tree_t *tree, reiser4_place_t *place,
+				 blk_t *near, int split)
+{
+	/* It is not good, that we reference here to particular item group. But,
+	   we have to do so, considering, that this is up to tree to know about
+	   items type in it. Probably this is why tree should be plugin too to
+	   handle things like this in more flexible manner. */
+	if (place->plug->p.id.group != EXTENT_ITEM) 
+		return 0;
 	
-	aal_assert("umka-2302", tree != NULL);
-	aal_assert("umka-2303", node != NULL);
+	/* Allocating unallocated extent item at @place. */
+	return reiser4_tree_alloc_extent(tree, place, near, split);
+}
+
+/* Allocates extent items of @node. Returns 1 if some extent unit is left
+   unallocated or the tree is changed. See tree_alloc_extent() for details. */
+static errno_t reiser4_tree_alloc_extents(reiser4_tree_t *tree,
+					  reiser4_node_t *node,
+					  blk_t *near, int split)
+{
+	reiser4_place_t place;
+	errno_t res;
+	uint32_t i;
+
+	for (i = 0; i < reiser4_node_items(node); i++) {
+		reiser4_place_assign(&place, node, i, MAX_UINT32);
+
+		if ((res = reiser4_place_fetch(&place)))
+			return res;
+		
+		if ((res = cb_nodeptr_adjust(tree, &place, near, split)))
+			return res;
+	}
+
+	return 0;
+}
+
+/* Assigns real block number @blk to fake allocated @node. Updates the tree
+   root or the nodeptr in the parent node and rehashes @node. */
+static errno_t reiser4_tree_assign_node(reiser4_tree_t *tree,
+					reiser4_node_t *node, blk_t blk)
+{
+	errno_t res;
+	
+	if (reiser4_tree_root_node(tree, node))
+		reiser4_tree_set_root(tree, blk);
+		
+	if (node->p.node) {
+		if ((res = reiser4_item_update_link(&node->p, blk)))
+			return res;
+	}
+		
+	/* Rehashing node in @tree->nodes hash table. */
+	return reiser4_tree_rehash_node(tree, node, blk);
+}
+
+static errno_t cb_node_adjust(reiser4_tree_t *tree, reiser4_node_t *node) {
+	aal_assert("umka-2302", tree != NULL);
+	aal_assert("umka-2303", node != NULL);
 	aal_assert("umka-3075", reiser4_node_items(node) > 0);
 
 	/* Requesting block allocator to allocate the real block number
@@ -1292,36 +1745,12 @@ static errno_t cb_node_adjust(reiser4_tree_t *tree, reiser4_node_t *node) {
 		if (!reiser4_alloc_allocate(tree->fs->alloc, &blk, 1))
 			return -ENOSPC;
 
-		if (reiser4_tree_root_node(tree, node))
-			reiser4_tree_set_root(tree, blk);
-		
-		if (node->p.node) {
-			if ((res = reiser4_item_update_link(&node->p, blk)))
-				return res;
-		}
-		
-		/* Rehashing node in @tree->nodes hash table. */
-		reiser4_tree_rehash_node(tree, node, blk);
+		return reiser4_tree_assign_node(tree, node, blk);
 	}
 
 	return 0;
 }
 
-#if 0
-/* Runs through the node in @place and calls tree_adjust_node() for all
-   children. */
-static errno_t cb_nodeptr_adjust(reiser4_tree_t *tree, reiser4_place_t *place) {
-	/* It is not good, that we reference here to particular item group. But,
-	   we have to do so, considering, that this is up to tree to know about
-	   items type in it. Probably this is why tree should be plugin too to
-	   handle things like this in more flexible manner. */
-	if (place->plug->p.id.group != EXTENT_ITEM) 
-		return 0;
-	
-	/* Allocating unallocated extent item at @place. */
-	return reiser4_tree_alloc_extent(tree, place);
-}
-#endif /* 0 */
 #endif
 
 static errno_t cb_node_unload(reiser4_tree_t *tree, reiser4_node_t *node) {
@@ -1332,6 +1761,18 @@ static errno_t cb_node_unload(reiser4_tree_t *tree, reiser4_node_t *node) {
 		return 0;
 	
 #ifndef ENABLE_MINIMAL
+	{
+		blk_t near = 0;
+		errno_t res;
+
+		/* Allocating extent units in place. Node with units which
+		   cannot be allocated without changing the tree is kept in
+		   the cache, as their data blocks have no location on device
+		   yet. They are allocated on tree_sync(). */
+		if ((res = reiser4_tree_alloc_extents(tree, node, &near, 0)))
+			return res < 0 ? res : 0;
+	}
+	
 	/* Okay, node is fully allocated now and ready to be saved to device if
 	   it is dirty. */
 	if (reiser4_node_isdirty(node) && reiser4_node_sync(node)) {
@@ -1345,6 +1786,168 @@ static errno_t cb_node_unload(reiser4_tree_t *tree, reiser4_node_t *node) {
 }
 
 
+/* Evicts the coldest not locked leaf from the tree cache. Dirty leaf is
+   allocated and saved before it gets unloaded. Returns 1 if some leaf was
+   evicted, 0 if there is nothing to evict and negative value for errors. */
+static int reiser4_tree_evict(reiser4_tree_t *tree) {
+	reiser4_node_t *node;
+	errno_t res;
+
+	for (node = tree->lru_tail; node; node = node->lru_prev) {
+		/* Leaf which is used by someone or is empty and waits for its
+		   release cannot be evicted. */
+		if (reiser4_node_locked(node) || tree->root == node ||
+		    !reiser4_node_items(node))
+		{
+			continue;
+		}
+
+#ifndef ENABLE_MINIMAL
+		{
+			blk_t near = 0;
+
+			/* Leaf with extent units which cannot be allocated in
+			   place cannot be evicted. */
+			if ((res = reiser4_tree_alloc_extents(tree, node,
+							      &near, 0)) < 0)
+			{
+				return res;
+			}
+
+			if (res > 0)
+				continue;
+		}
+		
+		if ((res = cb_node_adjust(tree, node)))
+			return res;
+#endif
+		if ((res = cb_node_unload(tree, node)))
+			return res;
+
+		tree->stat.evicts++;
+		return 1;
+	}
+
+	return 0;
+}
+
+#ifndef ENABLE_MINIMAL
+/* Helper function for collecting extent data blocks which may be dropped from
+   the tree cache. Dirty blocks are saved first. Blocks of not yet allocated
+   extents have no location on device and stay in cache until allocated. */
+static errno_t cb_evict_block(void *entry, void *data) {
+	aal_hash_node_t *node = (aal_hash_node_t *)entry;
+	aal_block_t *block = (aal_block_t *)node->value;
+	aal_list_t **list = (aal_list_t **)data;
+
+	if (!block->nr)
+		return 0;
+	
+	if (block->dirty) {
+		errno_t res;
+		
+		if ((res = aal_block_write(block)))
+			return res;
+
+		block->dirty = 0;
+	}
+
+	*list = aal_list_prepend(*list, node->key);
+	return 0;
+}
+
+/* Drops all allocated extent data blocks from the tree cache. Data blocks are
+   usually read or written once, so there is no point to keep them in LRU
+   order like leaves. */
+static errno_t reiser4_tree_evict_blocks(reiser4_tree_t *tree) {
+	aal_list_t *list = NULL;
+	aal_block_t *block;
+	aal_list_t *walk;
+	errno_t res;
+
+	res = aal_hash_table_foreach(tree->blocks, cb_evict_block, &list);
+
+	/* Removing collected blocks even if some dirty block failed to be
+	   written, as all collected ones are clean already. */
+	aal_list_foreach_forward(list, walk) {
+		block = aal_hash_table_lookup(tree->blocks, walk->data);
+		reiser4_tree_prefetch_drop(tree, block->nr, 1);
+		
+		aal_hash_table_remove(tree->blocks, walk->data);
+	}
+
+	aal_list_free(list, NULL, NULL);
+	return res;
+}
+#endif
+
+errno_t reiser4_tree_mpressure(reiser4_tree_t *tree) {
+	errno_t res = 0;
+	uint32_t evicted;
+	int mp;
+	
+	/* Check for memory pressure event. If memory pressure is uppon us, we
+	   evict cold leaves from the tree cache one by one until the pressure
+	   goes away. Nodes and extent data blocks have separate limits. */
+	if (!tree->mpc_func || !(mp = tree->mpc_func(tree)))
+		return 0;
+
+	if (tree->adjusting)
+		return 0;
+
+#ifndef ENABLE_MINIMAL
+	if (mp & MP_BLOCKS) {
+		if ((res = reiser4_tree_evict_blocks(tree))) {
+			aal_error("Can't evict extent data blocks from "
+				  "the tree cache.");
+			return res;
+		}
+
+		mp = tree->mpc_func(tree);
+	}
+#endif
+
+	if (!(mp & MP_NODES))
+		return 0;
+
+#ifndef ENABLE_MINIMAL
+	/* Blocks read in advance are cheaper to lose than cached nodes. */
+	if (tree->pfcount) {
+		reiser4_tree_prefetch_release(tree);
+
+		if (!(tree->mpc_func(tree) & MP_NODES))
+			return 0;
+	}
+#endif
+
+	tree->adjusting = 1;
+	
+	for (evicted = 0; tree->mpc_func(tree) & MP_NODES; evicted++) {
+		if ((res = reiser4_tree_evict(tree)) <= 0)
+			break;
+	}
+	
+	tree->adjusting = 0;
+
+	if (res < 0) {
+		aal_error("Can't evict node from the tree cache.");
+		return res;
+	}
+
+	if (evicted)
+		return 0;
+
+	/* There are no leaves to be evicted, so the cache is filled by locked
+	   or internal nodes. Adjusting the whole tree then in order to release
+	   all not locked nodes. */
+	if ((res = reiser4_tree_adjust(tree))) {
+		aal_error("Can't adjust tree.");
+		return res;
+	}
+
+	return 0;
+}
+
 /* Entry point for adjsuting tree routines. */
 errno_t reiser4_tree_adjust(reiser4_tree_t *tree) {
 	aal_assert("umka-3034", tree != NULL);
@@ -1447,23 +2050,6 @@ errno_t reiser4_tree_walk_node(reiser4_tree_t *tree,
 }
 
 #ifndef ENABLE_MINIMAL
-/* Helper function for save one unformatted block to device. Used from
-   tree_sync() to save all in-memory unfromatted blocks. */
-static errno_t cb_save_block( void *entry, void *data) {
-	aal_hash_node_t *node = (aal_hash_node_t *)entry;
-	aal_block_t *block = (aal_block_t *)node->value;
-
-	/* Save block if it is dirty. */
-	if (block->dirty) {
-		errno_t res;
-		
-		if ((res = aal_block_write(block)))
-			return res;
-	}
-
-	return 0;
-}
-
 /* Packs one level at passed @node. Moves all items and units from right node
    to left neighbour node and so on until rightmost node is reached. */
 static errno_t reiser4_tree_compress_level(reiser4_tree_t *tree,
@@ -1586,1748 +2172,2958 @@ errno_t reiser4_tree_compress(reiser4_tree_t *tree) {
 	return 0;
 }
 
-/* Saves all dirty nodes in tree to device tree lies on. */
-errno_t reiser4_tree_sync(reiser4_tree_t *tree) {
-	errno_t res;
+/* Flush planner state. It is an array of nodes or data blocks to be saved. */
+typedef struct tree_flush {
+	void **items;
+	uint32_t count;
+	uint32_t size;
+} tree_flush_t;
+
+typedef blk_t (*flush_nr_func_t) (void *);
+
+static blk_t cb_flush_node_nr(void *item) {
+	return ((reiser4_node_t *)item)->block->nr;
+}
+
+static blk_t cb_flush_block_nr(void *item) {
+	return ((aal_block_t *)item)->nr;
+}
+
+static errno_t reiser4_tree_flush_add(tree_flush_t *flush, void *item) {
+	void **items;
+	uint32_t size;
 	
-	aal_assert("umka-2259", tree != NULL);
+	if (flush->count == flush->size) {
+		size = flush->size ? flush->size * 2 : TREE_FLUSH_RUN;
+		
+		if (!(items = aal_malloc(size * sizeof(void *))))
+			return -ENOMEM;
 
-	if (!tree->root)
-		return 0;
+		if (flush->items) {
+			aal_memcpy(items, flush->items,
+				   flush->count * sizeof(void *));
+			aal_free(flush->items);
+		}
 
-	/* Flushing formatted nodes starting from root node with memory pressure
-	   flag set to 0, that is do not check memory presure, and save
-	   everything. */
-	if ((res = reiser4_tree_walk_node(tree, tree->root, 
-					  cb_node_adjust,
-					  NULL,
-					  cb_node_unload)))
-	{
-		aal_error("Can't save formatted nodes to device.");
-		return res;
+		flush->items = items;
+		flush->size = size;
 	}
 
-	/* Flushing unformatted blocks (extents data) attached to @tree->data
-	   hash table. */
-	if ((res = aal_hash_table_foreach(tree->blocks, cb_save_block, tree))) {
-		aal_error("Can't save unformatted nodes to device.");
-		return res;
-	}
-	
-	return res;
+	flush->items[flush->count++] = item;
+	return 0;
 }
 
-/* Correct passed @place according to handle key collisions. */
-lookup_t reiser4_tree_collision(reiser4_tree_t *tree, 
-				reiser4_place_t *place,
-				coll_hint_t *hint)
+static void reiser4_tree_flush_fini(tree_flush_t *flush) {
+	if (flush->items)
+		aal_free(flush->items);
+
+	aal_memset(flush, 0, sizeof(*flush));
+}
+
+/* Sorts collected items by block numbers they are lie at. */
+static errno_t reiser4_tree_flush_sort(tree_flush_t *flush,
+				       flush_nr_func_t nr_func)
 {
-	uint32_t adjust = 0;
-	uint32_t units, unit;
-	lookup_t lookup = PRESENT;
+	uint32_t width, i, k, l, r, lend, rend;
+	void **src, **dst, **tmp;
+	void **buff;
 
-	aal_assert("umka-3130", tree != NULL);
-	aal_assert("vpf-1522", place != NULL);
-	
-	if (hint == NULL)
-		return PRESENT;
-	
-	/* If type does not match, there is no collision found. */
-	if (place->plug->p.id.group != hint->type)
-		return PRESENT;
+	if (flush->count < 2)
+		return 0;
 
-	/* Key collisions handling. Sequentional search by name. */	
-	while (1) {
-		units = reiser4_item_units(place);
+	if (!(buff = aal_malloc(flush->count * sizeof(void *))))
+		return -ENOMEM;
 
-		if (place->pos.unit != MAX_UINT32 && place->pos.unit >= units) {
-			reiser4_place_t temp;
-			
-			/* Getting next item. */
-			if ((reiser4_tree_next_place(tree, place, &temp)))
-				return -EIO;
-			
-			/* Directory is over? */
-			if (!temp.node || !plug_equal(place->plug, temp.plug)) {
-				place->key.adjust = adjust;
-				return ABSENT;
+	src = flush->items;
+	dst = buff;
+
+	/* Bottom-up merge sort. */
+	for (width = 1; width < flush->count; width *= 2) {
+		for (i = 0; i < flush->count; i += 2 * width) {
+			lend = (i + width < flush->count) ?
+				i + width : flush->count;
+			rend = (lend + width < flush->count) ?
+				lend + width : flush->count;
+
+			for (k = l = i, r = lend; l < lend && r < rend; k++) {
+				if (nr_func(src[r]) < nr_func(src[l]))
+					dst[k] = src[r++];
+				else
+					dst[k] = src[l++];
 			}
 
-			aal_memcpy(place, &temp, sizeof(*place));
+			while (l < lend)
+				dst[k++] = src[l++];
+			
+			while (r < rend)
+				dst[k++] = src[r++];
 		}
-		
-		unit = place->pos.unit == MAX_UINT32 ? 0 : place->pos.unit;
-		
-		if ((lookup = reiser4_item_collision(place, hint)) < 0)
-			return lookup;
-		
-		adjust += place->pos.unit - unit;
 
-		if (place->pos.unit < units)
-			break;
+		tmp = src;
+		src = dst;
+		dst = tmp;
 	}
-	
-	place->key.adjust = adjust;
-	
-	return PRESENT;
+
+	if (src != flush->items) {
+		aal_memcpy(flush->items, src,
+			   flush->count * sizeof(void *));
+	}
+
+	aal_free(buff);
+	return 0;
 }
 
-/* Makes search of the leftmost item/unit with the same key as passed @key is
-   starting from @place. This is needed to work with key collisions. */
-static errno_t reiser4_tree_collision_start(reiser4_tree_t *tree,
-					    reiser4_place_t *place,
-					    reiser4_key_t *key)
+/* Collects @node and all its loaded children into @flush. Children are visited
+   from left to right, so nodes of each level go in key order. */
+static errno_t reiser4_tree_flush_collect(reiser4_tree_t *tree,
+					  reiser4_node_t *node,
+					  tree_flush_t *flush)
 {
-        reiser4_place_t walk;
-                                                                                     
-        aal_assert("umka-2396", key != NULL);
-        aal_assert("umka-2388", tree != NULL);
-        aal_assert("umka-2389", place != NULL);
-                                                                                     
-        if (reiser4_place_fetch(place))
-                return -EINVAL;
-	
-        aal_memcpy(&walk, place, sizeof(*place));
-                                                                                     
-        /* Main loop until leftmost node reached. */
-        while (walk.node) {
-                int32_t i;
-                                                                                     
-                /* Loop through the items of the current node */
-                for (i = walk.pos.item - 1; i >= 0; i--) {
-                        walk.pos.item = i;
-                                                                                     
-                        /* Fetching item info */
-                        if (reiser4_place_fetch(&walk))
-                                return -EINVAL;
-                                                                                     
-                        /* If items of different objects, get out here. */
-                        if (reiser4_key_compshort(&walk.key, key))
-                                return 0;
-                        
-			/* If the maxreal key does not match anymore, 
-			   get out here. This clause is needed for the case 
-			   of corruption when not directory item has a NAME 
-			   minor. */
-			if (walk.plug->balance->maxposs_key) {
-				reiser4_key_t maxkey;
+	reiser4_place_t place;
+	reiser4_node_t *child;
+	uint32_t i, j;
+	errno_t res;
+	
+	if ((res = reiser4_tree_flush_add(flush, node)))
+		return res;
+	
+	for (i = 0; i < reiser4_node_items(node); i++) {
+		reiser4_place_assign(&place, node, i, MAX_UINT32);
 
-				reiser4_item_maxposs_key(&walk, &maxkey);
-				
-				if (reiser4_key_compfull(&maxkey, key) < 0)
-					return 0;
-			}
+		if ((res = reiser4_place_fetch(&place)))
+			return res;
+
+		if (!reiser4_item_branch(place.plug))
+			continue;
+
+		for (j = 0; j < reiser4_item_units(&place); j++) {
+			place.pos.unit = j;
 			
-                        /* If item's lookup is implemented, we use it. Item key
-                           comparing is used otherwise. */
-                        if (walk.plug->balance->lookup) {
-				lookup_hint_t lhint;
+			child = reiser4_tree_lookup_node(tree,
+				reiser4_item_down_link(&place));
 
-				lhint.key = key;
-				
-                                switch (objcall(&walk, balance->lookup, 
-						&lhint, FIND_EXACT))
-                                {
-                                case PRESENT:
-                                        aal_memcpy(place, &walk, sizeof(*place));
-                                        break;
-                                default:
-                                        return 0;
-                                }
-                        } else if (!reiser4_key_compfull(&walk.key, key)) {
-				aal_memcpy(place, &walk, sizeof(*place));
-                        } else {
-				return 0;
-                        }
-                }
-                                                                                     
-                /* Getting left neighbour node. */
-                reiser4_node_lock(place->node);
-                reiser4_tree_ltrt_node(tree, walk.node, DIR_LEFT);
-                reiser4_node_unlock(place->node);
-                                                                                     
-                /* Initializing @walk by neighbour node and last item. */
-                if ((walk.node = walk.node->left)) {
-                        int32_t items = reiser4_node_items(walk.node);
-                                                                                     
-                        /* Here should be namely @items, not @items - 1, because
-                           we will access @walk.item - 1 on the next cycle */
-                        POS_INIT(&walk.pos, items, MAX_UINT32);
-                }
-        }
-                                                                                     
-        return 0;
-}
-#endif
+			if (!child)
+				continue;
 
-#define restore_and_exit(res) \
-	do {hint->key = saved; return res;} while (0)
+			if ((res = reiser4_tree_flush_collect(tree, child,
+							      flush)))
+			{
+				return res;
+			}
+		}
+	}
 
-/* Makes search in the tree by specified @key. Fills passed place by data of
-   found item. That is body pointer, plugin, etc. */
-lookup_t reiser4_tree_lookup(reiser4_tree_t *tree, lookup_hint_t *hint,
-			     lookup_bias_t bias, reiser4_place_t *place)
+	return 0;
+}
+
+/* Allocates real blocks for fake allocated nodes collected in @flush. This is
+   done level by level from the root to leaves. Fake nodes of each level get
+   contiguous runs of blocks in key order, so they lie together on device and
+   parents are allocated before their children. */
+static errno_t reiser4_tree_flush_alloc(reiser4_tree_t *tree,
+					tree_flush_t *flush)
 {
-	lookup_t res;
-	reiser4_key_t *saved;
-	reiser4_key_t wanted;
+	reiser4_node_t *node;
+	uint32_t i, fakes;
+	count_t width;
+	uint8_t level;
+	errno_t res;
+	blk_t blk;
+	
+	for (level = reiser4_tree_get_height(tree);
+	     level >= LEAF_LEVEL; level--)
+	{
+		for (i = 0, fakes = 0; i < flush->count; i++) {
+			node = (reiser4_node_t *)flush->items[i];
+			
+			if (reiser4_node_get_level(node) == level &&
+			    reiser4_fake_ack(node->block->nr))
+			{
+				fakes++;
+			}
+		}
 
-	aal_assert("umka-742", hint != NULL);
-	aal_assert("umka-1760", tree != NULL);
-	aal_assert("umka-2057", place != NULL);
-	aal_assert("umka-3088", hint->key != NULL);
+		for (i = 0, width = 0; fakes > 0; i++) {
+			node = (reiser4_node_t *)flush->items[i];
 
-	/* We store @key in @wanted. All consequence code will use @wan. This is
-	   needed, because @key might point to @place->key in @place and will be
-	   corrupted during lookup. */
-	aal_memcpy(&wanted, hint->key, sizeof(wanted));
+			if (reiser4_node_get_level(node) != level ||
+			    !reiser4_fake_ack(node->block->nr))
+			{
+				continue;
+			}
 
-	/* Setting hint->key to stored local key in order to keep not corrupted
-	   if it points to @place->key and will be chnaged after @place is
-	   modified. It will be restored after lookup is finished. */
-	saved = hint->key;
-	hint->key = &wanted;
+			aal_assert("umka-3140", reiser4_node_items(node) > 0);
+			
+			/* Allocating the run for all remaining fake nodes of
+			   the level, allocator may give less. */
+			if (!width && !(width = reiser4_alloc_allocate(
+						tree->fs->alloc, &blk, fakes)))
+			{
+				return -ENOSPC;
+			}
 
-	/* Zeroing place just of rcase it was not initialized before to prevent
-	   having some garbage in it. */
-	aal_memset(place, 0, sizeof(*place));
+			if ((res = reiser4_tree_assign_node(tree, node, blk)))
+				return res;
 
-#ifndef ENABLE_MINIMAL
-	/* Making sure that root exists. If not, getting out with @place
-	   initialized by NULL root. */
-	if (reiser4_tree_fresh(tree)) {
-		reiser4_place_assign(place, NULL, 0, MAX_UINT32);
-		return ABSENT;
-	} else {
-#endif
-		if ((res = reiser4_tree_load_root(tree)) < 0)
-			return res;
-		
-		reiser4_place_assign(place, tree->root, 0, MAX_UINT32);
-#ifndef ENABLE_MINIMAL
+			blk++;
+			width--;
+			fakes--;
+		}
 	}
-#endif
 
-	while (1) {
-		uint32_t clevel;
-		lookup_bias_t cbias;
-		blk_t blk;
+	return 0;
+}
 
-		clevel = reiser4_node_get_level(place->node);
-		cbias = (clevel > hint->level ? FIND_EXACT : bias);
-		
-		/* Looking up for key inside node. Result of lookuping will be
-		   stored in &place->pos. */
-		res = reiser4_node_lookup(place->node, hint,
-					  cbias, &place->pos);
+/* Saves dirty nodes collected in @flush. Nodes are sorted by their block
+   numbers and runs of adjacent nodes are written by one request. Node plugin
+   updates the node block before, checksum for instance. */
+static errno_t reiser4_tree_flush_nodes(reiser4_tree_t *tree,
+					tree_flush_t *flush)
+{
+	reiser4_node_t **nodes;
+	uint32_t i, j, run;
+	uint32_t blksize;
+	uint32_t factor;
+	errno_t res;
+	char *buff;
 
-		/* Check if we should finish lookup because we reach stop level
-		   or some error occurred during last node lookup. */
-		if (clevel <= hint->level || res < 0) {
-			if (res == PRESENT) {
-#ifndef ENABLE_MINIMAL
-				if (reiser4_tree_collision_start(tree, place,
-								 &wanted))
-				{
-					restore_and_exit(-EIO);
-				}
+	/* Leaving dirty nodes only. */
+	for (i = 0, j = 0; i < flush->count; i++) {
+		if (reiser4_node_isdirty((reiser4_node_t *)flush->items[i]))
+			flush->items[j++] = flush->items[i];
+	}
 
-				/* Handle collisions. */
-				if (hint->collision) {
-					tree_entity_t *t;
-					
-					t = (tree_entity_t *)tree;
-					
-					res = hint->collision(t, place, 
-							      hint->hint);
-					
-					if (res < 0)
-						restore_and_exit(res);
-				}
-#endif
-				/* Fetching item at @place if key is found */
-				if (reiser4_place_fetch(place))
-					restore_and_exit(-EIO);
+	flush->count = j;
+
+	if (!flush->count)
+		return 0;
+	
+	if ((res = reiser4_tree_flush_sort(flush, cb_flush_node_nr)))
+		return res;
+
+	blksize = reiser4_tree_get_blksize(tree);
+	factor = blksize / tree->fs->device->blksize;
+
+	if (!(buff = aal_malloc(TREE_FLUSH_RUN * blksize)))
+		return -ENOMEM;
+
+	nodes = (reiser4_node_t **)flush->items;
+
+	for (i = 0; i < flush->count; i += run) {
+		for (run = 1; run < TREE_FLUSH_RUN &&
+			     i + run < flush->count; run++)
+		{
+			if (nodes[i + run]->block->nr !=
+			    nodes[i]->block->nr + run)
+			{
+				break;
+			}
+		}
 
+		for (j = 0; j < run; j++) {
+			if ((res = reiser4_node_seal(nodes[i + j]))) {
+				aal_error("Can't prepare node %llu for "
+					  "writing.", (unsigned long long)
+					  nodes[i + j]->block->nr);
+				goto error_free_buff;
 			}
 			
-			restore_and_exit(res);
+			aal_memcpy(buff + j * blksize,
+				   nodes[i + j]->block->data, blksize);
 		}
 
-		/* Initializing @place. This should be done before using any
-		   item methods or access @place fields. */
-		if (!reiser4_place_valid(place))
-			restore_and_exit(ABSENT);
-		
-		if (reiser4_place_fetch(place))
-			restore_and_exit(-EIO);
-		
-		/* Checking is item at @place is nodeptr one. If not, we correct
-		   posision back. */
-		if (!reiser4_item_branch(place->plug))
-			restore_and_exit(res);
-		
-		/* Loading node by its nodeptr item at @place. */
-		blk = reiser4_item_down_link(place);
-		if (!(place->node = reiser4_tree_load_node(tree, place->node,
-							   blk)))
+		if ((res = aal_device_write(tree->fs->device, buff,
+					    nodes[i]->block->nr * factor,
+					    run * factor)))
 		{
-			aal_error("Can't load child node %llu.",
-				  (unsigned long long)blk);
-			restore_and_exit(-EIO);
+			aal_error("Can't write nodes %llu-%llu.",
+				  (unsigned long long)nodes[i]->block->nr,
+				  (unsigned long long)(nodes[i]->block->nr +
+						       run - 1));
+			goto error_free_buff;
 		}
 
-		/* Zero the plug pointer. */
-		place->plug = NULL;
+		for (j = 0; j < run; j++)
+			reiser4_node_mkclean(nodes[i + j]);
+
+		reiser4_tree_prefetch_drop(tree, nodes[i]->block->nr, run);
 	}
-	
-	restore_and_exit(ABSENT);
-}
 
-#ifndef ENABLE_MINIMAL
-/* Returns 1 if passed @tree has minimal possible height and thus cannot be
-   dried out. Othersize 0 is returned. */
-bool_t reiser4_tree_minimal(reiser4_tree_t *tree) {
-	return (reiser4_tree_get_height(tree) <= 2);
+ error_free_buff:
+	aal_free(buff);
+	return res;
 }
 
-/* Returns 1 if root node contain one item, that is, tree is singular and should
-   be dried out. Otherwise 0 is returned. */
-bool_t reiser4_tree_singular(reiser4_tree_t *tree) {
-	return (reiser4_node_items(tree->root) == 1);
+/* Helper function for collecting dirty unformatted blocks. Blocks of not yet
+   allocated extents have no location on device and are skipped. */
+static errno_t cb_flush_block(void *entry, void *data) {
+	aal_hash_node_t *node = (aal_hash_node_t *)entry;
+	aal_block_t *block = (aal_block_t *)node->value;
+
+	if (!block->dirty || !block->nr)
+		return 0;
+	
+	return reiser4_tree_flush_add((tree_flush_t *)data, block);
 }
 
-/* Returns 1 if tree has not root node and 0 otherwise. Tree has not root just
-   after format instance is created and tree is initialized on fs with it. And
-   thus tree has not any nodes in it. */
-bool_t reiser4_tree_fresh(reiser4_tree_t *tree) {
-	aal_assert("umka-1930", tree != NULL);
-	return (reiser4_tree_get_root(tree) == INVAL_BLK);
-}
-
-/* Updates key at passed @place by passed @key by means of using
-   node_update_key() function in recursive maner. This function is used for
-   update all internal left delimiting keys after balancing on underlying
-   levels. */
-errno_t reiser4_tree_update_keys(reiser4_tree_t *tree,
-				 reiser4_place_t *place,
-				 reiser4_key_t *key)
-{
+/* Saves dirty unformatted blocks (extents data). Blocks are sorted by their
+   numbers and runs of adjacent blocks are written by one request. */
+static errno_t reiser4_tree_flush_blocks(reiser4_tree_t *tree) {
+	aal_block_t **blocks;
+	tree_flush_t flush;
+	uint32_t i, j, run;
+	uint32_t blksize;
+	uint32_t factor;
 	errno_t res;
-	reiser4_key_t pkey;
+	char *buff;
 	
-	aal_assert("umka-1892", tree != NULL);
-	aal_assert("umka-1893", place != NULL);
-	aal_assert("umka-1894", key != NULL);
-
-	/* Small improvement. Do not update keys if this is not really
-	   needed. */
-	reiser4_item_get_key(place, &pkey);
+	aal_memset(&flush, 0, sizeof(flush));
+	
+	if ((res = aal_hash_table_foreach(tree->blocks, cb_flush_block,
+					  &flush)))
+	{
+		goto error_fini_flush;
+	}
 
-	if (!reiser4_key_compfull(&pkey, key))
+	if (!flush.count)
 		return 0;
 	
-	aal_memcpy(&place->key, key, sizeof(*key));
+	if ((res = reiser4_tree_flush_sort(&flush, cb_flush_block_nr)))
+		goto error_fini_flush;
+	
+	blksize = reiser4_tree_get_blksize(tree);
+	factor = blksize / tree->fs->device->blksize;
 
-	/* Check if we should update keys on higher levels of tree. */
-	if (reiser4_place_leftmost(place) && place->node->p.node) {
-		reiser4_place_t *parent = &place->node->p;
-		
-		if ((res = reiser4_tree_update_keys(tree, parent, key)))
-			return res;
+	if (!(buff = aal_malloc(TREE_FLUSH_RUN * blksize))) {
+		res = -ENOMEM;
+		goto error_fini_flush;
 	}
 
-	/* Actual key updating in @place->node. */
-	return reiser4_node_update_key(place->node, &place->pos, key);
-}
+	blocks = (aal_block_t **)flush.items;
+	
+	for (i = 0; i < flush.count; i += run) {
+		for (run = 1; run < TREE_FLUSH_RUN &&
+			     i + run < flush.count; run++)
+		{
+			if (blocks[i + run]->nr != blocks[i]->nr + run)
+				break;
+		}
 
-/* Returns 1 for attached node and 0 otherwise. */
-bool_t reiser4_tree_attached_node(reiser4_tree_t *tree,
-				  reiser4_node_t *node)
-{
-	aal_assert("umka-3128", tree != NULL);
-	aal_assert("umka-3129", node != NULL);
+		for (j = 0; j < run; j++) {
+			aal_memcpy(buff + j * blksize,
+				   blocks[i + j]->data, blksize);
+		}
 
-	if (reiser4_tree_fresh(tree))
-		return 0;
+		if ((res = aal_device_write(tree->fs->device, buff,
+					    blocks[i]->nr * factor,
+					    run * factor)))
+		{
+			aal_error("Can't write blocks %llu-%llu.",
+				  (unsigned long long)blocks[i]->nr,
+				  (unsigned long long)(blocks[i]->nr +
+						       run - 1));
+			goto error_free_buff;
+		}
 
-	if (reiser4_tree_root_node(tree, node))
-		return 1;
+		for (j = 0; j < run; j++)
+			blocks[i + j]->dirty = 0;
 
-	return (node->p.node != NULL && 
-		(reiser4_tree_t *)node->tree == tree);
+		reiser4_tree_prefetch_drop(tree, blocks[i]->nr, run);
+	}
+
+ error_free_buff:
+	aal_free(buff);
+ error_fini_flush:
+	reiser4_tree_flush_fini(&flush);
+	return res;
 }
 
-/* This function inserts new nodeptr item to the tree and in such way attaches
-   passed @node to tree. It also connects passed @node into tree cache. */
-errno_t reiser4_tree_attach_node(reiser4_tree_t *tree, reiser4_node_t *node,
-				 reiser4_place_t *place, uint32_t flags)
-{
+/* Allocates all unallocated extent units in loaded nodes and saves their
+   data blocks. Nodes are walked in key order, so data of each file is placed
+   after its previous blocks. Balancing caused by splitting some unit may move
+   items between nodes, so the pass is restarted then. */
+static errno_t reiser4_tree_flush_extents(reiser4_tree_t *tree) {
+	tree_flush_t flush;
 	errno_t res;
-	uint8_t level;
-	ptr_hint_t ptr;
-	trans_hint_t hint;
-
-	aal_assert("umka-913", tree != NULL);
-	aal_assert("umka-916", node != NULL);
-	aal_assert("umka-3104", place != NULL);
-
-	aal_memset(&hint, 0, sizeof(hint));
-	
-	hint.count = 1;
-	hint.specific = &ptr;
-	hint.shift_flags = flags;
-	hint.plug = (reiser4_item_plug_t *)tree->ent.tset[TSET_NODEPTR];
+	uint32_t i;
+	blk_t near;
 
-	ptr.width = 1;
-	ptr.start = node->block->nr;
-	
-	level = reiser4_node_get_level(node) + 1;
-	reiser4_node_leftmost_key(node, &hint.offset);
+	do {
+		aal_memset(&flush, 0, sizeof(flush));
+		
+		if ((res = reiser4_tree_flush_collect(tree, tree->root,
+						      &flush)))
+		{
+			break;
+		}
 
-	/* Inserting node ptr into tree. */
-	if ((res = reiser4_tree_insert(tree, place, &hint, level)) < 0) {
-		aal_error("Can't insert nodeptr item to the tree.");
-		return res;
-	}
+		for (i = 0, near = 0; i < flush.count; i++) {
+			if ((res = reiser4_tree_alloc_extents(tree,
+					flush.items[i], &near, 1)))
+			{
+				break;
+			}
+		}
 
-	/* Connecting node to tree cache. */
-	if ((res = reiser4_tree_connect_node(tree, place->node, node))) {
-		aal_error("Can't connect node %llu to tree cache.",
-			  (unsigned long long)node->block->nr);
-		return res;
-	}
+		reiser4_tree_flush_fini(&flush);
+	} while (res > 0);
 
-	/* This is needed to update sibling pointers, as new attached node may
-	   be inserted between two nodes, that has established sibling links and
-	   they should be changed. */
-	reiser4_tree_ltrt_node(tree, node, DIR_LEFT);
-	reiser4_tree_ltrt_node(tree, node, DIR_RIGHT);
-	
-	return 0;
+	return res;
 }
 
-/* Removes passed @node from the on-disk tree and cache structures. That is
-   removes nodeptr item from the tree and node instance itself from its parent
-   children list. */
-errno_t reiser4_tree_detach_node(reiser4_tree_t *tree,
-				 reiser4_node_t *node,
-				 uint32_t flags)
-{
+/* Saves all dirty nodes in tree to device tree lies on. Unallocated extents
+   get allocated first, as this may change the tree. Loaded nodes are
+   collected then, fake allocated ones get real blocks level by level in key
+   order, and then dirty nodes are saved in the order of block numbers. */
+errno_t reiser4_tree_sync(reiser4_tree_t *tree) {
+	tree_flush_t flush;
 	errno_t res;
-	reiser4_place_t parent;
 	
-	aal_assert("umka-1726", tree != NULL);
-	aal_assert("umka-1727", node != NULL);
-
-	/* Save parent pos, because it will be needed later and it is destroed
-	   by tree_disconnect_node(). */
-	parent = node->p;
+	aal_assert("umka-2259", tree != NULL);
 
-	/* Disconnecting @node from tree. This should be done before removing
-	   nodeptr item in parent, as parent may get empty and we will unable to
-	   release it as it is locked by connect @node. */
-	if ((res = reiser4_tree_disconnect_node(tree, node))) {
-		aal_error("Can't disconnect node %llu "
-			  "from tree during its detaching.",
-			  (unsigned long long)node->block->nr);
-		return res;
-	}
-        /* Disconnecting node from parent node if any. */
-	if (!reiser4_tree_root_node(tree, node)) {
-		trans_hint_t hint;
-		
-		hint.count = 1;
-		hint.place_func = NULL;
-		hint.region_func = NULL;
-		hint.shift_flags = flags;
+	if (!tree->root)
+		return 0;
 
-		/* Removing nodeptr item/unit at @parent. */
-		return reiser4_tree_remove(tree, &parent, &hint);
-	} else {
-		/* Putting INVAL_BLK into root block number in super block to
-		   let know that old root is detached. */
-		reiser4_tree_set_root(tree, INVAL_BLK);
-	}
-	
-	return 0;
-}
+	aal_memset(&flush, 0, sizeof(flush));
 
-/* This function forces tree to grow by one level and sets it up after the
-   growing. This occurs when after next balancing root node needs to accept new
-   nodeptr item, but has not free space enough.  */
-errno_t reiser4_tree_growup(reiser4_tree_t *tree) {
-	errno_t res;
-	uint32_t height;
-	reiser4_place_t aplace;
-	reiser4_node_t *new_root;
-	reiser4_node_t *old_root;
+	/* Check for special case -- empty root, nothing to allocate. */
+	if (reiser4_node_items(tree->root)) {
+		/* Do not let memory pressure handling unload nodes while
+		   collected ones are handled. */
+		tree->adjusting = 1;
+		res = reiser4_tree_flush_extents(tree);
+		tree->adjusting = 0;
+		
+		if (res) {
+			aal_error("Can't allocate extents.");
+			return res;
+		}
+		
+		if ((res = reiser4_tree_flush_collect(tree, tree->root,
+						      &flush)))
+		{
+			goto error_fini_flush;
+		}
 
-	aal_assert("umka-1701", tree != NULL);
-	aal_assert("umka-1736", tree->root != NULL);
-	
-	height = reiser4_tree_get_height(tree) + 1;
+		if ((res = reiser4_tree_flush_alloc(tree, &flush)))
+			goto error_fini_flush;
 
-	/* Allocating new root node. */
-	if (!(new_root = reiser4_tree_alloc_node(tree, height)))
-		return -ENOSPC;
+		if ((res = reiser4_tree_flush_nodes(tree, &flush)))
+			goto error_fini_flush;
+	}
 
-	if ((res = reiser4_tree_load_root(tree)))
-		goto error_free_new_root;
+	reiser4_tree_flush_fini(&flush);
 	
-	old_root = tree->root;
-
-	/* Detaching old root from tree first. */
-	if ((res = reiser4_tree_detach_node(tree, old_root,
-					    SF_DEFAULT)))
+	/* Unloading not locked nodes, all of them are clean now. */
+	if ((res = reiser4_tree_walk_node(tree, tree->root, 
+					  NULL, NULL, cb_node_unload)))
 	{
-		aal_error("Can't detach old root node %llu from "
-			  "tree during tree growing up.",
-			  (unsigned long long)old_root->block->nr);
-		goto error_return_root;
-	}
-	
-	/* Assign new root node, changing tree height and root node blk in
-	   format used in fs instance tree belongs to. */
-	if ((res = reiser4_tree_assign_root(tree, new_root))) {
-		aal_error("Can't assign new root node "
-			  "durring tree growing up.");
-		goto error_free_new_root;
+		aal_error("Can't save formatted nodes to device.");
+		return res;
 	}
 
-	/* Attaching old root to tree back. Now it should be attached to new
-	   root node, not to virtual super block. */
-	reiser4_node_lock(new_root);
-
-	/* Place old root will be attached. */
-	reiser4_place_assign(&aplace, new_root, 0, MAX_UINT32);
-
-	if ((res = reiser4_tree_attach_node(tree, old_root,
-					    &aplace, SF_DEFAULT)))
-	{
-		aal_error("Can't attach node %llu to tree during"
-			  "tree growing up.",
-			  (unsigned long long)old_root->block->nr);
-		reiser4_node_unlock(new_root);
-		goto error_return_root;
+	/* Flushing unformatted blocks (extents data) attached to @tree->data
+	   hash table. */
+	if ((res = reiser4_tree_flush_blocks(tree))) {
+		aal_error("Can't save unformatted nodes to device.");
+		return res;
 	}
-
-	reiser4_node_unlock(new_root);
-
+	
 	return 0;
 
-error_return_root:
-	reiser4_tree_assign_root(tree, old_root);
-error_free_new_root:
-	reiser4_tree_release_node(tree, new_root);
+ error_fini_flush:
+	reiser4_tree_flush_fini(&flush);
+	aal_error("Can't save formatted nodes to device.");
 	return res;
 }
 
-/* Decreases tree height by one level. This occurs when tree gets singular (root
-   has one nodeptr item) after one of removals. */
-errno_t reiser4_tree_dryout(reiser4_tree_t *tree) {
-	errno_t res;
-	reiser4_place_t place;
-	reiser4_node_t *new_root;
-	reiser4_node_t *old_root;
+/* Correct passed @place according to handle key collisions. */
+lookup_t reiser4_tree_collision(reiser4_tree_t *tree, 
+				reiser4_place_t *place,
+				coll_hint_t *hint)
+{
+	uint32_t adjust = 0;
+	uint32_t units, unit;
+	lookup_t lookup = PRESENT;
 
-	aal_assert("umka-1731", tree != NULL);
-	aal_assert("umka-1737", tree->root != NULL);
+	aal_assert("umka-3130", tree != NULL);
+	aal_assert("vpf-1522", place != NULL);
+	
+	if (hint == NULL)
+		return PRESENT;
+	
+	/* If type does not match, there is no collision found. */
+	if (place->plug->p.id.group != hint->type)
+		return PRESENT;
 
-	if (reiser4_tree_minimal(tree))
+	/* Key collisions handling. Sequentional search by name. */	
+	while (1) {
+		units = reiser4_item_units(place);
+
+		if (place->pos.unit != MAX_UINT32 && place->pos.unit >= units) {
+			reiser4_place_t temp;
+			
+			/* Getting next item. */
+			if ((reiser4_tree_next_place(tree, place, &temp)))
+				return -EIO;
+			
+			/* Directory is over? */
+			if (!temp.node || !plug_equal(place->plug, temp.plug)) {
+				place->key.adjust = adjust;
+				return ABSENT;
+			}
+
+			aal_memcpy(place, &temp, sizeof(*place));
+		}
+		
+		unit = place->pos.unit == MAX_UINT32 ? 0 : place->pos.unit;
+		
+		if ((lookup = reiser4_item_collision(place, hint)) < 0)
+			return lookup;
+		
+		adjust += place->pos.unit - unit;
+
+		if (place->pos.unit < units)
+			break;
+	}
+	
+	place->key.adjust = adjust;
+	
+	return PRESENT;
+}
+
+/* Makes search of the leftmost item/unit with the same key as passed @key is
+   starting from @place. This is needed to work with key collisions. */
+static errno_t reiser4_tree_collision_start(reiser4_tree_t *tree,
+					    reiser4_place_t *place,
+					    reiser4_key_t *key)
+{
+        reiser4_place_t walk;
+                                                                                     
+        aal_assert("umka-2396", key != NULL);
+        aal_assert("umka-2388", tree != NULL);
+        aal_assert("umka-2389", place != NULL);
+                                                                                     
+        if (reiser4_place_fetch(place))
+                return -EINVAL;
+	
+        aal_memcpy(&walk, place, sizeof(*place));
+                                                                                     
+        /* Main loop until leftmost node reached. */
+        while (walk.node) {
+                int32_t i;
+                                                                                     
+                /* Loop through the items of the current node */
+                for (i = walk.pos.item - 1; i >= 0; i--) {
+                        walk.pos.item = i;
+                                                                                     
+                        /* Fetching item info */
+                        if (reiser4_place_fetch(&walk))
+                                return -EINVAL;
+                                                                                     
+                        /* If items of different objects, get out here. */
+                        if (reiser4_key_compshort(&walk.key, key))
+                                return 0;
+                        
+			/* If the maxreal key does not match anymore, 
+			   get out here. This clause is needed for the case 
+			   of corruption when not directory item has a NAME 
+			   minor. */
+			if (walk.plug->balance->maxposs_key) {
+				reiser4_key_t maxkey;
+
+				reiser4_item_maxposs_key(&walk, &maxkey);
+				
+				if (reiser4_key_compfull(&maxkey, key) < 0)
+					return 0;
+			}
+			
+                        /* If item's lookup is implemented, we use it. Item key
+                           comparing is used otherwise. */
+                        if (walk.plug->balance->lookup) {
+				lookup_hint_t lhint;
+
+				lhint.key = key;
+				
+                                switch (objcall(&walk, balance->lookup, 
+						&lhint, FIND_EXACT))
+                                {
+                                case PRESENT:
+                                        aal_memcpy(place, &walk, sizeof(*place));
+                                        break;
+                                default:
+                                        return 0;
+                                }
+                        } else if (!reiser4_key_compfull(&walk.key, key)) {
+				aal_memcpy(place, &walk, sizeof(*place));
+                        } else {
+				return 0;
+                        }
+                }
+                                                                                     
+                /* Getting left neighbour node. */
+                reiser4_node_lock(place->node);
+                reiser4_tree_ltrt_node(tree, walk.node, DIR_LEFT);
+                reiser4_node_unlock(place->node);
+                                                                                     
+                /* Initializing @walk by neighbour node and last item. */
+                if ((walk.node = walk.node->left)) {
+                        int32_t items = reiser4_node_items(walk.node);
+                                                                                     
+                        /* Here should be namely @items, not @items - 1, because
+                           we will access @walk.item - 1 on the next cycle */
+                        POS_INIT(&walk.pos, items, MAX_UINT32);
+                }
+        }
+                                                                                     
+        return 0;
+}
+#endif
+
+#define restore_and_exit(res) \
+	do {hint->key = saved; return res;} while (0)
+
+/* Makes search in the tree by specified @key. Fills passed place by data of
+   found item. That is body pointer, plugin, etc. */
+lookup_t reiser4_tree_lookup(reiser4_tree_t *tree, lookup_hint_t *hint,
+			     lookup_bias_t bias, reiser4_place_t *place)
+{
+	lookup_t res;
+	reiser4_key_t *saved;
+	reiser4_key_t wanted;
+
+	aal_assert("umka-742", hint != NULL);
+	aal_assert("umka-1760", tree != NULL);
+	aal_assert("umka-2057", place != NULL);
+	aal_assert("umka-3088", hint->key != NULL);
+
+	/* We store @key in @wanted. All consequence code will use @wan. This is
+	   needed, because @key might point to @place->key in @place and will be
+	   corrupted during lookup. */
+	aal_memcpy(&wanted, hint->key, sizeof(wanted));
+
+	/* Setting hint->key to stored local key in order to keep not corrupted
+	   if it points to @place->key and will be chnaged after @place is
+	   modified. It will be restored after lookup is finished. */
+	saved = hint->key;
+	hint->key = &wanted;
+
+	/* Zeroing place just of rcase it was not initialized before to prevent
+	   having some garbage in it. */
+	aal_memset(place, 0, sizeof(*place));
+
+#ifndef ENABLE_MINIMAL
+	/* Making sure that root exists. If not, getting out with @place
+	   initialized by NULL root. */
+	if (reiser4_tree_fresh(tree)) {
+		reiser4_place_assign(place, NULL, 0, MAX_UINT32);
+		return ABSENT;
+	} else {
+#endif
+		if ((res = reiser4_tree_load_root(tree)) < 0)
+			return res;
+		
+		reiser4_place_assign(place, tree->root, 0, MAX_UINT32);
+#ifndef ENABLE_MINIMAL
+	}
+#endif
+
+	while (1) {
+		uint32_t clevel;
+		lookup_bias_t cbias;
+		blk_t blk;
+
+		clevel = reiser4_node_get_level(place->node);
+		cbias = (clevel > hint->level ? FIND_EXACT : bias);
+		
+		/* Looking up for key inside node. Result of lookuping will be
+		   stored in &place->pos. */
+		res = reiser4_node_lookup(place->node, hint,
+					  cbias, &place->pos);
+
+		/* Check if we should finish lookup because we reach stop level
+		   or some error occurred during last node lookup. */
+		if (clevel <= hint->level || res < 0) {
+			if (res == PRESENT) {
+#ifndef ENABLE_MINIMAL
+				if (reiser4_tree_collision_start(tree, place,
+								 &wanted))
+				{
+					restore_and_exit(-EIO);
+				}
+
+				/* Handle collisions. */
+				if (hint->collision) {
+					tree_entity_t *t;
+					
+					t = (tree_entity_t *)tree;
+					
+					res = hint->collision(t, place, 
+							      hint->hint);
+					
+					if (res < 0)
+						restore_and_exit(res);
+				}
+#endif
+				/* Fetching item at @place if key is found */
+				if (reiser4_place_fetch(place))
+					restore_and_exit(-EIO);
+
+			}
+			
+			restore_and_exit(res);
+		}
+
+		/* Initializing @place. This should be done before using any
+		   item methods or access @place fields. */
+		if (!reiser4_place_valid(place))
+			restore_and_exit(ABSENT);
+		
+		if (reiser4_place_fetch(place))
+			restore_and_exit(-EIO);
+		
+		/* Checking is item at @place is nodeptr one. If not, we correct
+		   posision back. */
+		if (!reiser4_item_branch(place->plug))
+			restore_and_exit(res);
+		
+		/* Loading node by its nodeptr item at @place. */
+		blk = reiser4_item_down_link(place);
+		if (!(place->node = reiser4_tree_load_node(tree, place->node,
+							   blk)))
+		{
+			aal_error("Can't load child node %llu.",
+				  (unsigned long long)blk);
+			restore_and_exit(-EIO);
+		}
+
+		/* Zero the plug pointer. */
+		place->plug = NULL;
+	}
+	
+	restore_and_exit(ABSENT);
+}
+
+#ifndef ENABLE_MINIMAL
+/* Returns 1 if passed @tree has minimal possible height and thus cannot be
+   dried out. Othersize 0 is returned. */
+bool_t reiser4_tree_minimal(reiser4_tree_t *tree) {
+	return (reiser4_tree_get_height(tree) <= 2);
+}
+
+/* Returns 1 if root node contain one item, that is, tree is singular and should
+   be dried out. Otherwise 0 is returned. */
+bool_t reiser4_tree_singular(reiser4_tree_t *tree) {
+	return (reiser4_node_items(tree->root) == 1);
+}
+
+/* Returns 1 if tree has not root node and 0 otherwise. Tree has not root just
+   after format instance is created and tree is initialized on fs with it. And
+   thus tree has not any nodes in it. */
+bool_t reiser4_tree_fresh(reiser4_tree_t *tree) {
+	aal_assert("umka-1930", tree != NULL);
+	return (reiser4_tree_get_root(tree) == INVAL_BLK);
+}
+
+/* Updates key at passed @place by passed @key by means of using
+   node_update_key() function in recursive maner. This function is used for
+   update all internal left delimiting keys after balancing on underlying
+   levels. */
+errno_t reiser4_tree_update_keys(reiser4_tree_t *tree,
+				 reiser4_place_t *place,
+				 reiser4_key_t *key)
+{
+	errno_t res;
+	reiser4_key_t pkey;
+	
+	aal_assert("umka-1892", tree != NULL);
+	aal_assert("umka-1893", place != NULL);
+	aal_assert("umka-1894", key != NULL);
+
+	/* Small improvement. Do not update keys if this is not really
+	   needed. */
+	reiser4_item_get_key(place, &pkey);
+
+	if (!reiser4_key_compfull(&pkey, key))
+		return 0;
+	
+	aal_memcpy(&place->key, key, sizeof(*key));
+
+	/* Check if we should update keys on higher levels of tree. */
+	if (reiser4_place_leftmost(place) && place->node->p.node) {
+		reiser4_place_t *parent = &place->node->p;
+		
+		if ((res = reiser4_tree_update_keys(tree, parent, key)))
+			return res;
+	}
+
+	/* Actual key updating in @place->node. */
+	return reiser4_node_update_key(place->node, &place->pos, key);
+}
+
+/* Returns 1 for attached node and 0 otherwise. */
+bool_t reiser4_tree_attached_node(reiser4_tree_t *tree,
+				  reiser4_node_t *node)
+{
+	aal_assert("umka-3128", tree != NULL);
+	aal_assert("umka-3129", node != NULL);
+
+	if (reiser4_tree_fresh(tree))
+		return 0;
+
+	if (reiser4_tree_root_node(tree, node))
+		return 1;
+
+	return (node->p.node != NULL && 
+		(reiser4_tree_t *)node->tree == tree);
+}
+
+/* This function inserts new nodeptr item to the tree and in such way attaches
+   passed @node to tree. It also connects passed @node into tree cache. */
+errno_t reiser4_tree_attach_node(reiser4_tree_t *tree, reiser4_node_t *node,
+				 reiser4_place_t *place, uint32_t flags)
+{
+	errno_t res;
+	uint8_t level;
+	ptr_hint_t ptr;
+	trans_hint_t hint;
+
+	aal_assert("umka-913", tree != NULL);
+	aal_assert("umka-916", node != NULL);
+	aal_assert("umka-3104", place != NULL);
+
+	aal_memset(&hint, 0, sizeof(hint));
+	
+	hint.count = 1;
+	hint.specific = &ptr;
+	hint.shift_flags = flags;
+	hint.plug = (reiser4_item_plug_t *)tree->ent.tset[TSET_NODEPTR];
+
+	ptr.width = 1;
+	ptr.start = node->block->nr;
+	
+	level = reiser4_node_get_level(node) + 1;
+	reiser4_node_leftmost_key(node, &hint.offset);
+
+	/* Inserting node ptr into tree. */
+	if ((res = reiser4_tree_insert(tree, place, &hint, level)) < 0) {
+		aal_error("Can't insert nodeptr item to the tree.");
+		return res;
+	}
+
+	/* Connecting node to tree cache. */
+	if ((res = reiser4_tree_connect_node(tree, place->node, node))) {
+		aal_error("Can't connect node %llu to tree cache.",
+			  (unsigned long long)node->block->nr);
+		return res;
+	}
+
+	/* This is needed to update sibling pointers, as new attached node may
+	   be inserted between two nodes, that has established sibling links and
+	   they should be changed. */
+	reiser4_tree_ltrt_node(tree, node, DIR_LEFT);
+	reiser4_tree_ltrt_node(tree, node, DIR_RIGHT);
+	
+	return 0;
+}
+
+/* Removes passed @node from the on-disk tree and cache structures. That is
+   removes nodeptr item from the tree and node instance itself from its parent
+   children list. */
+errno_t reiser4_tree_detach_node(reiser4_tree_t *tree,
+				 reiser4_node_t *node,
+				 uint32_t flags)
+{
+	errno_t res;
+	reiser4_place_t parent;
+	
+	aal_assert("umka-1726", tree != NULL);
+	aal_assert("umka-1727", node != NULL);
+
+	/* Save parent pos, because it will be needed later and it is destroed
+	   by tree_disconnect_node(). */
+	parent = node->p;
+
+	/* Disconnecting @node from tree. This should be done before removing
+	   nodeptr item in parent, as parent may get empty and we will unable to
+	   release it as it is locked by connect @node. */
+	if ((res = reiser4_tree_disconnect_node(tree, node))) {
+		aal_error("Can't disconnect node %llu "
+			  "from tree during its detaching.",
+			  (unsigned long long)node->block->nr);
+		return res;
+	}
+        /* Disconnecting node from parent node if any. */
+	if (!reiser4_tree_root_node(tree, node)) {
+		trans_hint_t hint;
+		
+		hint.count = 1;
+		hint.place_func = NULL;
+		hint.region_func = NULL;
+		hint.shift_flags = flags;
+
+		/* Removing nodeptr item/unit at @parent. */
+		return reiser4_tree_remove(tree, &parent, &hint);
+	} else {
+		/* Putting INVAL_BLK into root block number in super block to
+		   let know that old root is detached. */
+		reiser4_tree_set_root(tree, INVAL_BLK);
+	}
+	
+	return 0;
+}
+
+/* This function forces tree to grow by one level and sets it up after the
+   growing. This occurs when after next balancing root node needs to accept new
+   nodeptr item, but has not free space enough.  */
+errno_t reiser4_tree_growup(reiser4_tree_t *tree) {
+	errno_t res;
+	uint32_t height;
+	reiser4_place_t aplace;
+	reiser4_node_t *new_root;
+	reiser4_node_t *old_root;
+
+	aal_assert("umka-1701", tree != NULL);
+	aal_assert("umka-1736", tree->root != NULL);
+	
+	height = reiser4_tree_get_height(tree) + 1;
+
+	/* Allocating new root node. */
+	if (!(new_root = reiser4_tree_alloc_node(tree, height)))
+		return -ENOSPC;
+
+	if ((res = reiser4_tree_load_root(tree)))
+		goto error_free_new_root;
+	
+	old_root = tree->root;
+
+	/* Detaching old root from tree first. */
+	if ((res = reiser4_tree_detach_node(tree, old_root,
+					    SF_DEFAULT)))
+	{
+		aal_error("Can't detach old root node %llu from "
+			  "tree during tree growing up.",
+			  (unsigned long long)old_root->block->nr);
+		goto error_return_root;
+	}
+	
+	/* Assign new root node, changing tree height and root node blk in
+	   format used in fs instance tree belongs to. */
+	if ((res = reiser4_tree_assign_root(tree, new_root))) {
+		aal_error("Can't assign new root node "
+			  "durring tree growing up.");
+		goto error_free_new_root;
+	}
+
+	/* Attaching old root to tree back. Now it should be attached to new
+	   root node, not to virtual super block. */
+	reiser4_node_lock(new_root);
+
+	/* Place old root will be attached. */
+	reiser4_place_assign(&aplace, new_root, 0, MAX_UINT32);
+
+	if ((res = reiser4_tree_attach_node(tree, old_root,
+					    &aplace, SF_DEFAULT)))
+	{
+		aal_error("Can't attach node %llu to tree during"
+			  "tree growing up.",
+			  (unsigned long long)old_root->block->nr);
+		reiser4_node_unlock(new_root);
+		goto error_return_root;
+	}
+
+	reiser4_node_unlock(new_root);
+
+	return 0;
+
+error_return_root:
+	reiser4_tree_assign_root(tree, old_root);
+error_free_new_root:
+	reiser4_tree_release_node(tree, new_root);
+	return res;
+}
+
+/* Decreases tree height by one level. This occurs when tree gets singular (root
+   has one nodeptr item) after one of removals. */
+errno_t reiser4_tree_dryout(reiser4_tree_t *tree) {
+	errno_t res;
+	reiser4_place_t place;
+	reiser4_node_t *new_root;
+	reiser4_node_t *old_root;
+
+	aal_assert("umka-1731", tree != NULL);
+	aal_assert("umka-1737", tree->root != NULL);
+
+	if (reiser4_tree_minimal(tree))
+		return -EINVAL;
+
+	/* Rasing up the root node if it exists. */
+	if ((res = reiser4_tree_load_root(tree)))
+		return res;
+
+	old_root = tree->root;
+	
+	/* Getting new root as the first child of the old root node. */
+	reiser4_place_assign(&place, old_root, 0, 0);
+
+	if (!(new_root = reiser4_tree_child_node(tree, &place))) {
+		aal_error("Can't load new root during "
+			  "drying tree out.");
+		return -EINVAL;
+	}
+
+	/* Detaching new root from its parent (old_root). This will also release
+	   parent node from tree, as it will be empty. */
+	if ((res = reiser4_tree_detach_node(tree, new_root,
+					    SF_DEFAULT)))
+	{
+		aal_error("Can't detach new root from "
+			  "tree during tree drying out.");
+		return res;
+	}
+
+	/* Assign new root node. Setting tree height to new root level and root
+	   block number to new root block number. */
+	if ((res = reiser4_tree_assign_root(tree, new_root))) {
+		aal_error("Can't assign new root node "
+			  "durring tree drying out.");
+		return res;
+	}
+
+	return 0;
+}
+
+/* Tries to shift items and units from @place to passed @neig node. After that
+   it's finished, place will contain new insert point, which may be used for
+   inserting item/unit to it. */
+errno_t reiser4_tree_shift(reiser4_tree_t *tree, reiser4_place_t *place,
+			   reiser4_node_t *neig, uint32_t flags)
+{
+	errno_t res;
+	reiser4_node_t *node;
+	reiser4_node_t *right;
+
+	shift_hint_t hint;
+	reiser4_key_t lkey;
+	
+	uint8_t start;
+
+	aal_assert("umka-1225", tree != NULL);
+	aal_assert("umka-1226", place != NULL);
+	aal_assert("umka-1227", neig != NULL);
+    
+	aal_memset(&hint, 0, sizeof(hint));
+
+	/* Prepares shift hint. Initializing shift flags (shift direction, is it
+	   allowed to create new nodes, etc) and insert point. */
+	node = place->node;
+	hint.control = flags;
+	hint.pos = place->pos;
+
+	/* Needed for the left shift. */
+	start = reiser4_node_items(neig);
+	start = start ? start - 1 : 0;
+	
+	/* Perform node shift from @node to @neig. */
+	if ((res = reiser4_node_shift(node, neig, &hint)))
+		return res;
+
+	/* Check if insert point was moved to neighbour node. If so, assign
+	   neightbour node to insert point coord. */
+	if (hint.result & SF_MOVE_POINT)
+		place->node = neig;
+
+	/* Updating @place->pos by hint->pos if there is permission flag. */
+	if (hint.control & SF_UPDATE_POINT)
+		place->pos = hint.pos;
+
+	right = (hint.control & SF_ALLOW_LEFT) ? node : neig;
+
+	/* Check if we need update key in insert part of tree. That is if source
+	   node is not empty and there was actually moved at least one item or
+	   unit. */
+	if (reiser4_node_items(right) > 0 && hint.update) {
+		/* Check if node is connected to tree or it is not root and
+		   updating left delimiting keys if it makes sense at all. */
+		if (right->p.node != NULL) {
+			reiser4_place_t parent;
+
+			/* Getting leftmost key from @right. */
+			reiser4_node_leftmost_key(right, &lkey);
+
+			/* Recursive updating of all internal keys that supposed
+			   to be updated. */
+			aal_memcpy(&parent, &right->p, sizeof(parent));
+				
+			if ((res = reiser4_tree_update_keys(tree, &parent, &lkey)))
+				return res;
+		}
+	}
+
+	/* Updating @node and @neig children's parent position. */
+	if (reiser4_node_get_level(node) > LEAF_LEVEL) {
+		reiser4_node_t *left = (hint.control & SF_ALLOW_LEFT) ? neig : NULL;
+
+		if (left && reiser4_node_items(left) > 0) {
+			if ((res = reiser4_tree_update_node(tree, left, start, 
+							    reiser4_node_items(left))))
+			{
+				return res;
+			}
+		}
+	
+		if (reiser4_node_items(right) > 0) {
+			if ((res = reiser4_tree_update_node(tree, right, 0, 
+							    reiser4_node_items(right))))
+			{
+				return res;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+/* Shifts data from passed @place to one of neighbour nodes basing on passed
+   @flags. */
+static errno_t tree_shift_todir(reiser4_tree_t *tree, reiser4_place_t *place,
+				uint32_t flags, int direction)
+{
+	errno_t res;
+	uint32_t shift_flags = 0;
+	reiser4_node_t *neighbour;
+	reiser4_node_t *old_node;
+
+	if (direction == DIR_LEFT && (SF_ALLOW_LEFT & flags))
+		shift_flags = SF_ALLOW_LEFT;
+
+	if (direction == DIR_RIGHT && (SF_ALLOW_RIGHT & flags))
+		shift_flags = SF_ALLOW_RIGHT;
+
+	/* Setting up shift flags. */
+	shift_flags |= SF_UPDATE_POINT;
+
+	if (SF_ALLOW_MERGE & flags)
+		shift_flags |= SF_ALLOW_MERGE;
+	
+	if (SF_HOLD_POS & flags)
+		shift_flags |= SF_HOLD_POS;
+
+	old_node = place->node;
+
+	/* Getting neighbour. */
+	neighbour = direction == DIR_LEFT ?
+		place->node->left : place->node->right;
+
+	aal_assert("umka-3096", neighbour != NULL);
+	
+	/* Shift items from @place to @left neighbour. */
+	if ((res = reiser4_tree_shift(tree, place, neighbour, shift_flags)))
+		return res;
+
+	if (reiser4_node_items(old_node) == 0 &&
+	    old_node != place->node)
+	{
+		if (reiser4_node_locked(old_node)) {
+			old_node->flags |= NF_HEARD_BANSHEE;
+		} else {
+			reiser4_node_lock(place->node);
+			
+			if ((res = reiser4_tree_discard_node(tree, old_node))) {
+				reiser4_node_unlock(place->node);
+				return res;
+			}
+
+			reiser4_node_unlock(place->node);
+		}
+	}
+
+	return 0;
+}
+
+/* This calculates if space in passed @needed is enough for passed @needed. */
+static inline int32_t tree_calc_space(reiser4_place_t *place, 
+				      uint32_t ioverh) 
+{
+	uint32_t overh = reiser4_node_overhead(place->node);
+	
+	return reiser4_node_space(place->node) - 
+		(place->pos.unit == MAX_UINT32 ? (overh + ioverh) : 0);
+}
+
+/* Makes space in tree to insert @ilen bytes of data. Returns space in insert
+   point, or negative value for errors. */
+int32_t reiser4_tree_expand(reiser4_tree_t *tree, reiser4_place_t *place,
+			    reiser4_place_t *parent, uint32_t ilen, 
+			    uint32_t ioverh, uint32_t flags)
+{
+	int alloc;
+	errno_t res;
+	uint8_t level;
+	int32_t enough;
+
+	aal_assert("umka-929", tree != NULL);
+	aal_assert("umka-766", place != NULL);
+	
+	aal_assert("umka-3064", place->node != NULL);
+	aal_assert("vpf-1543", ilen + ioverh <= 
+		   reiser4_node_maxspace(place->node));
+
+	if (reiser4_tree_fresh(tree))
+		return -EINVAL;
+
+	/* Check if there is enough space in insert point node. If so -- do
+	   nothing but exit. Here is also check if node is empty. Then we exit
+	   too and return available space in it. */
+	if ((enough = tree_calc_space(place, ioverh)) >= (int32_t)ilen)
+		return enough;
+
+	/* Shifting data into left neighbour if it exists and left shift
+	   allowing flag is specified. */
+	if ((SF_ALLOW_LEFT & flags) && 
+	    reiser4_tree_ltrt_node(tree, place->node, DIR_LEFT)) 
+	{
+		if ((res = tree_shift_todir(tree, place, flags, DIR_LEFT)))
+			return res;
+		
+		if ((enough = tree_calc_space(place, ioverh)) >= (int32_t)ilen)
+			return enough;
+	}
+
+	/* Shifting data into right neighbour if it exists and right shift
+	   allowing flag is specified. */
+	if ((SF_ALLOW_RIGHT & flags) && 
+	    reiser4_tree_ltrt_node(tree, place->node, DIR_RIGHT)) 
+	{
+		if ((res = tree_shift_todir(tree, place, flags, DIR_RIGHT)))
+			return res;
+		
+		if ((enough = tree_calc_space(place, ioverh)) >= (int32_t)ilen)
+			return enough;
+	}
+
+	/* Check if we allowed to allocate new nodes if there still not enough
+	   of space for insert @ilen bytes of data to tree. */
+	if (!(SF_ALLOW_ALLOC & flags))
+		return tree_calc_space(place, ioverh);
+	
+	/* Here we still have not enough free space for inserting item/unit into
+	   the tree. Allocating new nodes and trying to shift data into
+	   them. There are possible two tries to allocate new node and shift
+	   insert point to one of them. */
+	for (alloc = 0; enough < (int32_t)ilen && alloc < 2; alloc++) {
+		reiser4_place_t save;
+		reiser4_node_t *node;
+		uint32_t shift_flags;
+		uint32_t left_items;
+		reiser4_place_t aplace;
+
+		/* Saving place as it will be usefull for us later */
+		aal_memcpy(&save, place, sizeof(*place));
+
+		/* Allocating new node of @level */
+		level = reiser4_node_get_level(place->node);
+
+		if (!(node = reiser4_tree_alloc_node(tree, level)))
+			return -ENOSPC;
+
+		/* reiser4_place_leftmost cannot be used here because unit == 
+		   0 mean we should stay on this item -- writing to the extent
+		   with holes or inserting a SD extention. */
+		if (place->pos.unit == MAX_UINT32 && place->pos.item == 0) {
+			/* Do not shift anything for the leftmost position.
+			   Just insert the new node and move the insert point
+			   there. */
+			aal_memcpy(&aplace, &place->node->p, sizeof(aplace));
+			place->node = node;
+			place->pos.item = 0;
+			place->pos.unit = MAX_UINT32;
+		} else {
+			/* Setting up shift flags. */
+			shift_flags = (SF_ALLOW_RIGHT | SF_UPDATE_POINT);
+
+			if (SF_ALLOW_MERGE & flags)
+				shift_flags |= SF_ALLOW_MERGE;
+
+			if (SF_HOLD_POS & flags)
+				shift_flags |= SF_HOLD_POS;
+			
+			/* We will allow to move insert point to neighbour node 
+			   if we at first iteration in this loop or if place 
+			   points behind the last unit of last item in current 
+			   node. */
+			if (alloc > 0 || reiser4_place_rightmost(place))
+				shift_flags |= SF_MOVE_POINT;
+
+			/* Shift data from @place to @node. Updating @place by 
+			   new insert point. */
+			if ((res = reiser4_tree_shift(tree, place, node, 
+						      shift_flags)))
+			{
+				return res;
+			}
+
+			/* Preparing new @node parent place. */
+			tree_next_child_pos(save.node, &aplace);
+		}
+		
+		left_items = reiser4_node_items(save.node);
+		
+		if (left_items == 0) {
+			reiser4_node_lock(save.node);
+
+			/* If evth was moved to the new allocated node, it will
+			   be attached below. Do not pack the tree here, avoid
+			   2 balancings. */
+			shift_flags = SF_DEFAULT & ~SF_ALLOW_PACK;
+			
+			if ((res = reiser4_tree_detach_node(tree, save.node,
+							    shift_flags)))
+			{
+				reiser4_node_unlock(save.node);
+				return res;
+			}
+
+			reiser4_node_unlock(save.node);
+			aplace.pos.item--;
+		}
+		
+		if (reiser4_node_items(node) > 0) {
+			reiser4_node_lock(save.node);
+			
+			/* Growing tree in the case we splitted the root
+			   node. */
+			if (reiser4_tree_root_node(tree, save.node)) {
+				reiser4_node_t *old_root = tree->root;
+				
+				if ((res = reiser4_tree_growup(tree))) {
+					reiser4_node_unlock(save.node);
+					return res;
+				}
+
+				tree_next_child_pos(old_root, &aplace);
+			}
+
+			/* Attach new node to tree if it is not empty. */
+			if ((res = reiser4_tree_attach_node(tree, node,
+							    &aplace,
+							    SF_DEFAULT)))
+			{
+				reiser4_node_unlock(save.node);
+				return res;
+			}
+
+			reiser4_node_unlock(save.node);
+			/* Update the parent to the just attached node's parent.
+			   Needed as @save.node may be detached already. */
+			aal_memcpy(parent, &node->p, sizeof(*parent));
+		} else {
+			/* As node was not attached here, it will be attached in
+			   caller function, so we needd to update @parent by
+			   coord of attach. */
+
+			aal_memcpy(parent, &aplace, sizeof(aplace));
+		}
+		
+		/* If we are still in the same node, but on not-esistent 
+		   anymore item, set unit position to MAX_UINT32. */
+		if (save.node == place->node && place->pos.item >= left_items) {
+			aal_assert("vpf-1793", place->pos.unit == MAX_UINT32);
+		}
+	
+		/* Checking if it is enough of space in @place. */
+		enough = tree_calc_space(place, ioverh);
+
+		if (enough < (int32_t)ilen && save.node != place->node) {
+			aal_bug("vpf-1796", "When the insertion point is "
+				"moved to the new node, it is the second "
+				"node allocation and there must be enother "
+				"space.");
+		}
+
+		/* Releasing new allocated @node if it is empty and insert point
+		   is not inside it. */
+		if (reiser4_node_items(node) == 0 && node != place->node)
+			reiser4_tree_release_node(tree, node);
+		
+		/* Releasing save.@node if it is empty and insert point is not
+		   inside it. */
+		if (left_items == 0 && save.node != place->node) {
+			aal_bug("vpf-1795", "The insert point cannot "
+				"move to the new node with all items.");
+		}
+	}
+
+	return enough;
+}
+
+/* Packs node in @place by means of using shift to left. */
+errno_t reiser4_tree_shrink(reiser4_tree_t *tree, reiser4_place_t *place) {
+	errno_t res;
+	uint32_t flags;
+	reiser4_node_t *left, *right;
+
+	aal_assert("umka-1784", tree != NULL);
+	aal_assert("umka-1783", place != NULL);
+
+	/* Shift flags to be used in packing. */
+	flags = (SF_ALLOW_LEFT | SF_ALLOW_MERGE);
+	
+	/* Packing node in order to keep the tree in well packed state
+	   anyway. Here we will shift data from the target node to its left
+	   neighbour node. */
+	if ((left = reiser4_tree_ltrt_node(tree, place->node, DIR_LEFT))) {
+		if ((res = reiser4_tree_shift(tree, place, left, flags))) {
+			aal_error("Can't pack node %llu into left.",
+				  (unsigned long long)place_blknr(place));
+			return res;
+		}
+	}
+		
+	if (reiser4_node_items(place->node) > 0) {
+		/* Shifting the data from the right neigbour node into the
+		   target node. */
+		if ((right = reiser4_tree_ltrt_node(tree, place->node,
+						    DIR_RIGHT)))
+		{
+			reiser4_place_t bogus;
+
+			reiser4_place_assign(&bogus, right, 0, MAX_UINT32);
+	    
+			if ((res = reiser4_tree_shift(tree, &bogus,
+						      place->node, flags)))
+			{
+				aal_error("Can't pack node %llu into right.",
+					  (unsigned long long)right->block->nr);
+				return res;
+			}
+
+			/* Check if @bogus.node got empty. If so -- it will be
+			   released from tree and tree cache. */
+			if (reiser4_node_items(bogus.node) == 0) {
+				if (reiser4_node_locked(bogus.node)) {
+					bogus.node->flags |= NF_HEARD_BANSHEE;
+				}else {
+					reiser4_tree_discard_node(tree, bogus.node);
+				}
+			}
+		}
+	} else {
+		/* Release node, because it got empty. */
+		if (reiser4_node_locked(place->node)) {
+			place->node->flags |= NF_HEARD_BANSHEE;
+		} else {
+			if ((res = reiser4_tree_discard_node(tree, place->node)))
+				return res;
+				
+			place->node = NULL;
+		}
+	}
+
+	/* Drying tree up in the case root node has only one item. */
+	if (tree->root && reiser4_tree_singular(tree) &&
+	    !reiser4_tree_minimal(tree))
+	{
+		if ((res = reiser4_tree_dryout(tree)))
+			return res;
+	}
+
+	return 0;
+}
+
+/* Splits out the tree from passed @place up until passed @level is
+   reached. This is used in fsck and in extents write code. */
+static errno_t reiser4_tree_split(reiser4_tree_t *tree, 
+				  reiser4_place_t *place,
+				  uint8_t level)
+{
+	errno_t res;
+	uint32_t flags;
+	uint32_t clevel;
+	reiser4_node_t *node;
+	
+	aal_assert("vpf-674", level > 0);
+	aal_assert("vpf-672", tree != NULL);
+	aal_assert("vpf-673", place != NULL);
+	aal_assert("vpf-813", place->node != NULL);
+
+	clevel = reiser4_node_get_level(place->node);
+	aal_assert("vpf-680", clevel < level);
+
+	/* Loop until desired @level is reached.*/
+	while (clevel < level) {
+		aal_assert("vpf-676", place->node->p.node != NULL);
+
+		/* Check if @place points inside node. That is should we split
+		   node or not. */
+		if (!reiser4_place_leftmost(place) &&
+		    !reiser4_place_rightmost(place))
+		{
+			reiser4_place_t aplace;
+			
+			/* We are not on the border, split @place->node. That is
+			   allocate new right neighbour node and move all item
+			   right to @place->pos to new allocated node. */
+			if (!(node = reiser4_tree_alloc_node(tree, clevel))) {
+				aal_error("Tree failed to allocate "
+					  "a new node.");
+				return -EINVAL;
+			}
+
+			/* Flags allowed to be used during shift. */
+			flags = (SF_ALLOW_RIGHT | SF_UPDATE_POINT |
+				 SF_ALLOW_MERGE);
+
+			/* Perform shift from @place->node to @node. */
+			if ((res = reiser4_tree_shift(tree, place, node,
+						      flags)))
+			{
+				aal_error("Tree failed to shift into a "
+					  "new allocated node.");
+				goto error_free_node;
+			}
+
+			aal_assert("umka-3048", reiser4_node_items(node) > 0);
+			
+			reiser4_node_lock(place->node);
+
+			/* Check if we should grow up the tree. */
+			if (reiser4_tree_root_node(tree, place->node)) {
+				reiser4_node_t *old_root = tree->root;
+				
+				if ((res = reiser4_tree_growup(tree))) {
+					reiser4_node_unlock(place->node);
+					goto error_free_node;
+				}
+
+				tree_next_child_pos(old_root, &aplace);
+			} else
+				tree_next_child_pos(place->node, &aplace);
+
+			/* Attach new node to tree. */
+			if ((res = reiser4_tree_attach_node(tree, node,
+							    &aplace,
+							    SF_DEFAULT)))
+			{
+				aal_error("Tree is failed to attach "
+					  "node during split opeartion.");
+				reiser4_node_unlock(place->node);
+				goto error_free_node;
+			}
+			
+			reiser4_node_unlock(place->node);
+
+			/* Updating @place by parent coord from @place. */
+			aal_memcpy(place, &node->p, sizeof(*place));
+		} else {
+			int rightmost = reiser4_place_rightmost(place);
+			
+			/* There is nothing to move out. We are on node border
+			   (rightmost or leftmost). Here we should just go up by
+			   one level and increment position if @place was at
+			   rightmost position in the node. */
+			aal_memcpy(place, &place->node->p, sizeof(*place));
+
+			if (rightmost) {
+				bool_t whole;
+				
+				whole = (place->pos.unit == MAX_UINT32);
+				reiser4_place_inc(place, whole);
+			}
+		}
+
+		clevel++;
+	}
+	
+	return 0;
+	
+ error_free_node:
+	reiser4_tree_release_node(tree, node);
+	return res;
+}
+
+/* This grows tree until requested level reached. */
+static inline errno_t tree_growup_level(reiser4_tree_t *tree,
+					uint8_t level)
+{
+	if (level <= reiser4_tree_get_height(tree))
+		return 0;
+	
+	if (reiser4_tree_fresh(tree))
 		return -EINVAL;
+		
+	while (level > reiser4_tree_get_height(tree)) {
+		errno_t res;
+		
+		if ((res = reiser4_tree_growup(tree)))
+			return res;
+	}
+		
+	return 0;
+}
+
+/* This function prepares the tree for insert. That is it allocated root and
+   first leaf if needed, splits the tree, etc. */
+static inline errno_t tree_prep_modify(reiser4_tree_t *tree,
+				       reiser4_place_t *parent,
+				       reiser4_place_t *place,
+				       uint8_t level)
+{
+	reiser4_node_t *root;
+	uint32_t height;
+	errno_t res;
+
+	/* Check if tree has at least one node. If so -- load root node. Tree
+	   has not nodes just after it is created. Root node and first leaf will
+	   be created on demand then. */
+	if (!reiser4_tree_fresh(tree)) {
+		aal_assert("umka-3124", place->node != NULL);
+		
+		reiser4_node_lock(place->node);
+		
+		if ((res = reiser4_tree_load_root(tree))) {
+			reiser4_node_unlock(place->node);
+			return res;
+		}
+
+		reiser4_node_unlock(place->node);
+	}
+
+	/* Checking if we have the tree with height less than requested
+	   level. If so, we should grow the tree up to requested level. */
+	if (level > reiser4_tree_get_height(tree)) {
+		reiser4_node_lock(place->node);
+
+		if ((res = tree_growup_level(tree, level))) {
+			reiser4_node_unlock(place->node);
+			return res;
+		}
+
+		reiser4_node_unlock(place->node);
+	}
+
+	if (!reiser4_tree_fresh(tree)) {
+		if (level < reiser4_node_get_level(place->node)) {
+			aal_memcpy(parent, place, sizeof(*place));
+			
+			/* Allocating node of requested level and assign place
+			   for insert to it. This is the case, when we insert a
+			   tail among extents. That is previous lookup stoped on
+			   twig level and now we have to allocate a node of
+			   requested level, insert tail to it and then attach
+			   new node to tree. */
+			if (!(place->node = reiser4_tree_alloc_node(tree, level)))
+				return -ENOSPC;
+
+			POS_INIT(&place->pos, 0, MAX_UINT32);
+		} else {
+			if (level > reiser4_node_get_level(place->node)) {
+				/* Prepare the tree for insertion at the @level. 
+				   Here is case when extent is going to inserted.
+				   As lookup goes to the leaf level, we split 
+				   tree from leaf level up to requested @level,
+				   which is level new extent should be inserted. */
+				if ((res = reiser4_tree_split(tree, place, level)))
+					return res;
+			}
+
+			/* Here we do not need to update @parent, as there is no
+			   new not attached nodes. */
+		}
+	} else {
+		aal_assert("umka-3055", place->node == NULL);
+		
+		/* Preparing tree for insert first item (allocating root,
+		   etc). */
+		height = reiser4_tree_get_height(tree);
+
+		if (!(root = reiser4_tree_alloc_node(tree, height)))
+			return -ENOSPC;
+
+		if ((res = reiser4_tree_assign_root(tree, root)))
+			return res;
+
+		if (level == reiser4_node_get_level(root)) {
+			place->node = root;
+		} else {
+			if (!(place->node = reiser4_tree_alloc_node(tree, level)))
+				return -ENOMEM;
+		}
+	
+		POS_INIT(&place->pos, 0, MAX_UINT32);
+		reiser4_place_init(parent, root, &place->pos);
+	}
+	
+	return 0;
+}
+
+static inline errno_t tree_post_modify(reiser4_tree_t *tree, 
+				       reiser4_place_t *place) 
+{
+	uint32_t items;
+	errno_t res;
+
+	/* Nothing to be done if no item is left in the node. */
+	if (!(items = reiser4_node_items(place->node)))
+		return 0;
 
-	/* Rasing up the root node if it exists. */
-	if ((res = reiser4_tree_load_root(tree)))
+	/* Initializing insert point place. */
+	if ((res = reiser4_place_fetch(place)))
 		return res;
 
-	old_root = tree->root;
-	
-	/* Getting new root as the first child of the old root node. */
-	reiser4_place_assign(&place, old_root, 0, 0);
+	/* Parent keys will be updated if we inserted item/unit into leftmost
+	   pos and if target node has parent. */
+	if (reiser4_place_leftmost(place) && place->node->p.node) {
+		/* We will not update keys if node is not attached to tree
+		   yet. This will be done later on its attach. */
+		reiser4_place_t *parent = &place->node->p;
+		reiser4_key_t lkey;
 
-	if (!(new_root = reiser4_tree_child_node(tree, &place))) {
-		aal_error("Can't load new root during "
-			  "drying tree out.");
-		return -EINVAL;
-	}
+		reiser4_item_get_key(place, &lkey);
 
-	/* Detaching new root from its parent (old_root). This will also release
-	   parent node from tree, as it will be empty. */
-	if ((res = reiser4_tree_detach_node(tree, new_root,
-					    SF_DEFAULT)))
-	{
-		aal_error("Can't detach new root from "
-			  "tree during tree drying out.");
-		return res;
+		if ((res = reiser4_tree_update_keys(tree, parent, &lkey)))
+			return res;
 	}
 
-	/* Assign new root node. Setting tree height to new root level and root
-	   block number to new root block number. */
-	if ((res = reiser4_tree_assign_root(tree, new_root))) {
-		aal_error("Can't assign new root node "
-			  "durring tree drying out.");
-		return res;
+	/* Update @place->node children's parent pointers. */
+	if (reiser4_node_get_level(place->node) > LEAF_LEVEL) {
+		if ((res = reiser4_tree_update_node(tree, place->node, 
+						    place->pos.item, items)))
+		{
+			return res;
+		}
 	}
-
+	
 	return 0;
 }
 
-/* Tries to shift items and units from @place to passed @neig node. After that
-   it's finished, place will contain new insert point, which may be used for
-   inserting item/unit to it. */
-errno_t reiser4_tree_shift(reiser4_tree_t *tree, reiser4_place_t *place,
-			   reiser4_node_t *neig, uint32_t flags)
+/* Main function for tree modifications. It is used for inserting data to tree
+   (stat data items, directries) or writting (tails, extents). */
+int64_t reiser4_tree_modify(reiser4_tree_t *tree, reiser4_place_t *place,
+			    trans_hint_t *hint, uint8_t level,
+			    estimate_func_t estimate_func,
+			    modify_func_t modify_func)
 {
 	errno_t res;
-	reiser4_node_t *node;
-	reiser4_node_t *right;
+	int32_t space;
+	int32_t write;
+	reiser4_place_t parent;
 
-	shift_hint_t hint;
-	reiser4_key_t lkey;
+	aal_assert("umka-2673", tree != NULL);
+	aal_assert("umka-2674", hint != NULL);
+	aal_assert("umka-1645", hint->plug != NULL);
+	aal_assert("umka-1644", place != NULL);
 	
-	uint8_t start;
-
-	aal_assert("umka-1225", tree != NULL);
-	aal_assert("umka-1226", place != NULL);
-	aal_assert("umka-1227", neig != NULL);
-    
-	aal_memset(&hint, 0, sizeof(hint));
-
-	/* Prepares shift hint. Initializing shift flags (shift direction, is it
-	   allowed to create new nodes, etc) and insert point. */
-	node = place->node;
-	hint.control = flags;
-	hint.pos = place->pos;
+	aal_assert("umka-2676", modify_func != NULL);
+	aal_assert("umka-2675", estimate_func != NULL);
 
-	/* Needed for the left shift. */
-	start = reiser4_node_items(neig);
-	start = start ? start - 1 : 0;
-	
-	/* Perform node shift from @node to @neig. */
-	if ((res = reiser4_node_shift(node, neig, &hint)))
+	/* Preparing the tree modification. This may include splitting, 
+	   allocating root, etc. */
+	if ((res = tree_prep_modify(tree, &parent, place, level)))
 		return res;
 
-	/* Check if insert point was moved to neighbour node. If so, assign
-	   neightbour node to insert point coord. */
-	if (hint.result & SF_MOVE_POINT)
-		place->node = neig;
-
-	/* Updating @place->pos by hint->pos if there is permission flag. */
-	if (hint.control & SF_UPDATE_POINT)
-		place->pos = hint.pos;
-
-	right = (hint.control & SF_ALLOW_LEFT) ? node : neig;
-
-	/* Check if we need update key in insert part of tree. That is if source
-	   node is not empty and there was actually moved at least one item or
-	   unit. */
-	if (reiser4_node_items(right) > 0 && hint.update) {
-		/* Check if node is connected to tree or it is not root and
-		   updating left delimiting keys if it makes sense at all. */
-		if (right->p.node != NULL) {
-			reiser4_place_t parent;
+	/* Estimating item/unit to inserted/written to tree. */
+	if ((res = estimate_func(place, hint)))
+		return res;
+	
+	/* Preparing space in tree. */
+	space = reiser4_tree_expand(tree, place, &parent, hint->len, 
+				    hint->overhead, hint->shift_flags);
+	
+	/* Needed space is the length of the item + an item overhead on 
+	   the item creation if needed. */
+	if (place->pos.unit != MAX_UINT32)
+		hint->overhead = 0;
 
-			/* Getting leftmost key from @right. */
-			reiser4_node_leftmost_key(right, &lkey);
+	if (space < 0) {
+		aal_error("Can't prepare space in tree.");
+		return space;
+	} else {
+		/* Checking if we still have less space than needed. This is
+		   ENOSPC case if we tried to insert data. */
+		if (space < hint->len)
+			return -ENOSPC;
+	}
 
-			/* Recursive updating of all internal keys that supposed
-			   to be updated. */
-			aal_memcpy(&parent, &right->p, sizeof(parent));
-				
-			if ((res = reiser4_tree_update_keys(tree, &parent, &lkey)))
-				return res;
-		}
+	reiser4_node_lock(place->node);
+	
+	/* Inserting/writing data to node. */
+	if ((write = modify_func(place->node, &place->pos, hint)) < 0) {
+		aal_error("Can't insert data to node %llu.",
+			  (unsigned long long)place_blknr(place));
+		return write;
 	}
+	
+	reiser4_node_unlock(place->node);
 
-	/* Updating @node and @neig children's parent position. */
-	if (reiser4_node_get_level(node) > LEAF_LEVEL) {
-		reiser4_node_t *left = (hint.control & SF_ALLOW_LEFT) ? neig : NULL;
+	if ((res = tree_post_modify(tree, place)))
+		return res;
+	
+        /* If make space function allocates new node, we should attach it to the
+	   tree. Also, here we should handle the special case, when tree root
+	   should be changed. */
+	if (place->node != tree->root && !place->node->p.node) {
+		/* Check if insert was on root node level. If so -- growing tree
+		   up by one. */
+		if (level == reiser4_tree_get_height(tree)) {
+			reiser4_node_t *old_root = tree->root;
+			
+			reiser4_node_lock(place->node);
 
-		if (left && reiser4_node_items(left) > 0) {
-			if ((res = reiser4_tree_update_node(tree, left, start, 
-							    reiser4_node_items(left))))
-			{
+			if ((res = reiser4_tree_growup(tree))) {
+				aal_error("Can't grow tree up during "
+					  "modifying it.");
+				reiser4_node_unlock(place->node);
 				return res;
 			}
+			
+			reiser4_node_unlock(place->node);
+
+			/* Handling tree growth case. */
+			tree_next_child_pos(old_root, &parent);
 		}
-	
-		if (reiser4_node_items(right) > 0) {
-			if ((res = reiser4_tree_update_node(tree, right, 0, 
-							    reiser4_node_items(right))))
-			{
-				return res;
-			}
+		
+		/* Attaching new node to the tree. */
+		if ((res = reiser4_tree_attach_node(tree, place->node, &parent,
+						    hint->shift_flags)))
+		{
+			aal_error("Can't attach node %llu to tree.",
+				  (unsigned long long)place_blknr(place));
+			return res;
 		}
 	}
-	
-	return 0;
-}
-
-/* Shifts data from passed @place to one of neighbour nodes basing on passed
-   @flags. */
-static errno_t tree_shift_todir(reiser4_tree_t *tree, reiser4_place_t *place,
-				uint32_t flags, int direction)
-{
-	errno_t res;
-	uint32_t shift_flags = 0;
-	reiser4_node_t *neighbour;
-	reiser4_node_t *old_node;
 
-	if (direction == DIR_LEFT && (SF_ALLOW_LEFT & flags))
-		shift_flags = SF_ALLOW_LEFT;
+	/* Calling @hint->place_func if a new item was created. */
+	if (hint->place_func && place->pos.unit == MAX_UINT32) {
+		if ((res = hint->place_func(place, hint->data)))
+			return res;
+	}
 
-	if (direction == DIR_RIGHT && (SF_ALLOW_RIGHT & flags))
-		shift_flags = SF_ALLOW_RIGHT;
+	return write;
+}
 
-	/* Setting up shift flags. */
-	shift_flags |= SF_UPDATE_POINT;
+/* Estimates how many bytes is needed to insert data described by @hint. */
+static errno_t cb_tree_prep_insert(reiser4_place_t *place, trans_hint_t *hint) {
+	aal_assert("umka-2440", hint != NULL);
+	aal_assert("umka-2439", place != NULL);
 
-	if (SF_ALLOW_MERGE & flags)
-		shift_flags |= SF_ALLOW_MERGE;
-	
-	if (SF_HOLD_POS & flags)
-		shift_flags |= SF_HOLD_POS;
+	hint->len = 0;
+	hint->overhead = 0;
 
-	old_node = place->node;
+	return plugcall(hint->plug->object, prep_insert, place, hint);
+}
 
-	/* Getting neighbour. */
-	neighbour = direction == DIR_LEFT ?
-		place->node->left : place->node->right;
+static errno_t cb_tree_insert(reiser4_node_t *node, pos_t *pos, 
+			      trans_hint_t *hint) 
+{
+	return objcall(node, insert, pos, hint);
+}
 
-	aal_assert("umka-3096", neighbour != NULL);
-	
-	/* Shift items from @place to @left neighbour. */
-	if ((res = reiser4_tree_shift(tree, place, neighbour, shift_flags)))
-		return res;
+/* Inserts data to the tree. This function is used for inserting items which are
+   not file body items, that is statdata, directory, etc. */
+int64_t reiser4_tree_insert(reiser4_tree_t *tree, reiser4_place_t *place,
+			    trans_hint_t *hint, uint8_t level)
+{
+	return reiser4_tree_modify(tree, place, hint, level, 
+				   cb_tree_prep_insert, cb_tree_insert);
+}
 
-	if (reiser4_node_items(old_node) == 0 &&
-	    old_node != place->node)
-	{
-		if (reiser4_node_locked(old_node)) {
-			old_node->flags |= NF_HEARD_BANSHEE;
-		} else {
-			reiser4_node_lock(place->node);
-			
-			if ((res = reiser4_tree_discard_node(tree, old_node))) {
-				reiser4_node_unlock(place->node);
-				return res;
-			}
+/* Estimates how many bytes is needed to write data described by @hint. */
+static errno_t cb_tree_prep_write(reiser4_place_t *place, trans_hint_t *hint) {
+	aal_assert("umka-3007", hint != NULL);
+	aal_assert("umka-3008", place != NULL);
 
-			reiser4_node_unlock(place->node);
-		}
-	}
+	hint->len = 0;
+	hint->overhead = 0;
 
-	return 0;
+	return plugcall(hint->plug->object, prep_write, place, hint);
 }
 
-/* This calculates if space in passed @needed is enough for passed @needed. */
-static inline int32_t tree_calc_space(reiser4_place_t *place, 
-				      uint32_t ioverh) 
+static errno_t cb_tree_write(reiser4_node_t *node, 
+			     pos_t *pos, trans_hint_t *hint) 
 {
-	uint32_t overh = reiser4_node_overhead(place->node);
-	
-	return reiser4_node_space(place->node) - 
-		(place->pos.unit == MAX_UINT32 ? (overh + ioverh) : 0);
+	return objcall(node, write, pos, hint);
 }
 
-/* Makes space in tree to insert @ilen bytes of data. Returns space in insert
-   point, or negative value for errors. */
-int32_t reiser4_tree_expand(reiser4_tree_t *tree, reiser4_place_t *place,
-			    reiser4_place_t *parent, uint32_t ilen, 
-			    uint32_t ioverh, uint32_t flags)
+int64_t reiser4_tree_write(reiser4_tree_t *tree, reiser4_place_t *place,
+			   trans_hint_t *hint, uint8_t level)
+{
+	return reiser4_tree_modify(tree, place, hint, level,
+				   cb_tree_prep_write, cb_tree_write);
+}
+
+/* Removes item/unit at @place. */
+errno_t reiser4_tree_remove(reiser4_tree_t *tree, 
+			    reiser4_place_t *place,
+			    trans_hint_t *hint)
 {
-	int alloc;
 	errno_t res;
-	uint8_t level;
-	int32_t enough;
 
-	aal_assert("umka-929", tree != NULL);
-	aal_assert("umka-766", place != NULL);
-	
-	aal_assert("umka-3064", place->node != NULL);
-	aal_assert("vpf-1543", ilen + ioverh <= 
-		   reiser4_node_maxspace(place->node));
+	aal_assert("umka-2055", tree != NULL);
+	aal_assert("umka-2056", place != NULL);
+	aal_assert("umka-2392", hint != NULL);
 
-	if (reiser4_tree_fresh(tree))
-		return -EINVAL;
+	/* Removing iten/unit from the node. */
+	if ((res = reiser4_node_remove(place->node, &place->pos, hint)))
+		return res;
 
-	/* Check if there is enough space in insert point node. If so -- do
-	   nothing but exit. Here is also check if node is empty. Then we exit
-	   too and return available space in it. */
-	if ((enough = tree_calc_space(place, ioverh)) >= (int32_t)ilen)
-		return enough;
+	if ((res = tree_post_modify(tree, place)))
+		return res;
+	
+	/* Checking if the node became empty. If so, we release it, otherwise we
+	   pack the tree about it. */
+	if (reiser4_node_items(place->node) == 0) {
+		if (reiser4_node_locked(place->node)) {
+			place->node->flags |= NF_HEARD_BANSHEE;
+		} else {
+			if ((res = reiser4_tree_discard_node(tree, place->node)))
+				return res;
 
-	/* Shifting data into left neighbour if it exists and left shift
-	   allowing flag is specified. */
-	if ((SF_ALLOW_LEFT & flags) && 
-	    reiser4_tree_ltrt_node(tree, place->node, DIR_LEFT)) 
-	{
-		if ((res = tree_shift_todir(tree, place, flags, DIR_LEFT)))
-			return res;
-		
-		if ((enough = tree_calc_space(place, ioverh)) >= (int32_t)ilen)
-			return enough;
+			place->node = NULL;
+		}
+	} else {
+		if (hint->shift_flags & SF_ALLOW_PACK) {
+			if ((res = reiser4_tree_shrink(tree, place)))
+				return res;
+		}
 	}
 
-	/* Shifting data into right neighbour if it exists and right shift
-	   allowing flag is specified. */
-	if ((SF_ALLOW_RIGHT & flags) && 
-	    reiser4_tree_ltrt_node(tree, place->node, DIR_RIGHT)) 
+	/* Drying tree up in the case root node exists and tree is singular,
+	   that is has only one item. Tree also should not be minimal of
+	   height. Here root may be NULL due to nested call from
+	   tree_dryout(). */
+	if (tree->root && reiser4_tree_singular(tree) && 
+	    !reiser4_tree_minimal(tree) && (hint->shift_flags & SF_ALLOW_PACK))
 	{
-		if ((res = tree_shift_todir(tree, place, flags, DIR_RIGHT)))
+		if ((res = reiser4_tree_dryout(tree)))
 			return res;
-		
-		if ((enough = tree_calc_space(place, ioverh)) >= (int32_t)ilen)
-			return enough;
 	}
-
-	/* Check if we allowed to allocate new nodes if there still not enough
-	   of space for insert @ilen bytes of data to tree. */
-	if (!(SF_ALLOW_ALLOC & flags))
-		return tree_calc_space(place, ioverh);
 	
-	/* Here we still have not enough free space for inserting item/unit into
-	   the tree. Allocating new nodes and trying to shift data into
-	   them. There are possible two tries to allocate new node and shift
-	   insert point to one of them. */
-	for (alloc = 0; enough < (int32_t)ilen && alloc < 2; alloc++) {
-		reiser4_place_t save;
-		reiser4_node_t *node;
-		uint32_t shift_flags;
-		uint32_t left_items;
-		reiser4_place_t aplace;
-
-		/* Saving place as it will be usefull for us later */
-		aal_memcpy(&save, place, sizeof(*place));
+	return 0;
+}
 
-		/* Allocating new node of @level */
-		level = reiser4_node_get_level(place->node);
+/* Traverses @node with passed callback functions as actions. */
+errno_t reiser4_tree_trav_node(reiser4_tree_t *tree,
+			       reiser4_node_t *node,
+			       tree_open_func_t open_func,
+			       node_func_t before_func,
+			       place_func_t update_func,
+			       node_func_t after_func,
+			       void *data)
+{
+	errno_t res = 0;
+	tree_prefetch_t pf;
+	reiser4_place_t place;
+	pos_t *pos = &place.pos;
+ 
+	aal_assert("vpf-390", node != NULL);
+	aal_assert("umka-1935", tree != NULL);
 
-		if (!(node = reiser4_tree_alloc_node(tree, level)))
-			return -ENOSPC;
+	aal_memset(&pf, 0, sizeof(pf));
+	
+	if (open_func == NULL)
+		open_func = (tree_open_func_t)reiser4_tree_child_node;
 
-		/* reiser4_place_leftmost cannot be used here because unit == 
-		   0 mean we should stay on this item -- writing to the extent
-		   with holes or inserting a SD extention. */
-		if (place->pos.unit == MAX_UINT32 && place->pos.item == 0) {
-			/* Do not shift anything for the leftmost position.
-			   Just insert the new node and move the insert point
-			   there. */
-			aal_memcpy(&aplace, &place->node->p, sizeof(aplace));
-			place->node = node;
-			place->pos.item = 0;
-			place->pos.unit = MAX_UINT32;
-		} else {
-			/* Setting up shift flags. */
-			shift_flags = (SF_ALLOW_RIGHT | SF_UPDATE_POINT);
+	/* Locking @node to make sure, that it will not be released while we are
+	   working with it. Of course, it should be unlocked after we
+	   finished. */
+	reiser4_node_lock(node);
 
-			if (SF_ALLOW_MERGE & flags)
-				shift_flags |= SF_ALLOW_MERGE;
+	if ((before_func && (res = before_func(node, data))))
+		goto error_unlock_node;
 
-			if (SF_HOLD_POS & flags)
-				shift_flags |= SF_HOLD_POS;
-			
-			/* We will allow to move insert point to neighbour node 
-			   if we at first iteration in this loop or if place 
-			   points behind the last unit of last item in current 
-			   node. */
-			if (alloc > 0 || reiser4_place_rightmost(place))
-				shift_flags |= SF_MOVE_POINT;
+	/* Children are read in advance in the disk order rather than one by
+	   one in the key order. Failing to prefetch is not fatal. */
+	if (reiser4_node_get_level(node) > LEAF_LEVEL &&
+	    !reiser4_tree_prefetch_init(tree, node, &pf))
+	{
+		pf.prev = tree->prefetch;
+		tree->prefetch = &pf;
+	}
 
-			/* Shift data from @place to @node. Updating @place by 
-			   new insert point. */
-			if ((res = reiser4_tree_shift(tree, place, node, 
-						      shift_flags)))
-			{
-				return res;
-			}
+	/* The loop though the items of current node */
+	for (pos->item = 0; pos->item < reiser4_node_items(node);
+	     pos->item++)
+	{
+		pos->unit = MAX_UINT32; 
 
-			/* Preparing new @node parent place. */
-			tree_next_child_pos(save.node, &aplace);
+		/* If there is a suspicion of a corruption, it must be checked
+		   in before_func. All items must be opened here. */
+		if (reiser4_place_open(&place, node, pos)) {
+			aal_error("Node (%llu), item (%u): Can't open item "
+				  "by place.",
+				  (unsigned long long)node->block->nr,
+				  pos->item);
+			goto error_after_func;
 		}
-		
-		left_items = reiser4_node_items(save.node);
-		
-		if (left_items == 0) {
-			reiser4_node_lock(save.node);
 
-			/* If evth was moved to the new allocated node, it will
-			   be attached below. Do not pack the tree here, avoid
-			   2 balancings. */
-			shift_flags = SF_DEFAULT & ~SF_ALLOW_PACK;
-			
-			if ((res = reiser4_tree_detach_node(tree, save.node,
-							    shift_flags)))
-			{
-				reiser4_node_unlock(save.node);
-				return res;
-			}
+		if (!reiser4_item_branch(place.plug))
+			continue;
 
-			reiser4_node_unlock(save.node);
-			aplace.pos.item--;
-		}
-		
-		if (reiser4_node_items(node) > 0) {
-			reiser4_node_lock(save.node);
+		/* The loop though the units of the current item */
+		for (pos->unit = 0; pos->unit < reiser4_item_units(&place);
+		     pos->unit++)
+		{
+			reiser4_node_t *child = NULL;
 			
-			/* Growing tree in the case we splitted the root
-			   node. */
-			if (reiser4_tree_root_node(tree, save.node)) {
-				reiser4_node_t *old_root = tree->root;
-				
-				if ((res = reiser4_tree_growup(tree))) {
-					reiser4_node_unlock(save.node);
-					return res;
-				}
-
-				tree_next_child_pos(old_root, &aplace);
-			}
+			/* Opening the node by its pointer kept in @place */
+			if ((child = open_func(tree, &place, data)) == INVAL_PTR)
+				goto error_after_func;
 
-			/* Attach new node to tree if it is not empty. */
-			if ((res = reiser4_tree_attach_node(tree, node,
-							    &aplace,
-							    SF_DEFAULT)))
+			if (!child)
+				goto update;
+
+			/* Traversing the node */
+			if ((res = reiser4_tree_trav_node(tree, child, open_func, 
+							  before_func, update_func, 
+							  after_func, data)) < 0)
 			{
-				reiser4_node_unlock(save.node);
-				return res;
+				goto error_after_func;
 			}
-
-			reiser4_node_unlock(save.node);
-			/* Update the parent to the just attached node's parent.
-			   Needed as @save.node may be detached already. */
-			aal_memcpy(parent, &node->p, sizeof(*parent));
-		} else {
-			/* As node was not attached here, it will be attached in
-			   caller function, so we needd to update @parent by
-			   coord of attach. */
-
-			aal_memcpy(parent, &aplace, sizeof(aplace));
-		}
-		
-		/* If we are still in the same node, but on not-esistent 
-		   anymore item, set unit position to MAX_UINT32. */
-		if (save.node == place->node && place->pos.item >= left_items) {
-			aal_assert("vpf-1793", place->pos.unit == MAX_UINT32);
+			
+		update:	
+			if (update_func && (res = update_func(&place, data)))
+				goto error_after_func;
 		}
+	}
 	
-		/* Checking if it is enough of space in @place. */
-		enough = tree_calc_space(place, ioverh);
+	reiser4_tree_prefetch_fini(tree, &pf);
 
-		if (enough < (int32_t)ilen && save.node != place->node) {
-			aal_bug("vpf-1796", "When the insertion point is "
-				"moved to the new node, it is the second "
-				"node allocation and there must be enother "
-				"space.");
-		}
+	if (after_func)
+		res = after_func(node, data);
 
-		/* Releasing new allocated @node if it is empty and insert point
-		   is not inside it. */
-		if (reiser4_node_items(node) == 0 && node != place->node)
-			reiser4_tree_release_node(tree, node);
-		
-		/* Releasing save.@node if it is empty and insert point is not
-		   inside it. */
-		if (left_items == 0 && save.node != place->node) {
-			aal_bug("vpf-1795", "The insert point cannot "
-				"move to the new node with all items.");
-		}
-	}
+	reiser4_tree_unlock_node(tree, node);
+	return res;
 
-	return enough;
+ error_after_func:
+	reiser4_tree_prefetch_fini(tree, &pf);
+
+	if (after_func)
+		after_func(node, data);
+
+ error_unlock_node:
+	reiser4_tree_unlock_node(tree, node);
+	return res;
 }
 
-/* Packs node in @place by means of using shift to left. */
-errno_t reiser4_tree_shrink(reiser4_tree_t *tree, reiser4_place_t *place) {
+/* Traverses tree with passed callback functions for each event. This is used
+   for all tree traverse related operations like copy, measurements, etc. */
+errno_t reiser4_tree_trav(reiser4_tree_t *tree,
+			  tree_open_func_t open_func,
+			  node_func_t before_func,
+			  place_func_t update_func,
+			  node_func_t after_func,
+			  void *data)
+{
 	errno_t res;
-	uint32_t flags;
-	reiser4_node_t *left, *right;
-
-	aal_assert("umka-1784", tree != NULL);
-	aal_assert("umka-1783", place != NULL);
+	
+	aal_assert("umka-1768", tree != NULL);
 
-	/* Shift flags to be used in packing. */
-	flags = (SF_ALLOW_LEFT | SF_ALLOW_MERGE);
+	if ((res = reiser4_tree_load_root(tree)))
+		return res;
 	
-	/* Packing node in order to keep the tree in well packed state
-	   anyway. Here we will shift data from the target node to its left
-	   neighbour node. */
-	if ((left = reiser4_tree_ltrt_node(tree, place->node, DIR_LEFT))) {
-		if ((res = reiser4_tree_shift(tree, place, left, flags))) {
-			aal_error("Can't pack node %llu into left.",
-				  (unsigned long long)place_blknr(place));
-			return res;
+	return reiser4_tree_trav_node(tree, tree->root, open_func,
+				      before_func, update_func,
+				      after_func, data);
+}
+
+/* Looks @hint->key up in @node, the scan was at before the tree got modified,
+   and in its right neighbour. As @node was locked during modification, it is
+   still in memory, and if it is still attached to the tree and contains the
+   key, it is where the lookup from the root would come to. This allows to
+   avoid the lookup from the root on every scan restart. Returns PRESENT if the
+   key is found and @place is set to it, ABSENT if lookup is needed. */
+static lookup_t reiser4_tree_scan_cursor(reiser4_tree_t *tree,
+					 reiser4_node_t *node,
+					 lookup_hint_t *hint,
+					 reiser4_place_t *place)
+{
+	lookup_t res;
+	uint32_t i;
+
+	for (i = 0; i < 2 && node; i++, node = node->right) {
+		if (!reiser4_tree_attached_node(tree, node) ||
+		    !reiser4_node_items(node))
+		{
+			continue;
 		}
-	}
+
+		reiser4_place_assign(place, node, 0, MAX_UINT32);
 		
-	if (reiser4_node_items(place->node) > 0) {
-		/* Shifting the data from the right neigbour node into the
-		   target node. */
-		if ((right = reiser4_tree_ltrt_node(tree, place->node,
-						    DIR_RIGHT)))
+		if ((res = reiser4_node_lookup(node, hint, FIND_EXACT,
+					       &place->pos)) < 0)
 		{
-			reiser4_place_t bogus;
+			return res;
+		}
 
-			reiser4_place_assign(&bogus, right, 0, MAX_UINT32);
-	    
-			if ((res = reiser4_tree_shift(tree, &bogus,
-						      place->node, flags)))
-			{
-				aal_error("Can't pack node %llu into right.",
-					  (unsigned long long)right->block->nr);
-				return res;
-			}
+		if (res != PRESENT)
+			continue;
 
-			/* Check if @bogus.node got empty. If so -- it will be
-			   released from tree and tree cache. */
-			if (reiser4_node_items(bogus.node) == 0) {
-				if (reiser4_node_locked(bogus.node)) {
-					bogus.node->flags |= NF_HEARD_BANSHEE;
-				}else {
-					reiser4_tree_discard_node(tree, bogus.node);
-				}
-			}
-		}
-	} else {
-		/* Release node, because it got empty. */
-		if (reiser4_node_locked(place->node)) {
-			place->node->flags |= NF_HEARD_BANSHEE;
-		} else {
-			if ((res = reiser4_tree_discard_node(tree, place->node)))
-				return res;
-				
-			place->node = NULL;
-		}
-	}
+		if (reiser4_tree_collision_start(tree, place, hint->key))
+			return -EIO;
+		
+		if (reiser4_place_fetch(place))
+			return -EIO;
 
-	/* Drying tree up in the case root node has only one item. */
-	if (tree->root && reiser4_tree_singular(tree) &&
-	    !reiser4_tree_minimal(tree))
-	{
-		if ((res = reiser4_tree_dryout(tree)))
-			return res;
+		/* Key of some internal node, lookup will go down. */
+		if (reiser4_item_branch(place->plug))
+			return ABSENT;
+		
+		return PRESENT;
 	}
 
-	return 0;
+	return ABSENT;
 }
 
-/* Splits out the tree from passed @place up until passed @level is
-   reached. This is used in fsck and in extents write code. */
-static errno_t reiser4_tree_split(reiser4_tree_t *tree, 
-				  reiser4_place_t *place,
-				  uint8_t level)
+errno_t reiser4_tree_scan(reiser4_tree_t *tree, 
+			  node_func_t pre_func, 
+			  place_func_t func, 
+			  void *data) 
 {
-	errno_t res;
-	uint32_t flags;
-	uint32_t clevel;
-	reiser4_node_t *node;
-	
-	aal_assert("vpf-674", level > 0);
-	aal_assert("vpf-672", tree != NULL);
-	aal_assert("vpf-673", place != NULL);
-	aal_assert("vpf-813", place->node != NULL);
+        reiser4_node_t *cursor = NULL;
+        reiser4_key_t key, max;
+        errno_t res;
 
-	clevel = reiser4_node_get_level(place->node);
-	aal_assert("vpf-680", clevel < level);
+        aal_assert("vpf-1423", tree != NULL);
+        aal_assert("vpf-1424", func != NULL);
 
-	/* Loop until desired @level is reached.*/
-	while (clevel < level) {
-		aal_assert("vpf-676", place->node->p.node != NULL);
+        if (reiser4_tree_fresh(tree))
+                return -EINVAL;
 
-		/* Check if @place points inside node. That is should we split
-		   node or not. */
-		if (!reiser4_place_leftmost(place) &&
-		    !reiser4_place_rightmost(place))
-		{
-			reiser4_place_t aplace;
-			
-			/* We are not on the border, split @place->node. That is
-			   allocate new right neighbour node and move all item
-			   right to @place->pos to new allocated node. */
-			if (!(node = reiser4_tree_alloc_node(tree, clevel))) {
-				aal_error("Tree failed to allocate "
-					  "a new node.");
-				return -EINVAL;
-			}
+        if ((res = reiser4_tree_load_root(tree)))
+                return res;
 
-			/* Flags allowed to be used during shift. */
-			flags = (SF_ALLOW_RIGHT | SF_UPDATE_POINT |
-				 SF_ALLOW_MERGE);
+        if (tree->root == NULL)
+                return -EINVAL;
 
-			/* Perform shift from @place->node to @node. */
-			if ((res = reiser4_tree_shift(tree, place, node,
-						      flags)))
-			{
-				aal_error("Tree failed to shift into a "
-					  "new allocated node.");
-				goto error_free_node;
-			}
+        /* Prepare the start and the end keys. */
+        key.plug = max.plug = tree->key.plug;
+        reiser4_key_minimal(&key);
+        reiser4_key_maximal(&max);
+
+        /* While not the end of the tree. */
+        while (reiser4_key_compfull(&key, &max)) {
+                reiser4_place_t place;
+		reiser4_node_t *node;
+		lookup_hint_t hint;
+                lookup_t lookup;
+		pos_t *pos;
+
+                /* Some items can be handled a few times due to key 
+		   collisions. */
+		hint.key = &key;
+		hint.level = LEAF_LEVEL;
+		hint.collision = NULL;
+
+		/* Trying the node scan was at before restart first. */
+		lookup = ABSENT;
+		
+		if (cursor) {
+			lookup = reiser4_tree_scan_cursor(tree, cursor,
+							  &hint, &place);
+
+			if ((res = reiser4_tree_unlock_node(tree, cursor)))
+				return res;
+
+			cursor = NULL;
+			
+			if (lookup < 0)
+				return lookup;
+		}
+		
+                /* Lookup the key from the root. */
+                if (lookup != PRESENT && 
+		    (lookup = reiser4_tree_lookup(tree, &hint, FIND_EXACT,
+						  &place)) < 0)
+		{
+                        return lookup;
+		}
+
+		pos = &place.pos;
 
-			aal_assert("umka-3048", reiser4_node_items(node) > 0);
-			
-			reiser4_node_lock(place->node);
+		if (pre_func) {
+			if ((res = pre_func(place.node, data)) < 0)
+				return res;
+		
+			/* If res != 0, lookup is needed. */
+			if (res) continue;
+		}
+		
+		/* Count may get change in func (e.g. after item fusing), so 
+		   get it on every loop */
+		while (1) {
+			if (pos->item >= reiser4_node_items(place.node)) {
+				/* All items are handled whithin this node, but 
+				   lookup is not needed. To avoid infinite loop 
+				   in the case of key collision, get the next item 
+				   instead of another lookup call. */
+				if ((res = reiser4_tree_next_place(tree, &place,
+								   &place))) 
+				{
+					aal_error("Failed to get the next node.");
+					return res;
+				}
 
-			/* Check if we should grow up the tree. */
-			if (reiser4_tree_root_node(tree, place->node)) {
-				reiser4_node_t *old_root = tree->root;
+				if (!place.node)
+					return 0;
+			}
 				
-				if ((res = reiser4_tree_growup(tree))) {
-					reiser4_node_unlock(place->node);
-					goto error_free_node;
+                        if ((res = reiser4_place_fetch(&place)))
+                                return res;
+			
+			/* Go down to the child if branch. */
+			if ((res = reiser4_item_branch(place.plug))) {
+				if (!(place.node = 
+				      reiser4_tree_child_node(tree, &place)))
+				{
+					return -EIO;
 				}
+		
+				if (pre_func) {
+					if ((res = pre_func(place.node, 
+							    data)) < 0)
+					{
+						return res;
+					}
 
-				tree_next_child_pos(old_root, &aplace);
-			} else
-				tree_next_child_pos(place->node, &aplace);
+					/* If res != 0, lookup is needed. */
+					if (res) break;
+				}
 
-			/* Attach new node to tree. */
-			if ((res = reiser4_tree_attach_node(tree, node,
-							    &aplace,
-							    SF_DEFAULT)))
-			{
-				aal_error("Tree is failed to attach "
-					  "node during split opeartion.");
-				reiser4_node_unlock(place->node);
-				goto error_free_node;
+				place.pos.item = -1;
+				continue;
 			}
 			
-			reiser4_node_unlock(place->node);
+                        /* Get the key of the next item. */
+                        if ((res = reiser4_tree_next_key(tree, &place, &key)))
+                                return res;
 
-			/* Updating @place by parent coord from @place. */
-			aal_memcpy(place, &node->p, sizeof(*place));
-		} else {
-			int rightmost = reiser4_place_rightmost(place);
+                        /* Call func for the item. The node is locked to keep 
+			   it in memory for the case lookup will be needed. */
+			node = place.node;
+			reiser4_node_lock(node);
 			
-			/* There is nothing to move out. We are on node border
-			   (rightmost or leftmost). Here we should just go up by
-			   one level and increment position if @place was at
-			   rightmost position in the node. */
-			aal_memcpy(place, &place->node->p, sizeof(*place));
+                        if ((res = func(&place, data)) < 0) {
+				reiser4_tree_unlock_node(tree, node);
+                                return res;
+			}
 
-			if (rightmost) {
-				bool_t whole;
-				
-				whole = (place->pos.unit == MAX_UINT32);
-				reiser4_place_inc(place, whole);
+                        /* If res != 0 or the node got empty, lookup is 
+			   needed. */
+                        if (res || !reiser4_node_items(node)) {
+				cursor = node;
+				break;
 			}
-		}
 
-		clevel++;
-	}
-	
-	return 0;
+			if ((res = reiser4_tree_unlock_node(tree, node)))
+				return res;
+
+			pos->item++;
+                }
+        }
+
+	if (cursor)
+		return reiser4_tree_unlock_node(tree, cursor);
 	
- error_free_node:
-	reiser4_tree_release_node(tree, node);
-	return res;
+        return 0;
 }
 
-/* This grows tree until requested level reached. */
-static inline errno_t tree_growup_level(reiser4_tree_t *tree,
-					uint8_t level)
-{
-	if (level <= reiser4_tree_get_height(tree))
-		return 0;
-	
-	if (reiser4_tree_fresh(tree))
-		return -EINVAL;
-		
-	while (level > reiser4_tree_get_height(tree)) {
-		errno_t res;
-		
-		if ((res = reiser4_tree_growup(tree)))
-			return res;
-	}
-		
+/* Max number of blocks copied by one request in reiser4_tree_copy() and
+   reiser4_tree_resize(). */
+#define TREE_COPY_BLOCKS (256)
+
+static errno_t cb_clear_block(blk_t start, count_t width, void *data) {
+	reiser4_bitmap_clear_region((reiser4_bitmap_t *)data, start, width);
 	return 0;
 }
 
-/* This function prepares the tree for insert. That is it allocated root and
-   first leaf if needed, splits the tree, etc. */
-static inline errno_t tree_prep_modify(reiser4_tree_t *tree,
-				       reiser4_place_t *parent,
-				       reiser4_place_t *place,
-				       uint8_t level)
-{
-	reiser4_node_t *root;
-	uint32_t height;
-	errno_t res;
-
-	/* Check if tree has at least one node. If so -- load root node. Tree
-	   has not nodes just after it is created. Root node and first leaf will
-	   be created on demand then. */
-	if (!reiser4_tree_fresh(tree)) {
-		aal_assert("umka-3124", place->node != NULL);
-		
-		reiser4_node_lock(place->node);
-		
-		if ((res = reiser4_tree_load_root(tree))) {
-			reiser4_node_unlock(place->node);
-			return res;
-		}
+/* Returns the bitmap of blocks @tree lies in, that is formatted nodes and
+   extent data. These are used blocks which do not belong to any filesystem
+   metadata. */
+static reiser4_bitmap_t *reiser4_tree_blocks(reiser4_tree_t *tree) {
+	reiser4_bitmap_t *bitmap;
+	reiser4_fs_t *fs = tree->fs;
 
-		reiser4_node_unlock(place->node);
-	}
+	if (!(bitmap = reiser4_bitmap_create(reiser4_format_get_len(fs->format))))
+		return NULL;
 
-	/* Checking if we have the tree with height less than requested
-	   level. If so, we should grow the tree up to requested level. */
-	if (level > reiser4_tree_get_height(tree)) {
-		reiser4_node_lock(place->node);
+	if (reiser4_alloc_extract(fs->alloc, bitmap))
+		goto error_free_bitmap;
 
-		if ((res = tree_growup_level(tree, level))) {
-			reiser4_node_unlock(place->node);
-			return res;
-		}
+	if (reiser4_fs_layout(fs, cb_clear_block, bitmap))
+		goto error_free_bitmap;
 
-		reiser4_node_unlock(place->node);
-	}
+	return bitmap;
 
-	if (!reiser4_tree_fresh(tree)) {
-		if (level < reiser4_node_get_level(place->node)) {
-			aal_memcpy(parent, place, sizeof(*place));
-			
-			/* Allocating node of requested level and assign place
-			   for insert to it. This is the case, when we insert a
-			   tail among extents. That is previous lookup stoped on
-			   twig level and now we have to allocate a node of
-			   requested level, insert tail to it and then attach
-			   new node to tree. */
-			if (!(place->node = reiser4_tree_alloc_node(tree, level)))
-				return -ENOSPC;
+ error_free_bitmap:
+	reiser4_bitmap_close(bitmap);
+	return NULL;
+}
 
-			POS_INIT(&place->pos, 0, MAX_UINT32);
-		} else {
-			if (level > reiser4_node_get_level(place->node)) {
-				/* Prepare the tree for insertion at the @level. 
-				   Here is case when extent is going to inserted.
-				   As lookup goes to the leaf level, we split 
-				   tree from leaf level up to requested @level,
-				   which is level new extent should be inserted. */
-				if ((res = reiser4_tree_split(tree, place, level)))
-					return res;
-			}
+/* Reports the progress of a long operation if @tree has a progress function
+   set by the application. */
+static void reiser4_tree_progress(reiser4_tree_t *tree, count_t done,
+				  count_t total)
+{
+	if (tree->progress_func)
+		tree->progress_func(tree, done, total);
+}
 
-			/* Here we do not need to update @parent, as there is no
-			   new not attached nodes. */
-		}
-	} else {
-		aal_assert("umka-3055", place->node == NULL);
-		
-		/* Preparing tree for insert first item (allocating root,
-		   etc). */
-		height = reiser4_tree_get_height(tree);
+/* Copies @count blocks from @src on @src_dev to @dst on @dst_dev by requests
+   of TREE_COPY_BLOCKS blocks. @buff should be able to keep so many blocks. */
+static errno_t reiser4_tree_copy_blocks(reiser4_tree_t *tree,
+					aal_device_t *src_dev, blk_t src,
+					aal_device_t *dst_dev, blk_t dst,
+					count_t count, char *buff)
+{
+	uint32_t blksize;
+	uint32_t factor;
+	count_t size;
+	errno_t res;
 
-		if (!(root = reiser4_tree_alloc_node(tree, height)))
-			return -ENOSPC;
+	blksize = reiser4_tree_get_blksize(tree);
+	
+	for (; count > 0; count -= size, src += size, dst += size) {
+		size = count > TREE_COPY_BLOCKS ? TREE_COPY_BLOCKS : count;
 
-		if ((res = reiser4_tree_assign_root(tree, root)))
+		/* Devices are addressed by their own blocks. */
+		factor = blksize / src_dev->blksize;
+		
+		if ((res = aal_device_read(src_dev, buff, src * factor,
+					   size * factor)))
+		{
+			aal_error("Can't read blocks %llu-%llu. %s.",
+				  (unsigned long long)src, 
+				  (unsigned long long)(src + size - 1),
+				  src_dev->error);
 			return res;
+		}
 
-		if (level == reiser4_node_get_level(root)) {
-			place->node = root;
-		} else {
-			if (!(place->node = reiser4_tree_alloc_node(tree, level)))
-				return -ENOMEM;
+		factor = blksize / dst_dev->blksize;
+		
+		if ((res = aal_device_write(dst_dev, buff, dst * factor,
+					    size * factor)))
+		{
+			aal_error("Can't write blocks %llu-%llu. %s.",
+				  (unsigned long long)dst, 
+				  (unsigned long long)(dst + size - 1),
+				  dst_dev->error);
+			return res;
 		}
-	
-		POS_INIT(&place->pos, 0, MAX_UINT32);
-		reiser4_place_init(parent, root, &place->pos);
 	}
-	
+
 	return 0;
 }
 
-static inline errno_t tree_post_modify(reiser4_tree_t *tree, 
-				       reiser4_place_t *place) 
+/* Makes copy of @src_tree to @dst_tree. This is a block level copy: all blocks
+   of the tree, that is formatted nodes and extent data, are copied to the same
+   locations. Thus @dst_tree should be empty and lie on a filesystem with the
+   same block size, key and node plugins, which has all these blocks free. The
+   tree blocks are found in the block allocator and copied by large requests,
+   so the copy time depends on the used space rather than on the device size. */
+errno_t reiser4_tree_copy(reiser4_tree_t *src_tree,
+			  reiser4_tree_t *dst_tree)
 {
-	uint32_t items;
+	reiser4_fs_t *src_fs, *dst_fs;
+	reiser4_bitmap_t *bitmap;
+	count_t total, done;
+	uint32_t blksize;
+	count_t count;
+	count_t len;
 	errno_t res;
+	char *buff;
+	blk_t blk;
+	
+	aal_assert("umka-2304", src_tree != NULL);
+	aal_assert("umka-2305", dst_tree != NULL);
 
-	/* Nothing to be done if no item is left in the node. */
-	if (!(items = reiser4_node_items(place->node)))
+	src_fs = src_tree->fs;
+	dst_fs = dst_tree->fs;
+	blksize = reiser4_tree_get_blksize(src_tree);
+
+	if (reiser4_tree_get_blksize(dst_tree) != blksize) {
+		aal_error("Can't copy the tree to the filesystem with "
+			  "different block size.");
+		return -EINVAL;
+	}
+	
+	if (src_tree->key.plug != dst_tree->key.plug ||
+	    reiser4_format_node_pid(src_fs->format) != 
+	    reiser4_format_node_pid(dst_fs->format))
+	{
+		aal_error("Can't copy the tree to the filesystem with "
+			  "different key or node plugins.");
+		return -EINVAL;
+	}
+
+	if (!reiser4_tree_fresh(dst_tree)) {
+		aal_error("Can't copy the tree to not empty one.");
+		return -EINVAL;
+	}
+	
+	if (reiser4_tree_fresh(src_tree))
 		return 0;
 
-	/* Initializing insert point place. */
-	if ((res = reiser4_place_fetch(place)))
-		return res;
+	len = reiser4_format_get_len(src_fs->format);
+	
+	if (!(bitmap = reiser4_tree_blocks(src_tree)))
+		return -EINVAL;
 
-	/* Parent keys will be updated if we inserted item/unit into leftmost
-	   pos and if target node has parent. */
-	if (reiser4_place_leftmost(place) && place->node->p.node) {
-		/* We will not update keys if node is not attached to tree
-		   yet. This will be done later on its attach. */
-		reiser4_place_t *parent = &place->node->p;
-		reiser4_key_t lkey;
+	if (!(buff = aal_malloc(TREE_COPY_BLOCKS * blksize))) {
+		res = -ENOMEM;
+		goto error_free_bitmap;
+	}
+
+	done = 0;
+	total = reiser4_bitmap_marked(bitmap);
+	reiser4_tree_progress(src_tree, done, total);
+	
+	for (blk = 0; (blk = reiser4_bitmap_find_marked(bitmap, blk))
+		     != INVAL_BLK; blk += count)
+	{
+		blk_t end;
+
+		/* Getting the run of tree blocks to be copied. */
+		if ((end = reiser4_bitmap_find_cleared(bitmap, blk)) == INVAL_BLK)
+			end = len;
 
-		reiser4_item_get_key(place, &lkey);
+		if ((count = end - blk) > TREE_COPY_BLOCKS)
+			count = TREE_COPY_BLOCKS;
 
-		if ((res = reiser4_tree_update_keys(tree, parent, &lkey)))
-			return res;
-	}
+		if (blk + count > reiser4_format_get_len(dst_fs->format) ||
+		    !reiser4_alloc_available(dst_fs->alloc, blk, count))
+		{
+			aal_error("Can't copy blocks %llu-%llu, they are "
+				  "not free on the destination filesystem.",
+				  (unsigned long long)blk, 
+				  (unsigned long long)(blk + count - 1));
+			res = -ENOSPC;
+			goto error_free_buff;
+		}
 
-	/* Update @place->node children's parent pointers. */
-	if (reiser4_node_get_level(place->node) > LEAF_LEVEL) {
-		if ((res = reiser4_tree_update_node(tree, place->node, 
-						    place->pos.item, items)))
+		if ((res = reiser4_tree_copy_blocks(src_tree, 
+						    src_fs->device, blk,
+						    dst_fs->device, blk,
+						    count, buff)))
 		{
-			return res;
+			goto error_free_buff;
 		}
-	}
-	
-	return 0;
-}
 
-/* Main function for tree modifications. It is used for inserting data to tree
-   (stat data items, directries) or writting (tails, extents). */
-int64_t reiser4_tree_modify(reiser4_tree_t *tree, reiser4_place_t *place,
-			    trans_hint_t *hint, uint8_t level,
-			    estimate_func_t estimate_func,
-			    modify_func_t modify_func)
-{
-	errno_t res;
-	int32_t space;
-	int32_t write;
-	reiser4_place_t parent;
+		reiser4_alloc_occupy(dst_fs->alloc, blk, count);
+		
+		if ((res = reiser4_format_dec_free(dst_fs->format, count)))
+			goto error_free_buff;
 
-	aal_assert("umka-2673", tree != NULL);
-	aal_assert("umka-2674", hint != NULL);
-	aal_assert("umka-1645", hint->plug != NULL);
-	aal_assert("umka-1644", place != NULL);
-	
-	aal_assert("umka-2676", modify_func != NULL);
-	aal_assert("umka-2675", estimate_func != NULL);
+		done += count;
+		reiser4_tree_progress(src_tree, done, total);
+	}
 
-	/* Preparing the tree modification. This may include splitting, 
-	   allocating root, etc. */
-	if ((res = tree_prep_modify(tree, &parent, place, level)))
-		return res;
+	reiser4_tree_set_root(dst_tree, reiser4_tree_get_root(src_tree));
+	reiser4_tree_set_height(dst_tree, reiser4_tree_get_height(src_tree));
 
-	/* Estimating item/unit to inserted/written to tree. */
-	if ((res = estimate_func(place, hint)))
-		return res;
-	
-	/* Preparing space in tree. */
-	space = reiser4_tree_expand(tree, place, &parent, hint->len, 
-				    hint->overhead, hint->shift_flags);
-	
-	/* Needed space is the length of the item + an item overhead on 
-	   the item creation if needed. */
-	if (place->pos.unit != MAX_UINT32)
-		hint->overhead = 0;
+ error_free_buff:
+	aal_free(buff);
+ error_free_bitmap:
+	reiser4_bitmap_close(bitmap);
+	return res;
+}
 
-	if (space < 0) {
-		aal_error("Can't prepare space in tree.");
-		return space;
-	} else {
-		/* Checking if we still have less space than needed. This is
-		   ENOSPC case if we tried to insert data. */
-		if (space < hint->len)
-			return -ENOSPC;
-	}
+/* State of the tree relocation on resizing. */
+typedef struct tree_resize {
+	/* Tree blocks to be moved. They are kept occupied until the end of
+	   the relocation, so that nothing is allocated there. */
+	reiser4_bitmap_t *moving;
 
-	reiser4_node_lock(place->node);
-	
-	/* Inserting/writing data to node. */
-	if ((write = modify_func(place->node, &place->pos, hint)) < 0) {
-		aal_error("Can't insert data to node %llu.",
-			  (unsigned long long)place_blknr(place));
-		return write;
-	}
+	/* Blocks moved already and free blocks of the area occupied for the
+	   relocation. They are released if the relocation fails. */
+	reiser4_bitmap_t *vacated;
+	reiser4_bitmap_t *occupied;
 	
-	reiser4_node_unlock(place->node);
+	/* Count of blocks to be moved and already moved ones. */
+	count_t total;
+	count_t moved;
 
-	if ((res = tree_post_modify(tree, place)))
-		return res;
+	/* Set if some extent unit got split, so the tree should be scanned
+	   once more for the rest of the unit. */
+	int split;
 	
-        /* If make space function allocates new node, we should attach it to the
-	   tree. Also, here we should handle the special case, when tree root
-	   should be changed. */
-	if (place->node != tree->root && !place->node->p.node) {
-		/* Check if insert was on root node level. If so -- growing tree
-		   up by one. */
-		if (level == reiser4_tree_get_height(tree)) {
-			reiser4_node_t *old_root = tree->root;
-			
-			reiser4_node_lock(place->node);
+	char *buff;
+} tree_resize_t;
 
-			if ((res = reiser4_tree_growup(tree))) {
-				aal_error("Can't grow tree up during "
-					  "modifying it.");
-				reiser4_node_unlock(place->node);
-				return res;
-			}
-			
-			reiser4_node_unlock(place->node);
+/* Calls @func for all runs of marked blocks in @bitmap. */
+static errno_t reiser4_tree_bitmap_layout(reiser4_bitmap_t *bitmap,
+					  region_func_t func, 
+					  void *data)
+{
+	errno_t res;
+	blk_t start;
+	blk_t end;
 
-			/* Handling tree growth case. */
-			tree_next_child_pos(old_root, &parent);
-		}
-		
-		/* Attaching new node to the tree. */
-		if ((res = reiser4_tree_attach_node(tree, place->node, &parent,
-						    hint->shift_flags)))
+	for (start = 0; (start = reiser4_bitmap_find_marked(bitmap, start))
+		     != INVAL_BLK; start = end)
+	{
+		if ((end = reiser4_bitmap_find_cleared(bitmap, start)) 
+		    == INVAL_BLK)
 		{
-			aal_error("Can't attach node %llu to tree.",
-				  (unsigned long long)place_blknr(place));
-			return res;
+			end = bitmap->total;
 		}
-	}
 
-	/* Calling @hint->place_func if a new item was created. */
-	if (hint->place_func && place->pos.unit == MAX_UINT32) {
-		if ((res = hint->place_func(place, hint->data)))
+		if ((res = func(start, end - start, data)))
 			return res;
 	}
 
-	return write;
+	return 0;
 }
 
-/* Estimates how many bytes is needed to insert data described by @hint. */
-static errno_t cb_tree_prep_insert(reiser4_place_t *place, trans_hint_t *hint) {
-	aal_assert("umka-2440", hint != NULL);
-	aal_assert("umka-2439", place != NULL);
+static errno_t cb_mark_block(blk_t start, count_t width, void *data) {
+	reiser4_bitmap_mark_region((reiser4_bitmap_t *)data, start, width);
+	return 0;
+}
 
-	hint->len = 0;
-	hint->overhead = 0;
+static errno_t cb_occupy_block(blk_t start, count_t width, void *data) {
+	return reiser4_alloc_occupy((reiser4_alloc_t *)data, start, width);
+}
 
-	return plugcall(hint->plug->object, prep_insert, place, hint);
+static errno_t cb_release_block(blk_t start, count_t width, void *data) {
+	return reiser4_alloc_release((reiser4_alloc_t *)data, start, width);
 }
 
-static errno_t cb_tree_insert(reiser4_node_t *node, pos_t *pos, 
-			      trans_hint_t *hint) 
-{
-	return objcall(node, insert, pos, hint);
+static errno_t cb_mark_backup(blk_t start, count_t width, void *data) {
+	reiser4_bitmap_t *bitmap = (reiser4_bitmap_t *)data;
+
+	/* Only backup blocks inside the current fs may be occupied. */
+	if (start < bitmap->total)
+		reiser4_bitmap_mark_region(bitmap, start, width);
+
+	return 0;
 }
 
-/* Inserts data to the tree. This function is used for inserting items which are
-   not file body items, that is statdata, directory, etc. */
-int64_t reiser4_tree_insert(reiser4_tree_t *tree, reiser4_place_t *place,
-			    trans_hint_t *hint, uint8_t level)
+/* Returns the bitmap of the blocks to be vacated for resizing the fs, @tree
+   lies on, to @blocks. This is the area to be cut off on shrinking and the
+   backup blocks of the new layout on growing. */
+static reiser4_bitmap_t *reiser4_tree_resize_area(reiser4_tree_t *tree,
+						  count_t blocks)
 {
-	return reiser4_tree_modify(tree, place, hint, level, 
-				   cb_tree_prep_insert, cb_tree_insert);
-}
+	reiser4_bitmap_t *area;
+	reiser4_fs_t *fs = tree->fs;
+	count_t len;
 
-/* Estimates how many bytes is needed to write data described by @hint. */
-static errno_t cb_tree_prep_write(reiser4_place_t *place, trans_hint_t *hint) {
-	aal_assert("umka-3007", hint != NULL);
-	aal_assert("umka-3008", place != NULL);
+	len = reiser4_format_get_len(fs->format);
+	
+	if (!(area = reiser4_bitmap_create(len)))
+		return NULL;
 
-	hint->len = 0;
-	hint->overhead = 0;
+	if (blocks < len) {
+		reiser4_bitmap_mark_region(area, blocks, len - blocks);
+		return area;
+	}
 
-	return plugcall(hint->plug->object, prep_write, place, hint);
+	if (reiser4_backup_layout_body(fs->alloc, 
+				       reiser4_tree_get_blksize(tree),
+				       blocks, cb_mark_backup, area))
+	{
+		reiser4_bitmap_close(area);
+		return NULL;
+	}
+
+	return area;
 }
 
-static errno_t cb_tree_write(reiser4_node_t *node, 
-			     pos_t *pos, trans_hint_t *hint) 
+/* Returns the bitmap of @tree blocks lying in @area. */
+static reiser4_bitmap_t *reiser4_tree_resize_moving(reiser4_tree_t *tree,
+						    reiser4_bitmap_t *area)
 {
-	return objcall(node, write, pos, hint);
+	reiser4_bitmap_t *moving;
+
+	if (!(moving = reiser4_tree_blocks(tree)))
+		return NULL;
+
+	/* Clearing all the blocks out of @area. */
+	reiser4_bitmap_invert(area);
+	reiser4_tree_bitmap_layout(area, cb_clear_block, moving);
+	reiser4_bitmap_invert(area);
+
+	return moving;
 }
 
-int64_t reiser4_tree_write(reiser4_tree_t *tree, reiser4_place_t *place,
-			   trans_hint_t *hint, uint8_t level)
+/* Accounts @count blocks starting from @start moved. */
+static void reiser4_tree_resize_moved(reiser4_tree_t *tree,
+				      tree_resize_t *resize,
+				      blk_t start, count_t count)
 {
-	return reiser4_tree_modify(tree, place, hint, level,
-				   cb_tree_prep_write, cb_tree_write);
+	reiser4_bitmap_mark_region(resize->vacated, start, count);
+	resize->moved += count;
+	
+	if (resize->moved > resize->total)
+		resize->moved = resize->total;
+
+	reiser4_tree_progress(tree, resize->moved, resize->total);
 }
 
-/* Removes item/unit at @place. */
-errno_t reiser4_tree_remove(reiser4_tree_t *tree, 
-			    reiser4_place_t *place,
-			    trans_hint_t *hint)
+/* Returns TRUE if some of @count blocks starting from @start are to be
+   moved. */
+static bool_t reiser4_tree_resize_test(tree_resize_t *resize,
+				       blk_t start, count_t count)
 {
-	errno_t res;
+	blk_t blk;
 
-	aal_assert("umka-2055", tree != NULL);
-	aal_assert("umka-2056", place != NULL);
-	aal_assert("umka-2392", hint != NULL);
+	if (start >= resize->moving->total)
+		return 0;
+	
+	blk = reiser4_bitmap_find_marked(resize->moving, start);
+	return blk != INVAL_BLK && blk < start + count;
+}
 
-	/* Removing iten/unit from the node. */
-	if ((res = reiser4_node_remove(place->node, &place->pos, hint)))
-		return res;
+/* Moves extent units of the item at @place, which point to the blocks to be
+   vacated, to newly allocated blocks. Units are moved entirely. If there is
+   no free run long enough, the unit gets split: the head is moved and the
+   tail is inserted as a new unit, which is handled on the next scan. */
+static errno_t cb_relocate_extent(reiser4_place_t *place, void *data) {
+	tree_resize_t *resize = (tree_resize_t *)data;
+	reiser4_tree_t *tree = (reiser4_tree_t *)place->node->tree;
+	reiser4_alloc_t *alloc = tree->fs->alloc;
+	trans_hint_t hint;
+	ptr_hint_t ptr;
+	uint32_t units;
+	errno_t res;
 
-	if ((res = tree_post_modify(tree, place)))
-		return res;
+	if (place->plug->p.id.group != EXTENT_ITEM)
+		return 0;
+
+	aal_memset(&hint, 0, sizeof(hint));
 	
-	/* Checking if the node became empty. If so, we release it, otherwise we
-	   pack the tree about it. */
-	if (reiser4_node_items(place->node) == 0) {
-		if (reiser4_node_locked(place->node)) {
-			place->node->flags |= NF_HEARD_BANSHEE;
-		} else {
-			if ((res = reiser4_tree_discard_node(tree, place->node)))
-				return res;
+	hint.count = 1;
+	hint.specific = &ptr;
+	hint.plug = place->plug;
+	hint.shift_flags = (SF_DEFAULT & ~SF_ALLOW_LEFT);
+	
+	units = reiser4_item_units(place);
+	
+	for (place->pos.unit = 0; place->pos.unit < units;
+	     place->pos.unit++)
+	{
+		reiser4_place_t iplace;
+		reiser4_key_t key;
+		uint64_t offset;
+		count_t width;
+		blk_t start;
+		blk_t blk;
+		blk_t end;
+		
+		if (objcall(place, object->fetch_units, &hint) != 1)
+			return -EIO;
 
-			place->node = NULL;
+		if (ptr.start == EXTENT_HOLE_UNIT || 
+		    ptr.start == EXTENT_UNALLOC_UNIT ||
+		    !reiser4_tree_resize_test(resize, ptr.start, ptr.width))
+		{
+			continue;
 		}
-	} else {
-		if (hint->shift_flags & SF_ALLOW_PACK) {
-			if ((res = reiser4_tree_shrink(tree, place)))
-				return res;
+
+		start = ptr.start;
+		width = ptr.width;
+		
+		if (!(ptr.width = reiser4_alloc_allocate(alloc, &ptr.start, 
+							 width)))
+		{
+			return -ENOSPC;
 		}
-	}
 
-	/* Drying tree up in the case root node exists and tree is singular,
-	   that is has only one item. Tree also should not be minimal of
-	   height. Here root may be NULL due to nested call from
-	   tree_dryout(). */
-	if (tree->root && reiser4_tree_singular(tree) && 
-	    !reiser4_tree_minimal(tree) && (hint->shift_flags & SF_ALLOW_PACK))
-	{
-		if ((res = reiser4_tree_dryout(tree)))
+		if ((res = reiser4_tree_copy_blocks(tree, tree->fs->device, 
+						    start, tree->fs->device, 
+						    ptr.start, ptr.width,
+						    resize->buff)))
+		{
 			return res;
-	}
-	
-	return 0;
-}
-
-/* Traverses @node with passed callback functions as actions. */
-errno_t reiser4_tree_trav_node(reiser4_tree_t *tree,
-			       reiser4_node_t *node,
-			       tree_open_func_t open_func,
-			       node_func_t before_func,
-			       place_func_t update_func,
-			       node_func_t after_func,
-			       void *data)
-{
-	errno_t res = 0;
-	reiser4_place_t place;
-	pos_t *pos = &place.pos;
- 
-	aal_assert("vpf-390", node != NULL);
-	aal_assert("umka-1935", tree != NULL);
-	
-	if (open_func == NULL)
-		open_func = (tree_open_func_t)reiser4_tree_child_node;
+		}
+		
+		if (objcall(place, object->update_units, &hint) != 1)
+			return -EIO;
 
-	/* Locking @node to make sure, that it will not be released while we are
-	   working with it. Of course, it should be unlocked after we
-	   finished. */
-	reiser4_node_lock(node);
+		/* Releasing the old blocks, except the ones to be vacated. */
+		for (blk = start, end = start + ptr.width; blk < end; ) {
+			blk_t next;
+			
+			next = reiser4_bitmap_find_marked(resize->moving, blk);
+			
+			if (next == INVAL_BLK || next > end)
+				next = end;
 
-	if ((before_func && (res = before_func(node, data))))
-		goto error_unlock_node;
+			if (next > blk)
+				reiser4_alloc_release(alloc, blk, next - blk);
 
-	/* The loop though the items of current node */
-	for (pos->item = 0; pos->item < reiser4_node_items(node);
-	     pos->item++)
-	{
-		pos->unit = MAX_UINT32; 
+			if ((blk = next) == end)
+				break;
 
-		/* If there is a suspicion of a corruption, it must be checked
-		   in before_func. All items must be opened here. */
-		if (reiser4_place_open(&place, node, pos)) {
-			aal_error("Node (%llu), item (%u): Can't open item "
-				  "by place.",
-				  (unsigned long long)node->block->nr,
-				  pos->item);
-			goto error_after_func;
+			next = reiser4_bitmap_find_cleared(resize->moving, blk);
+			
+			if (next == INVAL_BLK || next > end)
+				next = end;
+
+			reiser4_tree_resize_moved(tree, resize, blk, next - blk);
+			blk = next;
 		}
 
-		if (!reiser4_item_branch(place.plug))
+		if (ptr.width == width)
 			continue;
 
-		/* The loop though the units of the current item */
-		for (pos->unit = 0; pos->unit < reiser4_item_units(&place);
-		     pos->unit++)
-		{
-			reiser4_node_t *child = NULL;
-			
-			/* Opening the node by its pointer kept in @place */
-			if ((child = open_func(tree, &place, data)) == INVAL_PTR)
-				goto error_after_func;
-
-			if (!child)
-				goto update;
+		/* Inserting the rest of the unit after the moved head. */
+		objcall(place, balance->fetch_key, &key);
+		offset = objcall(&key, get_offset);
+		objcall(&key, set_offset, offset + ptr.width * 
+			reiser4_tree_get_blksize(tree));
 
-			/* Traversing the node */
-			if ((res = reiser4_tree_trav_node(tree, child, open_func, 
-							  before_func, update_func, 
-							  after_func, data)) < 0)
-			{
-				goto error_after_func;
-			}
-			
-		update:	
-			if (update_func && (res = update_func(&place, data)))
-				goto error_after_func;
+		ptr.start = start + ptr.width;
+		ptr.width = width - ptr.width;
+		
+		aal_memcpy(&hint.offset, &key, sizeof(key));
+		
+		iplace = *place;
+		iplace.pos.unit++;
+		
+		if ((res = reiser4_tree_insert(tree, &iplace, &hint,
+					       reiser4_node_get_level(
+						       iplace.node))) < 0)
+		{
+			return res;
 		}
+
+		/* Units after the split one may be shifted to another node
+		   by balancing, so the scan should be restarted. */
+		resize->split = 1;
+		return 1;
 	}
+
+	return 0;
+}
+
+/* Opens the child node if it may be moved, that is if it is an internal node
+   or a leaf to be moved. Other leaves are not loaded at all. */
+static reiser4_node_t *cb_relocate_open(reiser4_tree_t *tree,
+					reiser4_place_t *place,
+					void *data)
+{
+	tree_resize_t *resize = (tree_resize_t *)data;
+	reiser4_node_t *node;
 	
-	if (after_func)
-		res = after_func(node, data);
+	if (reiser4_place_fetch(place))
+		return INVAL_PTR;
 
-	reiser4_tree_unlock_node(tree, node);
-	return res;
+	if (!reiser4_item_branch(place->plug))
+		return NULL;
 
- error_after_func:
-	if (after_func)
-		after_func(node, data);
+	if (reiser4_node_get_level(place->node) == TWIG_LEVEL &&
+	    !reiser4_tree_resize_test(resize, reiser4_item_down_link(place), 1))
+	{
+		return NULL;
+	}
 
- error_unlock_node:
-	reiser4_tree_unlock_node(tree, node);
-	return res;
+	if (!(node = reiser4_tree_child_node(tree, place)))
+		return INVAL_PTR;
+
+	return node;
 }
 
-/* Traverses tree with passed callback functions for each event. This is used
-   for all tree traverse related operations like copy, measurements, etc. */
-errno_t reiser4_tree_trav(reiser4_tree_t *tree,
-			  tree_open_func_t open_func,
-			  node_func_t before_func,
-			  place_func_t update_func,
-			  node_func_t after_func,
-			  void *data)
-{
+/* Moves formatted @node to be vacated to a newly allocated block, updating
+   the pointer to the node in its parent. */
+static errno_t cb_relocate_node(reiser4_node_t *node, void *data) {
+	tree_resize_t *resize = (tree_resize_t *)data;
+	reiser4_tree_t *tree = (reiser4_tree_t *)node->tree;
 	errno_t res;
+	blk_t old;
+	blk_t blk;
 	
-	aal_assert("umka-1768", tree != NULL);
+	if (!reiser4_tree_resize_test(resize, node->block->nr, 1))
+		return 0;
 
-	if ((res = reiser4_tree_load_root(tree)))
+	old = node->block->nr;
+
+	if (!reiser4_alloc_allocate(tree->fs->alloc, &blk, 1))
+		return -ENOSPC;
+
+	if (reiser4_tree_root_node(tree, node))
+		reiser4_tree_set_root(tree, blk);
+		
+	if (node->p.node) {
+		if ((res = reiser4_item_update_link(&node->p, blk)))
+			return res;
+	}
+
+	if ((res = reiser4_tree_rehash_node(tree, node, blk)))
 		return res;
-	
-	return reiser4_tree_trav_node(tree, tree->root, open_func,
-				      before_func, update_func,
-				      after_func, data);
+
+	reiser4_tree_resize_moved(tree, resize, old, 1);
+	return 0;
 }
 
-errno_t reiser4_tree_scan(reiser4_tree_t *tree, 
-			  node_func_t pre_func, 
-			  place_func_t func, 
-			  void *data) 
+/* Returns the number of @tree blocks to be moved by reiser4_tree_resize() for
+   resizing the fs to @blocks, or negative value for errors. Extent units are
+   moved entirely, so the real number of copied blocks may be a bit greater. */
+int64_t reiser4_tree_resize_estimate(reiser4_tree_t *tree,
+				     count_t blocks)
 {
-        reiser4_key_t key, max;
-        errno_t res;
-
-        aal_assert("vpf-1423", tree != NULL);
-        aal_assert("vpf-1424", func != NULL);
-
-        if (reiser4_tree_fresh(tree))
-                return -EINVAL;
+	reiser4_bitmap_t *moving;
+	reiser4_bitmap_t *area;
+	count_t count;
+	
+	aal_assert("umka-3132", tree != NULL);
 
-        if ((res = reiser4_tree_load_root(tree)))
-                return res;
+	if (reiser4_tree_fresh(tree))
+		return 0;
+	
+	if (!(area = reiser4_tree_resize_area(tree, blocks)))
+		return -ENOMEM;
 
-        if (tree->root == NULL)
-                return -EINVAL;
+	if (!(moving = reiser4_tree_resize_moving(tree, area))) {
+		reiser4_bitmap_close(area);
+		return -EINVAL;
+	}
 
-        /* Prepare the start and the end keys. */
-        key.plug = max.plug = tree->key.plug;
-        reiser4_key_minimal(&key);
-        reiser4_key_maximal(&max);
+	count = reiser4_bitmap_marked(moving);
+	
+	reiser4_bitmap_close(moving);
+	reiser4_bitmap_close(area);
 
-        /* While not the end of the tree. */
-        while (reiser4_key_compfull(&key, &max)) {
-                reiser4_place_t place;
-		lookup_hint_t hint;
-                lookup_t lookup;
-		pos_t *pos;
+	return count;
+}
 
-                /* Some items can be handled a few times due to key 
-		   collisions. */
-		hint.key = &key;
-		hint.level = LEAF_LEVEL;
-		hint.collision = NULL;
+/* Prepares @tree for resizing the fs to @blocks. Formatted nodes and extent
+   data lying in the area to be cut off on shrinking, or in the new backup
+   blocks on growing, are moved to other blocks. Pointers to them are updated
+   in parent nodes and extent units. The allocator, format and backup are
+   resized by reiser4_fs_resize() then. */
+errno_t reiser4_tree_resize(reiser4_tree_t *tree,
+			    count_t blocks)
+{
+	reiser4_bitmap_t *area, *used;
+	reiser4_alloc_t *alloc;
+	tree_resize_t resize;
+	count_t len, avail;
+	errno_t res;
+	
+	aal_assert("umka-2323", tree != NULL);
 
-                /* Lookup the key. FIXME: it is possible to spped it up. */
-                if ((lookup = reiser4_tree_lookup(tree, &hint, FIND_EXACT,
-						  &place)) < 0)
-		{
-                        return lookup;
-		}
+	if (reiser4_tree_fresh(tree))
+		return 0;
 
-		pos = &place.pos;
+	aal_memset(&resize, 0, sizeof(resize));
+	alloc = tree->fs->alloc;
+	len = reiser4_format_get_len(tree->fs->format);
+	
+	if (!(area = reiser4_tree_resize_area(tree, blocks)))
+		return -ENOMEM;
 
-		if (pre_func) {
-			if ((res = pre_func(place.node, data)) < 0)
-				return res;
-		
-			/* If res != 0, lookup is needed. */
-			if (res) continue;
-		}
-		
-		/* Count may get change in func (e.g. after item fusing), so 
-		   get it on every loop */
-		while (1) {
-			if (pos->item >= reiser4_node_items(place.node)) {
-				/* All items are handled whithin this node, but 
-				   lookup is not needed. To avoid infinite loop 
-				   in the case of key collision, get the next item 
-				   instead of another lookup call. */
-				if ((res = reiser4_tree_next_place(tree, &place,
-								   &place))) 
-				{
-					aal_error("Failed to get the next node.");
-					return res;
-				}
+	if (!(resize.moving = reiser4_tree_resize_moving(tree, area))) {
+		res = -EINVAL;
+		goto error_free_area;
+	}
 
-				if (!place.node)
-					return 0;
-			}
-				
-                        if ((res = reiser4_place_fetch(&place)))
-                                return res;
-			
-			/* Go down to the child if branch. */
-			if ((res = reiser4_item_branch(place.plug))) {
-				if (!(place.node = 
-				      reiser4_tree_child_node(tree, &place)))
-				{
-					return -EIO;
-				}
-		
-				if (pre_func) {
-					if ((res = pre_func(place.node, 
-							    data)) < 0)
-					{
-						return res;
-					}
+	if (!(resize.total = reiser4_bitmap_marked(resize.moving))) {
+		res = 0;
+		goto error_free_moving;
+	}
 
-					/* If res != 0, lookup is needed. */
-					if (res) break;
-				}
+	/* Checking if there is enough free space out of @area and getting
+	   free blocks of @area. */
+	if (!(used = reiser4_bitmap_create(len))) {
+		res = -ENOMEM;
+		goto error_free_moving;
+	}
 
-				place.pos.item = -1;
-				continue;
-			}
-			
-                        /* Get the key of the next item. */
-                        if ((res = reiser4_tree_next_key(tree, &place, &key)))
-                                return res;
+	if (!(resize.occupied = reiser4_bitmap_clone(area))) {
+		res = -ENOMEM;
+		goto error_free_used;
+	}
+	
+	if ((res = reiser4_alloc_extract(alloc, used)))
+		goto error_free_used;
+
+	reiser4_tree_bitmap_layout(used, cb_clear_block, resize.occupied);
+	reiser4_tree_bitmap_layout(area, cb_mark_block, used);
+	avail = reiser4_bitmap_cleared(used);
+
+	if (resize.total > avail) {
+		aal_error("Can't resize the filesystem to %llu blocks. There "
+			  "are %llu blocks to be moved and only %llu free "
+			  "blocks left.", (unsigned long long)blocks,
+			  (unsigned long long)resize.total,
+			  (unsigned long long)avail);
+		res = -ENOSPC;
+		goto error_free_used;
+	}
 
-                        /* Call func for the item. */
-                        if ((res = func(&place, data)) < 0)
-                                return res;
+	/* Writing all dirty nodes and data and dropping data blocks from the 
+	   cache, as they are moved by the device requests. */
+	if ((res = reiser4_tree_sync(tree)))
+		goto error_free_used;
 
-                        /* If res != 0, lookup is needed. */
-                        if (res) break;
+	if ((res = reiser4_tree_evict_blocks(tree)))
+		goto error_free_used;
 
-			pos->item++;
-                }
-        }
+	if (!(resize.vacated = reiser4_bitmap_create(len))) {
+		res = -ENOMEM;
+		goto error_free_used;
+	}
+	
+	if (!(resize.buff = aal_malloc(TREE_COPY_BLOCKS * 
+				       reiser4_tree_get_blksize(tree))))
+	{
+		res = -ENOMEM;
+		goto error_free_vacated;
+	}
+	
+	/* Occupying @area, so that nothing is allocated there anymore. */
+	reiser4_tree_bitmap_layout(resize.occupied, cb_occupy_block, alloc);
+	reiser4_tree_progress(tree, 0, resize.total);
 
-        return 0;
-}
+	/* Moving extent data first, as splitting units may need new nodes. */
+	do {
+		resize.split = 0;
+		
+		if ((res = reiser4_tree_scan(tree, NULL, cb_relocate_extent,
+					     &resize)) < 0)
+		{
+			aal_error("Can't move extent data.");
+			goto error_release_area;
+		}
+	} while (resize.split);
 
-/* Makes copy of @src_tree to @dst_tree */
-errno_t reiser4_tree_copy(reiser4_tree_t *src_tree,
-			  reiser4_tree_t *dst_tree)
-{
-	aal_assert("umka-2304", src_tree != NULL);
-	aal_assert("umka-2305", dst_tree != NULL);
+	/* Allocating nodes created by balancing. */
+	if ((res = reiser4_tree_sync(tree)))
+		goto error_release_area;
 
-	aal_error("Sorry, not implemented yet!");
-	return -EINVAL;
-}
+	if ((res = reiser4_tree_trav(tree, cb_relocate_open, cb_relocate_node,
+				     NULL, NULL, &resize)))
+	{
+		aal_error("Can't move formatted nodes.");
+		goto error_release_area;
+	}
 
-/* Resizes @tree by @blocks */
-errno_t reiser4_tree_resize(reiser4_tree_t *tree,
-			    count_t blocks)
-{
-	aal_assert("umka-2323", tree != NULL);
+	res = reiser4_tree_sync(tree);
 
-	aal_error("Sorry, not implemented yet!");
-	return -EINVAL;
+ error_release_area:
+	/* The tree keeps pointing to moved blocks, so the old ones and the
+	   occupied free blocks are not used anymore. */
+	if (res) {
+		reiser4_tree_bitmap_layout(resize.vacated, cb_release_block,
+					   alloc);
+		reiser4_tree_bitmap_layout(resize.occupied, cb_release_block,
+					   alloc);
+	}
+	
+	aal_free(resize.buff);
+ error_free_vacated:
+	reiser4_bitmap_close(resize.vacated);
+ error_free_used:
+	if (resize.occupied)
+		reiser4_bitmap_close(resize.occupied);
+	
+	reiser4_bitmap_close(used);
+ error_free_moving:
+	reiser4_bitmap_close(resize.moving);
+ error_free_area:
+	reiser4_bitmap_close(area);
+	return res;
 }
 #endif
 
@@ -128,12 +128,315 @@ typedef struct stat_bitmap {
 	uint64_t read, by_node, by_item, empty;
 } stat_bitmap_t;
 
+/* Default seconds between checkpoints if checkpointing is enabled. Saving 
+   the state costs about the same on any fs, so it is done by time rather 
+   than by the count of processed nodes. */
+#define AM_CHECKPOINT_INTERVAL	300
+
+/* Saves the pass state if the checkpoint interval is over since the previous
+   save or since the pass start. Must be called only when the tree and the 
+   bitmaps match each other. */
+static errno_t repair_am_checkpoint(repair_am_t *am) {
+	uint32_t interval;
+	errno_t res;
+	time_t now;
+
+	if (!am->checkpoint)
+		return 0;
+
+	interval = am->interval ? am->interval : AM_CHECKPOINT_INTERVAL;
+	now = time(NULL);
+
+	if (!am->next) {
+		am->next = now + interval;
+		return 0;
+	}
+	
+	if (now < am->next)
+		return 0;
+
+	res = am->checkpoint(am->data);
+
+	/* The time spent on saving is not counted. */
+	am->next = time(NULL) + interval;
+	return res;
+}
+
+/* Recovered node waiting for insertion. */
+typedef struct am_node {
+	repair_ptr_t ptr;
+	reiser4_key_t rkey;
+	uint32_t flags;
+} am_node_t;
+
+/* The node overlaps some other one by keys. */
+#define AM_OVERLAP	(1 << 0)
+
+/* The node has items pointing to some blocks. */
+#define AM_LAYOUT	(1 << 1)
+
+/* Sorts @nodes by their leftmost keys with merge sort. */
+static errno_t repair_am_nodes_sort(am_node_t *nodes, uint64_t count) {
+	uint64_t width, left, mid, right, i, j, k;
+	am_node_t *buff, *src, *dst, *tmp;
+
+	if (count < 2)
+		return 0;
+
+	if (!(buff = aal_malloc(count * sizeof(*buff))))
+		return -ENOMEM;
+
+	src = nodes;
+	dst = buff;
+
+	for (width = 1; width < count; width *= 2) {
+		for (left = 0; left < count; left += 2 * width) {
+			mid = left + width < count ? left + width : count;
+			right = mid + width < count ? mid + width : count;
+
+			for (i = left, j = mid, k = left; k < right; k++) {
+				if (i < mid && (j >= right ||
+				    reiser4_key_compfull(&src[i].ptr.key,
+							 &src[j].ptr.key) <= 0))
+				{
+					dst[k] = src[i++];
+				} else {
+					dst[k] = src[j++];
+				}
+			}
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != nodes)
+		aal_memcpy(nodes, src, count * sizeof(*nodes));
+
+	aal_free(buff);
+	return 0;
+}
+
+/* Marks nodes overlapping some other one by keys. @nodes are sorted by the
+   leftmost keys, so a node overlaps a previous one if its leftmost key is
+   not greater than the biggest right key met so far. */
+static void repair_am_nodes_overlap(am_node_t *nodes, uint64_t count) {
+	uint64_t i, max;
+
+	for (i = 1, max = 0; i < count; i++) {
+		if (reiser4_key_compfull(&nodes[i].ptr.key,
+					 &nodes[max].rkey) <= 0)
+		{
+			nodes[i].flags |= AM_OVERLAP;
+			nodes[max].flags |= AM_OVERLAP;
+		}
+
+		if (reiser4_key_compfull(&nodes[i].rkey,
+					 &nodes[max].rkey) > 0)
+		{
+			max = i;
+		}
+	}
+}
+
+/* Opens the node @blk, prepares it for insertion and saves it back. Gets
+   the key range of the node into @am_node. Returns 1 if the node is empty
+   and has been released. */
+static errno_t repair_am_node_scan(repair_am_t *am, reiser4_bitmap_t *bitmap,
+				   blk_t blk, am_node_t *am_node)
+{
+	reiser4_place_t place;
+	reiser4_node_t *node;
+	uint32_t count;
+	errno_t res;
+
+	if (!(node = reiser4_node_open(am->repair->fs->tree, blk))) {
+		aal_error("Add Missing pass failed to "
+			  "open the node (%llu)",
+			  (unsigned long long)blk);
+		return -EINVAL;
+	}
+
+	/* Prepare the node for the insertion. */
+	if ((res = repair_am_node_prepare(am, node)))
+		goto error_close_node;
+
+	if (!(count = reiser4_node_items(node))) {
+		reiser4_bitmap_clear(bitmap, blk);
+		repair_am_blk_free(am, blk);
+		reiser4_node_close(node);
+		return 1;
+	}
+
+	aal_memset(am_node, 0, sizeof(*am_node));
+	am_node->ptr.blk = blk;
+
+	if ((res = reiser4_node_leftmost_key(node, &am_node->ptr.key)))
+		goto error_close_node;
+
+	place.node = node;
+	place.pos.unit = MAX_UINT32;
+
+	for (place.pos.item = 0; place.pos.item < count; place.pos.item++) {
+		if ((res = reiser4_place_fetch(&place))) {
+			aal_error("Node (%llu), item (%u): failed to open the "
+				  "item.", (unsigned long long)blk,
+				  place.pos.item);
+			goto error_close_node;
+		}
+
+		if (place.plug->object->layout)
+			am_node->flags |= AM_LAYOUT;
+	}
+
+	/* Branches are removed, the last item has the biggest key. */
+	place.pos.item = count - 1;
+
+	if ((res = reiser4_place_fetch(&place)))
+		goto error_close_node;
+
+	if ((res = reiser4_item_maxreal_key(&place, &am_node->rkey)))
+		goto error_close_node;
+
+	return reiser4_node_fini(node);
+
+ error_close_node:
+	reiser4_node_close(node);
+	return res;
+}
+
+/* Accounts the node @blk put to the tree as a whole. */
+static errno_t repair_am_node_done(repair_am_t *am, reiser4_bitmap_t *bitmap,
+				   reiser4_node_t *node, blk_t blk,
+				   stat_bitmap_t *stat)
+{
+	reiser4_bitmap_clear(bitmap, blk);
+	repair_am_blk_used(am, blk);
+
+	stat->by_node++;
+
+	if (!node)
+		return 0;
+
+	return reiser4_node_trav(node, cb_layout, am);
+}
+
+/* Attaches the node @blk to the tree with a lookup. The node is left in
+   @bitmap to be inserted item by item if this is not possible. */
+static errno_t repair_am_node_attach(repair_am_t *am, reiser4_bitmap_t *bitmap,
+				     blk_t blk, stat_bitmap_t *stat)
+{
+	reiser4_node_t *node;
+	errno_t res;
+
+	if (!(node = reiser4_node_open(am->repair->fs->tree, blk))) {
+		aal_error("Add Missing pass failed to "
+			  "open the node (%llu)",
+			  (unsigned long long)blk);
+		return -EINVAL;
+	}
+
+	res = repair_tree_attach_node(am->repair->fs->tree, node);
+
+	if (res < 0 && res != -ESTRUCT) {
+		aal_error("Add missing pass failed to attach "
+			  "the node (%llu) to the tree.",
+			  (unsigned long long)blk);
+
+		reiser4_node_close(node);
+		return res;
+	} else if (res == 0) {
+		/* Has been inserted. */
+		return repair_am_node_done(am, bitmap, node, blk, stat);
+	}
+
+	/* uninsertable case - insert by item later. */
+	reiser4_node_fini(node);
+	return 0;
+}
+
+/* Builds the fresh tree over not overlapping @nodes bottom-up at once. */
+static errno_t repair_am_nodes_build(repair_am_t *am, reiser4_bitmap_t *bitmap,
+				     am_node_t *nodes, uint64_t count,
+				     stat_bitmap_t *stat)
+{
+	reiser4_tree_t *tree;
+	reiser4_node_t *node;
+	repair_ptr_t *ptrs;
+	uint64_t i, n;
+	uint8_t level;
+	errno_t res;
+
+	tree = am->repair->fs->tree;
+
+	for (i = 0, n = 0; i < count; i++) {
+		if (!(nodes[i].flags & AM_OVERLAP))
+			n++;
+	}
+
+	/* A single node is just assigned to the root. */
+	if (n < 2)
+		return 0;
+
+	if (!(ptrs = aal_malloc(n * sizeof(*ptrs))))
+		return -ENOMEM;
+
+	for (i = 0, n = 0; i < count; i++) {
+		if (!(nodes[i].flags & AM_OVERLAP))
+			ptrs[n++] = nodes[i].ptr;
+	}
+
+	level = bitmap == am->bm_twig ? TWIG_LEVEL : LEAF_LEVEL;
+	res = repair_tree_build(tree, ptrs, n, level);
+	aal_free(ptrs);
+
+	if (res) {
+		aal_error("Add missing pass failed to build the tree "
+			  "over unconnected nodes.");
+		return res;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (nodes[i].flags & AM_OVERLAP)
+			continue;
+
+		node = NULL;
+
+		/* Only nodes with items pointing to blocks are read again
+		   to mark these blocks used. */
+		if ((nodes[i].flags & AM_LAYOUT) &&
+		    !(node = reiser4_node_open(tree, nodes[i].ptr.blk)))
+		{
+			aal_error("Add Missing pass failed to "
+				  "open the node (%llu)",
+				  (unsigned long long)nodes[i].ptr.blk);
+			return -EINVAL;
+		}
+
+		res = repair_am_node_done(am, bitmap, node,
+					  nodes[i].ptr.blk, stat);
+
+		if (node)
+			reiser4_node_close(node);
+
+		if (res)
+			return res;
+
+		/* Taken care of, attaching skips it. */
+		nodes[i].ptr.blk = INVAL_BLK;
+	}
+
+	return 0;
+}
+
 static errno_t repair_am_nodes_insert(repair_am_t *am, 
 				      reiser4_bitmap_t *bitmap,
 				      stat_bitmap_t *stat)
 {
-	reiser4_node_t *node;
+	am_node_t *nodes;
 	uint64_t total;
+	uint64_t i, n;
 	errno_t res;
 	blk_t blk;
 	
@@ -141,70 +444,69 @@ static errno_t repair_am_nodes_insert(repair_am_t *am,
 	aal_assert("vpf-1283", bitmap != NULL);
 	aal_assert("vpf-1284", stat != NULL);
 	
-	total = reiser4_bitmap_marked(bitmap);
+	if (!(total = reiser4_bitmap_marked(bitmap)))
+		return 0;
+
+	if (!(nodes = aal_malloc(total * sizeof(*nodes))))
+		return -ENOMEM;
 	
-	blk = 0;
-	/* Try to insert the whole twig/leaf at once. If it can be 
-	   inserted only after splitting the node found by lookup 
-	   into 2 nodes -- it will be done instead of following item
-	   by item insertion. */
-	while ((blk = reiser4_bitmap_find_marked(bitmap, blk)) != INVAL_BLK) {
-		node = reiser4_node_open(am->repair->fs->tree, blk);
+	/* Gather key ranges of all twigs/leaves first, reading them in the
+	   disk order. */
+	for (blk = 0, n = 0; (blk = reiser4_bitmap_find_marked(bitmap, blk))
+		     != INVAL_BLK && n < total; blk++)
+	{
 		stat->read++;
-		aal_gauge_set_value(am->gauge, stat->read * 100 / total);
+		aal_gauge_set_value(am->gauge, stat->read * 50 / total);
 		aal_gauge_touch(am->gauge);
 
-		if (node == NULL) {
-			aal_error("Add Missing pass failed to "
-				  "open the node (%llu)",
-				  (unsigned long long)blk);
-
-			return -EINVAL;
-		}
+		if ((res = repair_am_node_scan(am, bitmap, blk, &nodes[n])) < 0)
+			goto error_free_nodes;
 
-		/* Prepare the node for the insertion. */
-		if ((res = repair_am_node_prepare(am, node))) 
-			goto error_close_node;
-
-		if (reiser4_node_items(node) == 0) {
-			reiser4_bitmap_clear(bitmap, node->block->nr);
-			repair_am_blk_free(am, node->block->nr);
-			reiser4_node_close(node);
+		if (res)
 			stat->empty++;
-			blk++;
-			continue;
-		}
+		else
+			n++;
+	}
 
-		res = repair_tree_attach_node(am->repair->fs->tree, node);
-		
-		if (res < 0 && res != -ESTRUCT) {
-			aal_error("Add missing pass failed to attach "
-				  "the node (%llu) to the tree.",
-				  (unsigned long long)blk);
+	if ((res = repair_am_nodes_sort(nodes, n)))
+		goto error_free_nodes;
 
-			goto error_close_node;
-		} else if (res == 0) {
-			/* Has been inserted. */
-			reiser4_bitmap_clear(bitmap, node->block->nr);
-			repair_am_blk_used(am, node->block->nr);
+	repair_am_nodes_overlap(nodes, n);
 
-			stat->by_node++;
+	/* If the tree is empty, not overlapping nodes are put to it at once
+	   by building internal levels bottom-up. */
+	if (reiser4_tree_fresh(am->repair->fs->tree)) {
+		if ((res = repair_am_nodes_build(am, bitmap, nodes, n, stat)))
+			goto error_free_nodes;
+	}
+
+	/* Try to insert the whole twig/leaf at once. If it can be 
+	   inserted only after splitting the node found by lookup 
+	   into 2 nodes -- it will be done instead of following item
+	   by item insertion. Nodes go in the key order, so lookups
+	   go through the same path mostly. */
+	for (i = 0; i < n; i++) {
+		aal_gauge_set_value(am->gauge, 50 + (i + 1) * 50 / n);
+		aal_gauge_touch(am->gauge);
 
-			res = reiser4_node_trav(node, cb_layout, am);
-			if (res) goto error_close_node;
+		if (nodes[i].ptr.blk == INVAL_BLK)
+			continue;
 
-		} else {
-			/* uninsertable case - insert by item later. */
-			reiser4_node_fini(node);
+		if ((res = repair_am_node_attach(am, bitmap,
+						 nodes[i].ptr.blk, stat)))
+		{
+			goto error_free_nodes;
 		}
-		
-		blk++;
+
+		if ((res = repair_am_checkpoint(am)))
+			goto error_free_nodes;
 	}
 
+	aal_free(nodes);
 	return 0;
 
- error_close_node:
-	reiser4_node_close(node);
+ error_free_nodes:
+	aal_free(nodes);
 	return res;
 }
 
@@ -280,6 +582,9 @@ static errno_t repair_am_items_insert(repair_am_t *am,
 		repair_am_blk_free(am, node->block->nr);
 		reiser4_node_close(node);
 		blk++;
+
+		if ((res = repair_am_checkpoint(am)))
+			return res;
 	}
 
 	return 0;
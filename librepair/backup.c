@@ -218,10 +218,6 @@ static errno_t cb_blocks_free(void *h, void *data) {
 	return 0;
 }
 
-extern errno_t reiser4_backup_layout_body(reiser4_alloc_t *alloc, 
-					  uint32_t blksize, uint64_t len, 
-					  region_func_t func, void *data);
-
 /* This method reads all possible locations of backup blocks and make a decision
    what block is a correct one and what is a corrupted one. It must work even if
    master or format-specific super block cannot be opened.
@@ -531,6 +527,7 @@ reiser4_backup_t *repair_backup_open(reiser4_fs_t *fs, uint8_t mode) {
 		reiser4_backup_mkdirty(backup);
 
 	aal_list_free(list, cb_blocks_free, NULL);
+	reiser4_fs_owner_reset(fs);
 	return backup;
 
  error_free_alloc:
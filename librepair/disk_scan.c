@@ -25,6 +25,8 @@ static void repair_disk_scan_update(repair_ds_t *ds) {
 	aal_stream_init(&stream, NULL, &memory_stream);
 	
 	aal_stream_format(&stream, "\tRead nodes %llu\n", ds->stat.read_nodes);
+	aal_stream_format(&stream, "\tRead requests %llu\n", 
+			  ds->stat.read_requests);
 	aal_stream_format(&stream, "\tGood nodes %llu\n", ds->stat.good_nodes);
 	
 	aal_stream_format(&stream, "\t\tLeaves of them %llu, Twigs of them "
@@ -62,9 +64,10 @@ static errno_t cb_count_sd(reiser4_place_t *place, void *data) {
 /* The pass inself, goes through all the blocks marked in the scan bitmap, and
    if a block can contain some data to be recovered (formatted and contains not
    tree index data only) then fix all corruptions within the node and save it
-   for further insertion. */
+   for further insertion. Blocks are read ahead by large requests. */
 errno_t repair_disk_scan(repair_ds_t *ds) {
 	reiser4_node_t *node;
+	repair_ra_t ra;
 	aal_gauge_t *gauge;
 	errno_t res = 0;
 	uint64_t total;
@@ -79,6 +82,10 @@ errno_t repair_disk_scan(repair_ds_t *ds) {
 	aal_assert("vpf-820", ds->bm_scan != NULL);
 	aal_assert("vpf-820", ds->bm_met != NULL);    
 	
+	if ((res = repair_ra_init(&ra, ds->repair->fs->tree, ds->bm_scan,
+				  ds->repair->jobs)))
+		return res;
+	
 	aal_mess("LOOKING FOR UNCONNECTED NODES");
 	gauge = aal_gauge_create(aux_gauge_handlers[GT_PROGRESS], 
 				 NULL, NULL, 500, NULL);
@@ -94,8 +101,8 @@ errno_t repair_disk_scan(repair_ds_t *ds) {
 		aal_gauge_set_value(gauge, ds->stat.read_nodes * 100 / total);
 		aal_gauge_touch(gauge);
 		
-		if (!(node = repair_node_open(ds->repair->fs->tree, blk, 
-					      ds->mkidok ? ds->mkid : 0)))
+		if (!(node = repair_ra_open(&ra, blk, 
+					    ds->mkidok ? ds->mkid : 0)))
 		{
 			blk++;
 			continue;
@@ -161,6 +168,8 @@ errno_t repair_disk_scan(repair_ds_t *ds) {
  error:
 	aal_gauge_done(gauge);
 	aal_gauge_free(gauge);
+	ds->stat.read_requests = ra.requests;
+	repair_ra_fini(&ra);
 	repair_disk_scan_update(ds);
 	return res;
 }
@@ -159,11 +159,50 @@ errno_t repair_fs_replay(reiser4_fs_t *fs) {
 	return 0;
 }
 
-/* Pack passed @fs to @stream. */
+/* Writes the index of @count records in @entries and the tail of the packed
+   fs to @stream. @offset is the offset of the index from the first record. */
+static errno_t repair_fs_pack_index(reiser4_fs_t *fs,
+				    repair_pack_entry_t *entries,
+				    uint64_t count, uint64_t offset,
+				    aal_stream_t *stream)
+{
+	repair_pack_tail_t tail;
+	uint64_t size;
+
+	size = count * sizeof(*entries);
+	
+	aal_stream_write(stream, INDEX_PACK_SIGN, 4);
+	aal_stream_write(stream, &count, sizeof(count));
+	
+	if (count && aal_stream_write(stream, entries, size) != (int64_t)size)
+		return -EIO;
+
+	aal_memset(&tail, 0, sizeof(tail));
+	aal_memcpy(tail.sign, TAIL_PACK_SIGN, 4);
+	
+	tail.index = offset;
+	tail.blocks = reiser4_format_get_len(fs->format);
+	tail.blksize = reiser4_master_get_blksize(fs->master);
+
+	if (aal_stream_write(stream, &tail, sizeof(tail)) != sizeof(tail))
+		return -EIO;
+
+	return 0;
+}
+
+/* Pack passed @fs to @stream. If @index is set, node and block records are
+   followed by their index, see repair_pack_entry_t. Such a stream cannot be
+   unpacked by tools not knowing the index, so it is written on demand only. */
 errno_t repair_fs_pack(reiser4_fs_t *fs, 
 		       reiser4_bitmap_t *bitmap, 
-		       aal_stream_t *stream) 
+		       aal_stream_t *stream,
+		       bool_t index) 
 {
+	repair_pack_entry_t *entries = NULL;
+	reiser4_owner_map_t *owners;
+	aal_stream_t record, *out;
+	uint64_t count, size;
+	uint64_t offset;
 	count_t len;
 	errno_t res;
 	blk_t blk;
@@ -204,18 +243,24 @@ errno_t repair_fs_pack(reiser4_fs_t *fs,
 	
 	len = reiser4_format_get_len(fs->format);
 
-	/* Loop though the all data blocks, check if they belong to tree and if
-	   so try to open a formated node on it. */
-	for (blk = 0; blk < len; blk++) {
+	/* Blocks of fs components are looked up in the ownership map built
+	   once, instead of walking all the layouts for each block. */
+	if (!(owners = reiser4_fs_owner_map(fs)))
+		return -ENOMEM;
+	
+	/* Loop though the used data blocks, check if they belong to tree and
+	   if so try to open a formated node on it. Unused blocks are skipped
+	   by bitmap lookups. */
+	offset = count = size = 0;
+	
+	for (blk = reiser4_bitmap_find_marked(bitmap, 0);
+	     blk != INVAL_BLK && blk < len;
+	     blk = reiser4_bitmap_find_marked(bitmap, blk + 1))
+	{
 		reiser4_node_t *node;
-		errno_t res;
-		
-		/* We're not interested in unused blocks yet. */
-		if (!reiser4_bitmap_test(bitmap, blk))
-			continue;
 
 		/* We're not interested in other blocks, but tree nodes. */
-		if (reiser4_fs_belongs(fs, blk) != O_UNKNOWN)
+		if (reiser4_owner_map_find(owners, blk) != O_UNKNOWN)
 			continue;
 
 		/* Try to open @blk block and find out is it formatted one or
@@ -223,30 +268,78 @@ errno_t repair_fs_pack(reiser4_fs_t *fs,
 		if (!(node = reiser4_node_open(fs->tree, blk)))
 			continue;
 
+		/* Indexed records are built in memory to know their offsets. */
+		if (index) {
+			aal_stream_init(&record, NULL, &memory_stream);
+			out = &record;
+		} else {
+			out = stream;
+		}
+		
 		res = repair_node_check_struct(node, NULL, RM_CHECK, NULL);
 
 		if (res > 0) {
-			aal_stream_write(stream, BLOCK_PACK_SIGN, 4);
+			aal_stream_write(out, BLOCK_PACK_SIGN, 4);
 		
 			/* Packing @node to @stream. */
-			if ((res = repair_fs_block_pack(node->block, stream)))
-				return res;
+			res = repair_fs_block_pack(node->block, out);
 		} else if (res == 0) {
-			aal_stream_write(stream, NODE_PACK_SIGN, 4);
+			aal_stream_write(out, NODE_PACK_SIGN, 4);
 		
 			/* Packing @node to @stream. */
-			if ((res = repair_node_pack(node, stream)))
-				return res;
-		} else {
-			reiser4_node_close(node);
-			return res;
+			res = repair_node_pack(node, out);
 		}
 
 		/* Close node. */
 		reiser4_node_close(node);
+
+		if (res < 0) {
+			if (index)
+				aal_stream_fini(&record);
+			
+			goto error_free_entries;
+		}
+
+		if (!index)
+			continue;
+
+		if (count == size) {
+			size = size ? size * 2 : 1024;
+
+			if (!(entries = aal_realloc(entries, size *
+						    sizeof(*entries))))
+			{
+				aal_stream_fini(&record);
+				res = -ENOMEM;
+				goto error_free_entries;
+			}
+		}
+
+		entries[count].blk = blk;
+		entries[count].offset = offset;
+		count++;
+		
+		offset += record.size;
+		
+		if (aal_stream_write(stream, record.entity, record.size) !=
+		    record.size)
+		{
+			aal_stream_fini(&record);
+			res = -EIO;
+			goto error_free_entries;
+		}
+		
+		aal_stream_fini(&record);
 	}
 
-	return 0;
+	if (index)
+		res = repair_fs_pack_index(fs, entries, count, offset, stream);
+	
+ error_free_entries:
+	if (entries)
+		aal_free(entries);
+	
+	return res;
 }
 
 static errno_t cb_mark_used(uint64_t start, uint64_t count, void *data) {
@@ -257,18 +350,17 @@ static errno_t cb_mark_used(uint64_t start, uint64_t count, void *data) {
 	return 0;
 }
 
-/* Unpack filesystem from @stream to @device. */
-reiser4_fs_t *repair_fs_unpack(aal_device_t *device,
-			       reiser4_bitmap_t *bitmap,
-			       aal_stream_t *stream)
+/* Unpacks all the fs components but the tree from @stream to @device. The
+   stream is left at the first node or block record. */
+reiser4_fs_t *repair_fs_unpack_meta(aal_device_t *device,
+				    reiser4_bitmap_t *bitmap,
+				    aal_stream_t *stream)
 {
 	uint64_t bn;
 	uint32_t bs;
 	reiser4_fs_t *fs;
 	char sign[5] = {0};
-	
 	aal_block_t *block;
-	reiser4_node_t *node;
 	
 	aal_assert("umka-2633", device != NULL);
 	aal_assert("umka-2648", stream != NULL);
@@ -404,6 +496,58 @@ reiser4_fs_t *repair_fs_unpack(aal_device_t *device,
 		}
 	}
 		
+	return fs;
+
+ error_free_journal:
+	reiser4_journal_close(fs->journal);
+ error_free_backup:
+	/* Backup is not openned, just raw blocks are copied. */
+ error_free_status:
+	reiser4_status_close(fs->status);
+ error_free_alloc:
+	reiser4_alloc_close(fs->alloc);
+ error_free_tree:
+	reiser4_tree_close(fs->tree);
+ error_free_oid:
+	reiser4_oid_close(fs->oid);
+ error_free_format:
+	reiser4_format_close(fs->format);
+ error_free_master:
+	reiser4_master_close(fs->master);
+ error_free_fs:
+	aal_free(fs);
+	return NULL;
+}
+
+/* Frees the fs unpacked by repair_fs_unpack_meta() without saving it. */
+static void repair_fs_unpack_free(reiser4_fs_t *fs) {
+	reiser4_journal_close(fs->journal);
+	reiser4_status_close(fs->status);
+	reiser4_alloc_close(fs->alloc);
+	reiser4_tree_close(fs->tree);
+	reiser4_oid_close(fs->oid);
+	reiser4_format_close(fs->format);
+	reiser4_master_close(fs->master);
+	aal_free(fs);
+}
+
+/* Unpack filesystem from @stream to @device. */
+reiser4_fs_t *repair_fs_unpack(aal_device_t *device,
+			       reiser4_bitmap_t *bitmap,
+			       aal_stream_t *stream)
+{
+	char sign[5] = {0};
+	reiser4_fs_t *fs;
+	
+	aal_block_t *block;
+	reiser4_node_t *node;
+	
+	aal_assert("umka-3168", device != NULL);
+	aal_assert("umka-3169", stream != NULL);
+
+	if (!(fs = repair_fs_unpack_meta(device, bitmap, stream)))
+		return NULL;
+	
 	while (1) {
 		int pack;
 		
@@ -411,11 +555,15 @@ reiser4_fs_t *repair_fs_unpack(aal_device_t *device,
 			if (aal_stream_eof(stream))
 				break;
 			else
-				goto error_free_journal;
+				goto error_free_fs;
 		}
 
 		node = NULL;
 		block = NULL;
+
+		/* The index of records is not needed for sequential unpack. */
+		if (!aal_strncmp(sign, INDEX_PACK_SIGN, 4))
+			break;
 		
 		if (!aal_strncmp(sign, NODE_PACK_SIGN, 4)) {
 			node = repair_node_unpack(fs->tree, stream);
@@ -426,7 +574,7 @@ reiser4_fs_t *repair_fs_unpack(aal_device_t *device,
 		} else {
 			aal_error("Invalid object %s is detected in stream. "
 				  "Node is expected.", sign);
-			goto error_free_journal;
+			goto error_free_fs;
 		}
 
 		if ((pack && !node) || (!pack && !block)) {
@@ -455,24 +603,8 @@ reiser4_fs_t *repair_fs_unpack(aal_device_t *device,
  error:
 	if (block) aal_block_free(block);
 	if (node) reiser4_node_close(node);
- error_free_journal:
-	reiser4_journal_close(fs->journal);
- error_free_backup:
-	/* Backup is not openned, just raw blocks are copied. */
- error_free_status:
-	reiser4_status_close(fs->status);
- error_free_alloc:
-	reiser4_alloc_close(fs->alloc);
- error_free_tree:
-	reiser4_tree_close(fs->tree);
- error_free_oid:
-	reiser4_oid_close(fs->oid);
- error_free_format:
-	reiser4_format_close(fs->format);
- error_free_master:
-	reiser4_master_close(fs->master);
  error_free_fs:
-	aal_free(fs);
+	repair_fs_unpack_free(fs);
 	return NULL;
 }
 
@@ -0,0 +1,429 @@
+/* Copyright 2001-2005 by Hans Reiser, licensing governed by
+   reiser4progs/COPYING.
+
+   librepair/image.c - device over the packed fs metadata image. */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <repair/librepair.h>
+
+/* The image of the packed fs. Blocks of fs components are unpacked into
+   memory at open time, nodes are unpacked from their records on reading,
+   the records are found in the index. Blocks written to the image device
+   are kept in memory as well, the image file itself is never changed. */
+typedef struct repair_image {
+	FILE *file;
+
+	/* Offset of the first node record in the file. */
+	off_t start;
+
+	/* Offset of the index from the first record. */
+	uint64_t index;
+
+	uint64_t blocks;
+	uint32_t blksize;
+
+	repair_pack_entry_t *entries;
+	uint64_t count;
+
+	/* Key plugin of the fs, needed for unpacking nodes. */
+	reiser4_key_plug_t *kplug;
+
+	/* Blocks unpacked or written in memory. */
+	aal_hash_table_t *written;
+
+	aal_device_t *device;
+} repair_image_t;
+
+static uint64_t cb_image_hash_func(void *key) {
+	return *(uint64_t *)key;
+}
+
+static int cb_image_comp_func(void *key1, void *key2, void *data) {
+	if (*(uint64_t *)key1 < *(uint64_t *)key2)
+		return -1;
+
+	if (*(uint64_t *)key1 > *(uint64_t *)key2)
+		return 1;
+
+	return 0;
+}
+
+static void cb_image_valrem_func(void *val) {
+	aal_block_free((aal_block_t *)val);
+}
+
+/* Returns the index entry of @blk, NULL if there is no record of it. */
+static repair_pack_entry_t *repair_image_find(repair_image_t *image,
+					      blk_t blk)
+{
+	uint64_t left = 0;
+	uint64_t right = image->count;
+
+	while (left < right) {
+		uint64_t middle = (left + right) / 2;
+
+		if (image->entries[middle].blk == blk)
+			return &image->entries[middle];
+
+		if (image->entries[middle].blk < blk)
+			left = middle + 1;
+		else
+			right = middle;
+	}
+
+	return NULL;
+}
+
+/* Unpacks the record of the fs block @blk to @buff. */
+static errno_t repair_image_record(repair_image_t *image,
+				   repair_pack_entry_t *entry,
+				   char *buff)
+{
+	reiser4_node_t *node;
+	aal_block_t *block;
+	aal_stream_t stream;
+	reiser4_plug_t *plug;
+	char sign[5] = {0};
+	errno_t res = -EIO;
+	blk_t blk;
+	rid_t pid;
+
+	if (fseeko(image->file, image->start + entry->offset, SEEK_SET))
+		return -EIO;
+
+	aal_stream_init(&stream, image->file, &file_stream);
+
+	if (aal_stream_read(&stream, sign, 4) != 4)
+		goto error_fini_stream;
+
+	if (!aal_strncmp(sign, BLOCK_PACK_SIGN, 4)) {
+		if (aal_stream_read(&stream, &blk, sizeof(blk)) != sizeof(blk) ||
+		    aal_stream_read(&stream, buff, image->blksize) !=
+		    image->blksize)
+		{
+			goto error_fini_stream;
+		}
+
+		res = 0;
+		goto error_fini_stream;
+	}
+
+	if (aal_strncmp(sign, NODE_PACK_SIGN, 4) || !image->kplug) {
+		aal_error("Invalid record %s of the block %llu is detected "
+			  "in the image.", sign, (unsigned long long)entry->blk);
+		goto error_fini_stream;
+	}
+
+	if (aal_stream_read(&stream, &pid, sizeof(pid)) != sizeof(pid) ||
+	    aal_stream_read(&stream, &blk, sizeof(blk)) != sizeof(blk))
+	{
+		goto error_fini_stream;
+	}
+
+	if (!(plug = reiser4_factory_ifind(NODE_PLUG_TYPE, pid))) {
+		aal_error("Can't find node plugin by its id 0x%x.", pid);
+		goto error_fini_stream;
+	}
+
+	if (!(block = aal_block_alloc(image->device, image->blksize, blk))) {
+		res = -ENOMEM;
+		goto error_fini_stream;
+	}
+
+	aal_block_fill(block, 0);
+
+	if (!(node = plugcall((reiser4_node_plug_t *)plug, unpack,
+			      block, image->kplug, &stream)))
+	{
+		aal_block_free(block);
+		goto error_fini_stream;
+	}
+
+	aal_memcpy(buff, node->block->data, image->blksize);
+	reiser4_node_close(node);
+	res = 0;
+
+ error_fini_stream:
+	aal_stream_fini(&stream);
+	return res;
+}
+
+/* Gets the content of the fs block @blk: written one, unpacked from its
+   record, or zeroed one if the image has nothing about @blk. */
+static errno_t repair_image_fetch(repair_image_t *image, blk_t blk,
+				  char *buff)
+{
+	repair_pack_entry_t *entry;
+	aal_block_t *block;
+
+	if ((block = aal_hash_table_lookup(image->written, &blk))) {
+		aal_memcpy(buff, block->data, image->blksize);
+		return 0;
+	}
+
+	if ((entry = repair_image_find(image, blk)))
+		return repair_image_record(image, entry, buff);
+
+	aal_memset(buff, 0, image->blksize);
+	return 0;
+}
+
+static errno_t repair_image_open_device(aal_device_t *device, void *person,
+					uint32_t blksize, int flags)
+{
+	repair_image_t *image = (repair_image_t *)person;
+
+	device->entity = image;
+	image->device = device;
+
+	return 0;
+}
+
+/* Reads or writes @count device blocks at @blk fs block by fs block, as
+   device blocks may be smaller than fs ones. */
+static errno_t repair_image_rw(aal_device_t *device, void *buff,
+			       blk_t blk, count_t count, int write)
+{
+	repair_image_t *image = (repair_image_t *)device->entity;
+	uint64_t offset, end;
+	aal_block_t *block;
+	errno_t res;
+
+	offset = blk * device->blksize;
+	end = offset + count * device->blksize;
+
+	while (offset < end) {
+		uint32_t off, size;
+		blk_t fblk;
+
+		fblk = offset / image->blksize;
+		off = offset % image->blksize;
+		size = image->blksize - off;
+
+		if (size > end - offset)
+			size = end - offset;
+
+		if (!(block = aal_hash_table_lookup(image->written, &fblk))) {
+			if (!(block = aal_block_alloc(device, image->blksize,
+						      fblk)))
+			{
+				return -ENOMEM;
+			}
+
+			if ((res = repair_image_fetch(image, fblk,
+						      block->data)))
+			{
+				aal_block_free(block);
+				return res;
+			}
+
+			/* Only written blocks are kept in memory. */
+			if (write && aal_hash_table_insert(image->written,
+							   &block->nr, block))
+			{
+				aal_block_free(block);
+				return -ENOMEM;
+			}
+		}
+
+		if (write) {
+			aal_memcpy(block->data + off, buff, size);
+		} else {
+			aal_memcpy(buff, block->data + off, size);
+
+			if (!aal_hash_table_lookup(image->written, &fblk))
+				aal_block_free(block);
+		}
+
+		buff += size;
+		offset += size;
+	}
+
+	return 0;
+}
+
+static errno_t repair_image_read(aal_device_t *device, void *buff,
+				 blk_t blk, count_t count)
+{
+	return repair_image_rw(device, buff, blk, count, 0);
+}
+
+static errno_t repair_image_write(aal_device_t *device, void *buff,
+				  blk_t blk, count_t count)
+{
+	return repair_image_rw(device, buff, blk, count, 1);
+}
+
+static errno_t repair_image_sync(aal_device_t *device) {
+	return 0;
+}
+
+static int repair_image_equals(aal_device_t *device1,
+			       aal_device_t *device2)
+{
+	return device1->entity == device2->entity;
+}
+
+static count_t repair_image_len(aal_device_t *device) {
+	repair_image_t *image = (repair_image_t *)device->entity;
+
+	return image->blocks * image->blksize / device->blksize;
+}
+
+static void repair_image_free(repair_image_t *image) {
+	if (image->written)
+		aal_hash_table_free(image->written);
+
+	if (image->entries)
+		aal_free(image->entries);
+
+	aal_free(image);
+}
+
+static void repair_image_close_device(aal_device_t *device) {
+	repair_image_free((repair_image_t *)device->entity);
+}
+
+struct aal_device_ops image_ops = {
+	.open    = repair_image_open_device,
+	.read    = repair_image_read,
+	.write   = repair_image_write,
+	.sync    = repair_image_sync,
+	.equals  = repair_image_equals,
+	.len     = repair_image_len,
+	.close   = repair_image_close_device
+};
+
+/* Reads the tail of the image, it ends the image file. */
+static errno_t repair_image_tail(repair_image_t *image) {
+	repair_pack_tail_t tail;
+
+	if (fseeko(image->file, -(off_t)sizeof(tail), SEEK_END) ||
+	    fread(&tail, sizeof(tail), 1, image->file) != 1 ||
+	    aal_strncmp(tail.sign, TAIL_PACK_SIGN, 4))
+	{
+		aal_error("The image has no index of blocks. It was packed "
+			  "without the index or is truncated, unpack it "
+			  "instead.");
+		return -EINVAL;
+	}
+
+	image->index = tail.index;
+	image->blocks = tail.blocks;
+	image->blksize = tail.blksize;
+
+	return 0;
+}
+
+/* Reads the index of the image. Offsets are counted from the first record,
+   so @image->start should be known already. */
+static errno_t repair_image_index(repair_image_t *image) {
+	char sign[4];
+	uint64_t size;
+
+	if (fseeko(image->file, image->start + image->index, SEEK_SET) ||
+	    fread(sign, 4, 1, image->file) != 1 ||
+	    aal_strncmp(sign, INDEX_PACK_SIGN, 4) ||
+	    fread(&image->count, sizeof(image->count), 1, image->file) != 1)
+	{
+		aal_error("Can't read the index of the image.");
+		return -EIO;
+	}
+
+	if (!image->count)
+		return 0;
+
+	size = image->count * sizeof(repair_pack_entry_t);
+
+	if (!(image->entries = aal_malloc(size)))
+		return -ENOMEM;
+
+	if (fread(image->entries, size, 1, image->file) != 1) {
+		aal_error("Can't read the index of the image.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* Opens the device over the packed fs metadata image @file. The file should
+   be positioned after the header written by the packing application, at the
+   packed fs itself. The device may be opened as a reiser4 fs then, without
+   unpacking the image to a real device. */
+aal_device_t *repair_image_open(FILE *file, char *name) {
+	repair_image_t *image;
+	aal_device_t *device;
+	aal_stream_t stream;
+	reiser4_fs_t *fs;
+	off_t start;
+
+	aal_assert("umka-3170", file != NULL);
+
+	if (!(image = aal_calloc(sizeof(*image), 0)))
+		return NULL;
+
+	image->file = file;
+
+	if ((start = ftello(file)) == -1)
+		goto error_free_image;
+
+	if (repair_image_tail(image))
+		goto error_free_image;
+
+	if (!(image->written = aal_hash_table_create(1024,
+						     cb_image_hash_func,
+						     cb_image_comp_func,
+						     NULL,
+						     cb_image_valrem_func)))
+	{
+		goto error_free_image;
+	}
+
+	if (!(device = aal_device_open(&image_ops, image,
+				       512, O_RDWR)))
+	{
+		goto error_free_image;
+	}
+
+	aal_strncpy(device->name, name, sizeof(device->name));
+
+	/* Unpacking fs components into memory. They are followed by node
+	   records, which offsets are counted from. */
+	if (fseeko(file, start, SEEK_SET))
+		goto error_close_device;
+
+	aal_stream_init(&stream, file, &file_stream);
+	fs = repair_fs_unpack_meta(device, NULL, &stream);
+	aal_stream_fini(&stream);
+
+	if (!fs)
+		goto error_close_device;
+
+	image->start = ftello(file);
+	image->kplug = fs->tree->key.plug;
+
+	if (image->start == -1 || repair_image_index(image)) {
+		reiser4_fs_close(fs);
+		goto error_close_device;
+	}
+
+	/* Writing unpacked components into memory. */
+	if (reiser4_fs_sync(fs)) {
+		reiser4_fs_close(fs);
+		goto error_close_device;
+	}
+
+	reiser4_fs_close(fs);
+	return device;
+
+ error_close_device:
+	aal_device_close(device);
+	return NULL;
+ error_free_image:
+	repair_image_free(image);
+	return NULL;
+}
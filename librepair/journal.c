@@ -39,7 +39,7 @@ errno_t repair_journal_open(reiser4_fs_t *fs,
 	aal_assert("vpf-445", fs != NULL);
 	aal_assert("vpf-446", fs->format != NULL);
 	aal_assert("vpf-476", journal_device != NULL);
-	
+
 	/* Try to open the journal. */
 	if ((fs->journal = reiser4_journal_open(fs, journal_device)) == NULL) {
 		/* failed to open a journal. Build a new one. */
@@ -160,6 +160,7 @@ reiser4_journal_t *repair_journal_unpack(reiser4_fs_t *fs,
 		goto error;
 	}
 
+	reiser4_fs_owner_reset(fs);
 	return journal;
 	
  error:
@@ -3,8 +3,31 @@
    
    librepair/node.c - methods are needed for node recovery. */
 
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
 #include <repair/librepair.h>
 
+#ifdef HAVE_LIBPTHREAD
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <pthread.h>
+#endif
+
+/* Checks the @node has correct mkid stamp, closes it otherwise. */
+static reiser4_node_t *repair_node_check_mkid(reiser4_node_t *node,
+					      uint32_t mkid)
+{
+	/* Extra checks are needed. */
+	if (mkid && mkid != reiser4_node_get_mstamp(node)) {
+		reiser4_node_close(node);
+		return NULL;
+	}
+	
+	return node;
+}
+
 /* Opens the node if it has correct mkid stamp. */
 reiser4_node_t *repair_node_open(reiser4_tree_t *tree, blk_t blk, uint32_t mkid)
 {
@@ -15,17 +38,403 @@ reiser4_node_t *repair_node_open(reiser4_tree_t *tree, blk_t blk, uint32_t mkid)
 	if (!(node = reiser4_node_open(tree, blk)))
 		return NULL;
 	
-	/* Extra checks are needed. */
-	if (mkid && mkid != reiser4_node_get_mstamp(node))
-		goto error_node_free;
+	return repair_node_check_mkid(node, mkid);
+}
+
+/* The same as above, but opens the node from already read @block. */
+reiser4_node_t *repair_node_open_block(reiser4_tree_t *tree,
+				       aal_block_t *block,
+				       uint32_t mkid)
+{
+	reiser4_node_t *node;
 	
-	return node;
+	aal_assert("vpf-1916", tree != NULL);
+	
+	if (!(node = reiser4_node_open_block(tree, block)))
+		return NULL;
 	
- error_node_free:
-	reiser4_node_close(node);
+	return repair_node_check_mkid(node, mkid);
+}
+
+/* Max number of not read blocks between two runs of blocks to be read, which
+   are read along with them. Reading few extra blocks is cheaper than a seek. */
+#define RA_GAP	16
+
+/* Returns the length of the region starting at marked @start to be read by one
+   request. The region consists of runs of marked in @bm blocks separated by
+   short gaps. */
+static count_t repair_ra_region(reiser4_bitmap_t *bm, blk_t start) {
+	blk_t end = start;
+	blk_t next;
+
+	while (end < bm->total) {
+		/* Extending the region over the run of marked blocks. */
+		if ((end = reiser4_bitmap_find_cleared(bm, end)) == INVAL_BLK)
+			end = bm->total;
+		
+		if (end - start >= RA_BLOCKS)
+			return RA_BLOCKS;
+
+		if (end >= bm->total)
+			break;
+		
+		/* Bridging the gap to the next run if it is short enough. */
+		next = reiser4_bitmap_find_marked(bm, end);
+		
+		if (next == INVAL_BLK || next - end > RA_GAP ||
+		    next - start >= RA_BLOCKS)
+		{
+			break;
+		}
+
+		end = next;
+	}
+
+	return end - start;
+}
+
+#ifdef HAVE_LIBPTHREAD
+enum ra_state {
+	RA_FREE		= 0,
+	RA_QUEUED	= 1,
+	RA_READY	= 2
+};
+
+/* The region queued for the reading stage. */
+typedef struct ra_slot {
+	char *buff;
+	blk_t start;
+	count_t count;
+	int failed;
+	int state;
+} ra_slot_t;
+
+/* The reading stage. The thread reads regions queued by repair_ra_open() in
+   the order they are queued through its own descriptor of the device, while
+   the caller checks nodes of regions read before. The thread touches neither
+   the tree nor the bitmap, it just fills buffers of slots. */
+typedef struct ra_pipe {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	int fd;
+	int stop;
+	uint32_t size;
+
+	ra_slot_t *slots;
+	uint32_t nr;			/* Slots count. */
+	uint32_t head;			/* The oldest queued region. */
+	uint32_t queued;		/* Queued regions count. */
+	blk_t next;			/* Where to look for the next region. */
+} ra_pipe_t;
+
+static int repair_ra_pread(int fd, char *buff, uint64_t offset,
+			   uint64_t size)
+{
+	ssize_t done;
+
+	while (size) {
+		if ((done = pread(fd, buff, size, offset)) <= 0) {
+			if (done < 0 && errno == EINTR)
+				continue;
+			
+			return -EIO;
+		}
+
+		buff += done;
+		size -= done;
+		offset += done;
+	}
+
+	return 0;
+}
+
+static void *repair_ra_reader(void *data) {
+	ra_pipe_t *pipe = (ra_pipe_t *)data;
+	uint32_t pos = 0;
+	ra_slot_t *slot;
+	int failed;
+
+	pthread_mutex_lock(&pipe->lock);
+	
+	while (1) {
+		slot = &pipe->slots[pos];
+		
+		while (!pipe->stop && slot->state != RA_QUEUED)
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+
+		if (pipe->stop)
+			break;
+
+		pthread_mutex_unlock(&pipe->lock);
+		
+		failed = repair_ra_pread(pipe->fd, slot->buff,
+					 (uint64_t)slot->start * pipe->size,
+					 (uint64_t)slot->count * pipe->size);
+		
+		pthread_mutex_lock(&pipe->lock);
+		
+		slot->failed = failed;
+		slot->state = RA_READY;
+		pthread_cond_broadcast(&pipe->cond);
+		pos = (pos + 1) % pipe->nr;
+	}
+	
+	pthread_mutex_unlock(&pipe->lock);
 	return NULL;
 }
 
+static void repair_ra_pipe_free(ra_pipe_t *pipe) {
+	uint32_t i;
+
+	for (i = 0; i < pipe->nr; i++) {
+		if (pipe->slots[i].buff)
+			aal_free(pipe->slots[i].buff);
+	}
+	
+	aal_free(pipe->slots);
+	aal_free(pipe);
+}
+
+/* Starts the reading stage with @jobs regions to be read ahead. Returns NULL
+   if it cannot be started, nodes are read synchronously then. */
+static ra_pipe_t *repair_ra_pipe_start(repair_ra_t *ra, uint32_t jobs) {
+	aal_device_t *device;
+	ra_pipe_t *pipe;
+	uint32_t i;
+
+	device = ra->tree->fs->device;
+	
+	if (!(pipe = aal_calloc(sizeof(*pipe), 0)))
+		return NULL;
+
+	pipe->nr = jobs;
+	pipe->size = ra->size;
+
+	if (!(pipe->slots = aal_calloc(jobs * sizeof(ra_slot_t), 0)))
+		goto error_free_pipe;
+
+	for (i = 0; i < jobs; i++) {
+		if (!(pipe->slots[i].buff = aal_malloc(RA_BLOCKS * ra->size)))
+			goto error_free_pipe;
+	}
+
+	if ((pipe->fd = open(device->name, O_RDONLY)) == -1)
+		goto error_free_pipe;
+
+	pthread_mutex_init(&pipe->lock, NULL);
+	pthread_cond_init(&pipe->cond, NULL);
+	
+	if (pthread_create(&pipe->thread, NULL, repair_ra_reader, pipe))
+		goto error_close_fd;
+
+	return pipe;
+	
+ error_close_fd:
+	pthread_cond_destroy(&pipe->cond);
+	pthread_mutex_destroy(&pipe->lock);
+	close(pipe->fd);
+ error_free_pipe:
+	repair_ra_pipe_free(pipe);
+	return NULL;
+}
+
+static void repair_ra_pipe_stop(ra_pipe_t *pipe) {
+	pthread_mutex_lock(&pipe->lock);
+	pipe->stop = 1;
+	pthread_cond_broadcast(&pipe->cond);
+	pthread_mutex_unlock(&pipe->lock);
+	
+	pthread_join(pipe->thread, NULL);
+	
+	pthread_cond_destroy(&pipe->cond);
+	pthread_mutex_destroy(&pipe->lock);
+	close(pipe->fd);
+	repair_ra_pipe_free(pipe);
+}
+
+/* Queues next regions of marked blocks while there are free slots. */
+static void repair_ra_pipe_fill(repair_ra_t *ra, ra_pipe_t *pipe) {
+	ra_slot_t *slot;
+	blk_t start;
+	int queued = 0;
+
+	pthread_mutex_lock(&pipe->lock);
+	
+	while (pipe->queued < pipe->nr) {
+		start = reiser4_bitmap_find_marked(ra->bm, pipe->next);
+
+		if (start == INVAL_BLK)
+			break;
+
+		slot = &pipe->slots[(pipe->head + pipe->queued) % pipe->nr];
+		
+		slot->start = start;
+		slot->count = repair_ra_region(ra->bm, start);
+		slot->state = RA_QUEUED;
+		
+		pipe->next = start + slot->count;
+		pipe->queued++;
+		ra->requests++;
+		queued = 1;
+	}
+
+	if (queued)
+		pthread_cond_broadcast(&pipe->cond);
+	
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+/* Returns the slot with read region containing @blk, or NULL if @blk is not
+   queued. Regions before @blk are released. */
+static ra_slot_t *repair_ra_pipe_wait(ra_pipe_t *pipe, blk_t blk) {
+	ra_slot_t *slot = NULL;
+
+	pthread_mutex_lock(&pipe->lock);
+	
+	while (pipe->queued) {
+		slot = &pipe->slots[pipe->head];
+		
+		if (blk < slot->start) {
+			slot = NULL;
+			break;
+		}
+		
+		while (slot->state != RA_READY)
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+
+		if (blk < slot->start + slot->count)
+			break;
+
+		/* The region is passed, the slot may be reused. */
+		slot->state = RA_FREE;
+		pipe->head = (pipe->head + 1) % pipe->nr;
+		pipe->queued--;
+		slot = NULL;
+	}
+	
+	pthread_mutex_unlock(&pipe->lock);
+	return slot;
+}
+
+/* The same as repair_ra_open(), but gets regions from the reading stage. */
+static reiser4_node_t *repair_ra_pipe_open(repair_ra_t *ra, blk_t blk,
+					   uint32_t mkid)
+{
+	ra_pipe_t *pipe = (ra_pipe_t *)ra->pipe;
+	aal_block_t *block;
+	ra_slot_t *slot;
+
+	slot = repair_ra_pipe_wait(pipe, blk);
+
+	/* The caller may jump over blocks, do not queue ones before @blk. */
+	if (!pipe->queued && pipe->next < blk)
+		pipe->next = blk;
+	
+	repair_ra_pipe_fill(ra, pipe);
+
+	/* The block is not queued or cannot be read with its region. */
+	if (!slot || slot->failed)
+		return repair_node_open(ra->tree, blk, mkid);
+
+	if (!(block = aal_block_alloc(ra->tree->fs->device, ra->size, blk)))
+		return NULL;
+
+	aal_memcpy(block->data, slot->buff + (blk - slot->start) * ra->size,
+		   ra->size);
+	
+	return repair_node_open_block(ra->tree, block, mkid);
+}
+#endif
+
+/* Prepares @ra for reading ahead nodes of @tree marked in @bm. If @jobs is
+   more than 1, blocks are read by the separate thread, which keeps up to @jobs
+   regions read ahead of the checked node. */
+errno_t repair_ra_init(repair_ra_t *ra, reiser4_tree_t *tree,
+		       reiser4_bitmap_t *bm, uint32_t jobs)
+{
+	aal_assert("vpf-1917", ra != NULL);
+	aal_assert("vpf-1918", tree != NULL);
+	aal_assert("vpf-1919", bm != NULL);
+
+	aal_memset(ra, 0, sizeof(*ra));
+	
+	ra->bm = bm;
+	ra->tree = tree;
+	ra->size = reiser4_tree_get_blksize(tree);
+
+#ifdef HAVE_LIBPTHREAD
+	if (jobs > 1) {
+		if ((ra->pipe = repair_ra_pipe_start(ra, jobs)))
+			return 0;
+		
+		aal_warn("Cannot start reading the device in parallel, "
+			 "reading it synchronously.");
+	}
+#endif
+	
+	if (!(ra->buff = aal_malloc(RA_BLOCKS * ra->size)))
+		return -ENOMEM;
+
+	return 0;
+}
+
+void repair_ra_fini(repair_ra_t *ra) {
+	aal_assert("vpf-1920", ra != NULL);
+
+#ifdef HAVE_LIBPTHREAD
+	if (ra->pipe) {
+		repair_ra_pipe_stop((ra_pipe_t *)ra->pipe);
+		return;
+	}
+#endif
+	
+	aal_free(ra->buff);
+}
+
+/* Opens the node at @blk if it has correct mkid stamp. Blocks marked in the
+   @ra bitmap are read by large requests covering runs of them, so sequential
+   opening of marked blocks is bound by the device bandwidth rather than by its
+   latency. If the region cannot be read at once, its blocks are read one by
+   one to get bad ones reported and good ones opened. */
+reiser4_node_t *repair_ra_open(repair_ra_t *ra, blk_t blk, uint32_t mkid) {
+	aal_device_t *device;
+	aal_block_t *block;
+	uint32_t factor;
+	
+	aal_assert("vpf-1921", ra != NULL);
+
+#ifdef HAVE_LIBPTHREAD
+	if (ra->pipe)
+		return repair_ra_pipe_open(ra, blk, mkid);
+#endif
+	
+	device = ra->tree->fs->device;
+	
+	if (blk < ra->start || blk >= ra->start + ra->count) {
+		/* Device is addressed by its own blocks, not by fs ones. */
+		factor = ra->size / device->blksize;
+		
+		ra->start = blk;
+		ra->count = repair_ra_region(ra->bm, blk);
+		ra->failed = aal_device_read(device, ra->buff, blk * factor,
+					     ra->count * factor) != 0;
+		ra->requests++;
+	}
+
+	if (ra->failed)
+		return repair_node_open(ra->tree, blk, mkid);
+
+	if (!(block = aal_block_alloc(device, ra->size, blk)))
+		return NULL;
+
+	aal_memcpy(block->data, ra->buff + (blk - ra->start) * ra->size,
+		   ra->size);
+	
+	return repair_node_open_block(ra->tree, block, mkid);
+}
+
 /* Checks all the items of the node. */
 static errno_t repair_node_items_check(reiser4_node_t *node, place_func_t func,
 				       uint8_t mode, void *data) 
@@ -147,6 +147,12 @@ errno_t repair_object_check_attach(reiser4_object_t *parent,
 	
 	if (!reiser4_psobj(object)->check_attach)
 		return 0;
+
+	/* Directories get ".." added or fixed to point to @parent. */
+	if (mode != RM_CHECK) {
+		reiser4_semantic_forget((reiser4_tree_t *)object->info.tree,
+					&object->info.object, "..");
+	}
 	
 	return plugcall(reiser4_psobj(object), check_attach, 
 			object, parent, place_func, data, mode);
@@ -11,6 +11,7 @@
 #include <repair/semantic.h>
 #include <repair/cleanup.h>
 #include <stdio.h>
+#include <unistd.h>
 
 typedef struct repair_control {
 	repair_data_t *repair;
@@ -29,6 +30,32 @@ typedef struct repair_control {
 	uint64_t sysblk;
 } repair_control_t;
 
+#define REPAIR_CP_MAGIC "R4FsckCheckpoint"
+
+/* Checkpoints of the BUILD mode, the stage tells what is done already. */
+enum {
+	REPAIR_CP_NONE		= 0x0,
+	REPAIR_CP_FILTER	= 0x1,	/* Filter and the first twig scan. */
+	REPAIR_CP_SCAN		= 0x2,	/* Disk scan and the second twig scan. */
+	REPAIR_CP_MISSING	= 0x3,	/* Add missing, maybe partially. */
+	REPAIR_CP_LAST
+};
+
+/* The checkpoint file header, packed bitmaps follow it. */
+typedef struct repair_cp {
+	char magic[16];
+	uint32_t stage;
+	uint32_t stamp;
+	uint64_t fs_len;
+
+	uint64_t oid, files;
+	uint64_t sysblk;
+	uint64_t fatal, fixable;
+
+	uint32_t mkidok;
+	uint32_t mkid;
+} repair_cp_t;
+
 static errno_t repair_bitmap_compare(reiser4_bitmap_t *bm1, 
 				     reiser4_bitmap_t *bm2, 
 				     int verbose) 
@@ -124,6 +151,208 @@ static errno_t cb_release(reiser4_alloc_t *alloc, uint64_t start,
 	return 0;
 }
 
+/* Gets the bitmaps saved at the @stage checkpoint. The used bitmap is not 
+   saved on add missing as it is rebuilt from the tree on resuming. */
+static uint32_t repair_cp_bitmaps(repair_control_t *control, uint32_t stage,
+				  reiser4_bitmap_t ***slots)
+{
+	uint32_t count = 0;
+
+	if (stage < REPAIR_CP_MISSING)
+		slots[count++] = &control->bm_used;
+
+	slots[count++] = &control->bm_twig;
+	slots[count++] = &control->bm_leaf;
+
+	if (stage < REPAIR_CP_MISSING)
+		slots[count++] = &control->bm_met;
+
+	return count;
+}
+
+/* Saves the state of the BUILD mode passes after the @stage into the 
+   checkpoint file. The file is replaced atomically, so that the previous 
+   checkpoint is kept if fsck gets interrupted while saving. */
+static errno_t repair_cp_save(repair_control_t *control, uint32_t stage) {
+	reiser4_bitmap_t **slots[4];
+	repair_data_t *repair;
+	aal_stream_t stream;
+	uint32_t count, i;
+	repair_cp_t cp;
+	errno_t res;
+	FILE *file;
+	char *name;
+
+	aal_assert("umka-3150", control != NULL);
+	aal_assert("umka-3151", stage < REPAIR_CP_LAST);
+
+	repair = control->repair;
+	
+	if (!repair->checkpoint_file || repair->mode != RM_BUILD)
+		return 0;
+
+	/* The saved state describes the tree on disk. */
+	if ((res = reiser4_fs_sync(repair->fs))) {
+		aal_error("Failed to sync the filesystem before saving "
+			  "the checkpoint.");
+		return res;
+	}
+
+	aal_memset(&cp, 0, sizeof(cp));
+	aal_memcpy(cp.magic, REPAIR_CP_MAGIC, sizeof(cp.magic));
+	
+	cp.stage = stage;
+	cp.stamp = reiser4_format_get_stamp(repair->fs->format);
+	cp.fs_len = reiser4_format_get_len(repair->fs->format);
+	cp.oid = control->oid;
+	cp.files = control->files;
+	cp.sysblk = control->sysblk;
+	cp.fatal = repair->fatal;
+	cp.fixable = repair->fixable;
+	cp.mkidok = control->mkidok;
+	cp.mkid = control->mkid;
+
+	count = repair_cp_bitmaps(control, stage, slots);
+	
+	i = aal_strlen(repair->checkpoint_file) + 5;
+	
+	if (!(name = aal_malloc(i)))
+		return -ENOMEM;
+
+	aal_snprintf(name, i, "%s.tmp", repair->checkpoint_file);
+	
+	if (!(file = fopen(name, "w"))) {
+		aal_error("Cannot open the checkpoint file (%s).", name);
+		res = -EIO;
+		goto error_free_name;
+	}
+
+	aal_stream_init(&stream, file, &file_stream);
+
+	if (aal_stream_write(&stream, &cp, sizeof(cp)) != sizeof(cp))
+		res = -EIO;
+	
+	for (i = 0; i < count && !res; i++)
+		res = reiser4_bitmap_pack(*slots[i], &stream);
+
+	aal_stream_fini(&stream);
+
+	if (!res && (fflush(file) || ferror(file) || fsync(fileno(file))))
+		res = -EIO;
+	
+	if (fclose(file))
+		res = -EIO;
+
+	if (res) {
+		aal_error("Failed to write the checkpoint file (%s).", name);
+		unlink(name);
+		goto error_free_name;
+	}
+	
+	if (rename(name, repair->checkpoint_file)) {
+		aal_error("Failed to replace the checkpoint file (%s).",
+			  repair->checkpoint_file);
+		unlink(name);
+		res = -EIO;
+	}
+
+ error_free_name:
+	aal_free(name);
+	return res;
+}
+
+static errno_t cb_checkpoint(void *data) {
+	return repair_cp_save((repair_control_t *)data, REPAIR_CP_MISSING);
+}
+
+/* Loads the state saved by repair_cp_save, returns the stage it was saved 
+   after in @stage. */
+static errno_t repair_cp_load(repair_control_t *control, uint32_t *stage) {
+	reiser4_bitmap_t **slots[4];
+	repair_data_t *repair;
+	aal_stream_t stream;
+	uint32_t count, i;
+	uint64_t fs_len;
+	repair_cp_t cp;
+	errno_t res;
+	FILE *file;
+
+	aal_assert("umka-3152", control != NULL);
+	aal_assert("umka-3153", stage != NULL);
+
+	repair = control->repair;
+	
+	if (!repair->checkpoint_file || repair->mode != RM_BUILD) {
+		aal_error("Only the BUILD mode with the checkpoint file "
+			  "specified can be resumed.");
+		return -EINVAL;
+	}
+	
+	if (!(file = fopen(repair->checkpoint_file, "r"))) {
+		aal_error("Cannot open the checkpoint file (%s).",
+			  repair->checkpoint_file);
+		return -EINVAL;
+	}
+
+	res = 0;
+	fs_len = reiser4_format_get_len(repair->fs->format);
+	aal_stream_init(&stream, file, &file_stream);
+
+	if (aal_stream_read(&stream, &cp, sizeof(cp)) != sizeof(cp) ||
+	    aal_memcmp(cp.magic, REPAIR_CP_MAGIC, sizeof(cp.magic)) ||
+	    cp.stage == REPAIR_CP_NONE || cp.stage >= REPAIR_CP_LAST)
+	{
+		aal_error("The checkpoint file (%s) is corrupted.",
+			  repair->checkpoint_file);
+		res = -EINVAL;
+		goto error_close_file;
+	}
+
+	if (cp.fs_len != fs_len || 
+	    cp.stamp != reiser4_format_get_stamp(repair->fs->format))
+	{
+		aal_error("The checkpoint file (%s) belongs to another fs.",
+			  repair->checkpoint_file);
+		res = -EINVAL;
+		goto error_close_file;
+	}
+
+	count = repair_cp_bitmaps(control, cp.stage, slots);
+	
+	for (i = 0; i < count; i++) {
+		if (!(*slots[i] = reiser4_bitmap_unpack(&stream)) ||
+		    (*slots[i])->total != fs_len)
+		{
+			aal_error("Can't unpack the bitmap from the "
+				  "checkpoint file (%s).", 
+				  repair->checkpoint_file);
+			res = -EINVAL;
+			goto error_close_file;
+		}
+		
+		reiser4_bitmap_calc_marked(*slots[i]);
+	}
+
+	control->oid = cp.oid;
+	control->files = cp.files;
+	control->sysblk = cp.sysblk;
+	control->mkidok = cp.mkidok;
+	control->mkid = cp.mkid;
+	repair->fatal = cp.fatal;
+	repair->fixable = cp.fixable;
+
+	repair->fs->alloc->hook.alloc = cb_alloc;
+	repair->fs->alloc->hook.release = cb_release;
+	repair->fs->alloc->hook.data = control;
+
+	*stage = cp.stage;
+	
+ error_close_file:
+	aal_stream_fini(&stream);
+	fclose(file);
+	return res;
+}
+
 static errno_t repair_filter_prepare(repair_control_t *control, 
 				     repair_filter_t *filter) 
 {
@@ -446,6 +675,115 @@ static errno_t repair_am_prepare(repair_control_t *control, repair_am_t *am) {
 	return 0;
 }
 
+/* Callbacks for rebuilding the used bitmap from the tree on resuming add 
+   missing. Blocks are occupied in the allocator, the hook marks them in the 
+   used bitmap. */
+static errno_t cb_resume_region(uint64_t start, uint64_t count, void *data) {
+	repair_control_t *control = (repair_control_t *)data;
+
+	if (start != 0)
+		reiser4_alloc_occupy(control->repair->fs->alloc, start, count);
+
+	return 0;
+}
+
+static errno_t cb_resume_layout(reiser4_place_t *place, void *data) {
+	if (reiser4_item_branch(place->plug) || !place->plug->object->layout)
+		return 0;
+
+	return objcall(place, object->layout, cb_resume_region, data);
+}
+
+static errno_t cb_resume_node(reiser4_node_t *node, void *data) {
+	repair_control_t *control = (repair_control_t *)data;
+
+	reiser4_alloc_occupy(control->repair->fs->alloc, node->block->nr, 1);
+
+	if (reiser4_node_get_level(node) != TWIG_LEVEL)
+		return 0;
+	
+	return reiser4_node_trav(node, cb_resume_layout, data);
+}
+
+/* Leaves are not read, twigs have all the needed info about them. */
+static reiser4_node_t *cb_resume_open(reiser4_tree_t *tree, 
+				      reiser4_place_t *place, 
+				      void *data)
+{
+	repair_control_t *control = (repair_control_t *)data;
+	reiser4_node_t *node;
+	
+	if (reiser4_node_get_level(place->node) == TWIG_LEVEL) {
+		reiser4_alloc_occupy(control->repair->fs->alloc,
+				     reiser4_item_down_link(place), 1);
+		return NULL;
+	}
+
+	if (!(node = reiser4_tree_child_node(tree, place)))
+		return INVAL_PTR;
+
+	return node;
+}
+
+/* Prepares add missing resumed from the checkpoint. Nodes inserted after the 
+   checkpoint could be flushed already, the used bitmap is rebuilt from the 
+   tree and these nodes are excluded from the twig and leaf bitmaps. */
+static errno_t repair_am_resume(repair_control_t *control, repair_am_t *am) {
+	reiser4_fs_t *fs;
+	uint64_t i;
+	errno_t res;
+
+	aal_assert("umka-3154", am != NULL);
+	aal_assert("umka-3155", control != NULL);
+	aal_assert("umka-3156", control->bm_twig != NULL);
+	aal_assert("umka-3157", control->bm_leaf != NULL);
+	
+	fs = control->repair->fs;
+	
+	if (!(control->bm_used = 
+	      reiser4_bitmap_create(reiser4_format_get_len(fs->format))))
+	{
+		aal_error("Failed to allocate a bitmap of used blocks.");
+		return -ENOMEM;
+	}
+	
+	if (reiser4_fs_layout(fs, cb_format_mark, control->bm_used)) {
+		aal_error("Failed to mark the filesystem area as "
+			  "used in the bitmap.");
+		return -EINVAL;
+	}
+
+	if (!reiser4_tree_fresh(fs->tree)) {
+		if ((res = reiser4_tree_trav(fs->tree, cb_resume_open,
+					     cb_resume_node, NULL, 
+					     NULL, control)))
+		{
+			aal_error("Failed to account the tree blocks on "
+				  "resuming. Run fsck without resuming.");
+			return res;
+		}
+	}
+	
+	for (i = 0; i < control->bm_used->size; i++) {
+		control->bm_twig->map[i] &= ~(control->bm_used->map[i]);
+		control->bm_leaf->map[i] &= ~(control->bm_used->map[i]);
+	}
+	
+	reiser4_bitmap_calc_marked(control->bm_twig);
+	reiser4_bitmap_calc_marked(control->bm_leaf);
+	
+	reiser4_format_set_free(fs->format, reiser4_alloc_free(fs->alloc));
+	
+	aal_memset(am, 0, sizeof(*am));
+	am->repair = control->repair;
+	am->bm_leaf = control->bm_leaf;
+	am->bm_twig = control->bm_twig;
+	am->bm_used = control->bm_used;
+	am->stat.files = &control->files;
+
+	return 0;
+}
+
 static errno_t repair_sem_prepare(repair_control_t *control, 
 				  repair_semantic_t *sem) 
 {
@@ -725,6 +1063,7 @@ errno_t repair_check(repair_data_t *repair) {
 	repair_am_t am;
 	repair_semantic_t sem;
 	repair_cleanup_t cleanup;
+	uint32_t stage;
 	errno_t res;
 	
 	aal_assert("vpf-852", repair != NULL);
@@ -733,6 +1072,7 @@ errno_t repair_check(repair_data_t *repair) {
 	aal_memset(&control, 0, sizeof(control));
 	
 	control.repair = repair;
+	stage = REPAIR_CP_NONE;
 	
 	if (repair->flags & (1 << REPAIR_DEBUG)) {
 		/* Debugging */
@@ -745,44 +1085,78 @@ errno_t repair_check(repair_data_t *repair) {
 		return 0;
 	}
 	
-	/* Scan the storage reiser4 tree. Cut broken parts out. */
-	if ((res = repair_filter_prepare(&control, &filter)))
-		goto error;
-	
-	if ((res = repair_filter(&filter)))
-		goto error;
+	if (repair->flags & (1 << REPAIR_RESUME)) {
+		if ((res = repair_cp_load(&control, &stage)))
+			goto error;
+	}
 	
-	/* Scan twigs which are in the tree to avoid scanning the unformatted 
-	   blocks at BUILD pass which are pointed by extents and preparing the 
-	   allocable blocks. */
-	if ((res = repair_ts_prepare(&control, &ts, repair->mode == RM_BUILD)))
-		goto error;
-
-	if ((res = repair_twig_scan(&ts)))
-		goto error;
-
-	if (repair->mode == RM_BUILD) {
-		/* Scanning blocks which are used but not in the tree yet. */
-		if ((res = repair_ds_prepare(&control, &ds)))
+	if (stage < REPAIR_CP_FILTER) {
+		/* Scan the storage reiser4 tree. Cut broken parts out. */
+		if ((res = repair_filter_prepare(&control, &filter)))
 			goto error;
-		
-		if ((res = repair_disk_scan(&ds)))
+
+		if ((res = repair_filter(&filter)))
 			goto error;
-		
-		/* Scanning twigs which are not in the tree and fix if they 
-		   point to some used block or some met formatted block. */
-		if ((res = repair_ts_prepare(&control, &ts, 0)))
+
+		/* Scan twigs which are in the tree to avoid scanning the 
+		   unformatted blocks at BUILD pass which are pointed by 
+		   extents and preparing the allocable blocks. */
+		if ((res = repair_ts_prepare(&control, &ts, 
+					     repair->mode == RM_BUILD)))
+		{
 			goto error;
+		}
 
 		if ((res = repair_twig_scan(&ts)))
 			goto error;
+
+		if ((res = repair_cp_save(&control, REPAIR_CP_FILTER)))
+			goto error;
+	}
+
+	if (repair->mode == RM_BUILD) {
+		if (stage < REPAIR_CP_SCAN) {
+			/* Scanning blocks which are used but not in the tree 
+			   yet. */
+			if ((res = repair_ds_prepare(&control, &ds)))
+				goto error;
+
+			if ((res = repair_disk_scan(&ds)))
+				goto error;
+
+			/* Scanning twigs which are not in the tree and fix if 
+			   they point to some used block or some met formatted 
+			   block. */
+			if ((res = repair_ts_prepare(&control, &ts, 0)))
+				goto error;
+
+			if ((res = repair_twig_scan(&ts)))
+				goto error;
+
+			if ((res = repair_cp_save(&control, REPAIR_CP_SCAN)))
+				goto error;
+		}
 		
 		/* Inserting missed blocks into the tree. */
-		if ((res = repair_am_prepare(&control, &am)))
+		if (stage < REPAIR_CP_MISSING)
+			res = repair_am_prepare(&control, &am);
+		else
+			res = repair_am_resume(&control, &am);
+
+		if (res)
 			goto error;
+
+		if (repair->checkpoint_file) {
+			am.checkpoint = cb_checkpoint;
+			am.data = &control;
+			am.interval = repair->checkpoint_interval;
+		}
 		
 		if ((res = repair_add_missing(&am)))
 			goto error;
+		
+		if ((res = repair_cp_save(&control, REPAIR_CP_MISSING)))
+			goto error;
 	} else {
 		repair_ts_fini(&control);
 	}
@@ -824,6 +1198,10 @@ errno_t repair_check(repair_data_t *repair) {
 	/* Update SB data */
 	if (!repair->fatal && (res = repair_update(&control))) 
 		goto error;
+
+	/* The check is over, nothing to resume anymore. */
+	if (repair->checkpoint_file && repair->mode == RM_BUILD)
+		unlink(repair->checkpoint_file);
 	
  error:
 	repair_control_release(&control);
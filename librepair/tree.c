@@ -621,3 +621,163 @@ errno_t repair_tree_insert(reiser4_tree_t *tree, reiser4_place_t *src,
 	return res;
 }
 
+/* Builds internal levels of the fresh @tree bottom-up over @count nodes of
+   @level pointed by @ptrs. @ptrs must be sorted by keys and nodes must not
+   overlap each other by keys. Every internal node is filled up before the
+   next one is started, so the whole tree is built in one sequential pass
+   without lookups and balancing. @ptrs is used as a scratch space. */
+errno_t repair_tree_build(reiser4_tree_t *tree, repair_ptr_t *ptrs,
+			  uint64_t count, uint8_t level)
+{
+	reiser4_node_t **nodes, *node;
+	uint64_t first, total, start;
+	uint64_t size;
+	reiser4_place_t place;
+	trans_hint_t hint;
+	uint8_t children;
+	uint64_t i, n;
+	ptr_hint_t ptr;
+	int adjusting;
+	errno_t res;
+
+	aal_assert("umka-3146", tree != NULL);
+	aal_assert("umka-3147", ptrs != NULL);
+	aal_assert("umka-3148", count > 1);
+	aal_assert("umka-3149", reiser4_tree_fresh(tree));
+
+	/* Nodes are filled up, and a node fits 2 pointers at least, so all
+	   nodes of a level but the last one get 2 pointers at least. A level
+	   over @n pointers takes ceil(n / 2) nodes at most then, @size is the
+	   sum of it over all levels up to the root. */
+	for (size = 0, n = count; n > 1; n = (n + 1) / 2)
+		size += (n + 1) / 2;
+	
+	if (!(nodes = aal_calloc(size * sizeof(*nodes), 0)))
+		return -ENOMEM;
+
+	aal_memset(&hint, 0, sizeof(hint));
+
+	hint.count = 1;
+	hint.specific = &ptr;
+	hint.shift_flags = SF_DEFAULT;
+	hint.plug = (reiser4_item_plug_t *)tree->ent.tset[TSET_NODEPTR];
+
+	ptr.width = 1;
+
+	/* Nodes being built are not attached to the tree until the root is
+	   assigned, they should not be flushed on memory pressure. */
+	adjusting = tree->adjusting;
+	tree->adjusting = 1;
+
+	/* Nodes of @level are not in memory, internal ones built on the
+	   previous pass are in @nodes starting at @first. */
+	children = level;
+	first = total = 0;
+
+	for (; count > 1; level++) {
+		start = total;
+		node = NULL;
+
+		for (i = 0, n = 0; i < count; i++) {
+			ptr.start = ptrs[i].blk;
+			aal_memcpy(&hint.offset, &ptrs[i].key,
+				   sizeof(hint.offset));
+
+			if (node) {
+				reiser4_place_assign(&place, node,
+						     reiser4_node_items(node),
+						     MAX_UINT32);
+
+				hint.len = hint.overhead = 0;
+
+				if ((res = plugcall(hint.plug->object,
+						    prep_insert, &place,
+						    &hint)))
+				{
+					goto error_release_nodes;
+				}
+
+				if (hint.len + hint.overhead +
+				    reiser4_node_overhead(node) >
+				    reiser4_node_space(node))
+				{
+					node = NULL;
+				}
+			}
+
+			if (!node) {
+				if (!(node = reiser4_tree_alloc_node(tree,
+								     level + 1)))
+				{
+					res = -ENOSPC;
+					goto error_release_nodes;
+				}
+
+				aal_assert("umka-3173", total < size);
+				nodes[total++] = node;
+
+				/* @n never exceeds @i, the pointer to the new
+				   node is put over an already used one. */
+				ptrs[n].blk = node->block->nr;
+				aal_memcpy(&ptrs[n].key, &hint.offset,
+					   sizeof(ptrs[n].key));
+				n++;
+
+				reiser4_place_assign(&place, node, 0,
+						     MAX_UINT32);
+
+				hint.len = hint.overhead = 0;
+
+				if ((res = plugcall(hint.plug->object,
+						    prep_insert, &place,
+						    &hint)))
+				{
+					goto error_release_nodes;
+				}
+			}
+
+			if ((res = reiser4_node_insert(node, &place.pos,
+						       &hint)))
+			{
+				goto error_release_nodes;
+			}
+
+			if (level == children)
+				continue;
+
+			/* Children built on the previous pass are connected
+			   to be allocated and flushed along with the tree. */
+			if ((res = reiser4_tree_connect_node(tree, node,
+							     nodes[first + i])))
+			{
+				goto error_release_nodes;
+			}
+		}
+
+		first = start;
+		count = n;
+	}
+
+	if ((res = reiser4_tree_assign_root(tree, nodes[total - 1])))
+		goto error_release_nodes;
+
+	tree->adjusting = adjusting;
+	aal_free(nodes);
+
+	return 0;
+
+ error_release_nodes:
+	/* Children go before parents in @nodes, disconnecting them unlocks
+	   parents before those are released. */
+	for (i = 0; i < total; i++) {
+		if (nodes[i]->p.node)
+			reiser4_tree_disconnect_node(tree, nodes[i]);
+
+		reiser4_tree_release_node(tree, nodes[i]);
+	}
+
+	tree->adjusting = adjusting;
+	aal_free(nodes);
+
+	return res;
+}
@@ -98,6 +98,8 @@ static void repair_twig_scan_update(repair_ts_t *ts) {
 	
 	aal_stream_init(&stream, NULL, &memory_stream);
 	aal_stream_format(&stream, "\tRead twigs %llu\n", ts->stat.read_twigs);
+	aal_stream_format(&stream, "\tRead requests %llu\n", 
+			  ts->stat.read_requests);
 	
 	if (ts->stat.fixed_twigs) {
 		aal_stream_format(&stream, "\tCorrected nodes %llu\n", 
@@ -125,9 +127,11 @@ static void repair_twig_scan_update(repair_ts_t *ts) {
 }
 
 /* The pass itself, goes through all twigs, check block pointers which items 
-   may have and account them in proper bitmaps. */
+   may have and account them in proper bitmaps. Twigs are read ahead by large
+   requests. */
 errno_t repair_twig_scan(repair_ts_t *ts) {
 	reiser4_node_t *node;
+	repair_ra_t ra;
 	aal_gauge_t *gauge;
 	uint64_t total;
 	blk_t blk = 0;
@@ -137,6 +141,10 @@ errno_t repair_twig_scan(repair_ts_t *ts) {
 	aal_assert("vpf-534", ts->repair != NULL);
 	aal_assert("vpf-845", ts->repair->fs != NULL);
 	
+	if ((res = repair_ra_init(&ra, ts->repair->fs->tree, ts->bm_twig,
+				  ts->repair->jobs)))
+		return res;
+	
 	aal_mess("CHECKING EXTENT REGIONS.");
 	gauge = aal_gauge_create(aux_gauge_handlers[GT_PROGRESS], 
 				 NULL, NULL, 500, NULL);
@@ -152,7 +160,7 @@ errno_t repair_twig_scan(repair_ts_t *ts) {
 		aal_gauge_set_value(gauge, ts->stat.read_twigs * 100 / total);
 		aal_gauge_touch(gauge);
 		
-		if (!(node = reiser4_node_open(ts->repair->fs->tree, blk))) {
+		if (!(node = repair_ra_open(&ra, blk, 0))) {
 			aal_error("Twig scan pass failed to open "
 				  "the twig (%llu)", (unsigned long long)blk);
 
@@ -176,6 +184,8 @@ errno_t repair_twig_scan(repair_ts_t *ts) {
 	aal_gauge_done(gauge);
 	aal_gauge_free(gauge);
 	
+	ts->stat.read_requests = ra.requests;
+	repair_ra_fini(&ra);
 	repair_twig_scan_update(ts);
 
 	if (ts->repair->mode != RM_CHECK)
@@ -188,6 +198,8 @@ errno_t repair_twig_scan(repair_ts_t *ts) {
  error:
 	aal_gauge_done(gauge);
 	aal_gauge_free(gauge);
+	ts->stat.read_requests = ra.requests;
+	repair_ra_fini(&ra);
 	repair_twig_scan_update(ts);
 
 	return res;
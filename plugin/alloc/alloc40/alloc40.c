@@ -59,6 +59,90 @@ errno_t alloc40_layout(reiser4_alloc_ent_t *entity,
 	return res;
 }
 
+/* Returns the number of blocks one bitmap block describes. */
+static inline uint64_t alloc40_bpb(alloc40_t *alloc) {
+	return (alloc->blksize - CRC_SIZE) * 8;
+}
+
+/* Builds the bitmap summary from scratch. It is called when the whole bitmap
+   gets loaded or assigned, and then it is kept up to date incrementally. */
+errno_t alloc40_summary(alloc40_t *alloc) {
+	uint64_t bpb, start, count;
+	uint32_t i, regions;
+	
+	aal_assert("umka-3135", alloc != NULL);
+	aal_assert("umka-3136", alloc->bitmap != NULL);
+
+	bpb = alloc40_bpb(alloc);
+	regions = (alloc->bitmap->total + bpb - 1) / bpb;
+
+	if (alloc->free)
+		aal_free(alloc->free);
+
+	if (alloc->run)
+		aal_free(alloc->run);
+
+	alloc->run = NULL;
+	
+	if (!(alloc->free = aal_calloc(regions * sizeof(uint32_t), 0)))
+		return -ENOMEM;
+	
+	if (!(alloc->run = aal_calloc(regions * sizeof(uint32_t), 0)))
+		return -ENOMEM;
+
+	for (i = 0, start = 0; i < regions; i++, start += bpb) {
+		count = alloc->bitmap->total - start;
+
+		if (count > bpb)
+			count = bpb;
+
+		alloc->free[i] = reiser4_bitmap_calc(alloc->bitmap, start,
+						     count, 0);
+		alloc->run[i] = alloc->free[i];
+	}
+
+	return 0;
+}
+
+/* Marks or clears @count blocks starting from @start and updates the summary
+   of all touched bitmap blocks. */
+static void alloc40_region_change(alloc40_t *alloc, uint64_t start,
+				  uint64_t count, int mark)
+{
+	uint64_t bpb, end, next, marked;
+	uint32_t i;
+
+	if (!count || start + count > alloc->bitmap->total)
+		return;
+
+	bpb = alloc40_bpb(alloc);
+	
+	for (end = start + count; start < end; start = next) {
+		i = start / bpb;
+		
+		if ((next = (i + 1) * bpb) > end)
+			next = end;
+
+		marked = alloc->bitmap->marked;
+		
+		if (mark) {
+			reiser4_bitmap_mark_region(alloc->bitmap, start,
+						   next - start);
+			alloc->free[i] -= alloc->bitmap->marked - marked;
+
+			if (alloc->run[i] > alloc->free[i])
+				alloc->run[i] = alloc->free[i];
+		} else {
+			reiser4_bitmap_clear_region(alloc->bitmap, start,
+						    next - start);
+			alloc->free[i] += marked - alloc->bitmap->marked;
+
+			/* Released blocks may join free runs around. */
+			alloc->run[i] = alloc->free[i];
+		}
+	}
+}
+
 /* Fetches one bitmap block. Extracts its checksum from teh first 4 bytes and
    saves it in allocator checksums area. Actually this function is callback one
    which is called by alloc40_layout function in order to load all bitmap map
@@ -155,8 +239,16 @@ static reiser4_alloc_ent_t *alloc40_open(aal_device_t *device,
 
 	/* Updating bitmap counters (free blocks, etc) */
 	reiser4_bitmap_calc_marked(alloc->bitmap);
+
+	if (alloc40_summary(alloc))
+		goto error_free_summary;
+	
 	return (reiser4_alloc_ent_t *)alloc;
 
+ error_free_summary:
+	aal_free(alloc->free);
+	aal_free(alloc->run);
+	aal_free(alloc->crc);
  error_free_bitmap:
 	reiser4_bitmap_close(alloc->bitmap);
  error_free_alloc:
@@ -197,9 +289,16 @@ static reiser4_alloc_ent_t *alloc40_create(aal_device_t *device,
 	alloc->device = device;
 	alloc->blksize = blksize;
 	alloc->state = (1 << ENTITY_DIRTY);
+
+	if (alloc40_summary(alloc))
+		goto error_free_summary;
     
 	return (reiser4_alloc_ent_t *)alloc;
 
+ error_free_summary:
+	aal_free(alloc->free);
+	aal_free(alloc->run);
+	aal_free(alloc->crc);
  error_free_bitmap:
 	reiser4_bitmap_close(alloc->bitmap);
  error_free_alloc:
@@ -223,7 +322,7 @@ static errno_t alloc40_assign(reiser4_alloc_ent_t *entity, void *data) {
 	alloc->bitmap->marked = bitmap->marked;
 	alloc->state |= (1 << ENTITY_DIRTY);
 
-	return 0;
+	return alloc40_summary(alloc);
 }
 
 static errno_t alloc40_extract(reiser4_alloc_ent_t *entity, void *data) {
@@ -274,23 +373,11 @@ static errno_t cb_sync_bitmap(blk_t start, count_t width, void *data) {
 	aal_memcpy(block.data + CRC_SIZE, current, chunk);
 
 	/* Calculating adler crc checksum and updating it in the block to be
-	   saved. For the last block we are calculating it only for significant
-	   patr of bitmap. */
-	if (chunk < size) {
-		void *fake;
-
-		if (!(fake = aal_calloc(size, 0xff))) {
-			res = -ENOMEM;
-			goto error_free_block;
-		}
+	   saved. The rest of the last block is counted as 0xff bytes. */
+	adler = aux_adler32(0, current, chunk);
 
-		aal_memcpy(fake, current, chunk);
-		adler = aux_adler32(0, fake, size);
-		
-		aal_free(fake);
-	} else {
-		adler = aux_adler32(0, current, chunk);
-	}
+	if (chunk < size)
+		adler = aux_adler32_fill(adler, 0xff, size - chunk);
 	
 	*((uint32_t *)block.data) = CPU_TO_LE32(adler);
 
@@ -301,7 +388,6 @@ static errno_t cb_sync_bitmap(blk_t start, count_t width, void *data) {
 			  alloc->device->error);
 	}
 
- error_free_block:
 	aal_block_fini(&block);
 	return res;
 }
@@ -333,6 +419,8 @@ static void alloc40_close(reiser4_alloc_ent_t *entity) {
 
 	reiser4_bitmap_close(alloc->bitmap);
 
+	aal_free(alloc->free);
+	aal_free(alloc->run);
 	aal_free(alloc->crc);
 	aal_free(alloc);
 }
@@ -346,8 +434,7 @@ static errno_t alloc40_occupy(reiser4_alloc_ent_t *entity,
 	aal_assert("umka-370", alloc != NULL);
 	aal_assert("umka-371", alloc->bitmap != NULL);
     
-	reiser4_bitmap_mark_region(alloc->bitmap,
-			       start, count);
+	alloc40_region_change(alloc, start, count, 1);
 
 	alloc->state |= (1 << ENTITY_DIRTY);
 	return 0;
@@ -362,22 +449,71 @@ static errno_t alloc40_release(reiser4_alloc_ent_t *entity,
 	aal_assert("umka-372", alloc != NULL);
 	aal_assert("umka-373", alloc->bitmap != NULL);
     
-	reiser4_bitmap_clear_region(alloc->bitmap,
-				start, count);
+	alloc40_region_change(alloc, start, count, 0);
 
 	alloc->state |= (1 << ENTITY_DIRTY);
 	return 0;
 }
 
+/* Looks for a free run of @count blocks in the bitmap block @i starting from
+   @from. Returns @count and stores the run start in @start if found, 0
+   otherwise. If the whole bitmap block is scanned, its longest free run gets
+   known and is saved in the summary. */
+static uint64_t alloc40_find_run(alloc40_t *alloc, uint32_t i,
+				 uint64_t from, uint64_t count,
+				 uint64_t *start)
+{
+	uint64_t bpb, blk, end, lo, hi;
+	uint64_t longest = 0;
+
+	bpb = alloc40_bpb(alloc);
+	
+	lo = i * bpb;
+	hi = lo + bpb;
+
+	if (hi > alloc->bitmap->total)
+		hi = alloc->bitmap->total;
+
+	for (blk = from > lo ? from : lo; blk < hi; blk = end) {
+		blk = aal_find_next_zero_bit(alloc->bitmap->map, hi, blk);
+
+		if (blk >= hi)
+			break;
+
+		end = aal_find_next_set_bit(alloc->bitmap->map, hi, blk);
+
+		if (end > hi)
+			end = hi;
+
+		if (end - blk >= count) {
+			*start = blk;
+			return count;
+		}
+
+		if (end - blk > longest)
+			longest = end - blk;
+	}
+
+	if (from <= lo)
+		alloc->run[i] = longest;
+
+	return 0;
+}
+
 /* Tries to find specified @count of free blocks in block allocator. The first
    block of the found free area is stored in @start. Actual found number of
    blocks is retured to caller. This function is mostly needed for handling
-   extent allocation. */
+   extent allocation. The bitmap summary is used for skipping bitmap blocks
+   without free blocks at all, and, for requests of many blocks, the ones
+   without a free run long enough. If no such a run is found, the first free
+   area is returned, as before. */
 static uint64_t alloc40_allocate(reiser4_alloc_ent_t *entity,
 				 uint64_t *start, uint64_t count)
 {
-	uint64_t found;
+	uint32_t i, regions;
+	uint64_t found = 0;
 	alloc40_t *alloc;
+	uint64_t bpb;
 	
 	alloc = (alloc40_t *)entity;
 	
@@ -385,9 +521,36 @@ static uint64_t alloc40_allocate(reiser4_alloc_ent_t *entity,
 	aal_assert("umka-1771", start != NULL);
 	aal_assert("umka-375", alloc->bitmap != NULL);
 
-	/* Calling bitmap for gettign free area from it */
-	found = reiser4_bitmap_find_region(alloc->bitmap,
-				       start, count, 0);
+	bpb = alloc40_bpb(alloc);
+	regions = (alloc->bitmap->total + bpb - 1) / bpb;
+
+	/* Looking for the whole run inside one bitmap block first. */
+	if (count > 1) {
+		for (i = *start / bpb; i < regions; i++) {
+			if (alloc->run[i] < count)
+				continue;
+
+			if ((found = alloc40_find_run(alloc, i, *start,
+						      count, start)))
+			{
+				break;
+			}
+		}
+	}
+
+	if (!found) {
+		for (i = *start / bpb; i < regions && !alloc->free[i]; i++);
+
+		if (i == regions)
+			return 0;
+
+		if (*start < i * bpb)
+			*start = i * bpb;
+		
+		/* Calling bitmap for gettign free area from it */
+		found = reiser4_bitmap_find_region(alloc->bitmap,
+						   start, count, 0);
+	}
 
 	/* Marking found region as occupied if its length more then zero.
 	   Probably we should implement more flexible behavior here. And
@@ -395,8 +558,7 @@ static uint64_t alloc40_allocate(reiser4_alloc_ent_t *entity,
 	   caller will decide, that found area is not enough convenient for
 	   him. If so, he will call marking found area as occupied by hands. */
 	if (found > 0) {
-		reiser4_bitmap_mark_region(alloc->bitmap,
-				       *start, found);
+		alloc40_region_change(alloc, *start, found, 1);
 		alloc->state |= (1 << ENTITY_DIRTY);
 	}
 
@@ -489,18 +651,11 @@ errno_t cb_valid_block(blk_t start, count_t width, void *data) {
 	/* Calculating adler checksumm for piece of bitmap */
 	chunk = free > size ? size : free;
 
-	if (chunk < size) {
-		void *fake;
+	cadler = aux_adler32(0, current, chunk);
 
-		if (!(fake = aal_calloc(size, 0xff)))
-			return -ENOMEM;
-
-		aal_memcpy(fake, current, chunk);
-		cadler = aux_adler32(0, fake, size);
-		
-		aal_free(fake);
-	} else
-		cadler = aux_adler32(0, current, chunk);
+	/* The rest of the last block is counted as 0xff bytes. */
+	if (chunk < size)
+		cadler = aux_adler32_fill(cadler, 0xff, size - chunk);
 
 	/* If loaded checksum and calculated one are not equal, we have
 	   corrupted bitmap. */
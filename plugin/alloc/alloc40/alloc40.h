@@ -24,6 +24,12 @@ typedef struct alloc40 {
 
 	char *crc;
 
+	/* Bitmap summary. The number of free blocks and the upper bound of the
+	   longest free run for each bitmap block. Used for skipping bitmap
+	   blocks which cannot satisfy the allocation request. */
+	uint32_t *free;
+	uint32_t *run;
+
 	void *data;
 } alloc40_t;
 
@@ -31,6 +37,8 @@ typedef struct alloc40 {
 
 extern reiser4_alloc_plug_t alloc40_plug;
 
+extern errno_t alloc40_summary(alloc40_t *alloc);
+
 extern int alloc40_occupied(reiser4_alloc_ent_t *entity, 
 			    uint64_t start, uint64_t count);
 
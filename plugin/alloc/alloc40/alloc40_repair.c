@@ -200,9 +200,15 @@ reiser4_alloc_ent_t *alloc40_unpack(aal_device_t *device,
 
 	alloc->state = (1 << ENTITY_DIRTY);
 	reiser4_bitmap_calc_marked(alloc->bitmap);
+
+	if (alloc40_summary(alloc))
+		goto error_free_summary;
 	
 	return (reiser4_alloc_ent_t *)alloc;
 
+ error_free_summary:
+	aal_free(alloc->free);
+	aal_free(alloc->run);
  error_free_crc:
 	aal_free(alloc->crc);
  error_free_bitmap:
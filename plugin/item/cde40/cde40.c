@@ -983,53 +983,100 @@ int cde40_comp_hash(reiser4_place_t *place, uint32_t pos, reiser4_key_t *key) {
 	return objcall(&curr, compfull, key);
 }
 
-/* Helper function that is used by lookup method for 
-   comparing given key with passed entry hash. */
-static int cb_comp_hash(void *array, uint32_t pos,
-			void *key, void *data)
+/* Compares the entry @hash with @needle. The entry hash is the tail of the
+   entry key, that is @els little endian 64-bit key elements, and @needle is
+   the tail of the looked up key converted to CPU byte order. */
+static inline int cde40_comp_entry(void *hash, uint64_t *needle,
+				   uint32_t els)
 {
-	return cde40_comp_hash((reiser4_place_t *)data, pos, 
-			       (reiser4_key_t *)key);
+	uint64_t el;
+	uint32_t i;
+
+	for (i = 0; i < els; i++) {
+		el = LE64_TO_CPU(get_unaligned((d64_t *)hash + i));
+
+		if (el != needle[i])
+			return el < needle[i] ? -1 : 1;
+	}
+
+	return 0;
 }
 
-/* Performs lookup inside cde item. Found position is stored in @pos. */
+/* Performs lookup inside cde item. Found position is stored in @pos. The first
+   key element, locality and type, is the same for all entries of the item, so
+   it is compared once. Then entry hashes are compared in place, without
+   building the entry keys. */
 lookup_t cde40_lookup(reiser4_place_t *place,
 		      lookup_hint_t *hint,
 		      lookup_bias_t bias)
 {
-#ifndef ENABLE_MINIMAL
-	int32_t i;
-#endif
+	int32_t left, right, i;
+	uint64_t needle[4];
+	reiser4_key_t key;
+	uint32_t units;
+	uint32_t pol;
+	uint64_t el;
+	int res;
 
 	aal_assert("umka-610", hint != NULL);
 	aal_assert("umka-609", place != NULL);
-    
+
+	pol = cde40_key_pol(place);
+	
+	if (!(units = cde40_units(place))) {
+		place->pos.unit = 0;
+		return (bias == FIND_CONV ? PRESENT : ABSENT);
+	}
+
+	for (i = 0; i < (int32_t)pol; i++) {
+		needle[i] = LE64_TO_CPU(get_unaligned((d64_t *)
+						      hint->key->body + i));
+	}
+
+	cde40_get_hash(place, 0, &key);
+	el = LE64_TO_CPU(get_unaligned((d64_t *)key.body));
+
+	if (el != needle[0]) {
+		place->pos.unit = (el > needle[0]) ? 0 : units;
+		return (bias == FIND_CONV ? PRESENT : ABSENT);
+	}
+	
 	/* Bin search within the cde item to get the position of 
 	   the wanted key. */
-	switch (aux_bin_search(place->body, cde40_units(place),
-			       hint->key, cb_comp_hash,
-			       place, &place->pos.unit))
-	{
-	case 1:
+	left = 0;
+	right = units - 1;
+
+	while (left <= right) {
+		i = (left + right) / 2;
+		res = cde40_comp_entry(cde40_hash(place, i), 
+				       needle + 1, pol - 1);
+
+		if (res < 0) {
+			left = i + 1;
+		} else if (res > 0) {
+			right = i - 1;
+		} else {
 #ifndef ENABLE_MINIMAL
-		/* Making sure, that we have found right unit. This is needed
-		   because of possible key collision. We move left direction
-		   until we find a key smaller than passed one. */
-		for (i = place->pos.unit - 1; i >= 0; i--) {
-			/* Comparing keys. We break the loop when keys as not
-			   equal, that means, that we have found needed pos. */
-			if (!cde40_comp_hash(place, i, hint->key))
-				place->pos.unit = i;
-			else
-				return PRESENT;
-		}
+			/* Making sure, that we have found right unit. This is
+			   needed because of possible key collision. We move left
+			   direction until we find a key smaller than passed
+			   one. Usually there is no collision and the very first
+			   compare stops the loop. */
+			for (; i > 0; i--) {
+				if (cde40_comp_entry(cde40_hash(place, i - 1),
+						     needle + 1, pol - 1))
+				{
+					break;
+				}
+			}
 #endif
-		return PRESENT;
-	case 0:
-		return (bias == FIND_CONV ? PRESENT : ABSENT);
-	default:
-		return -EIO;
+			place->pos.unit = i;
+			return PRESENT;
+		}
 	}
+
+	place->pos.unit = left;
+	return (bias == FIND_CONV ? PRESENT : ABSENT);
 }
 
 static item_balance_ops_t balance_ops = {
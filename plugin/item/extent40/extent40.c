@@ -391,8 +391,48 @@ lookup_t extent40_lookup(reiser4_place_t *place,
 	return (bias == FIND_CONV ? PRESENT : ABSENT);
 }
 #ifndef ENABLE_MINIMAL
+/* Reads up to @max whole blocks starting at @blk, which keep data at @offset,
+   straight into @buff by one request. The run stops at the first block found
+   in data cache, as cached block may be newer than its copy on device. Returns
+   the number of blocks read. */
+static int64_t extent40_read_direct(reiser4_place_t *place,
+				    trans_hint_t *hint,
+				    reiser4_key_t *key,
+				    uint64_t offset,
+				    uint64_t blk,
+				    uint64_t max,
+				    void *buff)
+{
+	aal_device_t *device;
+	uint32_t blksize;
+	uint32_t factor;
+	uint64_t count;
+
+	blksize = place_blksize(place);
+	
+	for (count = 0; count < max; count++) {
+		objcall(key, set_offset, offset + count * blksize);
+
+		if (aal_hash_table_lookup(hint->blocks, key))
+			break;
+	}
+
+	if (!count)
+		return 0;
+
+	/* Device is addressed by its own blocks, not by fs ones. */
+	device = extent40_device(place);
+	factor = blksize / device->blksize;
+	
+	if (aal_device_read(device, buff, blk * factor, count * factor))
+		return -EIO;
+
+	return count;
+}
+
 /* Reads @count bytes of extent data from the extent item at passed @pos into
-   specified @buff. Uses data cache. */
+   specified @buff. Whole blocks not found in data cache are read directly
+   into @buff, partial ones are read through data cache. */
 static int64_t extent40_read_units(reiser4_place_t *place,
 				   trans_hint_t *hint)
 {
@@ -447,19 +487,18 @@ static int64_t extent40_read_units(reiser4_place_t *place,
 			   hole is detected during read. */
 			uint64_t width = et40_get_width(extent + i) - 
 				(rel_offset / blksize);
-			
-			for (; width > 0 && count > 0; count -= size,
-				     buff += size, read_offset += size, width--)
-			{
-				uint32_t rest;
+			uint64_t hole;
 
-				rest = blksize - (read_offset % blksize);
-				
-				if ((size = count) > rest)
-					size = rest;
+			hole = width * blksize - (read_offset % blksize);
 
-				aal_memset(buff, 0, size);
-			}
+			if (hole > count)
+				hole = count;
+
+			aal_memset(buff, 0, hole);
+
+			buff += hole;
+			count -= hole;
+			read_offset += hole;
 		} else while (blk < start + et40_get_width(extent + i) &&
 			      count > 0)
 		{
@@ -471,6 +510,33 @@ static int64_t extent40_read_units(reiser4_place_t *place,
 			if ((size = count) > rest)
 				size = rest;
 
+			/* Whole blocks are read straight into @buff. */
+			if (size == blksize) {
+				uint64_t max;
+				int64_t done;
+
+				max = start + et40_get_width(extent + i) - blk;
+
+				if (max > count / blksize)
+					max = count / blksize;
+
+				if ((done = extent40_read_direct(place, hint, 
+								 &key, read_offset,
+								 blk, max, 
+								 buff)) < 0)
+				{
+					return done;
+				}
+
+				if (done > 0) {
+					buff += done * blksize;
+					count -= done * blksize;
+					read_offset += done * blksize;
+					blk += done;
+					continue;
+				}
+			}
+
 			/* Initilaizing offset of block needed data lie
 			   in. It is needed for getting block from data
 			   cache. */
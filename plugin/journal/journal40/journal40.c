@@ -25,6 +25,18 @@ static errno_t journal40_valid(reiser4_journal_ent_t *entity) {
 	return 0;
 }
 
+/* Checks if there are committed transactions not replayed yet. */
+static bool_t journal40_pending(reiser4_journal_ent_t *entity) {
+	journal40_t *journal;
+	
+	aal_assert("umka-3166", entity != NULL);
+
+	journal = PLUG_ENT(entity);
+	
+	return get_jh_last_commited(JHEADER(journal->header)) !=
+		get_jf_last_flushed(JFOOTER(journal->footer));
+}
+
 /* Journal enumerator function. */
 static errno_t journal40_layout(reiser4_journal_ent_t *entity,
 				region_func_t region_func,
@@ -526,71 +538,282 @@ errno_t journal40_traverse(
 	return res;
 }
 
-static errno_t cb_replay(reiser4_journal_ent_t *entity, 
-			 aal_block_t *block,
-			 d64_t orig, void *data)
+/* Collects wandered/original pairs of all transactions into @data. The
+   wandered block of each pair goes first, then its original one. */
+static errno_t cb_collect_replay(reiser4_journal_ent_t *entity,
+				 aal_block_t *block, blk_t blk,
+				 journal40_block_t type, void *data)
 {
-	errno_t res;
+	journal40_tx_header_t *header;
+	journal40_replay_t *replay;
+	journal40_pair_t *pairs;
+	uint64_t size;
+	
+	replay = (journal40_replay_t *)data;
+
+	switch (type) {
+	case JB_LGR:
+		/* A print at every transaction. */
+		if (replay->tx_blk == block->nr)
+			return 0;
+
+		header = (journal40_tx_header_t *)block->data;
+		replay->tx_blk = block->nr;
+		replay->tx_count++;
+
+		if (replay->verbose) {
+			aal_mess("Replaying transaction: id %llu, block "
+				 "count %lu.", 
+				 (unsigned long long)get_th_id(header),
+				 (long unsigned)get_th_total(header));
+		}
+		
+		return 0;
+	case JB_WAN:
+		replay->wandered = blk;
+		replay->blk_count++;
+		return 0;
+	case JB_ORG:
+		if (replay->count == replay->size) {
+			size = replay->size ? replay->size * 2 :
+				JOURNAL40_REPLAY_RUN;
+			
+			if (!(pairs = aal_malloc(size * sizeof(*pairs))))
+				return -ENOMEM;
 
-	aal_block_move(block, PLUG_ENT(entity)->device, orig);
-	    
-	if ((res = aal_block_write(block))) {
-		aal_error("Can't write block %llu.",
-			  (unsigned long long)block->nr);
-		aal_block_free(block);
-	}
+			if (replay->pairs) {
+				aal_memcpy(pairs, replay->pairs, replay->count *
+					   sizeof(*pairs));
+				aal_free(replay->pairs);
+			}
 
-	return res;
+			replay->pairs = pairs;
+			replay->size = size;
+		}
+
+		replay->pairs[replay->count].wandered = replay->wandered;
+		replay->pairs[replay->count].original = blk;
+		replay->count++;
+		return 0;
+	default:
+		return 0;
+	}
 }
 
-typedef struct replay_count {
-	uint64_t tx_count;
-	uint64_t blk_count;
-} replay_count_t;
+/* Sorts @pairs by original blocks. Sort is stable, so pairs of the same
+   original block are left in the order of transactions. */
+static errno_t journal40_sort_pairs(journal40_pair_t *pairs,
+				    uint64_t count)
+{
+	uint64_t width, i, k, l, r, lend, rend;
+	journal40_pair_t *src, *dst, *tmp;
+	journal40_pair_t *buff;
+
+	if (count < 2)
+		return 0;
+
+	if (!(buff = aal_malloc(count * sizeof(*pairs))))
+		return -ENOMEM;
+
+	src = pairs;
+	dst = buff;
+
+	/* Bottom-up merge sort. */
+	for (width = 1; width < count; width *= 2) {
+		for (i = 0; i < count; i += 2 * width) {
+			lend = (i + width < count) ? i + width : count;
+			rend = (lend + width < count) ? lend + width : count;
+
+			for (k = l = i, r = lend; l < lend && r < rend; k++) {
+				if (src[r].original < src[l].original)
+					dst[k] = src[r++];
+				else
+					dst[k] = src[l++];
+			}
+
+			while (l < lend)
+				dst[k++] = src[l++];
+			
+			while (r < rend)
+				dst[k++] = src[r++];
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != pairs)
+		aal_memcpy(pairs, src, count * sizeof(*pairs));
 
-static errno_t cb_print_replay(reiser4_journal_ent_t *entity,
-			       aal_block_t *block, blk_t orig,
-			       journal40_block_t type, void *data)
+	aal_free(buff);
+	return 0;
+}
+
+/* Returns the number of pairs starting from @start whose original blocks go
+   one by one, so they may be written by one request. */
+static uint64_t journal40_replay_run(journal40_replay_t *replay,
+				     uint64_t start)
 {
-	journal40_tx_header_t *header;
-	replay_count_t *count;
+	journal40_pair_t *pair;
+	uint64_t run;
+
+	pair = replay->pairs + start;
 	
-	header = (journal40_tx_header_t *)block->data;
-	count = (replay_count_t *)data;
+	for (run = 1; run < JOURNAL40_REPLAY_RUN; run++) {
+		if (start + run >= replay->count)
+			break;
+
+		if (pair[run].original != pair->original + run)
+			break;
+	}
+
+	return run;
+}
+
+void journal40_replay_fini(journal40_replay_t *replay) {
+	aal_assert("umka-3137", replay != NULL);
 	
-	if (type == JB_WAN)
-		count->blk_count++;
-		
-	/* A print at every transaction. */
-	if (type != JB_LGR)
-		return 0;
+	if (replay->pairs)
+		aal_free(replay->pairs);
 
-	aal_mess("Replaying transaction: id %llu, block count %lu.",
-		 (unsigned long long)header->th_id,
-		 (long unsigned)header->th_total);
+	/* Statistics are left for reporting. */
+	replay->pairs = NULL;
+	replay->size = 0;
+}
+
+/* Builds the replay plan. Collects wandered/original pairs of all not flushed
+   transactions, sorts them by original blocks and leaves the latest pair for
+   each original block, as later transactions override earlier ones. Nothing
+   is written here, so this is also used for reporting what replay is going to
+   do. */
+errno_t journal40_replay_plan(reiser4_journal_ent_t *entity,
+			      journal40_replay_t *replay,
+			      int verbose)
+{
+	uint64_t i, j;
+	errno_t res;
 
-	count->tx_count++;
+	aal_assert("umka-3138", entity != NULL);
+	aal_assert("umka-3139", replay != NULL);
+
+	aal_memset(replay, 0, sizeof(*replay));
+	replay->verbose = verbose;
+	
+	if ((res = journal40_traverse(entity, NULL, NULL,
+				      cb_collect_replay, replay)))
+	{
+		goto error_fini_replay;
+	}
+
+	if ((res = journal40_sort_pairs(replay->pairs, replay->count)))
+		goto error_fini_replay;
+
+	/* Leave the latest pair for each original block. */
+	for (i = 0, j = 0; i < replay->count; i++) {
+		if (j && replay->pairs[j - 1].original ==
+		    replay->pairs[i].original)
+		{
+			j--;
+		}
+
+		replay->pairs[j++] = replay->pairs[i];
+	}
+
+	replay->count = j;
+
+	/* Count write requests. */
+	for (i = 0; i < replay->count; i += journal40_replay_run(replay, i))
+		replay->writes++;
 	
 	return 0;
+
+ error_fini_replay:
+	journal40_replay_fini(replay);
+	return res;
+}
+
+/* Writes wandered blocks to their original places according to @replay. Runs
+   of adjacent original blocks are written by one request, adjacent wandered
+   blocks are read by one request as well. */
+static errno_t journal40_replay_write(journal40_t *journal,
+				      journal40_replay_t *replay)
+{
+	journal40_pair_t *pair;
+	aal_device_t *device;
+	uint64_t i, j, run;
+	uint32_t factor;
+	uint64_t len;
+	errno_t res;
+	char *buff;
+
+	device = journal->device;
+	factor = journal->blksize / device->blksize;
+
+	if (!(buff = aal_malloc(JOURNAL40_REPLAY_RUN * journal->blksize)))
+		return -ENOMEM;
+
+	for (i = 0, res = 0; i < replay->count; i += run) {
+		run = journal40_replay_run(replay, i);
+		pair = replay->pairs + i;
+
+		for (j = 0; j < run; j += len) {
+			for (len = 1; j + len < run; len++) {
+				if (pair[j + len].wandered !=
+				    pair[j].wandered + len)
+				{
+					break;
+				}
+			}
+
+			if ((res = aal_device_read(device, buff + j *
+						   journal->blksize,
+						   pair[j].wandered * factor,
+						   len * factor)))
+			{
+				aal_error("Can't read block %llu while "
+					  "replaying the journal. %s.",
+					  (unsigned long long)pair[j].wandered,
+					  device->error);
+				goto error_free_buff;
+			}
+		}
+		
+		if ((res = aal_device_write(device, buff,
+					    pair->original * factor,
+					    run * factor)))
+		{
+			aal_error("Can't write blocks %llu-%llu while "
+				  "replaying the journal. %s.",
+				  (unsigned long long)pair->original,
+				  (unsigned long long)(pair->original +
+						       run - 1),
+				  device->error);
+			goto error_free_buff;
+		}
+	}
+
+ error_free_buff:
+	aal_free(buff);
+	return res;
 }
 
 /* Makes journal replay */
 static errno_t journal40_replay(reiser4_journal_ent_t *entity) {
-	replay_count_t count;
+	journal40_replay_t replay;
 	errno_t res;
 
 	aal_assert("umka-412", entity != NULL);
 
-	
-	aal_memset(&count, 0, sizeof(count));
-	
-	/* Traverse the journal and replay all transactions. */
-	if ((res = journal40_traverse(entity, NULL, cb_replay,
-				      cb_print_replay, &count)))
-	{
+	if ((res = journal40_replay_plan(entity, &replay, 1)))
 		return res;
-	}
 
+	res = journal40_replay_write(PLUG_ENT(entity), &replay);
+	journal40_replay_fini(&replay);
+
+	if (res)
+		return res;
+	
 	/* Update the format according to the footer's values. */
 	if ((res = journal40_update_format(PLUG_ENT(entity))))
 		return res;
@@ -599,13 +822,16 @@ static errno_t journal40_replay(reiser4_journal_ent_t *entity) {
 	if ((res = journal40_update(PLUG_ENT(entity))))
 		return res;
 
-	if (count.tx_count) {
+	if (replay.tx_count) {
 		aal_mess("Reiser4 journal (%s) on %s: %llu transactions "
-			 "replayed of the total %llu blocks.", 
+			 "replayed of the total %llu blocks, %llu blocks "
+			 "written by %llu requests.", 
 			 journal40_plug.p.label, 
 			 PLUG_ENT(entity)->device->name, 
-			 (unsigned long long)count.tx_count,
-			 (unsigned long long)count.blk_count);
+			 (unsigned long long)replay.tx_count,
+			 (unsigned long long)replay.blk_count,
+			 (unsigned long long)replay.count,
+			 (unsigned long long)replay.writes);
 	}
 
 	/* Invalidate the journal. */
@@ -633,6 +859,7 @@ reiser4_journal_plug_t journal40_plug = {
 	.create	  	= journal40_create,
 	.sync	  	= journal40_sync,
 	.replay   	= journal40_replay,
+	.pending   	= journal40_pending,
 	.print    	= journal40_print,
 	.layout   	= journal40_layout,
 	.valid	  	= journal40_valid,
@@ -163,6 +163,35 @@ typedef errno_t (*journal40_sec_func_t) (reiser4_journal_ent_t *, aal_block_t *,
 typedef errno_t (*journal40_han_func_t) (reiser4_journal_ent_t *, 
 					 aal_block_t *, blk_t, void *);
 
+/* Maximal number of blocks written by one request during replay. */
+#define JOURNAL40_REPLAY_RUN 256
+
+/* Wandered/original pair collected during replay. */
+typedef struct journal40_pair {
+	blk_t wandered;
+	blk_t original;
+} journal40_pair_t;
+
+/* Replay plan: all wandered/original pairs of the journal sorted by the
+   original block with only the latest pair for each original block left,
+   and some statistics. */
+typedef struct journal40_replay {
+	journal40_pair_t *pairs;
+	uint64_t count;
+	uint64_t size;
+
+	/* Wandered block of the pair being collected. */
+	blk_t wandered;
+
+	/* The last met transaction header. */
+	blk_t tx_blk;
+	int verbose;
+	
+	uint64_t tx_count;
+	uint64_t blk_count;
+	uint64_t writes;
+} journal40_replay_t;
+
 #define JFOOTER(block) ((journal40_footer_t *)block->data)
 #define JHEADER(block) ((journal40_header_t *)block->data)
 #endif
@@ -181,6 +210,12 @@ extern errno_t journal40_traverse_trans(reiser4_journal_ent_t *entity,
 
 extern aal_device_t *journal40_device(reiser4_journal_ent_t *entity);
 
+extern errno_t journal40_replay_plan(reiser4_journal_ent_t *entity,
+				     journal40_replay_t *replay,
+				     int verbose);
+
+extern void journal40_replay_fini(journal40_replay_t *replay);
+
 #define journal40_mkdirty(journal) \
 	((journal40_t *)journal)->state |= (1 << ENTITY_DIRTY);
 
@@ -649,6 +649,7 @@ void journal40_print(reiser4_journal_ent_t *entity,
 		     aal_stream_t *stream, 
 		     uint16_t options)
 {
+	journal40_replay_t replay;
 	journal40_t *journal;
 	journal40_footer_t *footer;
 	journal40_header_t *header;
@@ -694,6 +695,26 @@ void journal40_print(reiser4_journal_ent_t *entity,
 	/* Print all transactions. */
 	journal40_traverse(entity, cb_print_txh, cb_print_par, 
 			   cb_print_lgr, (void *)stream);
+
+	/* Print what the replay is going to do, nothing is written. */
+	if (journal40_replay_plan(entity, &replay, 0))
+		return;
+
+	aal_stream_format(stream, "\nReplay:\n");
+	
+	aal_stream_format(stream, "transactions:\t%llu\n",
+			  replay.tx_count);
+	
+	aal_stream_format(stream, "wandered blocks:%llu\n",
+			  replay.blk_count);
+	
+	aal_stream_format(stream, "blocks to write:%llu\n",
+			  replay.count);
+	
+	aal_stream_format(stream, "write requests:\t%llu\n",
+			  replay.writes);
+
+	journal40_replay_fini(&replay);
 }
 
 static errno_t journal40_block_pack(journal40_t *journal, aal_stream_t *stream,
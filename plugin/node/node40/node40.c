@@ -953,36 +953,54 @@ errno_t node40_set_key(reiser4_node_t *entity, pos_t *pos, reiser4_key_t *key)
 }
 #endif
 
-#ifdef ENABLE_SHORT_KEYS
-/* Helper callback for comparing two keys. This is used by node lookup. */
-static int cb_comp_key3(void *ih0, uint32_t pos,
-			void *k2, void *data)
-{
-	reiser4_key_t *key2;
-	void *key1;
-	
-	key1 = ih0 - sizeof(item_header3_t) * pos;
-	key2 = (reiser4_key_t *)k2;
-	
-	return plugcall(key2->plug, compraw, key1, key2->body);
+/* Compares the key of some item header with @needle. Keys are arrays of @els
+   little endian 64-bit elements compared one by one, like key plugins do it
+   in compraw(). @needle is the looked up key, already converted to CPU byte
+   order. */
+static inline int node40_comp_key(void *key, uint64_t *needle, uint32_t els) {
+	uint64_t el;
+	uint32_t i;
+
+	for (i = 0; i < els; i++) {
+		el = LE64_TO_CPU(get_unaligned((d64_t *)key + i));
+
+		if (el != needle[i])
+			return el < needle[i] ? -1 : 1;
+	}
+
+	return 0;
 }
-#endif
 
-#ifdef ENABLE_LARGE_KEYS
-/* Helper callback for comparing two keys. This is used by node lookup. */
-static int cb_comp_key4(void *ih0, uint32_t pos,
-			void *k2, void *data)
+/* Binary search for @needle among @count item headers of @size bytes which
+   grow down from @ih0. It is always called with constant @size and @els, so
+   the compare gets inlined and specialized for each key policy rather than
+   called through aux_bin_search() callback and the key plugin. */
+static inline int node40_search(void *ih0, uint32_t size, uint32_t els,
+				uint32_t count, uint64_t *needle,
+				uint32_t *pos)
 {
-	reiser4_key_t *key2;
-	void *key1;
-	
-	/* Key policy is given by @data. */
-	key1 = ih0 - sizeof(item_header4_t) * pos;
-	key2 = (reiser4_key_t *)k2;
-	
-	return plugcall(key2->plug, compraw, key1, key2->body);
+	int left, right, i, res;
+
+	left = 0;
+	right = count - 1;
+
+	while (left <= right) {
+		i = (left + right) / 2;
+		res = node40_comp_key(ih0 - size * i, needle, els);
+		
+		if (res < 0) {
+			left = i + 1;
+		} else if (res > 0) {
+			right = i - 1;
+		} else {
+			*pos = i;
+			return 1;
+		}
+	}
+
+	*pos = left;
+	return 0;
 }
-#endif
 
 /* Makes search inside the specified node @entity for @key and stores the result
    into @pos. This function returns 1 if key is found and 0 otherwise. */
@@ -991,8 +1009,11 @@ lookup_t node40_lookup(reiser4_node_t *entity,
 		       lookup_bias_t bias,
 		       pos_t *pos)
 {
-	aux_comp_func_t func;
+	uint64_t needle[4];
+	uint32_t count;
+	uint32_t i;
 	void *ih;
+	int res;
 	
 	aal_assert("umka-478", pos != NULL);
 	aal_assert("umka-472", hint != NULL);
@@ -1000,27 +1021,37 @@ lookup_t node40_lookup(reiser4_node_t *entity,
 	aal_assert("umka-3089", hint->key != NULL);
 	aal_assert("umka-567", hint->key->body != NULL);
 
+	if (!(count = nh_get_num_items(entity))) {
+		pos->item = 0;
+		return ABSENT;
+	}
+	
+	ih = node40_ih_at((reiser4_node_t *)entity, 0);
+
+	for (i = 0; i < entity->keypol; i++) {
+		needle[i] = LE64_TO_CPU(get_unaligned((d64_t *)
+						      hint->key->body + i));
+	}
+
 #if defined(ENABLE_SHORT_KEYS) && defined(ENABLE_LARGE_KEYS)
-	func = (entity->keypol == 3) ? cb_comp_key3 : cb_comp_key4;
+	if (entity->keypol == 3) {
+		res = node40_search(ih, sizeof(item_header3_t), 3,
+				    count, needle, &pos->item);
+	} else {
+		res = node40_search(ih, sizeof(item_header4_t), 4,
+				    count, needle, &pos->item);
+	}
 #elif defined(ENABLE_SHORT_KEYS)
-	func = cb_comp_key3;
+	res = node40_search(ih, sizeof(item_header3_t), 3,
+			    count, needle, &pos->item);
 #elif defined(ENABLE_LARGE_KEYS)
-	func = cb_comp_key4;
+	res = node40_search(ih, sizeof(item_header4_t), 4,
+			    count, needle, &pos->item);
 #else
-	func = NULL;
+	return -EIO;
 #endif
-	
-	ih = node40_ih_at((reiser4_node_t *)entity, 0);
-	switch (aux_bin_search(ih, nh_get_num_items(entity), 
-			       hint->key, func, NULL, &pos->item))
-	{
-	case 1:
-		return PRESENT;
-	case 0:
-		return ABSENT;
-	default:
-		return -EIO;
-	}
+
+	return res ? PRESENT : ABSENT;
 }
 
 #ifndef ENABLE_MINIMAL
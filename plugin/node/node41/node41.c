@@ -81,6 +81,14 @@ errno_t node41_sync(reiser4_node_t *entity) {
 
 #ifndef ENABLE_MINIMAL
 
+/* Updates node checksum in the node block. */
+static errno_t node41_seal(reiser4_node_t *entity) {
+	aal_assert("umka-3171", entity != NULL);
+
+	csum_node41(entity, 0 /* update */);
+	return 0;
+}
+
 /* Returns maximal size of item possible for passed node instance */
 static uint16_t node41_maxspace(reiser4_node_t *entity) {
 	aal_assert("edward-8", entity != NULL);
@@ -129,6 +137,7 @@ reiser4_node_plug_t node41_plug = {
 #ifndef ENABLE_MINIMAL
 	.init		= node41_init,
 	.sync           = node41_sync,
+	.seal           = node41_seal,
 	.merge          = node40_merge,
 
 	.pack           = node41_pack,
@@ -193,6 +193,75 @@ static int32_t dir40_readdir(reiser4_object_t *dir,
 	return 1;
 }
 
+#ifndef ENABLE_MINIMAL
+/* Reads up to @count entries to @entries. Unlike readdir() the position is
+   looked up in the tree only once, then units are walked sequentially across 
+   items and nodes. The position is moved exactly the way readdir() does it. 
+   Returns count of read entries, zero if the directory is over. */
+static int32_t dir40_readdir_batch(reiser4_object_t *dir, 
+				   entry_hint_t *entries,
+				   uint32_t count)
+{
+	entry_hint_t temp, *next;
+	uint32_t units, adjust;
+	uint64_t offset;
+	errno_t res;
+	uint32_t i;
+
+	aal_assert("umka-3162", dir != NULL);
+	aal_assert("umka-3163", entries != NULL);
+
+	if (!count)
+		return 0;
+	
+	/* Getting place of current unit */
+	if ((res = obj40_update_body(dir, dir40_entry_comp)) != PRESENT)
+		return res == ABSENT ? 0 : res;
+
+	if ((res = dir40_fetch(dir, &entries[0])))
+		return res;
+
+	units = objcall(&dir->body, balance->units);
+	
+	for (i = 0; i < count; ) {
+		dir40_entry_type(&entries[i++]);
+
+		/* Getting the next entry. */
+		if (++dir->body.pos.unit >= units) {
+			if ((res = obj40_next_item(dir)) < 0)
+				return res;
+
+			if (res == ABSENT) {
+				/* Set offset to non-existent value. */
+				offset = objcall(&dir->position, get_offset);
+				objcall(&dir->position, set_offset, offset + 1);
+				break;
+			}
+
+			units = objcall(&dir->body, balance->units);
+		}
+
+		/* The next entry is fetched right into @entries if there is
+		   room, otherwise just to set up @dir->position. */
+		next = i < count ? &entries[i] : &temp;
+		
+		if ((res = dir40_fetch(dir, next)))
+			return res;
+
+		/* Taking care about adjust */
+		if (!objcall(&next->offset, compfull, &dir->position))
+			adjust = dir->position.adjust + 1;
+		else
+			adjust = 0;
+
+		dir40_seekdir(dir, &next->offset);
+		dir->position.adjust = adjust;
+	}
+	
+	return i;
+}
+#endif
+
 /* Makes lookup inside directory. This is needed to be used in add_entry() for
    two reasons: for make sure, that passed entry does not exists and to use
    lookup result for consequent insert. */
@@ -646,6 +715,7 @@ reiser4_object_plug_t dir40_plug = {
 	.telldir	= dir40_telldir,
 
 #ifndef ENABLE_MINIMAL
+	.readdir_batch	= dir40_readdir_batch,
 	.sdext_mandatory = (1 << SDEXT_LW_ID),
 	.sdext_unknown   = (1 << SDEXT_SYMLINK_ID)
 #endif
@@ -44,7 +44,16 @@ static void cpfs_print_usage(char *name) {
 		"  -y, --yes                     assumes an answer 'yes' to all questions.\n"
 		"  -f, --force                   makes cpfs to use whole disk, not\n"
 		"                                block device or mounted partition.\n"
-		"  -c, --cache N                 number of nodes in tree buffer cache\n");
+		"  -c, --cache SIZE[,DATA]       tree cache size, or separate sizes of\n"
+		"                                formatted nodes and data caches.\n");
+}
+
+/* Advances the copying gauge. */
+static void cpfs_progress(reiser4_tree_t *tree, count_t done, count_t total) {
+	aal_gauge_t *gauge = (aal_gauge_t *)tree->progress_data;
+
+	aal_gauge_set_value(gauge, total ? done * 100 / total : 100);
+	aal_gauge_touch(gauge);
 }
 
 /* Initializes used by mkfs exception streams */
@@ -59,7 +68,6 @@ static void cpfs_init(void) {
 int main(int argc, char *argv[]) {
 	int c;
 
-	uint32_t cache;
 	struct stat st;
 	fs_hint_t hint;
 
@@ -115,13 +123,11 @@ int main(int argc, char *argv[]) {
 			flags |= BF_SHOW_PLUG;
 			break;
 		case 'c':
-			if ((cache = misc_str2long(optarg, 10)) == INVAL_DIG) {
+			if (misc_mpressure_setup(optarg)) {
 				aal_error("Invalid cache value specified (%s).",
 					  optarg);
 				return USER_ERROR;
 			}
-
-			misc_mpressure_setup(cache);
 			break;
 		case 'o':
 			aal_strncat(override, optarg,
@@ -268,15 +274,6 @@ int main(int argc, char *argv[]) {
 		{
 			goto error_free_dst_device;
 		}
-
-		if (!(gauge = aal_gauge_create(aux_gauge_handlers[GT_PROGRESS], 
-					       NULL, NULL, 0, "Copying %s to "
-					       "%s ... ", src_dev, dst_dev)))
-		{
-			goto error_free_libreiser4;
-		}
-		
-		aal_gauge_touch(gauge);
 	}
 
 	/* Opening source fs */
@@ -288,6 +285,20 @@ int main(int argc, char *argv[]) {
 
 	src_fs->tree->mpc_func = misc_mpressure_detect;
 
+	/* The source is opened read only, so its journal cannot be replayed
+	   here. Refusing to copy the fs until it is done by mount or fsck. */
+	if (!(src_fs->journal = reiser4_journal_open(src_fs, src_device))) {
+		aal_error("Can't open the journal on %s.", src_dev);
+		goto error_free_src_fs;
+	}
+
+	if (reiser4_journal_pending(src_fs->journal)) {
+		aal_error("The journal on %s has transactions not replayed. "
+			  "Mount and unmount it or run fsck.reiser4 on it "
+			  "before copying.", src_dev);
+		goto error_free_src_fs;
+	}
+
 	/* Creating destinatrion fs */
 	aal_strncpy(hint.uuid, reiser4_master_get_uuid(src_fs->master),
 		    sizeof(hint.uuid));
@@ -312,14 +323,33 @@ int main(int argc, char *argv[]) {
 		goto error_free_dst_fs;
 
 
+	if (!(flags & BF_YES)) {
+		if (!(gauge = aal_gauge_create(aux_gauge_handlers[GT_PROGRESS], 
+					       NULL, NULL, 0, "Copying %s to "
+					       "%s ... ", src_dev, dst_dev)))
+		{
+			goto error_free_dst_fs;
+		}
+		
+		src_fs->tree->progress_func = cpfs_progress;
+		src_fs->tree->progress_data = gauge;
+	}
+
 	if (reiser4_fs_copy(src_fs, dst_fs)) {
 		aal_error("Can't copy %s to %s.", src_dev, dst_dev);
 		goto error_free_dst_fs;
 	}
+
+	/* Backup the fs metadata. */
+	if (!(dst_fs->backup = reiser4_backup_create(dst_fs))) {
+		aal_error("Can't create the fs metadata backup.");
+		goto error_free_dst_fs;
+	}
 	
 	if (gauge) {
 		aal_gauge_done(gauge);
 		aal_gauge_free(gauge);
+		src_fs->tree->progress_func = NULL;
 	}
 
 	/* Closing dst fs */
@@ -341,6 +371,9 @@ int main(int argc, char *argv[]) {
 	return NO_ERROR;
 	
  error_free_dst_fs:
+	if (gauge)
+		aal_gauge_free(gauge);
+	
 	reiser4_fs_close(dst_fs);
  error_free_src_fs:
 	reiser4_fs_close(src_fs);
@@ -33,10 +33,14 @@ static errno_t debugfs_reg_cat(reiser4_object_t *object) {
 	return 0;
 }
 
+/* Count of directory entries read at once. */
+#define DEBUGFS_ENTRIES 16
+
 /* If object is the directory, we show its contant here */
 static errno_t debugfs_dir_cat(reiser4_object_t *object) {
+	entry_hint_t *entries;
+	int32_t count, i;
 	errno_t res;
-	entry_hint_t entry;
 	
 	if ((res = reiser4_object_reset(object))) {
 		aal_error("Can't reset object %s.", 
@@ -44,12 +48,22 @@ static errno_t debugfs_dir_cat(reiser4_object_t *object) {
 		return res;
 	}
 
+	if (!(entries = aal_calloc(DEBUGFS_ENTRIES * sizeof(*entries), 0)))
+		return -ENOMEM;
+	
 	/* The loop until all entry read */
-	while (reiser4_object_readdir(object, &entry) > 0) {
-		printf("[%s] %s\n", reiser4_print_key(&entry.object), 
-		       entry.name);
+	while ((count = reiser4_object_readdir_batch(object, entries,
+						     DEBUGFS_ENTRIES, 
+						     NULL)) > 0)
+	{
+		for (i = 0; i < count; i++) {
+			printf("[%s] %s\n", 
+			       reiser4_print_key(&entries[i].object), 
+			       entries[i].name);
+		}
 	}
 
+	aal_free(entries);
 	printf("\n");
 	
 	return 0;
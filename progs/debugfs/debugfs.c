@@ -37,6 +37,11 @@ static void debugfs_print_usage(char *name) {
 		"                                to standard output.\n"
 		"  -U, --unpack-metadata         uses metadata stream from stdandard input\n"
 		"                                to construct filesystem by it.\n"
+		"  -x, --pack-index              appends the index of blocks to the stream\n"
+		"                                written by --pack-metadata.\n"
+		"  -I, --image                   opens FILE as the metadata stream written\n"
+		"                                by --pack-metadata --pack-index, without\n"
+		"                                unpacking it.\n"
 		"Space options:\n"
 		"  -O, --occupied-blocks         works with occupied blocks only(default).\n"
 		"  -F, --free-blocks             works with free blocks only.\n"
@@ -54,7 +59,8 @@ static void debugfs_print_usage(char *name) {
 		"  -f, --force                   makes debugfs to use whole disk, not\n"
 		"  -y, --yes                     assumes an answer 'yes' to all questions.\n"
 		"                                block device or mounted partition.\n"
-		"  -c, --cache N                 number of nodes in tree buffer cache\n");
+		"  -c, --cache SIZE[,DATA]       tree cache size, or separate sizes of\n"
+		"                                formatted nodes and data caches.\n");
 }
 
 /* Initializes exception streams used by debugfs */
@@ -72,6 +78,47 @@ static void debugfs_init(void) {
 	misc_exception_set_stream(EXCEPTION_TYPE_FSCK, NULL);
 }
 
+/* Reads the header of the metadata stream written by --pack-metadata. Sets 
+   @indexed if the stream ends with the index of records. */
+static errno_t debugfs_unpack_version(aal_stream_t *stream, bool_t *indexed) {
+	char buf[256];
+	int i;
+
+	aal_stream_read(stream, buf, 4);
+	
+	if (!aal_strncmp(buf, VERSION_INDEX_PACK_SIGN, 4)) {
+		*indexed = 1;
+	} else if (!aal_strncmp(buf, VERSION_PACK_SIGN, 4)) {
+		*indexed = 0;
+	} else {
+		aal_error("The metadata were packed with the "
+			  "reiser4progs version <= 1.0.2.");
+		return -EINVAL;
+	}
+	
+	i = 0;
+	while (1) {
+		if (aal_stream_read(stream, buf + i, 1) != 1) {
+			aal_error("Can't read from the stream. Is it over?");
+			return -EIO;
+		}
+		
+		if (buf[i] == '\0' || i == 255)
+			break;
+		i++;
+	}
+
+	if (i == 255) {
+		aal_fatal("Can't detect the reiser4progs version "
+			  "the metadata were packed with.");
+		return -EINVAL;
+	}
+	
+	aal_info("The metadata were packed with the "
+		 "reiser4progs %s.", buf);
+	return 0;
+}
+
 typedef struct debugfs_backup_hint {
 	uint64_t count;
 	blk_t *blk;
@@ -87,7 +134,6 @@ extern void cb_gauge_tree_percent(aal_gauge_t *gauge);
 int main(int argc, char *argv[]) {
 	int c;
 
-	uint32_t cache;
 	struct stat st;
 	char *host_dev;
 
@@ -104,6 +150,7 @@ int main(int argc, char *argv[]) {
 	blk_t blocknr = 0;
 
 	FILE *file = NULL;
+	FILE *image = NULL;
 	char *bm_file = NULL;
 	reiser4_bitmap_t *bitmap = NULL;
 	
@@ -123,6 +170,8 @@ int main(int argc, char *argv[]) {
 		{"print-file", required_argument, NULL, 'i'},
 		{"pack-metadata", no_argument, NULL, 'P'},
 		{"unpack-metadata", no_argument, NULL, 'U'},
+		{"image", no_argument, NULL, 'I'},
+		{"pack-index", no_argument, NULL, 'x'},
 		{"print-profile", no_argument, NULL, 'p'},
 		{"print-plugins", no_argument, NULL, 'l'},
 		{"override", required_argument, NULL, 'o'},
@@ -143,7 +192,7 @@ int main(int argc, char *argv[]) {
 	}
     
 	/* Parsing parameters */    
-	while ((c = getopt_long(argc, argv, "hVyftb:djk:n:i:o:plsaPUOFWB:c:?",
+	while ((c = getopt_long(argc, argv, "hVyftb:djk:n:i:o:plsaPUIxOFWB:c:?",
 				long_options, (int *)0)) != EOF) 
 	{
 		switch (c) {
@@ -193,13 +242,11 @@ int main(int argc, char *argv[]) {
 			cat_filename = optarg;
 			break;
 		case 'c':
-			if ((cache = misc_str2long(optarg, 10)) == INVAL_DIG) {
+			if (misc_mpressure_setup(optarg)) {
 				aal_error("Invalid cache value specified (%s).",
 					  optarg);
 				return USER_ERROR;
 			}
-
-			misc_mpressure_setup(cache);
 			break;
 		case 'f':
 			behav_flags |= BF_FORCE;
@@ -213,6 +260,12 @@ int main(int argc, char *argv[]) {
 		case 'U':
 			behav_flags |= BF_UNPACK_META;
 			break;
+		case 'I':
+			behav_flags |= BF_IMAGE;
+			break;
+		case 'x':
+			behav_flags |= BF_PACK_INDEX;
+			break;
 		case 'l':
 			behav_flags |= BF_SHOW_PLUG;
 			break;
@@ -238,6 +291,12 @@ int main(int argc, char *argv[]) {
 		}
 	}
     
+	if ((behav_flags & BF_PACK_INDEX) && !(behav_flags & BF_PACK_META)) {
+		aal_error("The --pack-index option is used with "
+			  "--pack-metadata only.");
+		return USER_ERROR;
+	}
+	
 	if (!(behav_flags & BF_YES))
 		misc_print_banner(argv[0]);
 
@@ -283,20 +342,57 @@ int main(int argc, char *argv[]) {
 		goto error_free_libreiser4;
 	}
 
-	/* Opening device with file_ops and default blocksize */
-	if (!(device = aal_device_open(&file_ops, host_dev, 512,
-				       behav_flags & BF_UNPACK_META ?
-				       O_RDWR : O_RDONLY)))
-	{
-		aal_error("Can't open %s. %s.", host_dev, strerror(errno));
-		goto error_free_libreiser4;
+	if (behav_flags & BF_IMAGE) {
+		aal_stream_t stream;
+		bool_t indexed;
+
+		if (behav_flags & BF_UNPACK_META) {
+			aal_error("The image can't be unpacked to itself.");
+			goto error_free_libreiser4;
+		}
+		
+		if (!(image = fopen(host_dev, "r"))) {
+			aal_error("Can't open %s. %s.", host_dev, 
+				  strerror(errno));
+			goto error_free_libreiser4;
+		}
+
+		aal_stream_init(&stream, image, &file_stream);
+		
+		if (debugfs_unpack_version(&stream, &indexed))
+			goto error_close_image;
+
+		aal_stream_fini(&stream);
+
+		if (!indexed) {
+			aal_error("The image %s has no index of blocks. Pack "
+				  "it with --pack-index or unpack it with "
+				  "--unpack-metadata.", host_dev);
+			goto error_close_image;
+		}
+
+		/* Opening device over the image, blocks are unpacked from
+		   the image on demand. */
+		if (!(device = repair_image_open(image, host_dev))) {
+			aal_error("Can't open the image %s.", host_dev);
+			goto error_close_image;
+		}
+	} else {
+		/* Opening device with file_ops and default blocksize */
+		if (!(device = aal_device_open(&file_ops, host_dev, 512,
+					       behav_flags & BF_UNPACK_META ?
+					       O_RDWR : O_RDONLY)))
+		{
+			aal_error("Can't open %s. %s.", host_dev, 
+				  strerror(errno));
+			goto error_free_libreiser4;
+		}
 	}
 
 			
 	if (behav_flags & BF_UNPACK_META) {
 		aal_stream_t stream;
-		char buf[256];
-		int i;
+		bool_t indexed;
 		
 		/* Prepare the bitmap if needed. */
 		if (bm_file) {
@@ -313,34 +409,9 @@ int main(int argc, char *argv[]) {
 		}
 		
 		aal_stream_init(&stream, stdin, &file_stream);
-		aal_stream_read(&stream, buf, 4);
 		
-		if (aal_strncmp(buf, VERSION_PACK_SIGN, 4)) {
-			aal_error("The metadata were packed with the "
-				  "reiser4progs version <= 1.0.2.");
+		if (debugfs_unpack_version(&stream, &indexed))
 			goto error_free_bitmap;
-		}
-		
-		i = 0;
-		while (1) {
-			if (aal_stream_read(&stream, buf + i, 1) != 1) {
-				aal_error("Can't read from the stream. Is it over?");
-				goto error_free_bitmap;
-			}
-			
-			if (buf[i] == '\0' || i == 255)
-				break;
-			i++;
-		}
-
-		if (i == 255) {
-			aal_fatal("Can't detect the reiser4progs version "
-				  "the metadata were packed with.");
-			goto error_free_bitmap;
-		} else {
-			aal_info("The metadata were packed with the "
-				 "reiser4progs %s.", buf);
-		}
 		
 		if (!(fs = repair_fs_unpack(device, bitmap, &stream))) {
 			aal_error("Can't unpack filesystem.");
@@ -474,10 +545,13 @@ int main(int argc, char *argv[]) {
 		aal_stream_t stream;
 
 		aal_stream_init(&stream, stdout, &file_stream);
-		aal_stream_write(&stream, VERSION_PACK_SIGN, 4);
+		aal_stream_write(&stream, behav_flags & BF_PACK_INDEX ?
+				 VERSION_INDEX_PACK_SIGN : VERSION_PACK_SIGN, 4);
 		aal_stream_write(&stream, VERSION, sizeof(VERSION));
 		
-		if (repair_fs_pack(fs, bitmap, &stream)) {
+		if (repair_fs_pack(fs, bitmap, &stream,
+				   behav_flags & BF_PACK_INDEX ? 1 : 0))
+		{
 			aal_error("Can't pack filesystem.");
 			goto error_free_bitmap;
 		}
@@ -493,6 +567,9 @@ int main(int argc, char *argv[]) {
 
 	/* Closing device */
 	aal_device_close(device);
+
+	if (image)
+		fclose(image);
     
 	/* Deinitializing libreiser4. At the moment only plugins are unloading
 	   while doing this. */
@@ -513,6 +590,10 @@ int main(int argc, char *argv[]) {
 	}
  error_free_device:
 	aal_device_close(device);
+ error_close_image:
+	if (image) {
+		fclose(image);
+	}
  error_free_libreiser4:
 	libreiser4_fini();
  error:
@@ -20,4 +20,8 @@
 
 #define VERSION_PACK_SIGN "VRSN"
 
+/* The header of the stream with the index of node and block records. Tools
+   not knowing the index refuse such a stream before unpacking anything. */
+#define VERSION_INDEX_PACK_SIGN "VRSI"
+
 #endif
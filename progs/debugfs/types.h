@@ -25,6 +25,8 @@ typedef enum behav_flags {
 	BF_SHOW_PLUG		= 1 << 4,
 	BF_PACK_META		= 1 << 5,
 	BF_UNPACK_META		= 1 << 6,
+	BF_IMAGE		= 1 << 7,
+	BF_PACK_INDEX		= 1 << 8,
 } behav_flags_t;
 
 typedef enum space_flags {
@@ -1,82 +1,388 @@
 /* Copyright (C) 2001-2005 by Hans Reiser, licensing governed by
    reiser4progs/COPYING.
-   
+
    backup.c -- backup and rollback fsck changes code. */
 
 #ifndef _GNU_SOURCE
 #  define _GNU_SOURCE
 #endif
 
+#include <stdlib.h>
+#include <sys/types.h>
+
 #include <backup.h>
+#include <aux/crc32c.h>
 
 backup_t backup;
 
+#define BACKUP_REC_SIZE(blksize) (sizeof(backup_rec_t) + (blksize))
+
+/* Checksum of the record: the header but the checksum itself and @data. A
+   record with a wrong block number does not pass it as well. */
+static uint32_t backup_rec_crc(backup_rec_t *rec, void *data) {
+	uint32_t crc;
+
+	crc = crc32c(~0, &rec->blk, sizeof(rec->blk));
+	crc = crc32c(crc, &rec->pad, sizeof(rec->pad));
+	
+	return crc32c(crc, data, backup.blksize);
+}
+
+static errno_t backup_index_add(blk_t blk, uint64_t offset) {
+	if (backup.count == backup.size) {
+		backup_entry_t *index;
+		uint64_t size;
+
+		size = backup.size ? backup.size * 2 : 1024;
+
+		if (!(index = aal_malloc(size * sizeof(*index))))
+			return -ENOMEM;
+
+		if (backup.index) {
+			aal_memcpy(index, backup.index,
+				   backup.count * sizeof(*index));
+			aal_free(backup.index);
+		}
+
+		backup.index = index;
+		backup.size = size;
+	}
+
+	backup.index[backup.count].blk = blk;
+	backup.index[backup.count].offset = offset;
+	backup.count++;
+
+	return 0;
+}
+
+/* Writes gathered records into the file. It is called before the device
+   write gets through, so the original data always precedes the change. */
+static errno_t backup_flush() {
+	uint32_t size;
+
+	if (!backup.filled)
+		return 0;
+
+	size = backup.filled * BACKUP_REC_SIZE(backup.blksize);
+
+	if (fwrite(backup.chunk, size, 1, backup.file) != 1 ||
+	    fflush(backup.file))
+	{
+		aal_error("Failed to write to the backup file.");
+		return -EIO;
+	}
+
+	backup.offset += size;
+	backup.filled = 0;
+
+	return 0;
+}
+
 static errno_t backup_write(
 	aal_device_t *device,	    /* file device, data will be wrote onto */
 	void *buff,		    /* buffer, data stored in */
 	blk_t block,		    /* start position for writing */
 	count_t count)
 {
-	blk_t blk, end;
-	
+	uint32_t recsize, i;
+	blk_t blk, end, run;
+	errno_t res;
+
+	recsize = BACKUP_REC_SIZE(backup.blksize);
+
 	end = block + count;
-	for (blk = block; blk < end; blk++) {
+	for (blk = block; blk < end; blk = run) {
 		/* Check if the block is written already. */
-		if (reiser4_bitmap_test(backup.bitmap, blk))
+		if (reiser4_bitmap_test(backup.bitmap, blk)) {
+			run = blk + 1;
 			continue;
-		
-		/* Mark it in the bitmap. */
-		reiser4_bitmap_mark(backup.bitmap, blk);
-		
-		/* Write block number and data into the backup stream. */
-		fwrite(&blk, sizeof(blk), 1, backup.file);
-		fwrite(buff, device->blksize, 1, backup.file);
+		}
+
+		if (backup.filled == BACKUP_CHUNK) {
+			if ((res = backup_flush()))
+				return res;
+		}
+
+		/* Gather the run of blocks not saved yet and fitting the
+		   chunk to read their original data at once. */
+		for (run = blk + 1; run < end; run++) {
+			if (run - blk == BACKUP_CHUNK - backup.filled)
+				break;
+
+			if (reiser4_bitmap_test(backup.bitmap, run))
+				break;
+		}
+
+		if ((res = aal_device_read(device, backup.data,
+					   blk, run - blk)))
+		{
+			aal_error("Failed to read the block %llu for the "
+				  "backup.", (unsigned long long)blk);
+			return res;
+		}
+
+		for (i = 0; i < run - blk; i++) {
+			backup_rec_t *rec;
+			char *data;
+
+			if ((res = backup_index_add(blk + i, backup.offset +
+						    backup.filled * recsize)))
+			{
+				aal_error("Failed to allocate the backup "
+					  "index.");
+				return res;
+			}
+
+			/* Mark it in the bitmap. */
+			reiser4_bitmap_mark(backup.bitmap, blk + i);
+
+			/* Put block number and data into the chunk. */
+			rec = (backup_rec_t *)(backup.chunk +
+					       backup.filled * recsize);
+			data = (char *)(rec + 1);
+
+			aal_memcpy(data, backup.data + i * backup.blksize,
+				   backup.blksize);
+
+			rec->blk = blk + i;
+			rec->pad = 0;
+			rec->crc = backup_rec_crc(rec, data);
+
+			backup.filled++;
+		}
 	}
-	
+
+	if ((res = backup_flush()))
+		return res;
+
 	return backup.write(device, buff, block, count);
 }
 
 errno_t backup_init(FILE *file, aal_device_t *device, count_t len) {
-	aal_memset(&backup, 0, sizeof(backup));
+	errno_t res = -ENOMEM;
 	
+	aal_memset(&backup, 0, sizeof(backup));
+
 	if (!file) return 0;
 
 	aal_assert("vpf-1511", device != NULL);
-	
+
 	backup.file = file;
-	
+	backup.blksize = device->blksize;
+
 	if (!(backup.bitmap = reiser4_bitmap_create(len))) {
 		aal_error("Failed to allocate a bitmap for the backup.");
 		return -ENOMEM;
 	}
 
+	if (!(backup.chunk = aal_malloc(BACKUP_CHUNK *
+					BACKUP_REC_SIZE(backup.blksize))))
+	{
+		aal_error("Failed to allocate a buffer for the backup.");
+		goto error_free_bitmap;
+	}
+
+	if (!(backup.data = aal_malloc(BACKUP_CHUNK * backup.blksize))) {
+		aal_error("Failed to allocate a buffer for the backup.");
+		goto error_free_chunk;
+	}
+
+	/* Write header to the file. */
+	if (fwrite(BACKUP_MAGIC, sizeof(BACKUP_MAGIC), 1, backup.file) != 1 ||
+	    fwrite(&backup.blksize, sizeof(backup.blksize),
+		   1, backup.file) != 1)
+	{
+		aal_error("Failed to write to the backup file.");
+		res = -EIO;
+		goto error_free_data;
+	}
+
+	backup.offset = sizeof(BACKUP_MAGIC) + sizeof(backup.blksize);
+
 	backup.write = device->ops->write;
 	device->ops->write = backup_write;
 
-	/* Write header to the file. */
-	fwrite(BACKUP_MAGIC, sizeof(BACKUP_MAGIC), 1, backup.file);
-	fwrite(&device->blksize, sizeof(device->blksize), 1, backup.file);
-	
 	return 0;
+
+ error_free_data:
+	aal_free(backup.data);
+ error_free_chunk:
+	aal_free(backup.chunk);
+ error_free_bitmap:
+	reiser4_bitmap_close(backup.bitmap);
+	backup.file = NULL;
+	return res;
 }
 
 void backup_fini() {
+	backup_tail_t tail;
+
 	if (!backup.file) return;
 
+	/* Append the index and the tail pointing to it. */
+	aal_memset(&tail, 0, sizeof(tail));
+	aal_memcpy(tail.magic, BACKUP_INDEX_MAGIC, sizeof(tail.magic));
+
+	tail.count = backup.count;
+	tail.offset = backup.offset;
+	tail.crc = crc32c(~0, backup.index,
+			  backup.count * sizeof(backup_entry_t));
+
+	if ((backup.count && fwrite(backup.index, sizeof(backup_entry_t),
+				    backup.count, backup.file) != backup.count) ||
+	    fwrite(&tail, sizeof(tail), 1, backup.file) != 1)
+	{
+		aal_error("Failed to write the index to the backup file. "
+			  "Rollback will have to scan it.");
+	}
+
 	fclose(backup.file);
 	reiser4_bitmap_close(backup.bitmap);
+
+	aal_free(backup.chunk);
+	aal_free(backup.data);
+
+	if (backup.index)
+		aal_free(backup.index);
+}
+
+/* Loads the index from the end of the backup file. */
+static errno_t backup_load_index(FILE *file, uint64_t start) {
+	backup_tail_t tail;
+	uint64_t size;
+	off_t end;
+
+	if (fseeko(file, 0, SEEK_END) || (end = ftello(file)) < 0)
+		return -EIO;
+
+	if ((uint64_t)end < start + sizeof(tail))
+		return -EINVAL;
+
+	if (fseeko(file, end - sizeof(tail), SEEK_SET) ||
+	    fread(&tail, sizeof(tail), 1, file) != 1)
+	{
+		return -EIO;
+	}
+
+	if (aal_memcmp(tail.magic, BACKUP_INDEX_MAGIC, sizeof(tail.magic)))
+		return -EINVAL;
+
+	/* The index must lay right between records and the tail. */
+	size = tail.count * sizeof(backup_entry_t);
+
+	if (tail.offset < start || tail.count > (uint64_t)end /
+	    sizeof(backup_entry_t) || tail.offset + size +
+	    sizeof(tail) != (uint64_t)end)
+	{
+		return -EINVAL;
+	}
+
+	if (!tail.count)
+		return 0;
+
+	if (!(backup.index = aal_malloc(size)))
+		return -ENOMEM;
+
+	if (fseeko(file, tail.offset, SEEK_SET) ||
+	    fread(backup.index, size, 1, file) != 1)
+	{
+		goto error_free_index;
+	}
+
+	if (crc32c(~0, backup.index, size) != tail.crc)
+		goto error_free_index;
+
+	backup.count = backup.size = tail.count;
+	return 0;
+
+ error_free_index:
+	aal_free(backup.index);
+	backup.index = NULL;
+	return -EINVAL;
+}
+
+/* Builds the index by scanning records. Stops at the first broken one, what
+   is the end of the log if fsck was interrupted before fini. */
+static errno_t backup_scan_index(FILE *file, uint64_t start, void *data) {
+	backup_rec_t rec;
+	uint64_t offset;
+	errno_t res;
+
+	if (fseeko(file, start, SEEK_SET))
+		return -EIO;
+
+	for (offset = start; ; offset += BACKUP_REC_SIZE(backup.blksize)) {
+		if (fread(&rec, sizeof(rec), 1, file) != 1 ||
+		    fread(data, backup.blksize, 1, file) != 1)
+		{
+			break;
+		}
+
+		if (rec.pad || backup_rec_crc(&rec, data) != rec.crc)
+			break;
+
+		if ((res = backup_index_add(rec.blk, offset)))
+			return res;
+	}
+
+	return 0;
+}
+
+static int cb_comp_entry(const void *e1, const void *e2) {
+	const backup_entry_t *entry1 = e1;
+	const backup_entry_t *entry2 = e2;
+
+	if (entry1->blk != entry2->blk)
+		return entry1->blk < entry2->blk ? -1 : 1;
+
+	if (entry1->offset != entry2->offset)
+		return entry1->offset < entry2->offset ? -1 : 1;
+
+	return 0;
+}
+
+/* Reads the record at @offset into @data and checks it is not corrupted. */
+static errno_t backup_read_rec(FILE *file, backup_entry_t *entry,
+			       void *data, uint64_t *pos)
+{
+	backup_rec_t rec;
+
+	if (*pos != entry->offset) {
+		if (fseeko(file, entry->offset, SEEK_SET))
+			return -EIO;
+	}
+
+	if (fread(&rec, sizeof(rec), 1, file) != 1 ||
+	    fread(data, backup.blksize, 1, file) != 1)
+	{
+		return -EIO;
+	}
+
+	*pos = entry->offset + BACKUP_REC_SIZE(backup.blksize);
+
+	if (rec.blk != entry->blk || backup_rec_crc(&rec, data) != rec.crc)
+	{
+		aal_error("The backup of the block %llu is corrupted.",
+			  (unsigned long long)entry->blk);
+		return -EINVAL;
+	}
+
+	return 0;
 }
 
 errno_t backup_rollback(FILE *file, aal_device_t *device) {
 	char buf[sizeof(BACKUP_MAGIC)];
-	uint32_t size;
+	uint64_t i, start, pos;
 	count_t count;
+	blk_t first;
+	errno_t res;
 	void *data;
-	blk_t blk;
-	
+
 	aal_assert("vpf-1512", file != NULL);
 	aal_assert("vpf-1513", device != NULL);
 
+	aal_memset(&backup, 0, sizeof(backup));
+
 	if ((count = fread(buf, sizeof(BACKUP_MAGIC), 1, file)) != 1) {
 		aal_error("Failed to read from the backup file.");
 		return -EIO;
@@ -87,41 +393,89 @@ errno_t backup_rollback(FILE *file, aal_device_t *device) {
 		return -EIO;
 	}
 
-	if ((count = fread(&size, sizeof(size), 1, file)) != 1) {
+	if ((count = fread(&backup.blksize, sizeof(backup.blksize),
+			   1, file)) != 1)
+	{
 		aal_error("Failed to read from the backup file.");
 		return -EIO;
 	}
 
-	if (!(data = aal_malloc(size))) {
+	if (backup.blksize != device->blksize) {
+		aal_error("The backup block size %u does not match the device "
+			  "one %u.", backup.blksize, device->blksize);
+		return -EINVAL;
+	}
+
+	if (!(data = aal_malloc(BACKUP_RUN * backup.blksize))) {
 		aal_error("Failed to alloc the buffer for rollback.");
 		return -ENOMEM;
 	}
-	
-	while (1) {
-		/* Read from the backup file. */
-		count = fread(&blk, sizeof(blk), 1, file);
 
-		if (count != 1) {
-			if (feof(file))
-				break;
-			
+	start = sizeof(BACKUP_MAGIC) + sizeof(backup.blksize);
+
+	if ((res = backup_load_index(file, start))) {
+		if (res == -ENOMEM)
 			goto error_free_data;
+
+		aal_warn("The index of the backup file is missed or "
+			 "corrupted. Scanning the backup.");
+
+		if ((res = backup_scan_index(file, start, data)))
+			goto error_free_index;
+	}
+
+	/* Restore blocks in the disk order, merging neighbour ones into one
+	   write. If a block got into the log more than once, the first copy
+	   is the original one. */
+	qsort(backup.index, backup.count, sizeof(backup_entry_t),
+	      cb_comp_entry);
+
+	pos = 0;
+	first = 0;
+	count = 0;
+
+	for (i = 0; i < backup.count; i++) {
+		backup_entry_t *entry = &backup.index[i];
+
+		if (i && entry->blk == entry[-1].blk)
+			continue;
+
+		if (count && (entry->blk != first + count ||
+			      count == BACKUP_RUN))
+		{
+			if ((res = aal_device_write(device, data,
+						    first, count)))
+				goto error_free_index;
+
+			count = 0;
 		}
-		
-		if ((count = fread(data, size, 1, file)) != 1) {
-			aal_error("Failed to read from the backup file.");
-			goto error_free_data;
+
+		if (!count)
+			first = entry->blk;
+
+		if ((res = backup_read_rec(file, entry, data + count *
+					   backup.blksize, &pos)))
+		{
+			goto error_free_index;
 		}
-		
-		/* Write to the device. */
-		aal_device_write(device, data, blk, 1);
+
+		count++;
 	}
-	
+
+	if (count && (res = aal_device_write(device, data, first, count)))
+		goto error_free_index;
+
+	if (backup.index)
+		aal_free(backup.index);
+
+	aal_free(data);
 	return 0;
-	
+
+ error_free_index:
+	if (backup.index)
+		aal_free(backup.index);
  error_free_data:
-	aal_error("Failed to read from the backup file.");
+	aal_error("Failed to rollback fsck changes.");
 	aal_free(data);
-	return -EIO;
+	return res;
 }
-
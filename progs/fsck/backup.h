@@ -1,6 +1,6 @@
 /* Copyright (C) 2001-2005 by Hans Reiser, licensing governed by
    reiser4progs/COPYING.
-   
+
    backup.h -- backup and rollback fsck declarations. */
 
 #ifndef BACKUP_H
@@ -11,12 +11,68 @@
 #include <aal/libaal.h>
 #include <reiser4/bitmap.h>
 
-#define BACKUP_MAGIC "_RollBackFileForReiser4FSCK"
+#define BACKUP_MAGIC "_RollBackIndexForReiser4FSCK"
+#define BACKUP_INDEX_MAGIC "R4BKINDX"
+
+/* Max count of records gathered in one chunk before it is written out. */
+#define BACKUP_CHUNK 64
+
+/* Max count of blocks restored with one device write on rollback. */
+#define BACKUP_RUN 256
+
+/* The backup file layout is:
+
+   header:  BACKUP_MAGIC, blksize;
+   records: backup_rec_t followed by blksize bytes of the original data,
+	    written in chunks in the order blocks get overwritten by fsck;
+   index:   backup_entry_t array, one per record;
+   tail:    backup_tail_t pointing to the index.
+
+   The index and the tail are written on fini only, if they are missed or
+   corrupted, rollback scans records sequentially up to the first broken
+   one. */
+typedef struct backup_rec {
+	uint64_t blk;
+
+	/* crc32c of @blk, @pad and the data following the record. */
+	uint32_t crc;
+	uint32_t pad;
+} backup_rec_t;
+
+typedef struct backup_entry {
+	uint64_t blk;
+	uint64_t offset;
+} backup_entry_t;
+
+typedef struct backup_tail {
+	char magic[8];
+	uint64_t count;
+	uint64_t offset;
+	uint32_t crc;
+	uint32_t pad;
+} backup_tail_t;
 
 typedef struct backup {
 	errno_t (*write) (aal_device_t *, void *, blk_t, count_t);
 	reiser4_bitmap_t *bitmap;
 	FILE *file;
+
+	uint32_t blksize;
+
+	/* Original data of blocks being saved. */
+	char *data;
+
+	/* Records not written to the file yet. */
+	char *chunk;
+	uint32_t filled;
+
+	/* The file offset the next chunk is written at. */
+	uint64_t offset;
+
+	/* Block -> record offset index. */
+	backup_entry_t *index;
+	uint64_t count;
+	uint64_t size;
 } backup_t;
 
 extern errno_t backup_init(FILE *file, aal_device_t *device, count_t len);
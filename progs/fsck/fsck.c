@@ -20,6 +20,14 @@ static void fsck_print_usage(char *name) {
 		"  --fix                         fixes minor corruptions\n"
 		"  --build-sb                    rebuilds the super block\n"
 		"  --build-fs                    rebuilds the filesystem\n"
+		"  -C, --checkpoint file         saves the --build-fs state into the\n"
+		"                                file to be able to resume it later.\n"
+		"  -I, --checkpoint-interval N   saves the --build-fs state every N\n"
+		"                                seconds, 300 by default.\n"
+		"  -R, --resume                  resumes --build-fs from the state saved\n"
+		"                                in the --checkpoint file.\n"
+		"  -j, --jobs N                  reads the device in parallel with\n"
+		"                                checking, up to N regions ahead.\n"
 		"\n"
 		"  -L, --logfile file            complains into the file\n"
 		"  -n, --no-log                  makes fsck to not complain\n"
@@ -40,7 +48,8 @@ static void fsck_print_usage(char *name) {
 		"  -f, --force                   makes fsck to use whole disk, not block\n"
 		"                                device or mounted partition.\n"
 		"  -p, --preen                   automatically repair the filesysem.\n"
-		"  -c, --cache N                 number of nodes in tree buffer cache\n");
+		"  -c, --cache SIZE[,DATA]       tree cache size, or separate sizes of\n"
+		"                                formatted nodes and data caches.\n");
 }
 
 #define WARNING \
@@ -119,8 +128,9 @@ static errno_t fsck_init(fsck_parse_t *data,
 	char override[4096];
 	int option_index;
 	errno_t ret = 0;
-	uint32_t cache;
 	int mounted, c;
+	long long jobs;
+	long long interval;
 
 	static struct option options[] = {
 		/* FSCK modes. */
@@ -151,6 +161,10 @@ static errno_t fsck_init(fsck_parse_t *data,
 		{"unused", no_argument, NULL, 'u'},
 		{"oldfs", no_argument, NULL, 'O'},
 		{"nomkid", no_argument, NULL, 'N'},
+		{"checkpoint", required_argument, 0, 'C'},
+		{"checkpoint-interval", required_argument, 0, 'I'},
+		{"resume", no_argument, NULL, 'R'},
+		{"jobs", required_argument, 0, 'j'},
 		{0, 0, 0, 0}
 	};
 
@@ -164,7 +178,7 @@ static errno_t fsck_init(fsck_parse_t *data,
 		return USER_ERROR;
 	}
 
-	while ((c = getopt_long(argc, argv, "L:VhnqafU:b:r?dB:plo:c:uyON", 
+	while ((c = getopt_long(argc, argv, "L:VhnqafU:b:r?dB:plo:c:uyONC:I:Rj:", 
 				options, &option_index)) >= 0) 
 	{
 		switch (c) {
@@ -219,13 +233,11 @@ static errno_t fsck_init(fsck_parse_t *data,
 			data->bitmap_file = optarg;
 			break;
 		case 'c':
-			if ((cache = misc_str2long(optarg, 10)) == INVAL_DIG) {
+			if (misc_mpressure_setup(optarg)) {
 				aal_fatal("Invalid cache value specified (%s).",
 					  optarg);
 				return USER_ERROR;
 			}
-
-			misc_mpressure_setup(cache);
 			break;
 		case 'l':
 			mode = RM_SHOW_PLUG;
@@ -243,6 +255,38 @@ static errno_t fsck_init(fsck_parse_t *data,
 		case 'N':
 			aal_set_bit(&data->options, FSCK_OPT_NOMKID);
 			break;
+		case 'C':
+			data->checkpoint_file = optarg;
+			break;
+		case 'I':
+			interval = misc_str2long(optarg, 10);
+
+			if (interval == INVAL_DIG || interval <= 0 ||
+			    interval > MAX_UINT32)
+			{
+				aal_fatal("Invalid checkpoint interval specified "
+					  "(%s).", optarg);
+				return USER_ERROR;
+			}
+
+			data->checkpoint_interval = interval;
+			break;
+		case 'R':
+			aal_set_bit(&data->options, FSCK_OPT_RESUME);
+			break;
+		case 'j':
+			jobs = misc_str2long(optarg, 10);
+			
+			if (jobs == INVAL_DIG || jobs <= 0 || 
+			    jobs > FSCK_JOBS_MAX)
+			{
+				aal_fatal("Invalid number of jobs specified "
+					  "(%s).", optarg);
+				return USER_ERROR;
+			}
+
+			data->jobs = jobs;
+			break;
 		}
 	}
 	
@@ -284,6 +328,29 @@ static errno_t fsck_init(fsck_parse_t *data,
 
 	data->sb_mode = sb_mode ? sb_mode : mode;
 	data->fs_mode = fs_mode ? fs_mode : mode;
+
+	if ((data->checkpoint_file || 
+	     aal_test_bit(&data->options, FSCK_OPT_RESUME)) && 
+	    data->fs_mode != RM_BUILD)
+	{
+		aal_fatal("Checkpoints are supported in the --build-fs "
+			  "mode only.");
+		goto user_error;
+	}
+	
+	if (aal_test_bit(&data->options, FSCK_OPT_RESUME) && 
+	    !data->checkpoint_file)
+	{
+		aal_fatal("The --checkpoint file to resume from is not "
+			  "specified.");
+		goto user_error;
+	}
+
+	if (data->checkpoint_interval && !data->checkpoint_file) {
+		aal_fatal("The --checkpoint file to save the state into is "
+			  "not specified.");
+		goto user_error;
+	}
   
 	if (data->backup_file) {
 		data->backup = fopen(data->backup_file, 
@@ -551,9 +618,13 @@ int main(int argc, char *argv[]) {
 		fsck_opt(&parse_data, FSCK_OPT_OLD) << REPAIR_WHOLE |
 		fsck_opt(&parse_data, FSCK_OPT_OLD) << REPAIR_NO_MKID |
 		fsck_opt(&parse_data, FSCK_OPT_NOMKID) << REPAIR_NO_MKID |
-		fsck_opt(&parse_data, FSCK_OPT_YES) << REPAIR_YES;
+		fsck_opt(&parse_data, FSCK_OPT_YES) << REPAIR_YES |
+		fsck_opt(&parse_data, FSCK_OPT_RESUME) << REPAIR_RESUME;
 		
 	repair.bitmap_file = parse_data.bitmap_file;
+	repair.checkpoint_file = parse_data.checkpoint_file;
+	repair.checkpoint_interval = parse_data.checkpoint_interval;
+	repair.jobs = parse_data.jobs;
 	
 	res = fsck_check_init(&repair, device, parse_data.backup, 
 			      parse_data.sb_mode, parse_data.fs_mode);
@@ -570,6 +641,17 @@ int main(int argc, char *argv[]) {
 			       parse_data.fs_mode, res);
 	
 	fsck_time("fsck.reiser4 finished at");
+
+	if (fsck_opt(&parse_data, FSCK_OPT_DEBUG)) {
+		reiser4_tree_t *tree = repair.fs->tree;
+		
+		fprintf(stderr, "Tree cache: %llu hits, %llu misses "
+			"(%llu prefetched), %llu evicted nodes.\n",
+			(unsigned long long)tree->stat.hits,
+			(unsigned long long)tree->stat.misses,
+			(unsigned long long)tree->stat.prefetched,
+			(unsigned long long)tree->stat.evicts);
+	}
     
 	fprintf(stderr, "Closing fs...");
 	reiser4_fs_close(repair.fs);
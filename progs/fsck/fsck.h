@@ -32,6 +32,9 @@
 #define FATAL_SB_ERROR	2
 #define FATAL_ERROR	3
 
+/* Max number of regions read ahead in parallel with checking. */
+#define FSCK_JOBS_MAX	64
+
 /* fsck options. */
 typedef enum fsck_options {
     FSCK_OPT_AUTO	= 0x1,
@@ -41,7 +44,8 @@ typedef enum fsck_options {
     FSCK_OPT_DEBUG	= 0x4,
     FSCK_OPT_WHOLE	= 0x5,
     FSCK_OPT_OLD	= 0x6,
-    FSCK_OPT_NOMKID	= 0x7
+    FSCK_OPT_NOMKID	= 0x7,
+    FSCK_OPT_RESUME	= 0x8
 } fsck_options_t;
 
 typedef struct fsck_parse {
@@ -52,6 +56,9 @@ typedef struct fsck_parse {
 
     char *backup_file;
     char *bitmap_file;
+    char *checkpoint_file;
+    uint32_t checkpoint_interval;
+    uint32_t jobs;
     aal_device_t *host_device;
     uint16_t options;
 } fsck_parse_t;
@@ -58,7 +58,8 @@ static void measurefs_print_usage(char *name) {
 		"  -y, --yes                     assumes an answer 'yes' to all questions.\n"
 		"  -f, --force                   makes measurefs to use whole disk, not\n"
 		"                                block device or mounted partition.\n"
-		"  -c, --cache N                 number of nodes in tree buffer cache\n");
+		"  -c, --cache SIZE[,DATA]       tree cache size, or separate sizes of\n"
+		"                                formatted nodes and data caches.\n");
 }
 
 /* Initializes exception streams used by measurefs */
@@ -478,8 +479,22 @@ errno_t measurefs_tree_stat(reiser4_fs_t *fs, uint32_t flags) {
 	       (unsigned long long)stat_hint.direntries);
 	printf("  Tail items:%*llu\n", 16,
 	       (unsigned long long)stat_hint.tails);
-	printf("  Extent items:%*llu\n", 14,
+	printf("  Extent items:%*llu\n\n", 14,
 	       (unsigned long long)stat_hint.extents);
+
+	printf("Tree cache statistics:\n");
+	printf("  Cache hits:%*llu\n", 16,
+	       (unsigned long long)fs->tree->stat.hits);
+	printf("  Cache misses:%*llu\n", 14,
+	       (unsigned long long)fs->tree->stat.misses);
+	printf("  Evicted nodes:%*llu\n", 13,
+	       (unsigned long long)fs->tree->stat.evicts);
+	printf("  Prefetched nodes:%*llu\n", 10,
+	       (unsigned long long)fs->tree->stat.prefetched);
+	printf("  Dentry cache hits:%*llu\n", 9,
+	       (unsigned long long)fs->tree->stat.dentry_hits);
+	printf("  Dentry cache misses:%*llu\n", 7,
+	       (unsigned long long)fs->tree->stat.dentry_misses);
 	return 0;
 }
 
@@ -691,7 +706,6 @@ int main(int argc, char *argv[]) {
 	int c;
 	char *host_dev;
 
-	uint32_t cache;
 	uint32_t flags = 0;
 	char override[4096];
 
@@ -771,13 +785,11 @@ int main(int argc, char *argv[]) {
 			aal_strncat(override, ",", 1);
 			break;
 		case 'c':
-			if ((cache = misc_str2long(optarg, 10)) == INVAL_DIG) {
+			if (misc_mpressure_setup(optarg)) {
 				aal_error("Invalid cache value specified (%s).",
 					  optarg);
 				return USER_ERROR;
 			}
-
-			misc_mpressure_setup(cache);
 			break;
 		}
 	}
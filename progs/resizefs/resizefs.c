@@ -15,6 +15,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 
+#include <aux/aux.h>
 #include <misc/misc.h>
 #include <reiser4/libreiser4.h>
 
@@ -22,7 +23,8 @@ typedef enum behav_flags {
 	BF_FORCE      = 1 << 0,
 	BF_YES        = 1 << 1,
 	BF_SHOW_PARM  = 1 << 2,
-	BF_SHOW_PLUG  = 1 << 3
+	BF_SHOW_PLUG  = 1 << 3,
+	BF_DRY_RUN    = 1 << 4
 } behav_flags_t;
 
 /* Prints resizefs options */
@@ -42,7 +44,31 @@ static void resizefs_print_usage(char *name) {
 		"  -y, --yes                     assumes an answer 'yes' to all questions.\n"
 		"  -f, --force                   makes resizer to use whole disk, not\n"
 		"                                block device or mounted partition.\n"
-		"  -c, --cache N                 number of nodes in tree buffer cache\n");
+		"  -n, --dry-run                 estimates the number of blocks to be\n"
+		"                                moved, does not resize anything.\n"
+		"  -c, --cache SIZE[,DATA]       tree cache size, or separate sizes of\n"
+		"                                formatted nodes and data caches.\n");
+}
+
+/* Draws the gauge of moving the tree blocks, it is created on the first
+   call, when the number of blocks to be moved is known. */
+static void resizefs_progress(reiser4_tree_t *tree, count_t done,
+			      count_t total)
+{
+	aal_gauge_t **gauge = (aal_gauge_t **)tree->progress_data;
+
+	if (!*gauge) {
+		aal_mess("Moving %llu blocks of the tree.",
+			 (unsigned long long)total);
+		
+		*gauge = aal_gauge_create(aux_gauge_handlers[GT_PROGRESS],
+					  NULL, NULL, 500, NULL);
+	}
+
+	if (*gauge) {
+		aal_gauge_set_value(*gauge, total ? done * 100 / total : 100);
+		aal_gauge_touch(*gauge);
+	}
 }
 
 /* Initializes exception streams used by resizefs */
@@ -59,19 +85,22 @@ int main(int argc, char *argv[]) {
 	struct stat st;
 	char *host_dev;
 	count_t fs_len;
+	int64_t moved;
+	errno_t res;
 
-	uint32_t cache;
 	uint32_t flags = 0;
 	char override[4096];
 
 	reiser4_fs_t *fs;
 	aal_device_t *device;
+	aal_gauge_t *gauge = NULL;
 	
 	static struct option long_options[] = {
 		{"version", no_argument, NULL, 'V'},
 		{"help", no_argument, NULL, 'h'},
 		{"force", no_argument, NULL, 'f'},
 		{"yes", no_argument, NULL, 'y'},
+		{"dry-run", no_argument, NULL, 'n'},
 		{"print-profile", no_argument, NULL, 'p'},
 		{"print-plugins", no_argument, NULL, 'l'},
 		{"override", required_argument, NULL, 'o'},
@@ -83,7 +112,7 @@ int main(int argc, char *argv[]) {
 	memset(override, 0, sizeof(override));
 
 	/* Parsing parameters */    
-	while ((c = getopt_long(argc, argv, "Vhyfo:plc:?",
+	while ((c = getopt_long(argc, argv, "Vhyfno:plc:?",
 				long_options, (int *)0)) != EOF) 
 	{
 		switch (c) {
@@ -100,6 +129,9 @@ int main(int argc, char *argv[]) {
 		case 'y':
 			flags |= BF_YES;
 			break;
+		case 'n':
+			flags |= BF_DRY_RUN;
+			break;
 		case 'p':
 			flags |= BF_SHOW_PARM;
 			break;
@@ -107,13 +139,11 @@ int main(int argc, char *argv[]) {
 			flags |= BF_SHOW_PLUG;
 			break;
 		case 'c':
-			if ((cache = misc_str2long(optarg, 10)) == INVAL_DIG) {
+			if (misc_mpressure_setup(optarg)) {
 				aal_error("Invalid cache value specified (%s).",
 					  optarg);
 				return USER_ERROR;
 			}
-
-			misc_mpressure_setup(cache);
 			break;
 		case 'o':
 			aal_strncat(override, optarg, aal_strlen(optarg));
@@ -194,9 +224,10 @@ int main(int argc, char *argv[]) {
 		goto error_free_libreiser4;
 	}
 
-	/* Opening device with file_ops and default blocksize */
-	if (!(device = aal_device_open(&file_ops, host_dev,
-				       512, O_RDWR)))
+	/* Opening device with file_ops and default blocksize. Nothing is 
+	   written on dry run. */
+	if (!(device = aal_device_open(&file_ops, host_dev, 512, 
+				       flags & BF_DRY_RUN ? O_RDONLY : O_RDWR)))
 	{
 		aal_error("Can't open %s. %s.", host_dev,
 			  strerror(errno));
@@ -224,11 +255,40 @@ int main(int argc, char *argv[]) {
 	
 	fs_len /= (reiser4_master_get_blksize(fs->master) / 1024);
 
-	if (reiser4_fs_resize(fs, fs_len)) {
+	if (flags & BF_DRY_RUN) {
+		if ((moved = reiser4_fs_resize_estimate(fs, fs_len)) < 0) {
+			aal_error("Can't estimate the resize of reiser4 "
+				  "on %s.", host_dev);
+			goto error_free_fs;
+		}
+
+		aal_mess("Resizing %s from %llu to %llu blocks needs %llu "
+			 "blocks to be moved.", host_dev, (unsigned long long)
+			 reiser4_format_get_len(fs->format),
+			 (unsigned long long)fs_len, 
+			 (unsigned long long)moved);
+		
+		goto done;
+	}
+	
+	fs->tree->progress_func = resizefs_progress;
+	fs->tree->progress_data = &gauge;
+	
+	res = reiser4_fs_resize(fs, fs_len);
+
+	if (gauge) {
+		aal_gauge_done(gauge);
+		aal_gauge_free(gauge);
+	}
+
+	fs->tree->progress_func = NULL;
+	
+	if (res) {
 		aal_error("Can't resize reiser4 on %s.", host_dev);
 		goto error_free_fs;
 	}
 	
+ done:
 	/* Deinitializing filesystem instance and device instance */
 	reiser4_fs_close(fs);
 	aal_device_close(device);